@@ -19,6 +19,7 @@
 
 #include <stdint.h>
 #include <string.h>
+#include "I32CTT_config.h"
 #include "I32CTT.h"
 #include <Arduino.h>
 #include <stdarg.h>
@@ -27,6 +28,21 @@ void I32CTT_Interface::send_to_dst() {
   this->send();
 }
 
+/**
+ * \brief Selecciona el nodo destino de send_to_dst() con una dirección
+ *        de 16 bits. Las interfaces sin direcciones lo ignoran.
+ */
+void I32CTT_Interface::set_dst(uint16_t /*addr*/) {
+}
+
+/**
+ * \brief Dirección del nodo que envió el paquete en rx_buffer, 0 si la
+ *        interfaz no maneja direcciones.
+ */
+uint16_t I32CTT_Interface::get_src() {
+  return 0;
+}
+
 I32CTT_Controller::MasterInterface::MasterInterface() {
   this->controller = NULL;
   this->state = MASTER_STATE_t::IDLE;
@@ -67,7 +83,9 @@ uint8_t I32CTT_Controller::MasterInterface::write_record(I32CTT_RegData reg_data
 
 uint8_t I32CTT_Controller::MasterInterface::read_record(uint16_t reg) {
   uint8_t result = 0;
+#ifdef I32CTT_DEBUG
   Serial.println("Pushing record");
+#endif
   // Enviar comandos al tx_buffer
 
   if(this->current_cmd!=CMD_R || this->state != MASTER_STATE_t::PREPARE) {
@@ -117,15 +135,30 @@ uint8_t I32CTT_Controller::MasterInterface::available(uint8_t mode) {
   return result;
 }
 
-uint8_t I32CTT_Controller::MasterInterface::records_available() {
-  uint8_t result;
+I32CTT_Size_t I32CTT_Controller::MasterInterface::records_available() {
+  I32CTT_Size_t result;
   
   result = reg_count(this->mode_requested, this->controller->interface->rx_size);
   
   return result;
 }
 
-I32CTT_RegData I32CTT_Controller::MasterInterface::read_RegData(uint8_t idx) {
+/**
+ * \brief Registros que caben en un mensaje del comando dado.
+ *        Para CMD_R cuenta la respuesta (registro y dato por
+ *        registro), que es la que debe caber en la MTU.
+ */
+I32CTT_Size_t I32CTT_Controller::MasterInterface::max_records(CMD_t cmd_type) {
+  uint16_t mtu = this->controller->interface->get_MTU();
+
+  if(mtu <= sizeof(I32CTT_Header))
+    return 0;
+  if(cmd_type == CMD_R || cmd_type == CMD_W)
+    return (mtu-sizeof(I32CTT_Header))/sizeof(I32CTT_RegData);
+  return (mtu-sizeof(I32CTT_Header))/sizeof(I32CTT_Reg);
+}
+
+I32CTT_RegData I32CTT_Controller::MasterInterface::read_RegData(I32CTT_Size_t idx) {
   I32CTT_RegData result;
 
   result.reg = get_reg(this->controller->interface->rx_buffer, this->mode_requested, idx);
@@ -145,7 +178,7 @@ I32CTT_RegData I32CTT_Controller::MasterInterface::read_RegData(uint8_t idx) {
  * \param[in] mode_id  Identificador del driver. Nota: 
  *          el controlador no verifica que sea único.
  */
-I32CTT_Endpoint::I32CTT_Endpoint(uint32_t /*id*/) {
+I32CTT_Endpoint::I32CTT_Endpoint(uint32_t id) {
   this->id = id;
 }
 
@@ -180,6 +213,7 @@ I32CTT_Controller::I32CTT_Controller(uint8_t total_modes) {
   this->total_modes = total_modes;
   this->modes_set = 0;
   this->drivers = new I32CTT_Endpoint*[total_modes]; // (I32CTT_Endpoint**)malloc((sizeof(I32CTT_Endpoint*)*total_modes));
+  this->id_table = new I32CTT_IdEndpoint[total_modes];
   this->master = MasterInterface(this);
   for(int i=0;i<this->total_modes;i++) {
     this->drivers[i] = NULL;
@@ -216,6 +250,17 @@ uint8_t I32CTT_Controller::add_mode_driver(I32CTT_Endpoint &drv) {
 
   Serial.print("Adding mode at ");
   Serial.println(this->modes_set, DEC);
+
+  // Tabla de ids ordenada, el nuevo va después de los iguales
+  uint32_t id = drv.get_id();
+  int pos = this->modes_set;
+  while(pos > 0 && this->id_table[pos-1].id > id) {
+    this->id_table[pos] = this->id_table[pos-1];
+    pos--;
+  }
+  this->id_table[pos].id = id;
+  this->id_table[pos].endpoint = this->modes_set;
+
   this->drivers[this->modes_set++] = &drv;
   
   drv.init();
@@ -223,6 +268,31 @@ uint8_t I32CTT_Controller::add_mode_driver(I32CTT_Endpoint &drv) {
   return this->modes_set;
 }
 
+/**
+ * \brief Busca el endpoint con el id dado.
+ *        Búsqueda binaria en la tabla ordenada que arma
+ *        add_mode_driver(). Con ids repetidos devuelve el
+ *        primero que se agregó.
+ * \param id Identificador del driver (ver str2id).
+ * \return Número de endpoint, 0xFF si no existe.
+ */
+uint8_t I32CTT_Controller::find_mode(uint32_t id) {
+  int low = 0;
+  int high = this->modes_set;
+  int mid;
+
+  while(low < high) {
+    mid = (low+high)/2;
+    if(this->id_table[mid].id < id)
+      low = mid+1;
+    else
+      high = mid;
+  }
+  if(low < this->modes_set && this->id_table[low].id == id)
+    return this->id_table[low].endpoint;
+  return 0xFF;
+}
+
 /**
  * \brief Inicializa la clase, interfaz y drivers de modo.
  *        Este método se encarga de inicializar la interfaz como
@@ -251,7 +321,9 @@ void I32CTT_Controller::run() {
   if(this->interface != 0) {
     this->interface->update();
     if(this->interface->data_available()) {
+#ifdef I32CTT_DEBUG
       Serial.println("Data available");
+#endif
       this->parse(this->interface->rx_buffer, this->interface->rx_size);
     }
   }
@@ -271,9 +343,9 @@ void I32CTT_Controller::run() {
  * \param cmd_type Identificador del tipo de comando.
  * \param buffsize Tamaño del buffer (en bytes).
  */
-uint8_t I32CTT_Controller::valid_size(uint8_t cmd_type, uint8_t buffsize) {
+uint8_t I32CTT_Controller::valid_size(uint8_t cmd_type, I32CTT_Size_t buffsize) {
   uint8_t result = 0;
-  uint8_t min_size = 0;
+  I32CTT_Size_t min_size = 0;
   
   if(cmd_type == CMD_R || cmd_type == CMD_AW) {
      // Check for header (1-byte) + (1-byte) + [Addr (2-byte) ...]
@@ -289,6 +361,12 @@ uint8_t I32CTT_Controller::valid_size(uint8_t cmd_type, uint8_t buffsize) {
   } else if (cmd_type == CMD_LSTA) {
     min_size = sizeof(I32CTT_CMD)+sizeof(I32CTT_Endpoint_t)+sizeof(I32CTT_Endpoint_t);
     result = (buffsize>min_size) && ((buffsize-min_size)%sizeof(I32CTT_Id)==0);
+  } else if (cmd_type == CMD_FND) {
+    min_size = sizeof(I32CTT_CMD);
+    result = (buffsize>min_size) && ((buffsize-min_size)%sizeof(I32CTT_Id)==0);
+  } else if (cmd_type == CMD_FNDA) {
+    min_size = sizeof(I32CTT_CMD);
+    result = (buffsize>min_size) && ((buffsize-min_size)%sizeof(I32CTT_IdEndpoint)==0);
   }
 
   return result;
@@ -302,8 +380,8 @@ uint8_t I32CTT_Controller::valid_size(uint8_t cmd_type, uint8_t buffsize) {
  * \param cmd_type Identificador del tipo de comando.
  * \param buffsize Tamaño del buffer (en bytes).
  */
-uint8_t I32CTT_Controller::reg_count(uint8_t cmd_type, uint8_t buffsize) {
-  uint8_t result = 0;
+I32CTT_Size_t I32CTT_Controller::reg_count(uint8_t cmd_type, I32CTT_Size_t buffsize) {
+  I32CTT_Size_t result = 0;
   uint8_t header_size = sizeof(I32CTT_Header);
 
   if(cmd_type == CMD_R || cmd_type == CMD_AW) {
@@ -312,11 +390,11 @@ uint8_t I32CTT_Controller::reg_count(uint8_t cmd_type, uint8_t buffsize) {
   } else if (cmd_type == CMD_W || cmd_type == CMD_AR) {
      // Check for header (1-byte) + [(Addr (4-byte) + Data (4-byte) ...]
      result = (buffsize-header_size)/sizeof(I32CTT_RegData);
-  } else if (CMD_LSTA) {
-     result = (buffsize-(sizeof(I32CTT_CMD)+(sizeof(I32CTT_Endpoint)*2)))/sizeof(I32CTT_Id);
-  } else if (CMD_FND) {
+  } else if (cmd_type == CMD_LSTA) {
+     result = (buffsize-(sizeof(I32CTT_CMD)+(sizeof(I32CTT_Endpoint_t)*2)))/sizeof(I32CTT_Id);
+  } else if (cmd_type == CMD_FND) {
      result = (buffsize-sizeof(I32CTT_CMD))/sizeof(I32CTT_Id);
-  } else if (CMD_FNDA) {
+  } else if (cmd_type == CMD_FNDA) {
      result = (buffsize-sizeof(I32CTT_CMD))/sizeof(I32CTT_IdEndpoint);
   }
 
@@ -333,9 +411,9 @@ uint8_t I32CTT_Controller::reg_count(uint8_t cmd_type, uint8_t buffsize) {
  * \param cmd_type Tipo de comando solicitado.
  * \param pos Posición del registro (0..n).
  */
-uint16_t I32CTT_Controller::get_reg(uint8_t *buffer, uint8_t cmd_type, uint8_t pos) {
+uint16_t I32CTT_Controller::get_reg(uint8_t *buffer, uint8_t cmd_type, I32CTT_Size_t pos) {
   uint16_t result = 0;
-  uint8_t offset = 0;
+  I32CTT_Size_t offset = 0;
   uint8_t header_size = sizeof(I32CTT_Header);
 
   if(cmd_type == CMD_R || cmd_type == CMD_AW) {
@@ -363,9 +441,9 @@ uint16_t I32CTT_Controller::get_reg(uint8_t *buffer, uint8_t cmd_type, uint8_t p
  * \param cmd_type Tipo de comando solicitado.
  * \param pos Posición del registro (0..n).
  */
-uint32_t I32CTT_Controller::get_data(uint8_t *buffer, uint8_t cmd_type, uint8_t pos) {
+uint32_t I32CTT_Controller::get_data(uint8_t *buffer, uint8_t cmd_type, I32CTT_Size_t pos) {
   uint32_t result = 0;
-  uint8_t offset = 0;
+  I32CTT_Size_t offset = 0;
   uint8_t header_size = sizeof(I32CTT_Header);
   
   if (cmd_type == CMD_W || cmd_type == CMD_AR) {
@@ -389,8 +467,8 @@ uint32_t I32CTT_Controller::get_data(uint8_t *buffer, uint8_t cmd_type, uint8_t
  * \param cmd_type Tipo de comando solicitado.
  * \param pos Posición del registro (0..n).
  */
-void I32CTT_Controller::put_reg(uint8_t *buffer, uint16_t reg, uint8_t cmd_type, uint8_t pos) {
-  uint8_t offset = 0;
+void I32CTT_Controller::put_reg(uint8_t *buffer, uint16_t reg, uint8_t cmd_type, I32CTT_Size_t pos) {
+  I32CTT_Size_t offset = 0;
   uint8_t header_size = sizeof(I32CTT_Header);
   
   if(cmd_type == CMD_R || cmd_type == CMD_AW) {
@@ -415,8 +493,8 @@ void I32CTT_Controller::put_reg(uint8_t *buffer, uint16_t reg, uint8_t cmd_type,
  * \param cmd_type Tipo de comando solicitado.
  * \param pos Posición del registro (0..n).
  */
-void I32CTT_Controller::put_data(uint8_t *buffer, uint32_t data, uint8_t cmd_type, uint8_t pos) {
-  uint8_t offset = 0;
+void I32CTT_Controller::put_data(uint8_t *buffer, uint32_t data, uint8_t cmd_type, I32CTT_Size_t pos) {
+  I32CTT_Size_t offset = 0;
   uint8_t header_size = sizeof(I32CTT_Header);
 
   if (cmd_type == CMD_W || cmd_type == CMD_AR) {
@@ -428,8 +506,8 @@ void I32CTT_Controller::put_data(uint8_t *buffer, uint32_t data, uint8_t cmd_typ
   memcpy(buffer+offset, &data, sizeof(uint32_t));
 }
 
-void I32CTT_Controller::put_id(uint8_t *buffer, uint32_t data, uint8_t cmd_type, uint8_t pos) {
-  uint8_t offset = 0;
+void I32CTT_Controller::put_id(uint8_t *buffer, uint32_t data, uint8_t cmd_type, I32CTT_Size_t pos) {
+  I32CTT_Size_t offset = 0;
 
   if (cmd_type == CMD_LSTA) {
      offset = sizeof(I32CTT_CMD)+(sizeof(I32CTT_Endpoint_t)*2)+pos*sizeof(I32CTT_Id);
@@ -444,9 +522,9 @@ void I32CTT_Controller::put_id(uint8_t *buffer, uint32_t data, uint8_t cmd_type,
   memcpy(buffer+offset, &data, sizeof(I32CTT_Id));
 }
 
-uint32_t I32CTT_Controller::get_id(uint8_t *buffer, uint8_t cmd_type, uint8_t pos) {
+uint32_t I32CTT_Controller::get_id(uint8_t *buffer, uint8_t cmd_type, I32CTT_Size_t pos) {
   uint32_t result = 0;
-  uint8_t offset = 0;
+  I32CTT_Size_t offset = 0;
 
   if (cmd_type == CMD_LSTA) {
      offset = sizeof(I32CTT_CMD)+(sizeof(I32CTT_Endpoint_t)*2)+pos*sizeof(I32CTT_Id);
@@ -461,8 +539,8 @@ uint32_t I32CTT_Controller::get_id(uint8_t *buffer, uint8_t cmd_type, uint8_t po
   return result;
 }
 
-void I32CTT_Controller::put_endpoint(uint8_t *buffer, uint8_t data, uint8_t cmd_type, uint8_t pos) {
-  uint8_t offset = 0;
+void I32CTT_Controller::put_endpoint(uint8_t *buffer, uint8_t data, uint8_t cmd_type, I32CTT_Size_t pos) {
+  I32CTT_Size_t offset = 0;
 
   if (cmd_type == CMD_FNDA) {
      offset = sizeof(I32CTT_CMD)+sizeof(I32CTT_Id)+pos*sizeof(I32CTT_IdEndpoint);
@@ -474,9 +552,9 @@ void I32CTT_Controller::put_endpoint(uint8_t *buffer, uint8_t data, uint8_t cmd_
 }
 
 
-uint8_t I32CTT_Controller::get_endpoint(uint8_t *buffer, uint8_t cmd_type, uint8_t pos) {
+uint8_t I32CTT_Controller::get_endpoint(uint8_t *buffer, uint8_t cmd_type, I32CTT_Size_t pos) {
   uint8_t result = 0;
-  uint8_t offset = 0;
+  I32CTT_Size_t offset = 0;
 
   if (cmd_type == CMD_FNDA) {
      offset = sizeof(I32CTT_CMD)+sizeof(I32CTT_Id)+pos*sizeof(I32CTT_IdEndpoint);
@@ -487,6 +565,37 @@ uint8_t I32CTT_Controller::get_endpoint(uint8_t *buffer, uint8_t cmd_type, uint8
   return result;
 }
 
+/**
+ * \brief Responde un CMD_FND con un CMD_FNDA.
+ *        Cada id se busca en la tabla ordenada con find_mode(),
+ *        los que no existen se responden con id 0xFFFFFFFF y
+ *        endpoint 0xFF. Los ids que no caben en el MTU se ignoran.
+ * \param buffer Puntero al CMD_FND recibido.
+ * \param buffsize Tamaño del buffer.
+ */
+void I32CTT_Controller::answer_find(uint8_t *buffer, I32CTT_Size_t buffsize) {
+  I32CTT_Size_t records = reg_count(CMD_FND, buffsize);
+  I32CTT_Size_t max = (this->interface->get_MTU()-sizeof(I32CTT_CMD))/sizeof(I32CTT_IdEndpoint);
+  uint32_t id;
+  uint8_t endpoint;
+
+  if(records > max)
+    records = max;
+
+  this->interface->tx_buffer[0] = CMD_FNDA;
+  for(I32CTT_Size_t i=0;i<records;i++) {
+    id = get_id(buffer, CMD_FND, i);
+    endpoint = find_mode(id);
+    if(endpoint == 0xFF)
+      id = 0xFFFFFFFF;
+    put_id(this->interface->tx_buffer, id, CMD_FNDA, i);
+    put_endpoint(this->interface->tx_buffer, endpoint, CMD_FNDA, i);
+  }
+
+  this->interface->tx_size = sizeof(I32CTT_CMD)+records*sizeof(I32CTT_IdEndpoint);
+  this->interface->send();
+}
+
 /**
  * \brief Procesa los datos recibidos por la interfaz.
  *        Este método se encarga de procesar todos los datos recibidos
@@ -497,59 +606,87 @@ uint8_t I32CTT_Controller::get_endpoint(uint8_t *buffer, uint8_t cmd_type, uint8
  * \param buffer Puntero al buffer de datos.
  * \param buffsize Tamaño del buffer.
  */
-void I32CTT_Controller::parse(uint8_t *buffer, uint8_t buffsize) {
+void I32CTT_Controller::parse(uint8_t *buffer, I32CTT_Size_t buffsize) {
+#ifdef I32CTT_DEBUG
   Serial.println("Trying to parse");
+#endif
   if(buffsize==0) // Should never happend. But here just in case.
     return;
   if(buffsize<sizeof(I32CTT_Header)) // This neither.
     return;
 
   uint8_t nextEndpoint = 0;
-  uint32_t nextId = 0;
   int lst_records = 0;
   uint8_t cmd = buffer[0];
   uint8_t mode = buffer[1];
-  uint8_t id_found = 0;
 
+#ifdef I32CTT_DEBUG
   Serial.print("CMD: ");
   Serial.print(cmd, HEX);
   Serial.print("\r\n");
   Serial.print("MODE: ");
   Serial.print(mode, HEX);
   Serial.print("\r\n");
+#endif
 
   if(!valid_size(cmd, buffsize)) // return if size invalid
     return;
+#ifdef I32CTT_DEBUG
   Serial.println("Valid size.");
+#endif
+
+  // FND y FNDA no llevan modo, buffer[1] es parte del primer id
+  if(cmd == CMD_FND) {
+    if(this->interface != NULL)
+      answer_find(buffer, buffsize);
+    return;
+  }
+  if(cmd == CMD_FNDA) {
+    // Forward to response handler
+    this->master.mode_requested = cmd;
+    this->master.data_available = true;
+    return;
+  }
   
   // return if mode not set
   // Fixing bug reported by Joksan
   if(mode>=this->modes_set)
     return;
 
-  uint8_t records = reg_count(cmd, buffsize);
+  I32CTT_Size_t records = reg_count(cmd, buffsize);
+#ifdef I32CTT_DEBUG
   Serial.print("Records: ");
   Serial.print(records, DEC);
   Serial.print("\r\n");
+#endif
 
   if((this->interface != NULL) && (this->drivers[mode] !=  NULL)) {
+#ifdef I32CTT_DEBUG
     Serial.println("Calling driver");
+#endif
     I32CTT_Endpoint *driver = this->drivers[mode];
 
     switch(cmd) {
       case CMD_R:
+#ifdef I32CTT_DEBUG
         Serial.print("Buffer size: ");
         Serial.println(buffsize, DEC);
         Serial.print("Records: ");
         Serial.println(records, DEC);
+#endif
+        // Registers whose answer does not fit the MTU are ignored
+        if(records > (this->interface->get_MTU()-sizeof(I32CTT_Header))/sizeof(I32CTT_RegData))
+          records = (this->interface->get_MTU()-sizeof(I32CTT_Header))/sizeof(I32CTT_RegData);
         this->interface->tx_size = sizeof(I32CTT_Header)+records*sizeof(I32CTT_RegData);
         this->interface->tx_buffer[0] = CMD_AR;
         this->interface->tx_buffer[1] = mode;
 
         for(int i=0;i<records;i++) {
           uint32_t reg = get_reg(buffer, cmd, i);
+#ifdef I32CTT_DEBUG
           Serial.print("Register: ");
           Serial.println(reg, DEC);
+#endif
           put_reg(this->interface->tx_buffer, reg, CMD_AR, i);
           put_data(this->interface->tx_buffer, driver->read(reg) , CMD_AR, i);
         }
@@ -562,10 +699,15 @@ void I32CTT_Controller::parse(uint8_t *buffer, uint8_t buffsize) {
         this->master.data_available = true;
         break;
       case CMD_W:
+#ifdef I32CTT_DEBUG
         Serial.print("Buffer size: ");
         Serial.println(buffsize, DEC);
         Serial.print("Records: ");
         Serial.println(records, DEC);
+#endif
+        // Same for writes, the registers left out are not written
+        if(records > (this->interface->get_MTU()-sizeof(I32CTT_Header))/sizeof(I32CTT_Reg))
+          records = (this->interface->get_MTU()-sizeof(I32CTT_Header))/sizeof(I32CTT_Reg);
         this->interface->tx_size = sizeof(I32CTT_Header)+records*sizeof(I32CTT_Reg);
         this->interface->tx_buffer[0] = CMD_AW;
         this->interface->tx_buffer[1] = mode;
@@ -573,8 +715,10 @@ void I32CTT_Controller::parse(uint8_t *buffer, uint8_t buffsize) {
         for(int i=0;i<records;i++) {
           uint32_t reg = get_reg(buffer, cmd, i);
           uint32_t data = get_data(buffer, cmd, i);
+#ifdef I32CTT_DEBUG
           Serial.print("Register: ");
           Serial.println(reg, DEC);
+#endif
           driver->write(reg, data);
           put_reg(this->interface->tx_buffer, reg, CMD_AW, i);
         }
@@ -594,7 +738,8 @@ void I32CTT_Controller::parse(uint8_t *buffer, uint8_t buffsize) {
 
         if(nextEndpoint<this->modes_set) {
           for(lst_records=0;(lst_records<5 && (nextEndpoint+lst_records)<this->modes_set);lst_records++) {
-            this->put_id(this->interface->tx_buffer, 0xFFFFFFFF, CMD_LSTA, lst_records);
+            this->put_id(this->interface->tx_buffer, this->drivers[nextEndpoint+lst_records]->get_id(), CMD_LSTA,
+              lst_records);
           }
         } else {
           this->put_id(this->interface->tx_buffer, 0xFFFFFFFF, CMD_LSTA, 0);
@@ -609,38 +754,6 @@ void I32CTT_Controller::parse(uint8_t *buffer, uint8_t buffsize) {
         this->master.mode_requested = cmd;
         this->master.data_available = true;
         break;
-      case CMD_FND:
-        lst_records = 0;
-
-        this->interface->tx_buffer[0] = CMD_FNDA;
-
-        for(lst_records=0;lst_records<records;lst_records++) {
-          nextId = this->get_id(buffer, CMD_FNDA, lst_records);
-          id_found = 0;
-          for(int i = 0;i<this->modes_set;i++) {
-            if(nextId == this->drivers[i]->get_id()) {
-              nextEndpoint = i;
-              id_found = 1;
-              break;
-            }
-          }
-          if(id_found) {
-            this->put_id(this->interface->tx_buffer, nextId, CMD_FNDA, lst_records);
-            this->put_endpoint(this->interface->tx_buffer, nextEndpoint, CMD_FNDA, lst_records);
-          } else {
-            this->put_id(this->interface->tx_buffer, 0xFFFFFFFF, CMD_FNDA, lst_records);
-            this->put_endpoint(this->interface->tx_buffer, 0xFF, CMD_FNDA, lst_records);
-          }
-        }
-
-        this->interface->tx_size = sizeof(I32CTT_CMD)+lst_records*sizeof(I32CTT_IdEndpoint);
-        this->interface->send();
-        break;
-      case CMD_FNDA:
-        // Forward to response handler
-        this->master.mode_requested = cmd;
-        this->master.data_available = true;
-        break;
       default:
         break;
     }
@@ -27,6 +27,24 @@
 
 #define MAX_MODE_COUNT 64
 
+// Frame length and record index type. 8 bits keeps the AVR footprint, the
+// other targets (Teensy, hosts) use 16 bits so serial, UDP and fragmented
+// links can carry frames bigger than 255 bytes. Define I32CTT_SIZE_BITS to
+// force either.
+#ifndef I32CTT_SIZE_BITS
+#ifdef __AVR__
+#define I32CTT_SIZE_BITS 8
+#else
+#define I32CTT_SIZE_BITS 16
+#endif
+#endif
+
+#if I32CTT_SIZE_BITS == 8
+typedef uint8_t I32CTT_Size_t;
+#else
+typedef uint16_t I32CTT_Size_t;
+#endif
+
 // TODO: Check for memory leaks
 
 enum CMD_t {
@@ -38,6 +56,11 @@ enum CMD_t {
   CMD_LSTA = 0x06,
   CMD_FND  = 0x07,
   CMD_FNDA = 0x08,
+  CMD_FRG  = 0x09,
+  CMD_FRGA = 0x0A,
+  CMD_MESH = 0x0B,
+  CMD_RTB  = 0x0C,
+  CMD_AGG  = 0x0D, // Container: [len][message] repeated, same destination
   CMD_RES  = 0xFF // Reserver for unknow OPs
 };
 
@@ -97,12 +120,26 @@ struct __attribute__((__packed__)) I32CTT_ListHeaderAnswer {
   uint8_t next_endpoint;
 };
 
+struct __attribute__((__packed__)) I32CTT_FragHeader {
+  uint8_t cmd;
+  uint8_t msg_id;
+  uint8_t index;
+  uint8_t count;
+  uint16_t offset;
+};
+
+struct __attribute__((__packed__)) I32CTT_FragAck {
+  uint8_t cmd;
+  uint8_t msg_id;
+  uint32_t received;
+};
+
 class I32CTT_Interface {
   public:
     uint8_t *rx_buffer;
-    uint8_t rx_size;
+    I32CTT_Size_t rx_size;
     uint8_t *tx_buffer;
-    uint8_t tx_size;
+    I32CTT_Size_t tx_size;
     virtual void init()=0;
     virtual void update()=0;
     virtual uint8_t available()=0;
@@ -110,6 +147,8 @@ class I32CTT_Interface {
     virtual void send()=0;
     virtual void send_to_dst();
     virtual uint16_t get_MTU()=0;
+    virtual void set_dst(uint16_t addr);
+    virtual uint16_t get_src();
 };
 
 class I32CTT_Endpoint {
@@ -136,16 +175,16 @@ class I32CTT_Controller {
         uint8_t read_record(uint16_t reg);
         uint8_t try_send();
         uint8_t available(uint8_t mode);
-        uint8_t max_records(CMD_t cmd_type);
-        uint8_t records_available();
-        I32CTT_RegData read_RegData(uint8_t pos);
+        I32CTT_Size_t max_records(CMD_t cmd_type);
+        I32CTT_Size_t records_available();
+        I32CTT_RegData read_RegData(I32CTT_Size_t pos);
 
       private:
         I32CTT_Controller *controller;
         CMD_t current_cmd;
         MASTER_STATE_t state;
         uint8_t mode_requested;
-        uint8_t records;
+        I32CTT_Size_t records;
         uint8_t data_available;
 
       friend class I32CTT_Controller;
@@ -161,21 +200,24 @@ class I32CTT_Controller {
     void enable_scheduler();
     void disable_scheduler();
     uint8_t available(uint8_t mode);
-    uint8_t records_available();
-    I32CTT_RegData read_RegData(uint8_t idx);
-    static uint16_t get_reg(uint8_t *buffer, uint8_t cmd_type, uint8_t pos);
-    static uint32_t get_data(uint8_t *buffer, uint8_t cmd_type, uint8_t pos);
-    static uint32_t get_id(uint8_t *buffer, uint8_t cmd_type, uint8_t pos);
-    static uint8_t get_endpoint(uint8_t *buffer, uint8_t cmd_type, uint8_t pos);
-    static void put_reg(uint8_t *buffer, uint16_t reg, uint8_t cmd_type, uint8_t pos);
-    static void put_data(uint8_t *buffer, uint32_t data, uint8_t cmd_type, uint8_t pos);
-    static void put_endpoint(uint8_t *buffer, uint8_t data, uint8_t cmd_type, uint8_t pos);
-    static void put_id(uint8_t *buffer, uint32_t data, uint8_t cmd_type, uint8_t pos);
-    static uint8_t reg_count(uint8_t cmd_type, uint8_t buffsize);
+    I32CTT_Size_t records_available();
+    I32CTT_RegData read_RegData(I32CTT_Size_t idx);
+    static uint16_t get_reg(uint8_t *buffer, uint8_t cmd_type, I32CTT_Size_t pos);
+    static uint32_t get_data(uint8_t *buffer, uint8_t cmd_type, I32CTT_Size_t pos);
+    static uint32_t get_id(uint8_t *buffer, uint8_t cmd_type, I32CTT_Size_t pos);
+    static uint8_t get_endpoint(uint8_t *buffer, uint8_t cmd_type, I32CTT_Size_t pos);
+    static void put_reg(uint8_t *buffer, uint16_t reg, uint8_t cmd_type, I32CTT_Size_t pos);
+    static void put_data(uint8_t *buffer, uint32_t data, uint8_t cmd_type, I32CTT_Size_t pos);
+    static void put_endpoint(uint8_t *buffer, uint8_t data, uint8_t cmd_type, I32CTT_Size_t pos);
+    static void put_id(uint8_t *buffer, uint32_t data, uint8_t cmd_type, I32CTT_Size_t pos);
+    static I32CTT_Size_t reg_count(uint8_t cmd_type, I32CTT_Size_t buffsize);
   private:
-    void parse(uint8_t *buffer, uint8_t buffsize);
-    uint8_t valid_size(uint8_t cmd_type, uint8_t buffsize);
+    void parse(uint8_t *buffer, I32CTT_Size_t buffsize);
+    uint8_t valid_size(uint8_t cmd_type, I32CTT_Size_t buffsize);
+    uint8_t find_mode(uint32_t id);
+    void answer_find(uint8_t *buffer, I32CTT_Size_t buffsize);
     I32CTT_Endpoint **drivers;
+    I32CTT_IdEndpoint *id_table; // Ordenada por id, ver add_mode_driver()
     I32CTT_Interface *interface;
     uint8_t total_modes;
     uint8_t modes_set;
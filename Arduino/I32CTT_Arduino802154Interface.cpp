@@ -19,18 +19,39 @@
 #include <stdint.h>
 #include <Arduino.h>
 #include <SPI.h>
+#include "I32CTT_config.h"
 #include "I32CTT.h"
 #include "I32CTT_Arduino802154Interface.h"
 
+static uint32_t frame_airtime(uint8_t phr) {
+  return (uint32_t)(SHR_PHR_SIZE+phr)*BYTE_AIRTIME_US;
+}
+
 I32CTT_Arduino802154Interface::I32CTT_Arduino802154Interface() {
-  this->rx_buffer = new uint8_t[IEEE_802154_MTU];
-  memset(this->rx_buffer, 0, sizeof(uint8_t)*IEEE_802154_MTU);
+  // rx_buffer and tx_buffer point straight at the payload of each frame,
+  // the controller parses and encodes in place without extra copies.
+  // rx_frame and tx_frame share their allocation with the frame pool, a
+  // frame to forward or to hold for a sleepy child is swapped out into the
+  // pool instead of being copied.
+  this->frame_memory = new uint8_t[(FRAME_POOL_SIZE+2)*(PSDU_SIZE+1)];
+  memset(this->frame_memory, 0, sizeof(uint8_t)*(FRAME_POOL_SIZE+2)*(PSDU_SIZE+1));
+  this->rx_frame = this->frame_memory;
+  this->tx_frame = this->frame_memory+(PSDU_SIZE+1);
+  for(int i=0;i<FRAME_POOL_SIZE;i++)
+    this->free_frames[i] = this->frame_memory+(i+2)*(PSDU_SIZE+1);
+  this->free_count = FRAME_POOL_SIZE;
+  this->tx_queue_head = 0;
+  this->tx_queue_count = 0;
+  this->tx_pooled = NULL;
   this->rx_size = 0;
-  this->tx_buffer = new uint8_t[IEEE_802154_MTU];
-  memset(this->tx_buffer, 0, sizeof(uint8_t)*IEEE_802154_MTU);
-  this->frame_buffer = new uint8_t[PSDU_SIZE+1];
-  memset(this->frame_buffer, 0, sizeof(uint8_t)*(PSDU_SIZE+1));
   this->tx_size = 0;
+  this->mesh = false;
+  this->agg_rx_frame = NULL;
+  update_buffers();
+  this->pan_id = 0;
+  this->short_addr = 0;
+  this->dst_addr = 0;
+  this->seq_num = 0;
   this->phy_status = 0;
   this->cs_pin = 14;
   this->slp_tx_pin = 16;
@@ -40,12 +61,82 @@ I32CTT_Arduino802154Interface::I32CTT_Arduino802154Interface() {
   this->pa_enabled = false;
   this->radio_enabled = false;
   this->current_state = 0;
+  this->last_addr = 0;
+  this->d_available = false;
+  this->package_queued = false;
+  this->answer_pending = false;
+  this->answer_addr = 0;
+  this->promiscuous = false;
+  this->capture_queue = NULL;
+  this->capture_head = 0;
+  this->capture_count = 0;
+  this->capture_dropped = 0;
+  this->peers = new I32CTT_802154Peer[PEER_TABLE_SIZE];
+  memset(this->peers, 0, sizeof(I32CTT_802154Peer)*PEER_TABLE_SIZE);
+  this->stream_seqs = new I32CTT_802154StreamSeq[STREAM_TABLE_SIZE];
+  memset(this->stream_seqs, 0, sizeof(I32CTT_802154StreamSeq)*STREAM_TABLE_SIZE);
+  this->dedup = new I32CTT_802154Dedup[DEDUP_TABLE_SIZE];
+  memset(this->dedup, 0, sizeof(I32CTT_802154Dedup)*DEDUP_TABLE_SIZE);
+  this->tx_replay = false;
+  this->tx_peer_addr = 0;
+  this->tx_phr = 0;
+  this->tx_acked = true;
+  this->streaming = false;
+  this->dedup_hits = 0;
+  this->dedup_replays = 0;
+  this->routes = new I32CTT_802154Route[ROUTE_TABLE_SIZE];
+  memset(this->routes, 0, sizeof(I32CTT_802154Route)*ROUTE_TABLE_SIZE);
+  this->last_beacon = 0;
+  this->mesh_forwarded = 0;
+  this->mesh_dropped = 0;
+  this->children = new I32CTT_802154Child[CHILD_TABLE_SIZE];
+  memset(this->children, 0, sizeof(I32CTT_802154Child)*CHILD_TABLE_SIZE);
+  this->pending_bit = false;
+  this->indirect_dropped = 0;
+  this->parent_addr = 0;
+  this->poll_interval = 0;
+  this->sleepy_state = SLEEPY_OFF;
+  this->sleepy_received = false;
+  this->last_wake = 0;
+  this->listen_until = 0;
+  this->wake_at = 0;
+  memset(&this->sleep_stats, 0, sizeof(I32CTT_802154SleepStats));
+  this->channel = C2480;
+  this->channel_mask = 0;
+  this->home_channels = new I32CTT_802154HomeChannel[HOME_CHANNEL_TABLE_SIZE];
+  memset(this->home_channels, 0, sizeof(I32CTT_802154HomeChannel)*HOME_CHANNEL_TABLE_SIZE);
+  this->channel_hopping = false;
+  this->held_count = 0;
+  this->held_dropped = 0;
+  this->channel_since = 0;
+  this->channel_active = 0;
+  this->retunes = 0;
+  this->retune_time = 0;
+  this->channel_stats = new I32CTT_802154ChannelStats[CHANNEL_COUNT];
+  memset(this->channel_stats, 0, sizeof(I32CTT_802154ChannelStats)*CHANNEL_COUNT);
+  this->agg_hold = 0;
+  this->agg_frame = NULL;
+  this->agg_dst = 0;
+  this->agg_size = 0;
+  this->agg_count = 0;
+  this->agg_since = 0;
+  this->agg_rx_next = 0;
+  this->agg_rx_end = 0;
+  this->agg_rx_src = 0;
+  memset(&this->agg_stats, 0, sizeof(I32CTT_802154AggStats));
+  format_header();
 }
 
 I32CTT_Arduino802154Interface::~I32CTT_Arduino802154Interface() {
-  delete this->rx_buffer;
-  delete this->tx_buffer;
-  delete this->frame_buffer;
+  delete[] this->frame_memory;
+  delete[] this->capture_queue;
+  delete[] this->peers;
+  delete[] this->stream_seqs;
+  delete[] this->dedup;
+  delete[] this->routes;
+  delete[] this->children;
+  delete[] this->home_channels;
+  delete[] this->channel_stats;
   this->phy_status = 0;
   this->cs_pin = 14;
   this->slp_tx_pin = 16;
@@ -60,16 +151,53 @@ I32CTT_Arduino802154Interface::~I32CTT_Arduino802154Interface() {
 
 void I32CTT_Arduino802154Interface::set_pan_id(uint16_t pan_id) {
   this->pan_id = pan_id;
+  format_header();
 }
 
 void I32CTT_Arduino802154Interface::set_short_addr(uint16_t short_addr) {
   this->short_addr = short_addr;
+  format_header();
+}
+
+/**
+ * \brief Preformatea la cabecera MAC de la trama de transmisión.
+ *        FCF, PAN y dirección origen no cambian entre envíos, así que
+ *        solo se escriben cuando cambia la configuración. Cada envío
+ *        únicamente actualiza el número de secuencia y el destino.
+ */
+void I32CTT_Arduino802154Interface::format_header() {
+  IEEE_802154_FRAME_FCF fcf;
+
+  fcf.frame_type = DATA;
+  fcf.sec_enabled = SEC_DISABLED;
+  fcf.frame_pending = NOT_PENDING_FRAME;
+  fcf.ack_request = ACK_ENABLED;
+  fcf.pan_id_comp = PAN_ID_COMPRESSION;
+  fcf.res_0 = 0x000;
+  fcf.dst_addr_mode = SHORT_ADDR;
+  fcf.frame_ver = IEEE_802154_2006;
+  fcf.src_addr_mode = SHORT_ADDR;
+
+  memcpy(this->tx_frame+1, &fcf, sizeof(IEEE_802154_FRAME_FCF));
+  memcpy(this->tx_frame+FB_DST_PAN_OFFSET, &this->pan_id, sizeof(uint16_t));
+  memcpy(this->tx_frame+FB_SRC_ADDR_OFFSET, &this->short_addr, sizeof(uint16_t));
 }
 
 void I32CTT_Arduino802154Interface::set_dst_addr(uint16_t dst_addr) {
   this->dst_addr = dst_addr;
 }
 
+void I32CTT_Arduino802154Interface::set_dst(uint16_t addr) {
+  this->set_dst_addr(addr);
+}
+
+/**
+ * \brief Dirección corta del nodo que envió el último paquete recibido.
+ */
+uint16_t I32CTT_Arduino802154Interface::get_src() {
+  return this->last_addr;
+}
+
 void I32CTT_Arduino802154Interface::set_channel(IEEE_802154_CHANNEL channel) {
   this->channel = channel;
 }
@@ -107,8 +235,10 @@ uint8_t I32CTT_Arduino802154Interface::reg_read(uint8_t addr) {
 
 void I32CTT_Arduino802154Interface::reg_write(uint8_t addr, uint8_t value) {
   uint8_t cmd = 0xC0 | (0x3F & addr);
+#ifdef I32CTT_DEBUG
   Serial.println(cmd, HEX);
   Serial.println(value, HEX);
+#endif
   SPI.beginTransaction(this->spi_settings);
   digitalWrite(this->cs_pin, LOW);
   this->phy_status = SPI.transfer(cmd);
@@ -126,17 +256,21 @@ void I32CTT_Arduino802154Interface::fb_read(uint8_t *buffer) {
 
   phr = SPI.transfer(0x00);
 
-  if(phr>PSDU_SIZE)
+  if(phr>PSDU_SIZE) {
+    buffer[0] = 0;
+    digitalWrite(this->cs_pin, HIGH);
     return; //Something went really wrong. Abort.
+  }
 
   buffer[0] = phr;
 
   for(int i=0;i<phr;i++)
     buffer[i+1] = SPI.transfer(0x00);
 
+  // Frame buffer trailer: LQI, ED level and RX_STATUS
   this->lqi = SPI.transfer(0x00);
-  this->rx_status_1 = SPI.transfer(0x00);
-  this->rx_status_0 = SPI.transfer(0x00);
+  this->ed_level = SPI.transfer(0x00);
+  this->rx_status = SPI.transfer(0x00);
   digitalWrite(this->cs_pin, HIGH);
 }
 
@@ -151,8 +285,9 @@ void I32CTT_Arduino802154Interface::fb_write(uint8_t *buffer) {
   digitalWrite(this->cs_pin, LOW);
   this->phy_status = SPI.transfer(cmd);
   SPI.transfer(phr);
-  
-  for(int i=0;i<phr;i++) {
+
+  // FCS is appended by the radio (TX_AUTO_CRC_ON), no need to upload it
+  for(int i=0;i<(phr-IEEE_802154_FCS_SIZE);i++) {
     SPI.transfer(buffer[i+1]);
   }
   digitalWrite(this->cs_pin, HIGH);
@@ -237,13 +372,15 @@ void I32CTT_Arduino802154Interface::init() {
   Serial.println(reg_read(SHORT_ADDR_0), HEX);
 
   Serial.println("Setting radio channel...");
-  uint8_t phy_cc_cca = reg_read(PHY_CC_CCA);
-  phy_cc_cca  = this->channel | (phy_cc_cca & PHY_CC_CCA_CHANNEL_MSK);
-  reg_write(PHY_CC_CCA, phy_cc_cca);
+  write_channel();
+  this->channel_since = micros();
 
   Serial.print("My radio channel: ");
   Serial.println(reg_read(PHY_CC_CCA) & 0x1F, HEX);
 
+  Serial.println("Setting frame filter...");
+  configure_filter();
+
   Serial.println("Radio initialized...");
 
   this->radio_enabled = request_state(RX_AACK_ON);
@@ -261,7 +398,9 @@ uint8_t I32CTT_Arduino802154Interface::wait_for_state(AT86RF233_TRX_STATUS state
   uint64_t elapsed_time = millis();
   do {
     trx_status = reg_read(TRX_STATUS) & TRX_STATE_MSK;
+#ifdef I32CTT_DEBUG
     Serial.println(trx_status, HEX);
+#endif
   } while (trx_status != state && ((millis()-elapsed_time)<1));
 
   return trx_status == state;
@@ -270,10 +409,12 @@ uint8_t I32CTT_Arduino802154Interface::wait_for_state(AT86RF233_TRX_STATUS state
 uint8_t I32CTT_Arduino802154Interface::request_state(AT86RF233_TRX_STATE state) {
   uint8_t result = false;
   update_state();
+#ifdef I32CTT_DEBUG
   Serial.print("Current state: ");
   Serial.println(this->current_state, HEX);
   Serial.print("Requested state: ");
   Serial.println(state, HEX);
+#endif
 
   switch(current_state) {
     case P_ON_S:
@@ -696,14 +837,30 @@ uint8_t I32CTT_Arduino802154Interface::request_state(AT86RF233_TRX_STATE state)
 }
 
 void I32CTT_Arduino802154Interface::update() {
-  uint8_t phr = 0;
   uint8_t trx_status;
   uint8_t trac_status;
-  char str_fmt[3];
+  IEEE_802154_FRAME_FCF fcf;
+  I32CTT_802154Child *child;
+
+  if(this->sleepy_state != SLEEPY_OFF && !sleepy_update())
+    return; // Transceiver asleep, SPI is not available
+
   // Get current status to update IRQ status on PHY_STATUS
   update_state();
   trx_status = reg_read(TRX_STATE);
 
+  expire_indirect();
+  next_aggregated();
+
+  if(this->agg_frame != NULL && (millis()-this->agg_since) >= this->agg_hold)
+    flush_aggregate();
+
+  if(
+    this->mesh && this->radio_enabled &&
+    (millis()-this->last_beacon) >= MESH_BEACON_INTERVAL
+  )
+    send_beacon();
+
   switch(current_state) {
     case TX_ARET_ON_S:
       //Serial.println("Trying to send...");
@@ -713,69 +870,1359 @@ void I32CTT_Arduino802154Interface::update() {
       ) {
         if((millis()-this->last_try)>TX_POLL_TIMEOUT ) {
           Serial.println("Packet timed out");
+          trac_status = TRAC_INVALID;
+          update_tx_stats(TRAC_INVALID, true);
         } else {
           trac_status = trx_status>>5;
-          switch(trac_status) {
-            case TRAC_SUCCESS:
-                Serial.println("Packet sent");
-              break;
-            case TRAC_SUCCESS_DATA_PENDING:
-                Serial.println("Data pending");
-              break;
-            case TRAC_CHANNEL_ACCESS_FAILURE:
-                Serial.println("Access Failure");
-              break;
-            case TRAC_NO_ACK:
-                Serial.println("No ACK");
-              break;
-            case TRAC_INVALID:
-                Serial.println("Invalid");
-              break;
-          };
+          update_tx_stats(trac_status, false);
+        }
+        if(trac_status != TRAC_CHANNEL_ACCESS_FAILURE && trac_status != TRAC_INVALID) {
+          this->channel_stats[this->channel-C2405].tx_frames++;
+          this->channel_stats[this->channel-C2405].tx_airtime += frame_airtime(this->tx_phr);
+        }
+        this->channel_active = millis();
+        if(this->tx_pooled != NULL) {
+          // Forwarded frame, beacon, data request or indirect frame
+          memcpy(&fcf, this->tx_pooled+1, sizeof(IEEE_802154_FRAME_FCF));
+          child = find_child(this->tx_peer_addr);
+          if(fcf.frame_type == MAC_CMD && this->sleepy_state == SLEEPY_POLLING) {
+            // Data request: listen for a while only if the parent has data
+            this->sleepy_state = SLEEPY_LISTENING;
+            this->listen_until = millis();
+            if(trac_status == TRAC_SUCCESS_DATA_PENDING) {
+              this->sleep_stats.polls_pending++;
+              this->listen_until += SLEEPY_RX_WINDOW;
+            }
+          }
+          if(
+            child != NULL && fcf.frame_type == DATA &&
+            this->tx_pooled[0] > IEEE_802154_HEADER_SIZE+IEEE_802154_FCS_SIZE
+          ) {
+            if(trac_status == TRAC_SUCCESS || trac_status == TRAC_SUCCESS_DATA_PENDING) {
+              child->delivered++;
+              child->latency += millis()-child->queued_at;
+              if((millis()-child->queued_at) > child->latency_max)
+                child->latency_max = millis()-child->queued_at;
+            } else if(child->pending == NULL) {
+              // The child is asleep again, hold the frame for its next poll
+              child->pending = this->tx_pooled;
+              this->tx_pooled = NULL;
+              update_pending_bit();
+            }
+          }
+          if(this->tx_pooled != NULL)
+            release_frame(this->tx_pooled);
+          this->tx_pooled = NULL;
+        } else if(!this->tx_replay) {
+          this->tx_size  = 0; // Replays never touch the pending tx_buffer
         }
-        this->tx_size  = 0;
+        this->tx_replay = false;
         this->package_queued = false;
         reg_read(IRQ_STATUS); // Clear interrupt status
-        request_state(RX_AACK_ON); // Request listen state
+        if(this->tx_queue_count > 0)
+          send_queued(); // Back to back, no turnaround through RX_AACK_ON
+        else
+          request_state(RX_AACK_ON); // Request listen state
       }
       break;
     case RX_AACK_ON_S:
-      // A frame reception was successfully completed
+      // A frame reception was successfully completed. Frames not addressed
+      // to us never get here: RX_AACK drops them without raising TRX_END.
       if(this->phy_status & IRQ_3_TRX_END) {
-        IEEE_802154_FRAME_FCF response_fcf;
+        if(this->promiscuous) {
+          capture_frame();
+        } else {
+          fb_read(this->rx_frame);
+          deliver_frame(this->rx_frame);
+        }
+        this->channel_stats[this->channel-C2405].rx_frames++;
+        this->channel_active = millis();
+        reg_read(IRQ_STATUS); // Clear interrupt status
+      } else if(this->tx_queue_count > 0 && !this->package_queued) {
+        send_queued();
+      } else if(
+        this->held_count > 0 && !this->package_queued &&
+        (millis()-this->channel_active) >= CHANNEL_DWELL_TIME
+      ) {
+        schedule_channel(); // Current channel is done, move to the next batch
+      } else if(this->answer_pending && this->tx_size > 0 && !this->package_queued) {
+        // The answer found the radio busy (e.g. sending the ACK), retry it
+        this->answer_pending = false;
+        send_to_addr(this->answer_addr);
+        this->answer_pending = (this->tx_size > 0 && !this->package_queued);
+      }
+      break;
+  }
+}
 
-        fb_read(this->frame_buffer);
+/**
+ * \brief Configura el filtro de tramas del radio.
+ *        En modo normal RX_AACK descarta por hardware las tramas cuyo
+ *        PAN o dirección destino no coinciden, sin leer el frame buffer.
+ *        En modo promiscuo se aceptan todas las tramas (incluyendo tipos
+ *        reservados) y solo se responde ACK a las dirigidas a este nodo.
+ */
+void I32CTT_Arduino802154Interface::configure_filter() {
+  uint8_t xah_ctrl_1 = reg_read(XAH_CTRL_1);
+  uint8_t csma_seed_1 = reg_read(CSMA_SEED_1);
 
-        phr = this->frame_buffer[0];
+  // Accept 2003 and 2006 frame versions
+  csma_seed_1 = (csma_seed_1 & ~AACK_FVN_MODE_MSK) | AACK_FVN_MODE_0_1;
 
-        memcpy(&response_fcf, this->frame_buffer+1, sizeof(IEEE_802154_FRAME_FCF));
+  if(this->promiscuous) {
+    xah_ctrl_1 |= (AACK_PROM_MODE | AACK_UPLD_RES_FT | AACK_FLTR_RES_FT);
+  } else {
+    xah_ctrl_1 &= ~(AACK_PROM_MODE | AACK_UPLD_RES_FT | AACK_FLTR_RES_FT);
+  }
 
+  reg_write(CSMA_SEED_1, csma_seed_1);
+  reg_write(XAH_CTRL_1, xah_ctrl_1);
+}
 
-        for(int i=1;i<(phr+1);i++) {
-          sprintf(str_fmt, "%02x", this->frame_buffer[i]);
-          Serial.print(str_fmt);
-          Serial.print(":");
-        }
-        Serial.print("\r\n");
-
-        // Fill response buffer only if it makes sense
-        if(
-          response_fcf.sec_enabled == SEC_DISABLED &&
-          response_fcf.pan_id_comp == PAN_ID_COMPRESSION &&
-          response_fcf.dst_addr_mode == SHORT_ADDR &&
-          response_fcf.src_addr_mode == SHORT_ADDR
-        ) {
-          this->rx_size = phr-11;
-          // Copy payload
-          memcpy(this->rx_buffer, this->frame_buffer+10, this->rx_size);
-          // Copy source address
-          memcpy(&this->last_addr, this->frame_buffer+8, sizeof(uint16_t));
-          this->d_available = true;
+/**
+ * \brief Habilita o deshabilita el modo promiscuo (gateway/sniffer).
+ *        En modo promiscuo todas las tramas recibidas se encolan junto
+ *        con su LQI y RSSI en la cola de captura. Las tramas dirigidas
+ *        a este nodo se siguen entregando al controlador.
+ * \param value true para habilitar el modo promiscuo.
+ */
+void I32CTT_Arduino802154Interface::set_promiscuous(uint8_t value) {
+  if(value && this->capture_queue == NULL) {
+    this->capture_queue = new I32CTT_802154Capture[CAPTURE_QUEUE_SIZE];
+  }
+  this->capture_head = 0;
+  this->capture_count = 0;
+  this->promiscuous = value;
+
+  if(this->radio_enabled)
+    configure_filter();
+}
+
+void I32CTT_Arduino802154Interface::capture_frame() {
+  I32CTT_802154Capture *slot;
+
+  if(this->capture_count >= CAPTURE_QUEUE_SIZE) {
+    // Queue full: the frame still has to be read to release the buffer
+    this->capture_dropped++;
+    fb_read(this->rx_frame);
+    if(this->rx_status & RX_CRC_VALID)
+      deliver_frame(this->rx_frame);
+    return;
+  }
+
+  slot = &this->capture_queue[(this->capture_head+this->capture_count)%CAPTURE_QUEUE_SIZE];
+  fb_read(slot->frame);
+  if(slot->frame[0] == 0)
+    return; // Invalid PHR, nothing captured
+
+  slot->timestamp = millis();
+  slot->lqi = this->lqi;
+  slot->rssi = RSSI_BASE_VAL + this->ed_level;
+  slot->crc_valid = (this->rx_status & RX_CRC_VALID) != 0;
+  this->capture_count++;
+
+  if(slot->crc_valid)
+    deliver_frame(slot->frame);
+}
+
+uint8_t I32CTT_Arduino802154Interface::capture_available() {
+  return this->capture_count;
+}
+
+I32CTT_802154Capture *I32CTT_Arduino802154Interface::peek_capture() {
+  if(this->capture_count == 0)
+    return NULL;
+  return &this->capture_queue[this->capture_head];
+}
+
+void I32CTT_Arduino802154Interface::pop_capture() {
+  if(this->capture_count == 0)
+    return;
+  this->capture_head = (this->capture_head+1)%CAPTURE_QUEUE_SIZE;
+  this->capture_count--;
+}
+
+uint16_t I32CTT_Arduino802154Interface::get_capture_dropped() {
+  return this->capture_dropped;
+}
+
+/**
+ * \brief Entrega el payload de una trama al controlador.
+ *        Valida la cabecera MAC (tipo de trama, modos de dirección, PAN y
+ *        dirección destino). Si la trama ya está en rx_frame el payload
+ *        queda en su lugar, de lo contrario (cola de captura) se copia.
+ * \param buffer Trama recibida (PHR + PSDU).
+ * \return true si la trama iba dirigida a este nodo.
+ */
+uint8_t I32CTT_Arduino802154Interface::deliver_frame(uint8_t *buffer) {
+  IEEE_802154_FRAME_FCF fcf;
+  I32CTT_802154Peer *peer;
+  I32CTT_802154MeshHeader mesh;
+  I32CTT_802154Route *route;
+  uint8_t *payload = buffer+FB_PAYLOAD_OFFSET;
+  uint8_t phr = buffer[0];
+  uint8_t size;
+  uint8_t seq;
+  uint8_t gap;
+  uint16_t dst_pan;
+  uint16_t dst;
+  uint16_t src;
+  uint32_t rtt;
+
+  if(phr < (IEEE_802154_HEADER_SIZE+IEEE_802154_FCS_SIZE))
+    return false; // Too short for the header we use
+
+  memcpy(&fcf, buffer+1, sizeof(IEEE_802154_FRAME_FCF));
+
+  // Fill response buffer only if it makes sense
+  if(
+    (fcf.frame_type != DATA && fcf.frame_type != MAC_CMD) ||
+    fcf.sec_enabled != SEC_DISABLED ||
+    fcf.pan_id_comp != PAN_ID_COMPRESSION ||
+    fcf.dst_addr_mode != SHORT_ADDR ||
+    fcf.src_addr_mode != SHORT_ADDR
+  )
+    return false;
+
+  memcpy(&dst_pan, buffer+FB_DST_PAN_OFFSET, sizeof(uint16_t));
+  memcpy(&dst, buffer+FB_DST_ADDR_OFFSET, sizeof(uint16_t));
+
+  if(dst_pan != this->pan_id && dst_pan != IEEE_802154_BROADCAST)
+    return false;
+  if(dst != this->short_addr && dst != IEEE_802154_BROADCAST)
+    return false;
+
+  // A lost ACK makes the sender's radio retry with the same sequence number,
+  // answer it from cache instead of running the command again.
+  memcpy(&src, buffer+FB_SRC_ADDR_OFFSET, sizeof(uint16_t));
+  seq = buffer[FB_SEQ_OFFSET];
+
+  if(fcf.frame_type == MAC_CMD) {
+    if(phr > IEEE_802154_HEADER_SIZE+IEEE_802154_FCS_SIZE && payload[0] == IEEE_802154_DATA_REQUEST)
+      handle_data_request(src, seq);
+    return false;
+  }
+
+  peer = get_peer(src);
+  update_rx_stats(peer, phr);
+  if(fcf.ack_request == ACK_DISABLED && dst == this->short_addr) {
+    // Unacknowledged stream: no retries so no duplicates, count the gaps
+    if(peer->flags & PEER_STREAM_SEQ_VALID) {
+      gap = seq-(uint8_t)(peer->stream_rx_seq+1);
+      if(gap < 0x80)
+        peer->stats.stream_lost += gap; // Otherwise reordered or restarted
+    }
+    peer->flags |= PEER_STREAM_SEQ_VALID;
+    peer->stream_rx_seq = seq;
+    peer->stats.stream_rx++;
+    peer->last_rx = millis();
+    this->rx_size = phr-IEEE_802154_HEADER_SIZE-IEEE_802154_FCS_SIZE;
+    if(this->rx_size == 0 || this->mesh)
+      return false;
+    this->rx_buffer = this->rx_frame+FB_PAYLOAD_OFFSET;
+    if(buffer != this->rx_frame)
+      memcpy(this->rx_buffer, payload, this->rx_size);
+    this->last_addr = src;
+    this->d_available = true;
+    return true;
+  }
+  peer->last_rx = millis();
+  if(is_duplicate(src, seq)) {
+    this->dedup_hits++;
+    if(peer->answer[0] != 0 && available())
+      replay_answer(peer);
+    return false;
+  }
+  size = phr-IEEE_802154_HEADER_SIZE-IEEE_802154_FCS_SIZE;
+
+  if(this->sleepy_state != SLEEPY_OFF && src == this->parent_addr) {
+    this->sleepy_received = true;
+    this->sleep_stats.frames++;
+  }
+  if(size == 0)
+    return false; // Empty frame, a parent with nothing pending for us
+
+  if(this->mesh) {
+    learn_route(src, src, 1, link_cost(src));
+    if(size >= sizeof(I32CTT_802154RouteBeacon) && payload[0] == CMD_RTB) {
+      process_beacon(src, payload, size);
+      return false;
+    }
+    if(size < sizeof(I32CTT_802154MeshHeader) || payload[0] != CMD_MESH)
+      return false;
+    memcpy(&mesh, payload, sizeof(I32CTT_802154MeshHeader));
+
+    // Reverse route towards the origin, learned from the traffic itself
+    learn_route(mesh.origin, src, mesh.hops+1, mesh.cost+link_cost(src));
+
+    if(mesh.dst != this->short_addr && mesh.dst != IEEE_802154_BROADCAST) {
+      forward_frame(buffer, &mesh);
+      return false;
+    }
+
+    route = find_route(mesh.origin);
+    if(route != NULL && route->sent_at != 0) {
+      rtt = micros()-route->sent_at;
+      if(route->rtt_samples == 0)
+        route->rtt = rtt;
+      else
+        route->rtt = route->rtt+(((int32_t)rtt-(int32_t)route->rtt)>>LINK_EWMA_SHIFT);
+      route->rtt_samples++;
+      route->sent_at = 0;
+    }
+
+    src = mesh.origin; // Answers go back end to end
+    payload += sizeof(I32CTT_802154MeshHeader);
+    size -= sizeof(I32CTT_802154MeshHeader);
+  }
+
+  // Only a request gets an answer to replay, the master's next request
+  // to a slave is not the answer to the slave's last answer.
+  if(
+    payload[0] != CMD_AR && payload[0] != CMD_AW && payload[0] != CMD_LSTA &&
+    payload[0] != CMD_FNDA && payload[0] != CMD_FRGA
+  )
+    peer->flags |= PEER_AWAITING_ANSWER;
+  else
+    peer->flags &= ~PEER_AWAITING_ANSWER;
+  peer->answer[0] = 0;
+
+  this->rx_size = size;
+  this->rx_buffer = this->rx_frame+(payload-buffer); // May point into a container
+  if(buffer != this->rx_frame) {
+    // Copy payload, only needed for frames from the capture queue
+    memcpy(this->rx_buffer, payload, this->rx_size);
+  }
+  this->last_addr = src;
+
+  if(size > 1 && this->rx_buffer[0] == CMD_AGG) {
+    unpack_aggregate(src);
+    return this->d_available;
+  }
+  this->d_available = true;
+
+  return true;
+}
+
+I32CTT_802154Peer *I32CTT_Arduino802154Interface::find_peer(uint16_t addr) {
+  for(int i=0;i<PEER_TABLE_SIZE;i++) {
+    if((this->peers[i].flags & PEER_VALID) && this->peers[i].addr == addr)
+      return &this->peers[i];
+  }
+  return NULL;
+}
+
+/**
+ * \brief Obtiene la entrada de la tabla de pares para una dirección.
+ *        Si la dirección no está en la tabla se reutiliza una entrada
+ *        libre o, en su defecto, la que lleva más tiempo sin recibir.
+ * \param addr Dirección corta del par.
+ */
+I32CTT_802154Peer *I32CTT_Arduino802154Interface::get_peer(uint16_t addr) {
+  I32CTT_802154Peer *peer = find_peer(addr);
+  uint32_t now = millis();
+
+  if(peer != NULL)
+    return peer;
+
+  peer = &this->peers[0];
+  for(int i=0;i<PEER_TABLE_SIZE;i++) {
+    if(!(this->peers[i].flags & PEER_VALID)) {
+      peer = &this->peers[i];
+      break;
+    }
+    if((now-this->peers[i].last_rx) > (now-peer->last_rx))
+      peer = &this->peers[i];
+  }
+  memset(peer, 0, sizeof(I32CTT_802154Peer));
+  peer->addr = addr;
+  peer->flags = PEER_VALID;
+  peer->last_rx = now;
+  return peer;
+}
+
+/**
+ * \brief Indica si una trama repite el número de secuencia de la
+ *        anterior del mismo origen dentro de DEDUP_WINDOW (un reintento
+ *        tras un ACK perdido) y registra su número de secuencia. Si el
+ *        origen no está en la tabla se reutiliza una entrada libre o la
+ *        que lleva más tiempo sin recibir.
+ * \param src Dirección corta del origen.
+ * \param seq Número de secuencia MAC de la trama.
+ */
+uint8_t I32CTT_Arduino802154Interface::is_duplicate(uint16_t src, uint8_t seq) {
+  I32CTT_802154Dedup *entry = &this->dedup[0];
+  uint32_t now = millis();
+  uint8_t duplicate;
+
+  for(int i=0;i<DEDUP_TABLE_SIZE;i++) {
+    if(this->dedup[i].valid && this->dedup[i].addr == src) {
+      entry = &this->dedup[i];
+      duplicate = entry->seq == seq && (now-entry->last_rx) < DEDUP_WINDOW;
+      entry->seq = seq;
+      entry->last_rx = now;
+      return duplicate;
+    }
+  }
+
+  for(int i=0;i<DEDUP_TABLE_SIZE;i++) {
+    if(!this->dedup[i].valid) {
+      entry = &this->dedup[i];
+      break;
+    }
+    if((now-this->dedup[i].last_rx) > (now-entry->last_rx))
+      entry = &this->dedup[i];
+  }
+  entry->addr = src;
+  entry->valid = true;
+  entry->seq = seq;
+  entry->last_rx = now;
+  return false;
+}
+
+/**
+ * \brief Siguiente número de secuencia de las tramas sin ACK hacia una
+ *        dirección. Si la dirección no tiene secuencia se reutiliza una
+ *        entrada libre o la que lleva más tiempo sin transmitir.
+ * \param addr Dirección corta del destino.
+ */
+uint8_t I32CTT_Arduino802154Interface::next_stream_seq(uint16_t addr) {
+  I32CTT_802154StreamSeq *entry = &this->stream_seqs[0];
+  uint32_t now = millis();
+
+  for(int i=0;i<STREAM_TABLE_SIZE;i++) {
+    if(this->stream_seqs[i].valid && this->stream_seqs[i].addr == addr) {
+      entry = &this->stream_seqs[i];
+      entry->last_tx = now;
+      return ++entry->seq;
+    }
+  }
+
+  for(int i=0;i<STREAM_TABLE_SIZE;i++) {
+    if(!this->stream_seqs[i].valid) {
+      entry = &this->stream_seqs[i];
+      break;
+    }
+    if((now-this->stream_seqs[i].last_tx) > (now-entry->last_tx))
+      entry = &this->stream_seqs[i];
+  }
+  entry->addr = addr;
+  entry->valid = true;
+  entry->seq = 1;
+  entry->last_tx = now;
+  return entry->seq;
+}
+
+static void link_ewma(uint16_t *avg, uint16_t sample, uint8_t first) {
+  uint16_t value = sample<<LINK_EWMA_FRAC;
+  if(first)
+    *avg = value;
+  else
+    *avg = *avg + (((int32_t)value-(int32_t)*avg)>>LINK_EWMA_SHIFT);
+}
+
+void I32CTT_Arduino802154Interface::update_rx_stats(I32CTT_802154Peer *peer, uint8_t phr) {
+  I32CTT_802154LinkStats *stats = &peer->stats;
+  uint8_t first = (stats->rx_frames == 0);
+  uint16_t rssi = (uint16_t)(stats->rssi);
+
+  link_ewma(&stats->lqi, this->lqi, first);
+  // RSSI is negative, average its magnitude to keep the shift arithmetic simple
+  rssi = (uint16_t)(-(int16_t)rssi);
+  link_ewma(&rssi, (uint16_t)(-(RSSI_BASE_VAL+(int16_t)this->ed_level)), first);
+  stats->rssi = -(int16_t)rssi;
+
+  stats->rx_frames++;
+  stats->rx_airtime += frame_airtime(phr);
+}
+
+/**
+ * \brief Registra el resultado de una transmisión en la tabla de pares.
+ *        El número de reintentos lo reporta el radio en XAH_CTRL_2 al
+ *        terminar TX_ARET. El tiempo en aire incluye cada intento y el
+ *        ACK recibido. Solo se cuentan los pares que ya están en la
+ *        tabla: las entradas las crea el tráfico recibido, así un
+ *        maestro que envía a muchos esclavos no desaloja a cada envío
+ *        el estado de duplicados de los demás.
+ * \param trac_status Valor de TRAC_STATUS al terminar la transmisión.
+ * \param timed_out true si no se recibió TRX_END a tiempo.
+ */
+void I32CTT_Arduino802154Interface::update_tx_stats(uint8_t trac_status, uint8_t timed_out) {
+  I32CTT_802154Peer *peer;
+  I32CTT_802154LinkStats *stats;
+  uint8_t retries = 0;
+
+  if(this->tx_peer_addr == IEEE_802154_BROADCAST)
+    return; // Not a link to any peer
+
+  peer = find_peer(this->tx_peer_addr);
+  if(peer == NULL)
+    return; // Never heard from it, see get_peer()
+  stats = &peer->stats;
+
+  if(timed_out) {
+    stats->tx_no_ack++;
+    return;
+  }
+
+  if(trac_status != TRAC_CHANNEL_ACCESS_FAILURE)
+    retries = reg_read(XAH_CTRL_2)>>ARET_FRAME_RETRIES_SHIFT;
+
+  switch(trac_status) {
+    case TRAC_SUCCESS:
+    case TRAC_SUCCESS_DATA_PENDING:
+      stats->tx_success++;
+      stats->tx_airtime += frame_airtime(this->tx_phr)*(1+retries);
+      if(this->tx_acked)
+        stats->tx_airtime += frame_airtime(ACK_PSDU_SIZE);
+      else
+        stats->stream_tx++;
+      break;
+    case TRAC_CHANNEL_ACCESS_FAILURE:
+      stats->tx_channel_access_failure++;
+      break;
+    case TRAC_NO_ACK:
+      stats->tx_no_ack++;
+      stats->tx_airtime += frame_airtime(this->tx_phr)*(1+retries);
+      break;
+  }
+  stats->tx_retries += retries;
+}
+
+uint8_t I32CTT_Arduino802154Interface::get_peer_count() {
+  return PEER_TABLE_SIZE;
+}
+
+I32CTT_802154Peer *I32CTT_Arduino802154Interface::get_peer_at(uint8_t idx) {
+  if(idx >= PEER_TABLE_SIZE || !(this->peers[idx].flags & PEER_VALID))
+    return NULL;
+  return &this->peers[idx];
+}
+
+/**
+ * \brief Calidad de enlace promedio (LQI) hacia un par.
+ *        Permite al maestro consultar primero a los nodos con mejor
+ *        enlace. Retorna 0 si el par no está en la tabla.
+ * \param addr Dirección corta del par.
+ */
+uint8_t I32CTT_Arduino802154Interface::link_quality(uint16_t addr) {
+  I32CTT_802154Peer *peer = find_peer(addr);
+  if(peer == NULL)
+    return 0;
+  return peer->stats.lqi>>LINK_EWMA_FRAC;
+}
+
+void I32CTT_Arduino802154Interface::clear_link_stats() {
+  for(int i=0;i<PEER_TABLE_SIZE;i++) {
+    memset(&this->peers[i].stats, 0, sizeof(I32CTT_802154LinkStats));
+  }
+}
+
+void I32CTT_Arduino802154Interface::replay_answer(I32CTT_802154Peer *peer) {
+  if(!request_state(TX_ARET_ON))
+    return; // Still acknowledging, the peer retries the request anyway
+  this->last_try = millis();
+  this->package_queued = true;
+  this->tx_replay = true;
+  this->tx_peer_addr = peer->addr;
+  this->tx_phr = peer->answer[0];
+  this->tx_acked = true;
+  fb_write(peer->answer);
+  request_state(TX_START);
+  this->dedup_replays++;
+}
+
+uint16_t I32CTT_Arduino802154Interface::get_dedup_hits() {
+  return this->dedup_hits;
+}
+
+uint16_t I32CTT_Arduino802154Interface::get_dedup_replays() {
+  return this->dedup_replays;
+}
+
+void I32CTT_Arduino802154Interface::update_buffers() {
+  uint8_t offset = FB_PAYLOAD_OFFSET;
+
+  if(this->mesh)
+    offset += sizeof(I32CTT_802154MeshHeader);
+  if(this->agg_rx_frame == NULL)
+    this->rx_buffer = this->rx_frame+offset; // Otherwise it points into the container
+  this->tx_buffer = this->tx_frame+offset;
+}
+
+uint8_t *I32CTT_Arduino802154Interface::alloc_frame() {
+  if(this->free_count == 0)
+    return NULL;
+  return this->free_frames[--this->free_count];
+}
+
+void I32CTT_Arduino802154Interface::release_frame(uint8_t *frame) {
+  this->free_frames[this->free_count++] = frame;
+}
+
+uint8_t I32CTT_Arduino802154Interface::queue_frame(uint8_t *frame) {
+  if(this->tx_queue_count >= FRAME_POOL_SIZE)
+    return false;
+  this->tx_queue[(this->tx_queue_head+this->tx_queue_count)%FRAME_POOL_SIZE] = frame;
+  this->tx_queue_count++;
+  return true;
+}
+
+/**
+ * \brief Transmite la siguiente trama de la cola de transmisión.
+ *        Las tramas de la cola ya tienen la cabecera MAC completa y se
+ *        suben al radio tal cual. La trama vuelve al pool al terminar
+ *        TX_ARET.
+ */
+void I32CTT_Arduino802154Interface::send_queued() {
+  IEEE_802154_FRAME_FCF fcf;
+  uint8_t *frame = this->tx_queue[this->tx_queue_head];
+
+  if(!request_state(TX_ARET_ON))
+    return; // A reception just started, retry on the next update
+
+  this->tx_queue_head = (this->tx_queue_head+1)%FRAME_POOL_SIZE;
+  this->tx_queue_count--;
+
+  this->last_try = millis();
+  this->package_queued = true;
+  this->tx_pooled = frame;
+  memcpy(&this->tx_peer_addr, frame+FB_DST_ADDR_OFFSET, sizeof(uint16_t));
+  this->tx_phr = frame[0];
+  memcpy(&fcf, frame+1, sizeof(IEEE_802154_FRAME_FCF));
+  this->tx_acked = fcf.ack_request;
+  fb_write(frame);
+  request_state(TX_START);
+}
+
+/**
+ * \brief Habilita o deshabilita el modo malla (mesh).
+ *        En modo malla cada trama lleva una cabecera con origen, destino
+ *        final y saltos, los nodos reenvían las tramas que no son para
+ *        ellos y aprenden rutas del tráfico y de beacons periódicos.
+ *        Todos los nodos de la red deben usar el mismo modo.
+ * \param value true para habilitar el modo malla.
+ */
+void I32CTT_Arduino802154Interface::set_mesh(uint8_t value) {
+  this->mesh = value;
+  update_buffers();
+  memset(this->routes, 0, sizeof(I32CTT_802154Route)*ROUTE_TABLE_SIZE);
+  // Spread the first beacons of nodes powered up together
+  this->last_beacon = millis()-MESH_BEACON_INTERVAL+
+    (this->short_addr & 0x0F)*(MESH_BEACON_INTERVAL/16);
+}
+
+/**
+ * \brief Costo de un enlace a partir de su LQI promedio (1 a 8).
+ * \param addr Dirección corta del vecino.
+ */
+uint8_t I32CTT_Arduino802154Interface::link_cost(uint16_t addr) {
+  I32CTT_802154Peer *peer = find_peer(addr);
+  uint8_t lqi = this->lqi;
+
+  if(peer != NULL && peer->stats.rx_frames > 0)
+    lqi = peer->stats.lqi>>LINK_EWMA_FRAC;
+  return 1+((0xFF-lqi)>>5);
+}
+
+I32CTT_802154Route *I32CTT_Arduino802154Interface::find_route(uint16_t dst) {
+  for(int i=0;i<ROUTE_TABLE_SIZE;i++) {
+    if(
+      (this->routes[i].flags & ROUTE_VALID) &&
+      this->routes[i].dst == dst &&
+      (millis()-this->routes[i].updated) < MESH_ROUTE_TIMEOUT
+    )
+      return &this->routes[i];
+  }
+  return NULL;
+}
+
+/**
+ * \brief Actualiza la tabla de rutas con un camino hacia dst.
+ *        Una ruta por el mismo siguiente salto siempre se refresca,
+ *        una ruta por otro vecino solo la reemplaza si es más barata o
+ *        si la actual expiró. Si no hay espacio se reutiliza la entrada
+ *        más antigua.
+ * \param dst Destino final.
+ * \param via Vecino por el cual se alcanza dst.
+ * \param hops Saltos hasta dst.
+ * \param cost Costo acumulado hasta dst.
+ */
+void I32CTT_Arduino802154Interface::learn_route(uint16_t dst, uint16_t via, uint8_t hops, uint16_t cost) {
+  I32CTT_802154Route *route = NULL;
+  uint32_t now = millis();
+
+  if(dst == this->short_addr || dst == IEEE_802154_BROADCAST || hops > MESH_MAX_HOPS)
+    return;
+  if(cost > MESH_COST_MAX)
+    cost = MESH_COST_MAX;
+
+  for(int i=0;i<ROUTE_TABLE_SIZE;i++) {
+    if((this->routes[i].flags & ROUTE_VALID) && this->routes[i].dst == dst) {
+      route = &this->routes[i];
+      break;
+    }
+  }
+
+  if(route != NULL) {
+    if(
+      route->next_hop != via &&
+      cost >= route->cost &&
+      (now-route->updated) < MESH_ROUTE_TIMEOUT
+    )
+      return; // Current route is still better
+  } else {
+    route = &this->routes[0];
+    for(int i=0;i<ROUTE_TABLE_SIZE;i++) {
+      if(!(this->routes[i].flags & ROUTE_VALID)) {
+        route = &this->routes[i];
+        break;
+      }
+      if((now-this->routes[i].updated) > (now-route->updated))
+        route = &this->routes[i];
+    }
+    memset(route, 0, sizeof(I32CTT_802154Route));
+    route->dst = dst;
+    route->flags = ROUTE_VALID;
+  }
+
+  route->next_hop = via;
+  route->hops = hops;
+  route->cost = cost;
+  route->updated = now;
+}
+
+/**
+ * \brief Reenvía una trama hacia su destino final.
+ *        Si la trama está en rx_frame se intercambia con una trama libre
+ *        del pool, así pasa a la cola de transmisión sin copiarse. Solo
+ *        se parchan la cabecera MAC (secuencia, destino y origen) y los
+ *        saltos/costo de la cabecera de malla.
+ * \param buffer Trama recibida (PHR + PSDU).
+ * \param mesh Cabecera de malla de la trama.
+ */
+void I32CTT_Arduino802154Interface::forward_frame(uint8_t *buffer, I32CTT_802154MeshHeader *mesh) {
+  I32CTT_802154Route *route = find_route(mesh->dst);
+  I32CTT_802154MeshHeader *header;
+  uint8_t *frame;
+  uint16_t src;
+  uint16_t cost;
+
+  if(route == NULL || mesh->hops+1 >= MESH_MAX_HOPS) {
+    this->mesh_dropped++;
+    return;
+  }
+
+  frame = alloc_frame();
+  if(frame == NULL) {
+    this->mesh_dropped++;
+    return;
+  }
+
+  if(buffer == this->rx_frame) {
+    this->rx_frame = frame;
+    update_buffers();
+    frame = buffer;
+  } else {
+    memcpy(frame, buffer, buffer[0]+1); // From the capture queue
+  }
+
+  memcpy(&src, frame+FB_SRC_ADDR_OFFSET, sizeof(uint16_t));
+  header = (I32CTT_802154MeshHeader *)(frame+FB_PAYLOAD_OFFSET);
+  cost = header->cost+link_cost(src);
+  header->hops++;
+  header->cost = cost > MESH_COST_MAX ? MESH_COST_MAX : cost;
+
+  frame[FB_SEQ_OFFSET] = ++seq_num;
+  memcpy(frame+FB_DST_ADDR_OFFSET, &route->next_hop, sizeof(uint16_t));
+  memcpy(frame+FB_SRC_ADDR_OFFSET, &this->short_addr, sizeof(uint16_t));
+
+  if(!queue_frame(frame)) {
+    release_frame(frame);
+    this->mesh_dropped++;
+    return;
+  }
+  route->forwarded++;
+  this->mesh_forwarded++;
+}
+
+/**
+ * \brief Encola un beacon de rutas (vector de distancias).
+ *        Se difunde sin ACK con este nodo (costo 0) y las rutas vigentes.
+ *        Cada entrada incluye su siguiente salto para que los vecinos
+ *        ignoren las rutas que pasan por ellos mismos.
+ */
+void I32CTT_Arduino802154Interface::send_beacon() {
+  IEEE_802154_FRAME_FCF fcf;
+  I32CTT_802154RouteBeacon *beacon;
+  I32CTT_802154RouteEntry entry;
+  uint8_t *frame;
+  uint8_t size = sizeof(I32CTT_802154RouteBeacon);
+
+  this->last_beacon = millis();
+  frame = prepare_frame(DATA, IEEE_802154_BROADCAST);
+  if(frame == NULL)
+    return;
+
+  memcpy(&fcf, frame+1, sizeof(IEEE_802154_FRAME_FCF));
+  fcf.ack_request = ACK_DISABLED;
+  memcpy(frame+1, &fcf, sizeof(IEEE_802154_FRAME_FCF));
+
+  beacon = (I32CTT_802154RouteBeacon *)(frame+FB_PAYLOAD_OFFSET);
+  beacon->cmd = CMD_RTB;
+  beacon->count = 0;
+
+  entry.dst = this->short_addr;
+  entry.next_hop = this->short_addr;
+  entry.hops = 0;
+  entry.cost = 0;
+  memcpy(frame+FB_PAYLOAD_OFFSET+size, &entry, sizeof(I32CTT_802154RouteEntry));
+  size += sizeof(I32CTT_802154RouteEntry);
+  beacon->count++;
+
+  for(int i=0;i<ROUTE_TABLE_SIZE;i++) {
+    if(size+sizeof(I32CTT_802154RouteEntry) > IEEE_802154_MTU)
+      break;
+    if(find_route(this->routes[i].dst) != &this->routes[i])
+      continue; // Invalid or expired
+    entry.dst = this->routes[i].dst;
+    entry.next_hop = this->routes[i].next_hop;
+    entry.hops = this->routes[i].hops;
+    entry.cost = this->routes[i].cost;
+    memcpy(frame+FB_PAYLOAD_OFFSET+size, &entry, sizeof(I32CTT_802154RouteEntry));
+    size += sizeof(I32CTT_802154RouteEntry);
+    beacon->count++;
+  }
+
+  frame[0] = IEEE_802154_HEADER_SIZE+size+IEEE_802154_FCS_SIZE;
+  if(!queue_frame(frame))
+    release_frame(frame);
+}
+
+void I32CTT_Arduino802154Interface::process_beacon(uint16_t src, uint8_t *payload, uint8_t size) {
+  I32CTT_802154RouteBeacon beacon;
+  I32CTT_802154RouteEntry entry;
+  uint8_t cost = link_cost(src);
+
+  memcpy(&beacon, payload, sizeof(I32CTT_802154RouteBeacon));
+  payload += sizeof(I32CTT_802154RouteBeacon);
+  size -= sizeof(I32CTT_802154RouteBeacon);
+
+  for(int i=0;i<beacon.count && size >= sizeof(I32CTT_802154RouteEntry);i++) {
+    memcpy(&entry, payload, sizeof(I32CTT_802154RouteEntry));
+    payload += sizeof(I32CTT_802154RouteEntry);
+    size -= sizeof(I32CTT_802154RouteEntry);
+    if(entry.next_hop == this->short_addr)
+      continue; // Split horizon
+    learn_route(entry.dst, src, entry.hops+1, entry.cost+cost);
+  }
+}
+
+uint8_t I32CTT_Arduino802154Interface::get_route_count() {
+  return ROUTE_TABLE_SIZE;
+}
+
+I32CTT_802154Route *I32CTT_Arduino802154Interface::get_route_at(uint8_t idx) {
+  if(idx >= ROUTE_TABLE_SIZE || !(this->routes[idx].flags & ROUTE_VALID))
+    return NULL;
+  return &this->routes[idx];
+}
+
+uint16_t I32CTT_Arduino802154Interface::get_mesh_forwarded() {
+  return this->mesh_forwarded;
+}
+
+uint16_t I32CTT_Arduino802154Interface::get_mesh_dropped() {
+  return this->mesh_dropped;
+}
+
+/**
+ * \brief Registra un hijo dormilón (sleepy). Las tramas para el hijo no
+ *        se transmiten de inmediato, se retienen hasta que el hijo las
+ *        solicita con un data request al despertar (entrega indirecta).
+ * \param addr Dirección corta del hijo.
+ * \return true si había espacio en la tabla de hijos.
+ */
+uint8_t I32CTT_Arduino802154Interface::add_sleepy_child(uint16_t addr) {
+  if(find_child(addr) != NULL)
+    return true;
+  for(int i=0;i<CHILD_TABLE_SIZE;i++) {
+    if(!(this->children[i].flags & CHILD_VALID)) {
+      memset(&this->children[i], 0, sizeof(I32CTT_802154Child));
+      this->children[i].addr = addr;
+      this->children[i].flags = CHILD_VALID;
+      return true;
+    }
+  }
+  return false;
+}
+
+I32CTT_802154Child *I32CTT_Arduino802154Interface::find_child(uint16_t addr) {
+  for(int i=0;i<CHILD_TABLE_SIZE;i++) {
+    if((this->children[i].flags & CHILD_VALID) && this->children[i].addr == addr)
+      return &this->children[i];
+  }
+  return NULL;
+}
+
+/**
+ * \brief Retiene la trama armada en tx_frame para un hijo dormido.
+ *        La trama pasa al hijo sin copiarse: tx_frame se intercambia por
+ *        una trama libre del pool con la misma cabecera.
+ */
+void I32CTT_Arduino802154Interface::hold_for_child(I32CTT_802154Child *child) {
+  uint8_t *frame = detach_tx_frame();
+
+  if(frame == NULL) {
+    this->indirect_dropped++;
+    this->tx_size = 0;
+    return;
+  }
+  if(child->pending != NULL) {
+    // Only the newest answer is kept per child
+    release_frame(child->pending);
+    this->indirect_dropped++;
+  }
+
+  child->pending = frame;
+  child->queued_at = millis();
+  update_pending_bit();
+}
+
+/**
+ * \brief Separa la trama armada en tx_frame sin copiarla: tx_frame pasa a
+ *        ser una trama libre del pool con la misma cabecera y tx_buffer
+ *        queda libre para el siguiente mensaje.
+ * \return La trama armada o NULL si el pool está vacío.
+ */
+uint8_t *I32CTT_Arduino802154Interface::detach_tx_frame() {
+  uint8_t *frame = alloc_frame();
+  uint8_t *detached = this->tx_frame;
+
+  if(frame == NULL)
+    return NULL;
+
+  this->tx_frame = frame;
+  memcpy(this->tx_frame+1, detached+1, FB_PAYLOAD_OFFSET-1);
+  update_buffers();
+  this->tx_size = 0;
+  return detached;
+}
+
+/**
+ * \brief Atiende un data request de un hijo: encola la trama retenida o,
+ *        si el ACK salió con frame pending para otro hijo, una trama vacía
+ *        para que el hijo no espere en vano.
+ */
+void I32CTT_Arduino802154Interface::handle_data_request(uint16_t src, uint8_t seq) {
+  I32CTT_802154Child *child = find_child(src);
+  uint8_t *frame;
+
+  if(child == NULL)
+    return;
+  if((child->flags & CHILD_POLL_SEQ_VALID) && child->poll_seq == seq)
+    return; // ARET retry of a poll already served
+  child->flags |= CHILD_POLL_SEQ_VALID;
+  child->poll_seq = seq;
+  child->polls++;
+  child->last_poll = millis();
+
+  if(child->pending != NULL) {
+    if(queue_frame(child->pending))
+      child->pending = NULL;
+  } else if(this->pending_bit) {
+    // The transceiver has a single pending bit for every child
+    frame = prepare_frame(DATA, src);
+    if(frame != NULL) {
+      frame[0] = IEEE_802154_HEADER_SIZE+IEEE_802154_FCS_SIZE;
+      if(!queue_frame(frame))
+        release_frame(frame);
+    }
+  }
+  update_pending_bit();
+}
+
+/**
+ * \brief Descarta las tramas retenidas que el hijo no pidió a tiempo.
+ */
+void I32CTT_Arduino802154Interface::expire_indirect() {
+  uint8_t changed = false;
+
+  for(int i=0;i<CHILD_TABLE_SIZE;i++) {
+    if(
+      this->children[i].pending != NULL &&
+      (millis()-this->children[i].queued_at) > INDIRECT_TIMEOUT
+    ) {
+      release_frame(this->children[i].pending);
+      this->children[i].pending = NULL;
+      this->children[i].expired++;
+      changed = true;
+    }
+  }
+  if(changed)
+    update_pending_bit();
+}
+
+/**
+ * \brief Activa el bit frame pending de los ACK a data requests mientras
+ *        haya alguna trama retenida.
+ */
+void I32CTT_Arduino802154Interface::update_pending_bit() {
+  uint8_t pending = false;
+  uint8_t csma_seed_1;
+
+  for(int i=0;i<CHILD_TABLE_SIZE;i++) {
+    if(this->children[i].pending != NULL)
+      pending = true;
+  }
+  if(pending == this->pending_bit || !this->radio_enabled)
+    return;
+
+  this->pending_bit = pending;
+  csma_seed_1 = reg_read(CSMA_SEED_1);
+  if(pending)
+    csma_seed_1 |= AACK_SET_PD;
+  else
+    csma_seed_1 &= ~AACK_SET_PD;
+  reg_write(CSMA_SEED_1, csma_seed_1);
+}
+
+/**
+ * \brief Toma una trama del pool con la cabecera MAC de tx_frame, el tipo
+ *        de trama, un número de secuencia nuevo y el destino indicados.
+ * \return La trama o NULL si el pool está vacío.
+ */
+uint8_t *I32CTT_Arduino802154Interface::prepare_frame(IEEE_802154_FRAME_TYPE type, uint16_t dst) {
+  IEEE_802154_FRAME_FCF fcf;
+  uint8_t *frame = alloc_frame();
+
+  if(frame == NULL)
+    return NULL;
+
+  memcpy(frame+1, this->tx_frame+1, IEEE_802154_HEADER_SIZE);
+  memcpy(&fcf, frame+1, sizeof(IEEE_802154_FRAME_FCF));
+  fcf.frame_type = type;
+  memcpy(frame+1, &fcf, sizeof(IEEE_802154_FRAME_FCF));
+  frame[FB_SEQ_OFFSET] = ++seq_num;
+  memcpy(frame+FB_DST_ADDR_OFFSET, &dst, sizeof(uint16_t));
+  return frame;
+}
+
+uint8_t I32CTT_Arduino802154Interface::get_child_count() {
+  return CHILD_TABLE_SIZE;
+}
+
+I32CTT_802154Child *I32CTT_Arduino802154Interface::get_child_at(uint8_t idx) {
+  if(idx >= CHILD_TABLE_SIZE || !(this->children[idx].flags & CHILD_VALID))
+    return NULL;
+  return &this->children[idx];
+}
+
+uint16_t I32CTT_Arduino802154Interface::get_indirect_dropped() {
+  return this->indirect_dropped;
+}
+
+/**
+ * \brief Convierte al nodo en un hijo dormilón. El transceptor pasa en
+ *        SLEEP la mayor parte del tiempo, despierta cada poll_interval
+ *        para pedirle al padre sus tramas pendientes (data request) y
+ *        escucha solo si el ACK trae el bit frame pending. Si la
+ *        aplicación tiene algo que enviar también despierta.
+ * \param parent Dirección corta del padre (el maestro).
+ * \param poll_interval ms entre data requests, 0 deshabilita el modo.
+ */
+void I32CTT_Arduino802154Interface::set_sleepy(uint16_t parent, uint16_t poll_interval) {
+  this->parent_addr = parent;
+  this->poll_interval = poll_interval;
+  this->sleepy_received = false;
+  // Spread the polls of children powered up together
+  this->last_wake = millis()-poll_interval+
+    (this->short_addr & 0x0F)*(poll_interval/16);
+  this->listen_until = millis();
+  this->wake_at = micros();
+  this->sleepy_state = poll_interval == 0 ? SLEEPY_OFF : SLEEPY_LISTENING;
+}
+
+I32CTT_802154SleepStats *I32CTT_Arduino802154Interface::get_sleep_stats() {
+  return &this->sleep_stats;
+}
+
+/**
+ * \brief Ciclo de trabajo del hijo dormilón.
+ * \return false si el transceptor está dormido y update() no debe
+ *         tocarlo.
+ */
+uint8_t I32CTT_Arduino802154Interface::sleepy_update() {
+  uint8_t *frame;
+
+  if(!this->radio_enabled)
+    return true;
+
+  switch(this->sleepy_state) {
+    case SLEEPY_ASLEEP:
+      if((millis()-this->last_wake) >= this->poll_interval) {
+        wake_radio();
+        frame = prepare_frame(MAC_CMD, this->parent_addr);
+        if(frame != NULL) {
+          frame[FB_PAYLOAD_OFFSET] = IEEE_802154_DATA_REQUEST;
+          frame[0] = IEEE_802154_HEADER_SIZE+1+IEEE_802154_FCS_SIZE;
+          if(queue_frame(frame)) {
+            this->sleepy_state = SLEEPY_POLLING;
+            this->sleep_stats.polls++;
+            return true;
+          }
+          release_frame(frame);
         }
-        reg_read(IRQ_STATUS); // Clear interrupt status
+        this->sleepy_state = SLEEPY_LISTENING;
+        this->listen_until = millis();
+      } else if(this->tx_size > 0 || this->tx_queue_count > 0) {
+        wake_radio(); // Something to send before the next poll
+        this->sleepy_state = SLEEPY_LISTENING;
+        this->listen_until = millis();
+      } else {
+        return false;
+      }
+      break;
+    case SLEEPY_LISTENING:
+      if(
+        this->package_queued || this->tx_queue_count > 0 || this->tx_size > 0 ||
+        this->agg_frame != NULL || this->agg_rx_frame != NULL
+      )
+        break; // Stay awake until everything is sent
+      if(this->sleepy_received || (int32_t)(millis()-this->listen_until) >= 0) {
+        sleep_radio();
+        return false;
       }
       break;
   }
+  return true;
+}
+
+void I32CTT_Arduino802154Interface::wake_radio() {
+  uint32_t start = micros();
+
+  digitalWrite(slp_tx_pin, LOW);
+  // SLEEP to TRX_OFF takes a few hundred us, wait_for_state() counts in ms
+  while(
+    (reg_read(TRX_STATUS) & TRX_STATE_MSK) != TRX_OFF_S &&
+    (micros()-start) < SLEEPY_WAKEUP_TIMEOUT
+  );
+
+  this->wake_at = micros();
+  this->last_wake = millis();
+  this->sleepy_received = false;
+  this->sleep_stats.wakeups++;
+  request_state(RX_AACK_ON);
+}
+
+void I32CTT_Arduino802154Interface::sleep_radio() {
+  request_state(TRX_OFF);
+  digitalWrite(slp_tx_pin, HIGH);
+  this->sleep_stats.awake_time += micros()-this->wake_at;
+  this->sleepy_state = SLEEPY_ASLEEP;
+}
+
+/**
+ * \brief Define los canales en que se reparten los nodos. Un nodo sin
+ *        canal propio (set_home_channel) tiene como canal de casa el
+ *        canal número (addr % canales) de la máscara, así maestro y
+ *        esclavos calculan la misma asignación sin intercambiar nada.
+ * \param mask Bit n para el canal C2405+n, 0 para no repartir.
+ */
+void I32CTT_Arduino802154Interface::set_channel_mask(uint16_t mask) {
+  this->channel_mask = mask;
+}
+
+/**
+ * \brief Asigna explícitamente el canal de casa de un nodo.
+ * \return true si había espacio en la tabla.
+ */
+uint8_t I32CTT_Arduino802154Interface::set_home_channel(uint16_t addr, IEEE_802154_CHANNEL channel) {
+  I32CTT_802154HomeChannel *free_entry = NULL;
+
+  for(int i=0;i<HOME_CHANNEL_TABLE_SIZE;i++) {
+    if(this->home_channels[i].channel != 0 && this->home_channels[i].addr == addr) {
+      this->home_channels[i].channel = channel;
+      return true;
+    }
+    if(this->home_channels[i].channel == 0 && free_entry == NULL)
+      free_entry = &this->home_channels[i];
+  }
+  if(free_entry == NULL)
+    return false;
+  free_entry->addr = addr;
+  free_entry->channel = channel;
+  return true;
+}
+
+/**
+ * \brief Canal de casa de un nodo. Sin asignación explícita ni máscara
+ *        es el canal actual, los broadcast también salen en el canal
+ *        actual.
+ */
+IEEE_802154_CHANNEL I32CTT_Arduino802154Interface::get_home_channel(uint16_t addr) {
+  uint8_t count = 0;
+  uint8_t pick;
+
+  if(addr == IEEE_802154_BROADCAST)
+    return (IEEE_802154_CHANNEL)this->channel;
+
+  for(int i=0;i<HOME_CHANNEL_TABLE_SIZE;i++) {
+    if(this->home_channels[i].channel != 0 && this->home_channels[i].addr == addr)
+      return (IEEE_802154_CHANNEL)this->home_channels[i].channel;
+  }
+
+  for(int i=0;i<CHANNEL_COUNT;i++) {
+    if(this->channel_mask & (1<<i))
+      count++;
+  }
+  if(count == 0)
+    return (IEEE_802154_CHANNEL)this->channel;
+
+  pick = addr%count;
+  for(int i=0;i<CHANNEL_COUNT;i++) {
+    if(!(this->channel_mask & (1<<i)))
+      continue;
+    if(pick-- == 0)
+      return (IEEE_802154_CHANNEL)(C2405+i);
+  }
+  return (IEEE_802154_CHANNEL)this->channel;
+}
+
+/**
+ * \brief Habilita el planificador de canales del maestro. Las tramas
+ *        para nodos de otro canal se retienen y se envían en ráfaga al
+ *        sintonizar ese canal, el radio cambia de canal solo cuando el
+ *        canal actual queda sin tráfico por CHANNEL_DWELL_TIME, así el
+ *        tiempo de asentamiento del PLL se paga una vez por ráfaga.
+ * \param value true para habilitar.
+ */
+void I32CTT_Arduino802154Interface::set_channel_hopping(uint8_t value) {
+  this->channel_hopping = value;
+}
+
+I32CTT_802154ChannelStats *I32CTT_Arduino802154Interface::get_channel_stats(IEEE_802154_CHANNEL channel) {
+  if(channel < C2405 || channel > C2480)
+    return NULL;
+  if(channel == this->channel) {
+    // Account the visit in progress
+    this->channel_stats[channel-C2405].dwell_time += micros()-this->channel_since;
+    this->channel_since = micros();
+  }
+  return &this->channel_stats[channel-C2405];
+}
+
+uint16_t I32CTT_Arduino802154Interface::get_retunes() {
+  return this->retunes;
+}
+
+uint32_t I32CTT_Arduino802154Interface::get_retune_time() {
+  return this->retune_time;
+}
+
+void I32CTT_Arduino802154Interface::clear_channel_stats() {
+  memset(this->channel_stats, 0, sizeof(I32CTT_802154ChannelStats)*CHANNEL_COUNT);
+  this->retunes = 0;
+  this->retune_time = 0;
+  this->held_dropped = 0;
+  this->channel_since = micros();
+}
+
+/**
+ * \brief Tramas para otro canal descartadas porque el pool estaba lleno.
+ */
+uint16_t I32CTT_Arduino802154Interface::get_held_dropped() {
+  return this->held_dropped;
+}
+
+/**
+ * \brief Tramas libres en el pool. Con el planificador de canales o hijos
+ *        dormilones un envío sin tramas libres se descarta y se cuenta.
+ */
+uint8_t I32CTT_Arduino802154Interface::get_free_frames() {
+  return this->free_count;
+}
+
+void I32CTT_Arduino802154Interface::write_channel() {
+  uint8_t phy_cc_cca = reg_read(PHY_CC_CCA);
+  phy_cc_cca  = this->channel | (phy_cc_cca & PHY_CC_CCA_CHANNEL_MSK);
+  reg_write(PHY_CC_CCA, phy_cc_cca);
+}
+
+/**
+ * \brief Cambia de canal sin salir de RX_AACK_ON. Mientras el PLL se
+ *        asienta el radio no recibe ni transmite.
+ */
+void I32CTT_Arduino802154Interface::tune(uint8_t channel) {
+  uint32_t start = micros();
+
+  this->channel_stats[this->channel-C2405].dwell_time += start-this->channel_since;
+  this->channel = channel;
+  write_channel();
+  delayMicroseconds(CHANNEL_SWITCH_TIME);
+
+  this->retunes++;
+  this->retune_time += micros()-start;
+  this->channel_stats[channel-C2405].visits++;
+  this->channel_since = micros();
+  this->channel_active = millis();
+}
+
+/**
+ * \brief Retiene la trama armada en tx_frame hasta sintonizar su canal.
+ *        Si el pool está vacío la trama se descarta, igual que hacia un
+ *        hijo dormilón, así quien envía nunca espera a que pase una
+ *        ráfaga.
+ * \return false si se descartó.
+ */
+uint8_t I32CTT_Arduino802154Interface::hold_for_channel(uint8_t channel) {
+  uint8_t *frame = detach_tx_frame();
+
+  if(frame == NULL) {
+    this->held_dropped++;
+    this->tx_size = 0;
+    return false;
+  }
+  this->held[this->held_count] = frame;
+  this->held_channel[this->held_count] = channel;
+  this->held_count++;
+  return true;
+}
+
+/**
+ * \brief Sintoniza el canal con más tramas retenidas (el de la más
+ *        antigua en caso de empate) y pasa sus tramas a la cola de
+ *        transmisión.
+ */
+void I32CTT_Arduino802154Interface::schedule_channel() {
+  uint8_t best = this->held_channel[0];
+  uint8_t best_count = 0;
+  uint8_t count;
+  uint8_t kept = 0;
+
+  for(int i=0;i<this->held_count;i++) {
+    count = 0;
+    for(int j=0;j<this->held_count;j++) {
+      if(this->held_channel[j] == this->held_channel[i])
+        count++;
+    }
+    if(count > best_count) {
+      best = this->held_channel[i];
+      best_count = count;
+    }
+  }
+
+  if(best != this->channel)
+    tune(best);
+
+  for(int i=0;i<this->held_count;i++) {
+    if(this->held_channel[i] == best && queue_frame(this->held[i]))
+      continue;
+    this->held[kept] = this->held[i];
+    this->held_channel[kept] = this->held_channel[i];
+    kept++;
+  }
+  this->held_count = kept;
 }
 
 uint8_t I32CTT_Arduino802154Interface::available() {
@@ -804,7 +2251,9 @@ uint8_t I32CTT_Arduino802154Interface::data_available() {
 
 void I32CTT_Arduino802154Interface::send() {
   if(this->last_addr != 0) {
-    this->send_to_addr(this->last_addr);
+    this->answer_addr = this->last_addr; // The retry goes there even if another node is heard meanwhile
+    this->send_to_addr(this->answer_addr);
+    this->answer_pending = (this->tx_size > 0 && !this->package_queued);
   } else {
     // Here to prevent locks and
     // broadcast responses
@@ -814,80 +2263,330 @@ void I32CTT_Arduino802154Interface::send() {
 }
 
 void I32CTT_Arduino802154Interface::send_to_dst() {
-  this->send_to_addr(this->dst_addr);
+  if(this->streaming)
+    this->stream_to_addr(this->dst_addr);
+  else
+    this->send_to_addr(this->dst_addr);
+}
+
+/**
+ * \brief Habilita el modo de transmisión continua (streaming): los
+ *        mensajes de send_to_dst() salen sin ACK ni reintentos, para
+ *        telemetría de alta tasa que tolera pérdidas. Las respuestas
+ *        (send()) siempre usan ACK.
+ * \param value true para habilitar.
+ */
+void I32CTT_Arduino802154Interface::set_streaming(uint8_t value) {
+  this->streaming = value;
 }
 
+/**
+ * \brief Envía tx_buffer sin ACK ni reintentos. La trama se separa al
+ *        pool y se encola sin esperar el fin de la transmisión anterior,
+ *        la cola se transmite seguida sin volver a RX_AACK_ON entre
+ *        tramas. El número de secuencia es propio de cada destino para
+ *        que el receptor cuente las tramas perdidas por los saltos.
+ *        Sin tramas libres tx_buffer queda intacto para reintentar.
+ *        En modo malla, hacia hijos dormilones o a otro canal se envía
+ *        con ACK como siempre.
+ * \param addr Dirección corta del destino.
+ */
+void I32CTT_Arduino802154Interface::stream_to_addr(uint16_t addr) {
+  IEEE_802154_FRAME_FCF fcf;
+  uint8_t *frame;
+  uint8_t size;
+
+  update();
+
+  if(this->tx_size == 0)
+    return; // Nothing to do.
+
+  if(
+    this->mesh || find_child(addr) != NULL ||
+    (this->channel_hopping && get_home_channel(addr) != this->channel)
+  ) {
+    send_to_addr(addr);
+    return;
+  }
+
+  size = this->tx_size;
+  frame = detach_tx_frame();
+  if(frame == NULL)
+    return; // Pool full, the queue is still draining
+
+  memcpy(&fcf, frame+1, sizeof(IEEE_802154_FRAME_FCF));
+  fcf.ack_request = ACK_DISABLED;
+  memcpy(frame+1, &fcf, sizeof(IEEE_802154_FRAME_FCF));
+  frame[FB_SEQ_OFFSET] = addr != IEEE_802154_BROADCAST ? next_stream_seq(addr) : ++seq_num;
+  memcpy(frame+FB_DST_ADDR_OFFSET, &addr, sizeof(uint16_t));
+  frame[0] = IEEE_802154_HEADER_SIZE+size+IEEE_802154_FCS_SIZE;
+  queue_frame(frame); // Never full, it is as large as the pool
+
+  if(this->tx_queue_count > 0 && !this->package_queued && this->current_state == RX_AACK_ON_S)
+    send_queued();
+}
+
+/**
+ * \brief Porcentaje de tramas sin ACK recibidas de un nodo según los
+ *        saltos de secuencia, 100 si aún no hay datos.
+ * \param addr Dirección corta del nodo.
+ */
+uint8_t I32CTT_Arduino802154Interface::stream_delivery(uint16_t addr) {
+  I32CTT_802154Peer *peer = find_peer(addr);
+  uint32_t total;
+
+  if(peer == NULL)
+    return 100;
+  total = (uint32_t)peer->stats.stream_rx+peer->stats.stream_lost;
+  if(total == 0)
+    return 100;
+  return (uint32_t)peer->stats.stream_rx*100/total;
+}
+
+/**
+ * \brief Habilita la agregación a nivel MAC: los mensajes hacia un mismo
+ *        nodo se empacan en una sola trama (CMD_AGG) con su largo como
+ *        prefijo, hasta llenar la trama o hasta que pasa el tiempo de
+ *        espera desde el primero. Reduce la cabecera, el ACK y la
+ *        contención por mensaje. Un mensaje solo sale sin contenedor.
+ *        Las tramas agregadas se desempacan al recibir con o sin la
+ *        agregación habilitada. No aplica en modo malla, hacia hijos
+ *        dormilones ni a otros canales.
+ * \param hold_time ms que un mensaje espera a los siguientes
+ *        (AGGREGATION_HOLD_TIME sugerido), 0 deshabilita.
+ */
+void I32CTT_Arduino802154Interface::set_aggregation(uint8_t hold_time) {
+  this->agg_hold = hold_time;
+  if(hold_time == 0)
+    flush_aggregate();
+}
+
+I32CTT_802154AggStats *I32CTT_Arduino802154Interface::get_aggregation_stats() {
+  return &this->agg_stats;
+}
+
+/**
+ * \brief Agrega tx_buffer al contenedor para addr. Un contenedor para
+ *        otro destino o sin espacio se envía antes de empezar uno nuevo.
+ *        Sin tramas libres tx_buffer queda intacto para reintentar.
+ */
+void I32CTT_Arduino802154Interface::aggregate(uint16_t addr) {
+  uint8_t *message;
+
+  if(
+    this->agg_frame != NULL &&
+    (this->agg_dst != addr || this->agg_size+1+this->tx_size > IEEE_802154_MTU)
+  )
+    flush_aggregate();
+
+  if(this->agg_frame == NULL) {
+    this->agg_frame = prepare_frame(DATA, addr);
+    if(this->agg_frame == NULL)
+      return; // Pool full, the queue is still draining
+    this->agg_frame[FB_PAYLOAD_OFFSET] = CMD_AGG;
+    this->agg_dst = addr;
+    this->agg_size = 1;
+    this->agg_count = 0;
+    this->agg_since = millis();
+  }
+
+  message = this->agg_frame+FB_PAYLOAD_OFFSET+this->agg_size;
+  message[0] = this->tx_size;
+  memcpy(message+1, this->tx_buffer, this->tx_size);
+  this->agg_size += 1+this->tx_size;
+  this->agg_count++;
+  this->tx_size = 0;
+
+  if(this->agg_size+1+sizeof(I32CTT_Header) > IEEE_802154_MTU)
+    flush_aggregate(); // No room for another message
+}
+
+/**
+ * \brief Cierra el contenedor y lo pasa a la cola de transmisión. Se
+ *        guarda como respuesta del nodo por si repite su petición.
+ */
+void I32CTT_Arduino802154Interface::flush_aggregate() {
+  I32CTT_802154Peer *peer;
+  uint8_t *frame = this->agg_frame;
+  uint8_t *payload;
+
+  if(frame == NULL)
+    return;
+  this->agg_frame = NULL;
+
+  payload = frame+FB_PAYLOAD_OFFSET;
+  if(this->agg_count == 1) {
+    // A lone message goes out bare, the container would only add 2 bytes
+    this->agg_size -= 2;
+    memmove(payload, payload+2, this->agg_size);
+  } else {
+    this->agg_stats.tx_frames++;
+    this->agg_stats.tx_messages += this->agg_count;
+  }
+  frame[0] = IEEE_802154_HEADER_SIZE+this->agg_size+IEEE_802154_FCS_SIZE;
+
+  peer = find_peer(this->agg_dst);
+  if(peer != NULL && (peer->flags & PEER_AWAITING_ANSWER)) {
+    memcpy(peer->answer, frame, frame[0]+1-IEEE_802154_FCS_SIZE);
+    peer->flags &= ~PEER_AWAITING_ANSWER;
+  }
+
+  queue_frame(frame); // Never full, it is as large as the pool
+  if(!this->package_queued && this->current_state == RX_AACK_ON_S)
+    send_queued();
+}
+
+/**
+ * \brief Empieza a desempacar el contenedor recibido en rx_buffer. La
+ *        trama se separa de rx_frame para que las siguientes recepciones
+ *        no la sobrescriban, y sus mensajes se entregan al controlador uno
+ *        por update() como si hubieran llegado en tramas separadas.
+ */
+void I32CTT_Arduino802154Interface::unpack_aggregate(uint16_t src) {
+  uint8_t *frame;
+
+  this->d_available = false;
+  if(this->agg_rx_frame != NULL) {
+    // The previous container was not parsed yet, the rest of it is lost
+    release_frame(this->agg_rx_frame);
+    this->agg_rx_frame = NULL;
+    this->agg_stats.rx_dropped++;
+  }
+
+  frame = alloc_frame();
+  if(frame == NULL) {
+    this->agg_stats.rx_dropped++;
+    return;
+  }
+
+  this->agg_rx_frame = this->rx_frame;
+  this->rx_frame = frame;
+  this->agg_rx_next = this->rx_buffer+1-this->agg_rx_frame;
+  this->agg_rx_end = this->rx_buffer+this->rx_size-this->agg_rx_frame;
+  this->agg_rx_src = src;
+  this->agg_stats.rx_frames++;
+  next_aggregated();
+}
+
+/**
+ * \brief Entrega el siguiente mensaje del contenedor recibido cuando el
+ *        controlador ya leyó el anterior y su respuesta dejó tx_buffer.
+ *        Al terminar libera la trama y envía sin esperar las respuestas
+ *        agregadas para el mismo nodo.
+ */
+void I32CTT_Arduino802154Interface::next_aggregated() {
+  uint8_t *message;
+  uint8_t len;
+
+  if(this->agg_rx_frame == NULL || this->d_available || this->tx_size > 0)
+    return;
+
+  message = this->agg_rx_frame+this->agg_rx_next;
+  len = message[0];
+  if(
+    this->agg_rx_next >= this->agg_rx_end || len == 0 ||
+    len >= this->agg_rx_end-this->agg_rx_next
+  ) {
+    // Done, a malformed tail is ignored
+    release_frame(this->agg_rx_frame);
+    this->agg_rx_frame = NULL;
+    update_buffers();
+    if(this->agg_frame != NULL && this->agg_dst == this->agg_rx_src)
+      flush_aggregate();
+    return;
+  }
+
+  this->agg_rx_next += 1+len;
+  this->rx_buffer = message+1;
+  this->rx_size = len;
+  this->last_addr = this->agg_rx_src;
+  this->d_available = true;
+  this->agg_stats.rx_messages++;
+}
 
 void I32CTT_Arduino802154Interface::send_to_addr(uint16_t addr) {
-  char str_fmt[3];
+  I32CTT_802154Peer *peer;
+  I32CTT_802154MeshHeader mesh;
+  I32CTT_802154Route *route;
+  I32CTT_802154Child *child;
+  uint16_t next_hop = addr;
+  uint8_t mesh_size = 0;
   update(); // try to update before send.
-  
-  uint8_t frame_pos;
+
   if(this->tx_size == 0)
     return; // Nothing to do.
 
-  if(available()) {
-    frame_pos = 0;
+  if(
+    this->agg_hold && !this->mesh && find_child(addr) == NULL &&
+    !(this->channel_hopping && get_home_channel(addr) != this->channel) &&
+    this->tx_size+2 <= IEEE_802154_MTU
+  ) {
+    aggregate(addr); // Sent with the next messages to addr, or on its own after agg_hold
+    return;
+  }
 
+  if(available()) {
     seq_num++;
 
-    IEEE_802154_FRAME_FCF fcf;
-
-    fcf.frame_type = DATA;
-    fcf.sec_enabled = SEC_DISABLED;
-    fcf.frame_pending = NOT_PENDING_FRAME;
-    fcf.ack_request = ACK_ENABLED;
-    fcf.pan_id_comp = PAN_ID_COMPRESSION;
-    fcf.res_0 = 0x000;
-    fcf.dst_addr_mode = SHORT_ADDR;
-    fcf.frame_ver = IEEE_802154_2006;
-    fcf.src_addr_mode = SHORT_ADDR;
-
-    request_state(TX_ARET_ON);
-
-    frame_pos += sizeof(uint8_t); // Space for PHR
-
-    memcpy(frame_buffer+frame_pos, &fcf, sizeof(IEEE_802154_FRAME_FCF));
-    frame_pos += sizeof(IEEE_802154_FRAME_FCF); // FCF
-
-    memcpy(frame_buffer+frame_pos, &seq_num, sizeof(uint8_t));
-    frame_pos += sizeof(uint8_t); // Sequence Number
-
-    memcpy(frame_buffer+frame_pos, &pan_id, sizeof(uint16_t));
-    frame_pos += sizeof(uint16_t); // Destination PAN ID
-    memcpy(frame_buffer+frame_pos, &addr, sizeof(uint16_t));
-    frame_pos += sizeof(uint16_t); // Destination short address
-    memcpy(frame_buffer+frame_pos, &short_addr, sizeof(uint16_t));
-    frame_pos += sizeof(uint16_t); // Source short address
-
-    memcpy(frame_buffer+frame_pos, this->tx_buffer, this->tx_size);
-    frame_pos += this->tx_size;
-    memset(frame_buffer+frame_pos, 0, sizeof(uint16_t));
-    frame_pos += sizeof(uint16_t);
-
-    this->frame_buffer[0] = frame_pos-1; // Set PHR size
-    Serial.println("BEGIN: Buffer sizes");
-    Serial.println(this->frame_buffer[0], DEC);
-    Serial.println(this->tx_size, DEC);
-    Serial.println("END: Buffer sizes");
-
-    for(int i=1;i<(this->frame_buffer[0]+1);i++) {
-      sprintf(str_fmt, "%02x", this->frame_buffer[i]);
-      Serial.print(str_fmt);
-      Serial.print(":");
+    if(this->mesh) {
+      // tx_buffer already leaves room for the mesh header
+      mesh.cmd = CMD_MESH;
+      mesh.hops = 0;
+      mesh.cost = 0;
+      mesh.origin = this->short_addr;
+      mesh.dst = addr;
+      memcpy(this->tx_frame+FB_PAYLOAD_OFFSET, &mesh, sizeof(I32CTT_802154MeshHeader));
+      mesh_size = sizeof(I32CTT_802154MeshHeader);
+
+      route = find_route(addr);
+      if(route != NULL) {
+        next_hop = route->next_hop;
+        route->sent_at = micros() | 1; // 0 means no request pending
+      }
+    }
+
+    // Header is preformatted, patch only sequence number and destination
+    this->tx_frame[FB_SEQ_OFFSET] = seq_num;
+    memcpy(this->tx_frame+FB_DST_ADDR_OFFSET, &next_hop, sizeof(uint16_t));
+
+    // Set PHR size
+    this->tx_frame[0] = IEEE_802154_HEADER_SIZE+mesh_size+this->tx_size+IEEE_802154_FCS_SIZE;
+
+    child = find_child(next_hop);
+    if(child != NULL) {
+      hold_for_child(child); // Sleeping child, wait for its data request
+      return;
+    }
+
+    if(this->channel_hopping && get_home_channel(next_hop) != this->channel) {
+      // Batched with the rest of the channel's traffic, dropped and
+      // counted if the pool is full.
+      hold_for_channel(get_home_channel(next_hop));
+      return;
+    }
+
+    if(!request_state(TX_ARET_ON))
+      return; // A reception just started, tx_buffer is kept for a retry
+
+    // Keep the answer around in case the request is retried
+    peer = find_peer(next_hop);
+    if(peer != NULL && (peer->flags & PEER_AWAITING_ANSWER)) {
+      memcpy(peer->answer, this->tx_frame, this->tx_frame[0]+1-IEEE_802154_FCS_SIZE);
+      peer->flags &= ~PEER_AWAITING_ANSWER;
     }
-    Serial.print("\r\n");
 
-    Serial.print("Sequence: ");
-    Serial.println(seq_num, DEC);
     this->last_try = millis();
     this->package_queued = true;
-    fb_write(this->frame_buffer);
+    this->tx_peer_addr = next_hop;
+    this->tx_phr = this->tx_frame[0];
+    this->tx_acked = true;
+    fb_write(this->tx_frame);
     request_state(TX_START);
   }
 }
 
 uint16_t I32CTT_Arduino802154Interface::get_MTU() {
-  // Do nothing
+  if(this->mesh)
+    return IEEE_802154_MTU-sizeof(I32CTT_802154MeshHeader);
   return IEEE_802154_MTU;
 }
@@ -23,6 +23,57 @@
 #define IEEE_802154_MTU 116
 #define PSDU_SIZE 127
 #define TX_POLL_TIMEOUT 59
+#define CAPTURE_QUEUE_SIZE 4
+#ifndef PEER_TABLE_SIZE
+#define PEER_TABLE_SIZE 4
+#endif
+#define DEDUP_WINDOW 500 // ms a sequence number is remembered per source
+#ifndef DEDUP_TABLE_SIZE
+#define DEDUP_TABLE_SIZE 16 // Sources whose last sequence number is kept
+#endif
+#ifndef STREAM_TABLE_SIZE
+#define STREAM_TABLE_SIZE 8 // Destinations with their own stream sequence
+#endif
+
+#ifndef FRAME_POOL_SIZE
+#define FRAME_POOL_SIZE 4 // Frames for forwarding and beacons
+#endif
+#ifndef ROUTE_TABLE_SIZE
+#define ROUTE_TABLE_SIZE 8
+#endif
+#define MESH_MAX_HOPS        8
+#define MESH_BEACON_INTERVAL 2000 // ms
+#define MESH_ROUTE_TIMEOUT   7000 // ms without refresh before a route expires
+#define MESH_COST_MAX        0xFE
+#ifndef CHILD_TABLE_SIZE
+#define CHILD_TABLE_SIZE 4 // Sleepy children served with indirect delivery
+#endif
+#define INDIRECT_TIMEOUT  7680 // ms a frame waits for its sleepy child
+#define SLEEPY_RX_WINDOW  20   // ms a child listens after a frame pending ACK
+#define SLEEPY_WAKEUP_TIMEOUT 1000 // us, SLEEP to TRX_OFF takes ~240 us
+#ifndef HOME_CHANNEL_TABLE_SIZE
+#define HOME_CHANNEL_TABLE_SIZE 16 // Nodes with an explicit home channel
+#endif
+#define CHANNEL_COUNT       16
+#define CHANNEL_SWITCH_TIME 24 // us, PLL settling after a PHY_CC_CCA write
+#define CHANNEL_DWELL_TIME  8  // ms on a channel after its last frame, for answers
+#define AGGREGATION_HOLD_TIME 2 // ms a message waits for others to the same node
+#define LINK_EWMA_SHIFT  3 // EWMA weight 1/8
+#define LINK_EWMA_FRAC   4 // Fractional bits kept in lqi/rssi averages
+#define BYTE_AIRTIME_US  32 // 250 kb/s O-QPSK
+#define SHR_PHR_SIZE     6
+#define ACK_PSDU_SIZE    5
+#define ARET_FRAME_RETRIES_SHIFT 4
+
+#define IEEE_802154_HEADER_SIZE 9 // FCF + Seq + PAN + Dst + Src (PAN ID compression)
+#define IEEE_802154_FCS_SIZE    2
+#define IEEE_802154_BROADCAST   0xFFFF
+#define IEEE_802154_DATA_REQUEST 0x04 // MAC command identifier
+#define FB_SEQ_OFFSET           3 // Offsets inside the frame buffer (PHR at 0)
+#define FB_DST_PAN_OFFSET       4
+#define FB_DST_ADDR_OFFSET      6
+#define FB_SRC_ADDR_OFFSET      8
+#define FB_PAYLOAD_OFFSET       10
 
 #ifndef SPI_H
 #include <SPI.h>
@@ -37,6 +88,15 @@
 #define PHY_MONITOR_PHY_RSSI   2<<2
 #define PHY_MONITOR_IRQ_STATUS 3<<2
 #define TX_AUTO_CRC_ON         1<<5
+#define RX_CRC_VALID           (1<<7)
+#define RSSI_BASE_VAL          -94
+
+#define AACK_PROM_MODE         (1<<1)
+#define AACK_UPLD_RES_FT       (1<<4)
+#define AACK_FLTR_RES_FT       (1<<5)
+#define AACK_SET_PD            (1<<5) // CSMA_SEED_1: frame pending in ACKs to data requests
+#define AACK_FVN_MODE_MSK      0xC0
+#define AACK_FVN_MODE_0_1      (1<<6)
 
 #define IRQ_POLLING_EN         1<<1
 
@@ -208,6 +268,161 @@ enum AT86RF233_REGISTERS {
   TST_SDM = 0x3D
 };
 
+struct I32CTT_802154Capture {
+  uint32_t timestamp;
+  uint8_t lqi;
+  int8_t rssi;
+  uint8_t crc_valid;
+  uint8_t frame[PSDU_SIZE+1]; // PHR + PSDU
+};
+
+enum I32CTT_802154_PEER_FLAGS {
+  PEER_VALID = 1,
+  PEER_AWAITING_ANSWER = 1<<1,
+  PEER_STREAM_SEQ_VALID = 1<<2
+};
+
+struct I32CTT_802154LinkStats {
+  uint16_t lqi;  // EWMA, LINK_EWMA_FRAC fractional bits
+  int16_t rssi;  // EWMA in dBm, LINK_EWMA_FRAC fractional bits
+  uint16_t rx_frames;
+  uint16_t tx_success;
+  uint16_t tx_no_ack;
+  uint16_t tx_channel_access_failure;
+  uint16_t tx_retries;
+  uint32_t tx_airtime; // us
+  uint32_t rx_airtime; // us
+  uint16_t stream_tx;   // Unacknowledged frames sent
+  uint16_t stream_rx;   // Unacknowledged frames received
+  uint16_t stream_lost; // Sequence gaps seen in the received stream
+};
+
+struct I32CTT_802154Peer {
+  uint16_t addr;
+  uint8_t flags;
+  uint8_t stream_rx_seq;
+  uint32_t last_rx;
+  I32CTT_802154LinkStats stats;
+  uint8_t answer[PSDU_SIZE+1]; // Last answer frame sent to this peer (PHR = 0 if none)
+};
+
+// Last sequence number heard from a source. Kept out of the peer table,
+// more senders than it holds would evict an entry between a frame and its
+// retry and the retry would run again.
+struct I32CTT_802154Dedup {
+  uint16_t addr;
+  uint8_t valid;
+  uint8_t seq;
+  uint32_t last_rx; // millis() of the last frame
+};
+
+// Sequence of the unacknowledged frames sent to one destination. Kept out
+// of the peer table, where a destination that never answers is the first
+// entry evicted and its sequence would restart mid stream.
+struct I32CTT_802154StreamSeq {
+  uint16_t addr;
+  uint8_t valid;
+  uint8_t seq;
+  uint32_t last_tx; // millis() of the last frame
+};
+
+enum I32CTT_802154_ROUTE_FLAGS {
+  ROUTE_VALID = 1
+};
+
+// Precedes the I32CTT payload of every frame in mesh mode
+struct __attribute__((__packed__)) I32CTT_802154MeshHeader {
+  uint8_t cmd;     // CMD_MESH
+  uint8_t hops;    // Hops travelled so far
+  uint8_t cost;    // Accumulated link cost
+  uint16_t origin;
+  uint16_t dst;
+};
+
+struct __attribute__((__packed__)) I32CTT_802154RouteBeacon {
+  uint8_t cmd;     // CMD_RTB
+  uint8_t count;   // I32CTT_802154RouteEntry records that follow
+};
+
+struct __attribute__((__packed__)) I32CTT_802154RouteEntry {
+  uint16_t dst;
+  uint16_t next_hop; // Lets receivers skip routes through themselves
+  uint8_t hops;
+  uint8_t cost;
+};
+
+struct I32CTT_802154Route {
+  uint16_t dst;
+  uint16_t next_hop;
+  uint8_t hops;
+  uint8_t cost;
+  uint8_t flags;
+  uint32_t updated;   // millis() of the last refresh
+  uint32_t sent_at;   // micros() of the last request to dst, 0 if none pending
+  uint32_t rtt;       // us, EWMA
+  uint16_t rtt_samples;
+  uint16_t forwarded; // Frames this node forwarded towards dst
+};
+
+enum I32CTT_802154_CHILD_FLAGS {
+  CHILD_VALID = 1,
+  CHILD_POLL_SEQ_VALID = 1<<1
+};
+
+// Parent side view of a sleepy child
+struct I32CTT_802154Child {
+  uint16_t addr;
+  uint8_t flags;
+  uint8_t poll_seq;
+  uint8_t *pending;     // Frame waiting for a data request, NULL if none
+  uint32_t queued_at;   // millis() when pending was queued
+  uint32_t last_poll;
+  uint16_t polls;
+  uint16_t delivered;
+  uint16_t expired;
+  uint32_t latency;     // ms frames waited for their data request, summed
+  uint32_t latency_max;
+};
+
+enum I32CTT_802154_SLEEPY_STATE {
+  SLEEPY_OFF = 0,
+  SLEEPY_ASLEEP,
+  SLEEPY_POLLING,
+  SLEEPY_LISTENING
+};
+
+struct I32CTT_802154HomeChannel {
+  uint16_t addr;
+  uint8_t channel; // 0 if the entry is free
+};
+
+// Per channel counters of the channel scheduler
+struct I32CTT_802154ChannelStats {
+  uint32_t dwell_time; // us tuned to the channel
+  uint32_t tx_airtime; // us
+  uint16_t tx_frames;
+  uint16_t rx_frames;
+  uint16_t visits;     // Retunes to the channel
+};
+
+// Child side duty cycle counters
+struct I32CTT_802154SleepStats {
+  uint32_t wakeups;
+  uint32_t polls;
+  uint32_t polls_pending; // Polls answered with the frame pending bit
+  uint32_t frames;        // Frames received from the parent
+  uint32_t awake_time;    // us with the transceiver on
+};
+
+// Counters of MAC level aggregation (CMD_AGG)
+struct I32CTT_802154AggStats {
+  uint16_t tx_frames;   // Containers sent
+  uint16_t tx_messages; // Messages sent inside containers
+  uint16_t rx_frames;
+  uint16_t rx_messages;
+  uint16_t rx_dropped;  // Messages of a container overrun by the next one
+};
+
 class I32CTT_Arduino802154Interface: public I32CTT_Interface {
   public:
     I32CTT_Arduino802154Interface();
@@ -217,16 +432,56 @@ class I32CTT_Arduino802154Interface: public I32CTT_Interface {
     void set_dst_addr(uint16_t short_addr);
     void set_channel(IEEE_802154_CHANNEL channel);
     void enable_pa(uint8_t value);
+    void set_promiscuous(uint8_t value);
+    uint8_t capture_available();
+    I32CTT_802154Capture *peek_capture();
+    void pop_capture();
+    uint16_t get_capture_dropped();
+    uint16_t get_dedup_hits();
+    uint16_t get_dedup_replays();
+    uint8_t get_peer_count();
+    I32CTT_802154Peer *get_peer_at(uint8_t idx);
+    uint8_t link_quality(uint16_t addr);
+    void clear_link_stats();
+    void set_mesh(uint8_t value);
+    uint8_t get_route_count();
+    I32CTT_802154Route *get_route_at(uint8_t idx);
+    uint16_t get_mesh_forwarded();
+    uint16_t get_mesh_dropped();
+    uint8_t add_sleepy_child(uint16_t addr);
+    uint8_t get_child_count();
+    I32CTT_802154Child *get_child_at(uint8_t idx);
+    uint16_t get_indirect_dropped();
+    void set_sleepy(uint16_t parent, uint16_t poll_interval);
+    I32CTT_802154SleepStats *get_sleep_stats();
+    void set_channel_mask(uint16_t mask);
+    uint8_t set_home_channel(uint16_t addr, IEEE_802154_CHANNEL channel);
+    IEEE_802154_CHANNEL get_home_channel(uint16_t addr);
+    void set_channel_hopping(uint8_t value);
+    I32CTT_802154ChannelStats *get_channel_stats(IEEE_802154_CHANNEL channel);
+    uint16_t get_retunes();
+    uint32_t get_retune_time();
+    void clear_channel_stats();
+    uint8_t get_free_frames();
+    uint16_t get_held_dropped();
     void init();
     void update();
     uint8_t available();
     uint8_t data_available();
     void send();
     void send_to_dst();
+    void set_dst(uint16_t addr);
+    uint16_t get_src();
     void send_to_addr(uint16_t addr);
+    void set_streaming(uint8_t value);
+    void stream_to_addr(uint16_t addr);
+    uint8_t stream_delivery(uint16_t addr);
+    void set_aggregation(uint8_t hold_time);
+    I32CTT_802154AggStats *get_aggregation_stats();
     uint16_t get_MTU();
   private:
-    uint8_t *frame_buffer;
+    uint8_t *rx_frame;
+    uint8_t *tx_frame;
     uint8_t reg_read(uint8_t addr);
     void reg_write(uint8_t addr, uint8_t value);
     void fb_read(uint8_t *buffer);
@@ -234,14 +489,54 @@ class I32CTT_Arduino802154Interface: public I32CTT_Interface {
     uint8_t request_state(AT86RF233_TRX_STATE state);
     uint8_t wait_for_state(AT86RF233_TRX_STATUS state);
     void update_state();
+    void format_header();
+    void configure_filter();
+    void capture_frame();
+    uint8_t deliver_frame(uint8_t *buffer);
+    I32CTT_802154Peer *find_peer(uint16_t addr);
+    I32CTT_802154Peer *get_peer(uint16_t addr);
+    uint8_t next_stream_seq(uint16_t addr);
+    uint8_t is_duplicate(uint16_t src, uint8_t seq);
+    void replay_answer(I32CTT_802154Peer *peer);
+    void update_rx_stats(I32CTT_802154Peer *peer, uint8_t phr);
+    void update_tx_stats(uint8_t trac_status, uint8_t timed_out);
+    void update_buffers();
+    uint8_t *alloc_frame();
+    void release_frame(uint8_t *frame);
+    uint8_t queue_frame(uint8_t *frame);
+    void send_queued();
+    uint8_t link_cost(uint16_t addr);
+    I32CTT_802154Route *find_route(uint16_t dst);
+    void learn_route(uint16_t dst, uint16_t via, uint8_t hops, uint16_t cost);
+    void forward_frame(uint8_t *buffer, I32CTT_802154MeshHeader *mesh);
+    void send_beacon();
+    void process_beacon(uint16_t src, uint8_t *payload, uint8_t size);
+    I32CTT_802154Child *find_child(uint16_t addr);
+    void hold_for_child(I32CTT_802154Child *child);
+    void handle_data_request(uint16_t src, uint8_t seq);
+    void expire_indirect();
+    void update_pending_bit();
+    uint8_t *prepare_frame(IEEE_802154_FRAME_TYPE type, uint16_t dst);
+    uint8_t sleepy_update();
+    void wake_radio();
+    void sleep_radio();
+    uint8_t *detach_tx_frame();
+    void write_channel();
+    void tune(uint8_t channel);
+    uint8_t hold_for_channel(uint8_t channel);
+    void schedule_channel();
+    void aggregate(uint16_t addr);
+    void flush_aggregate();
+    void unpack_aggregate(uint16_t src);
+    void next_aggregated();
     uint8_t phy_status;
     uint8_t cs_pin;
     uint8_t slp_tx_pin;
     uint8_t rst_pin;
     uint8_t irq_pin;
     uint8_t lqi;
-    uint8_t rx_status_0;
-    uint8_t rx_status_1;
+    uint8_t ed_level;
+    uint8_t rx_status;
     uint8_t radio_enabled;
     uint8_t current_state;
     uint8_t pa_ena_pin;
@@ -255,6 +550,69 @@ class I32CTT_Arduino802154Interface: public I32CTT_Interface {
     uint8_t seq_num;
     uint64_t last_try;
     uint8_t package_queued;
+    uint8_t answer_pending;
+    uint16_t answer_addr;   // Node the pending answer goes to
+    uint8_t promiscuous;
+    I32CTT_802154Capture *capture_queue;
+    uint8_t capture_head;
+    uint8_t capture_count;
+    uint16_t capture_dropped;
+    I32CTT_802154Peer *peers;
+    I32CTT_802154StreamSeq *stream_seqs;
+    I32CTT_802154Dedup *dedup;
+    uint8_t tx_replay;
+    uint16_t tx_peer_addr;
+    uint8_t tx_phr;
+    uint8_t tx_acked;
+    uint8_t streaming;
+    uint16_t dedup_hits;
+    uint16_t dedup_replays;
+    uint8_t *frame_memory;
+    uint8_t *free_frames[FRAME_POOL_SIZE];
+    uint8_t free_count;
+    uint8_t *tx_queue[FRAME_POOL_SIZE];
+    uint8_t tx_queue_head;
+    uint8_t tx_queue_count;
+    uint8_t *tx_pooled; // Pool frame being transmitted
+    uint8_t mesh;
+    I32CTT_802154Route *routes;
+    uint32_t last_beacon;
+    uint16_t mesh_forwarded;
+    uint16_t mesh_dropped;
+    I32CTT_802154Child *children;
+    uint8_t pending_bit;
+    uint16_t indirect_dropped;
+    uint16_t parent_addr;
+    uint16_t poll_interval;
+    uint8_t sleepy_state;
+    uint8_t sleepy_received;
+    uint32_t last_wake;
+    uint32_t listen_until;
+    uint32_t wake_at;
+    I32CTT_802154SleepStats sleep_stats;
+    uint16_t channel_mask;
+    I32CTT_802154HomeChannel *home_channels;
+    uint8_t channel_hopping;
+    uint8_t *held[FRAME_POOL_SIZE]; // Frames waiting for their channel
+    uint8_t held_channel[FRAME_POOL_SIZE];
+    uint8_t held_count;
+    uint16_t held_dropped;   // Frames for another channel that found the pool empty
+    uint32_t channel_since;  // us, last retune
+    uint32_t channel_active; // ms, last frame on the current channel
+    uint16_t retunes;
+    uint32_t retune_time;
+    I32CTT_802154ChannelStats *channel_stats;
+    uint8_t agg_hold;       // ms, 0 disables aggregation
+    uint8_t *agg_frame;     // Container being filled, NULL if none
+    uint16_t agg_dst;
+    uint8_t agg_size;       // Payload bytes, CMD_AGG included
+    uint8_t agg_count;
+    uint32_t agg_since;     // ms, first message of the container
+    uint8_t *agg_rx_frame;  // Received container being unpacked
+    uint8_t agg_rx_next;    // Offsets inside agg_rx_frame
+    uint8_t agg_rx_end;
+    uint16_t agg_rx_src;
+    I32CTT_802154AggStats agg_stats;
     SPISettings spi_settings;
 };
 
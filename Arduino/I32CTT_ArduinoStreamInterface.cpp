@@ -23,7 +23,14 @@
 #include "I32CTT.h"
 #include "I32CTT_ArduinoStreamInterface.h"
 
-I32CTT_ArduinoStreamInterface::I32CTT_ArduinoStreamInterface(Stream &port) {
+/**
+ * \brief Constructor de la interfaz serial.
+ * \param port Puerto (Serial, Serial1...) ya inicializado.
+ * \param mode STREAM_TEXT para líneas ASCII legibles o STREAM_BINARY para
+ *        mensajes I32CTT crudos delimitados con SLIP y con CRC-16, que
+ *        soporta todos los comandos y ocupa mucho menos ancho de banda.
+ */
+I32CTT_ArduinoStreamInterface::I32CTT_ArduinoStreamInterface(Stream &port, I32CTT_STREAM_MODE mode) {
   this->rx_buffer = (uint8_t*)malloc(sizeof(uint8_t)*SER_MTU_SIZE);
   memset(this->rx_buffer, 0, sizeof(uint8_t)*SER_MTU_SIZE);
   this->rx_size = 0;
@@ -32,54 +39,93 @@ I32CTT_ArduinoStreamInterface::I32CTT_ArduinoStreamInterface(Stream &port) {
   this->tx_size = 0;
   this->serial_buffer = (uint8_t*)malloc(sizeof(uint8_t)*SER_BUFF_SIZE);
   memset(this->serial_buffer, 0, sizeof(uint8_t)*SER_BUFF_SIZE);
+  this->read_buffer = (uint8_t*)malloc(sizeof(uint8_t)*SER_READ_SIZE);
+  this->read_pos = 0;
+  this->read_len = 0;
+  this->echo_pos = 0;
+  this->out_buffer = (uint8_t*)malloc(sizeof(uint8_t)*SER_OUT_SIZE);
+  this->out_head = 0;
+  this->out_count = 0;
+  this->write_limited = 0;
 
   this->port = &port;
+  this->mode = mode;
+  this->slip_escaped = 0;
+  this->slip_overrun = 0;
+  this->text_field = 0;
+  this->text_cmd = 0;
+  this->text_records = 0;
+  this->text_state = 0;
+  this->text_value = 0;
+  this->last_cr = 0;
+  this->rx_errors = 0;
 
   this->d_available = 0;
   this->serial_size = 0;
 }
 
 I32CTT_ArduinoStreamInterface::~I32CTT_ArduinoStreamInterface() {
-  delete this->rx_buffer;
-  delete this->rx_buffer;
-  delete this->serial_buffer;
+  free(this->rx_buffer);
+  free(this->tx_buffer);
+  free(this->serial_buffer);
+  free(this->read_buffer);
+  free(this->out_buffer);
 }
 
 void I32CTT_ArduinoStreamInterface::init() {
+  this->write_limited = this->port->availableForWrite() > 0;
+  if(this->mode == STREAM_BINARY)
+    return; // No banner, the other end expects frames only
   this->port->println("Arduino Stream Interface initialized...");
 }
 
+/**
+ * \brief Lee del puerto todo lo disponible, en bloques y hasta
+ *        SER_UPDATE_BUDGET bytes por llamada. La lectura se detiene al
+ *        completar un mensaje, los bytes restantes quedan en read_buffer
+ *        para el siguiente update(), así un comando se procesa en una
+ *        sola iteración de run().
+ */
 void I32CTT_ArduinoStreamInterface::update() {
-
+  uint16_t budget = SER_UPDATE_BUDGET;
+  int count;
   uint8_t c;
-  uint8_t c_available = this->port->available();
-
-  if(c_available) {
-    c = this->port->read();
-    if(c == '\r' || c == '\n') {
-
-      this->serial_buffer[this->serial_size] = '\0';
-
-      this->port->println((char*)serial_buffer);
 
-      this->process_buffer();
+  this->flush_output();
 
-      this->serial_buffer[0] = '\0';
-      this->serial_size = 0;
-
-    } else {
-      if(this->serial_size<(SER_BUFF_SIZE-1)) {
-        this->serial_buffer[this->serial_size++] = c;
-      } else {
-        this->serial_buffer[0] = '\0';
-        this->serial_size = 0;
-      }
+  // Commands wait in the port while a full answer would not fit
+  while(!this->d_available && this->available()) {
+    if(this->read_pos == this->read_len) {
+      this->echo_read(0);
+      count = this->port->available();
+      if(count <= 0 || budget == 0)
+        break;
+      if(count > SER_READ_SIZE)
+        count = SER_READ_SIZE;
+      if(count > budget)
+        count = budget;
+      this->read_len = this->port->readBytes(this->read_buffer, count);
+      this->read_pos = 0;
+      this->echo_pos = 0;
+      budget -= this->read_len;
+      if(this->read_len == 0)
+        break;
     }
+    c = this->read_buffer[this->read_pos++];
+    if(this->mode == STREAM_BINARY)
+      this->process_binary(c);
+    else
+      this->process_text(c);
   }
+  this->echo_read(0);
 }
 
+/**
+ * \brief Hay espacio en el buffer de salida para la respuesta más larga,
+ *        enviar nunca bloquea al controlador.
+ */
 uint8_t I32CTT_ArduinoStreamInterface::available() {
-  return 1; // Siempre retorna 1 para esta interfaz ya que el envio es bloqueante
+  return (SER_OUT_SIZE-this->out_count) >= SER_ANSWER_MAX;
 }
 
 uint8_t I32CTT_ArduinoStreamInterface::data_available() {
@@ -88,118 +134,343 @@ uint8_t I32CTT_ArduinoStreamInterface::data_available() {
   return result;
 }
 
+/**
+ * \brief Formatea la respuesta completa en el buffer de salida y la
+ *        envía con una sola escritura hasta donde el puerto la acepte sin
+ *        bloquear, update() envía el resto.
+ */
 void I32CTT_ArduinoStreamInterface::send() {
   
+  if(this->mode == STREAM_BINARY) {
+    this->send_binary();
+    this->flush_output();
+    return;
+  }
+
   uint8_t cmd = 0;
   cmd = this->tx_buffer[0];
-  uint8_t reg_count = I32CTT_Controller::reg_count(cmd, this->tx_size);
+  I32CTT_Size_t reg_count = I32CTT_Controller::reg_count(cmd, this->tx_size);
   uint8_t mode = this->tx_buffer[1];
   
   switch(cmd) {
     case CMD_R:
-      this->port->print("r");
-      this->tx_size = 0;
+      this->out_str("r");
       break;
     case CMD_W:
-      this->port->print("w"); 
-      this->tx_size = 0;
+      this->out_str("w");
       break;
     case CMD_AR:
-      this->port->print("ar,");
-      this->port->print(mode, DEC);
+      this->out_str("ar,");
+      this->out_dec(mode);
       for(int i=0;i<reg_count;i++) {
-        this->port->print(",");
-        this->port->print(I32CTT_Controller::get_reg(this->tx_buffer, cmd, i), HEX);
-        this->port->print(",");
-        this->port->print(I32CTT_Controller::get_data(this->tx_buffer, cmd, i), HEX);
+        this->out_byte(',');
+        this->out_hex(I32CTT_Controller::get_reg(this->tx_buffer, cmd, i));
+        this->out_byte(',');
+        this->out_hex(I32CTT_Controller::get_data(this->tx_buffer, cmd, i));
       }
-      this->tx_size = 0;
       break;
     case CMD_AW:
-      this->port->print("aw,");
-      this->port->print(mode, DEC);
+      this->out_str("aw,");
+      this->out_dec(mode);
       for(int i=0;i<reg_count;i++) {
-        this->port->print(",");
-        this->port->print(I32CTT_Controller::get_reg(this->tx_buffer, cmd, i), HEX);
+        this->out_byte(',');
+        this->out_hex(I32CTT_Controller::get_reg(this->tx_buffer, cmd, i));
       }
-      this->tx_size = 0;
       break;
   }
   
-  this->port->print("\r\n");
+  this->out_str("\r\n");
+  this->tx_size = 0;
+  this->flush_output();
 }
 
-void I32CTT_ArduinoStreamInterface::process_buffer() {
-  
-  char *string_buffer = (char*)this->serial_buffer;
-  char *pch = strtok(string_buffer, ",");
-  uint8_t pos = 0;
-  uint8_t reg_count = 0;
-  uint32_t data = 0;
-  uint16_t data16 = 0;
-  uint8_t data8 = 0;
-  
-  //for(int i=0;i<SER_MTU_SIZE;i++) {
-  //  this->rx_buffer[i] = 0;
-  //}
-  this->rx_size = 0;
+/**
+ * \brief Devuelve al puerto, en una sola escritura, los bytes de texto
+ *        leídos desde el último eco (los humanos no siempre tienen eco
+ *        local en la terminal).
+ * \param skip 1 para omitir el último byte leído (fin de línea).
+ */
+void I32CTT_ArduinoStreamInterface::echo_read(uint8_t skip) {
+  uint8_t end = this->read_pos-skip;
+
+  if(this->mode == STREAM_TEXT && end > this->echo_pos)
+    this->out_write(this->read_buffer+this->echo_pos, end-this->echo_pos);
+  this->echo_pos = this->read_pos;
+}
+
+/**
+ * \brief Analiza un byte del protocolo de texto a medida que llega:
+ *        "r,modo,reg,reg..." o "w,modo,reg,dato,reg,dato...", números en
+ *        decimal y una línea por comando. Cada campo se codifica en
+ *        rx_buffer al llegar su coma, sin guardar ni volver a recorrer la
+ *        línea. Las líneas inválidas o más largas que el MTU se descartan
+ *        completas.
+ */
+void I32CTT_ArduinoStreamInterface::process_text(uint8_t c) {
+  if(c == '\n' && this->last_cr) {
+    this->last_cr = 0;
+    this->echo_read(1); // Second half of CR LF, already echoed
+    return;
+  }
+  this->last_cr = (c == '\r');
+
+  if(c == '\r' || c == '\n') {
+    this->echo_read(1);
+    this->out_str("\r\n");
+    if(this->text_field > 0 || this->text_state != 0) {
+      this->end_field();
+      if(this->text_state & TEXT_DISCARD)
+        this->rx_errors++;
+      else if(this->text_field > 1)
+        this->d_available = 1;
+    }
+    this->text_field = 0;
+    this->text_cmd = 0;
+    this->text_records = 0;
+    this->text_state = 0;
+    this->text_value = 0;
+    return;
+  }
+
+  if(this->text_state & TEXT_DISCARD)
+    return;
+
+  if(c == ',') {
+    this->end_field();
+  } else if(this->text_field == 0) {
+    // Same rule as before: any 'r' in the first field reads, else any 'w' writes
+    if(c == 'r')
+      this->text_cmd = CMD_R;
+    else if(c == 'w' && this->text_cmd != CMD_R)
+      this->text_cmd = CMD_W;
+    this->text_state |= TEXT_NUMBER_END;
+  } else if(c >= '0' && c <= '9' && !(this->text_state & TEXT_NUMBER_END)) {
+    this->text_value = this->text_value*10+(c-'0');
+    this->text_state |= TEXT_DIGITS;
+  } else if(c == '-' && !(this->text_state & (TEXT_DIGITS | TEXT_NUMBER_END))) {
+    this->text_state |= TEXT_NEGATIVE;
+  } else if(c != ' ' || (this->text_state & TEXT_DIGITS)) {
+    this->text_state |= TEXT_NUMBER_END; // strtol() stops at the first non digit
+  }
+}
+
+/**
+ * \brief Codifica en rx_buffer el campo de texto terminado.
+ */
+void I32CTT_ArduinoStreamInterface::end_field() {
+  uint32_t value = this->text_value;
+
+  if(this->text_state & TEXT_DISCARD)
+    return;
+  if(this->text_state & TEXT_NEGATIVE)
+    value = -value;
+
+  if(this->text_field == 0) {
+    if(this->text_cmd == 0) {
+      this->text_state = TEXT_DISCARD;
+      return;
+    }
+    this->rx_buffer[0] = this->text_cmd;
+    this->rx_size = sizeof(I32CTT_CMD);
+  } else if(this->text_field == 1) {
+    this->rx_buffer[1] = value;
+    this->rx_size = sizeof(I32CTT_Header);
+  } else if(this->text_cmd == CMD_R) {
+    if(this->rx_size+sizeof(I32CTT_Reg) > SER_MTU_SIZE) {
+      this->text_state = TEXT_DISCARD;
+      return;
+    }
+    I32CTT_Controller::put_reg(this->rx_buffer, value, CMD_R, this->text_field-2);
+    this->rx_size += sizeof(I32CTT_Reg);
+  } else if((this->text_field%2) == 0) {
+    if(this->rx_size+sizeof(I32CTT_RegData) > SER_MTU_SIZE) {
+      this->text_state = TEXT_DISCARD;
+      return;
+    }
+    I32CTT_Controller::put_reg(this->rx_buffer, value, CMD_W, this->text_records);
+  } else {
+    I32CTT_Controller::put_data(this->rx_buffer, value, CMD_W, this->text_records++);
+    this->rx_size += sizeof(I32CTT_RegData);
+  }
+
+  this->text_field++;
+  this->text_value = 0;
+  this->text_state = 0;
+}
+
+/**
+ * \brief Mensajes descartados: tramas binarias con CRC inválido o
+ *        demasiado largas y líneas de texto inválidas.
+ */
+uint16_t I32CTT_ArduinoStreamInterface::get_rx_errors() {
+  return this->rx_errors;
+}
 
-  while(pch != NULL) {
-    if(pos==0) {
-      if(strstr(pch,"r")!=NULL) {
-        this->rx_buffer[0] = CMD_R;
-      }else if(strstr(pch,"w")!=NULL) {
-        this->rx_buffer[0] = CMD_W;
+uint16_t I32CTT_ArduinoStreamInterface::get_MTU() {
+  return SER_MTU_SIZE;
+}
+
+/**
+ * \brief Decodifica un byte en modo binario. Los bytes entre dos SLIP_END
+ *        forman el mensaje seguido de su CRC-16 (little endian). Las
+ *        tramas con CRC inválido o más largas que el buffer se descartan
+ *        completas, el siguiente SLIP_END resincroniza.
+ */
+void I32CTT_ArduinoStreamInterface::process_binary(uint8_t c) {
+  uint16_t crc;
+  uint16_t size;
+
+  if(c == SLIP_END) {
+    size = this->serial_size;
+    if(!this->slip_overrun && size > SER_CRC_SIZE && size-SER_CRC_SIZE <= SER_MTU_SIZE) {
+      size -= SER_CRC_SIZE;
+      crc = this->serial_buffer[size] | (this->serial_buffer[size+1]<<8);
+      if(crc == crc16(0, this->serial_buffer, size)) {
+        memcpy(this->rx_buffer, this->serial_buffer, size);
+        this->rx_size = size;
+        this->d_available = 1;
       } else {
-        this->rx_size = 0;
-        break;
-      }
-      this->rx_size = sizeof(uint8_t);
-    } else if(pos==1) {
-      data8 = (uint8_t)strtol(pch,NULL, 10);
-      memcpy(this->rx_buffer+this->rx_size, &data8, sizeof(uint8_t));
-      this->rx_size += sizeof(uint8_t);
-    } else {
-      if(this->rx_buffer[0] == CMD_R ) {
-        data16 = (uint16_t)strtol(pch,NULL, 10);
-        I32CTT_Controller::put_reg(this->rx_buffer, data16, CMD_R, pos-2);
-        this->rx_size += sizeof(I32CTT_Reg);
-      }
-      if(this->rx_buffer[0] == CMD_W ) {
-        if((pos%2)==0) {
-          data16 = (uint16_t)strtol(pch,NULL, 10);
-          this->port->print("REG:");
-          this->port->println(data16, HEX);
-          I32CTT_Controller::put_reg(this->rx_buffer, data16, CMD_W, reg_count);
-        } else {
-          data = (uint32_t)strtol(pch,NULL, 10);
-          this->port->print("DATA:");
-          this->port->println(data, HEX);
-          I32CTT_Controller::put_data(this->rx_buffer, data, CMD_W, reg_count++);
-          this->rx_size += sizeof(I32CTT_RegData);
-        }
+        this->rx_errors++;
       }
+    } else if(size > 0) {
+      this->rx_errors++;
     }
-    pch = strtok(NULL, ","); 
-    pos++;
+    this->serial_size = 0;
+    this->slip_escaped = 0;
+    this->slip_overrun = 0;
+    return;
+  }
+
+  if(c == SLIP_ESC) {
+    this->slip_escaped = 1;
+    return;
   }
-  this->port->println("Packet: ");
-  for(int i=0;i<this->rx_size;i++) {
-    Serial.print(this->rx_buffer[i], HEX);
-    Serial.print(" ");
+  if(this->slip_escaped) {
+    if(c == SLIP_ESC_END)
+      c = SLIP_END;
+    else if(c == SLIP_ESC_ESC)
+      c = SLIP_ESC;
+    this->slip_escaped = 0;
   }
-  this->port->print("\r\n");
 
-  for(int i=0;i<SER_BUFF_SIZE;i++) {
-    this->serial_buffer[i] = 0;
+  if(this->serial_size < SER_BUFF_SIZE)
+    this->serial_buffer[this->serial_size++] = c;
+  else
+    this->slip_overrun = 1;
+}
+
+/**
+ * \brief Envía tx_buffer como una trama SLIP con CRC-16. El SLIP_END
+ *        inicial descarta el ruido que haya recibido el otro extremo.
+ */
+void I32CTT_ArduinoStreamInterface::send_binary() {
+  uint16_t crc = crc16(0, this->tx_buffer, this->tx_size);
+
+  this->out_byte(SLIP_END);
+  for(int i=0;i<this->tx_size;i++)
+    this->write_escaped(this->tx_buffer[i]);
+  this->write_escaped(crc & 0xFF);
+  this->write_escaped(crc >> 8);
+  this->out_byte(SLIP_END);
+  this->tx_size = 0;
+}
+
+void I32CTT_ArduinoStreamInterface::write_escaped(uint8_t c) {
+  if(c == SLIP_END) {
+    this->out_byte(SLIP_ESC);
+    this->out_byte(SLIP_ESC_END);
+  } else if(c == SLIP_ESC) {
+    this->out_byte(SLIP_ESC);
+    this->out_byte(SLIP_ESC_ESC);
+  } else {
+    this->out_byte(c);
   }
-  this->serial_size = 0;
-  if(pos>1) {
-    this->d_available = 1;
+}
+
+/**
+ * \brief Agrega un byte al buffer de salida (circular). Si está lleno se
+ *        vacía bloqueando, solo pasa si el otro extremo no lee.
+ */
+void I32CTT_ArduinoStreamInterface::out_byte(uint8_t c) {
+  if(this->out_count == SER_OUT_SIZE)
+    this->flush_output(true);
+  this->out_buffer[(this->out_head+this->out_count)%SER_OUT_SIZE] = c;
+  this->out_count++;
+}
+
+void I32CTT_ArduinoStreamInterface::out_write(uint8_t *buffer, uint16_t size) {
+  for(uint16_t i=0;i<size;i++)
+    this->out_byte(buffer[i]);
+}
+
+void I32CTT_ArduinoStreamInterface::out_str(const char *str) {
+  while(*str)
+    this->out_byte(*str++);
+}
+
+/**
+ * \brief Número en hexadecimal, mayúsculas y sin ceros a la izquierda
+ *        (igual que print(value, HEX)).
+ */
+void I32CTT_ArduinoStreamInterface::out_hex(uint32_t value) {
+  int shift = 28;
+
+  while(shift > 0 && (value >> shift) == 0)
+    shift -= 4;
+  for(;shift>=0;shift-=4)
+    this->out_byte("0123456789ABCDEF"[(value >> shift) & 0x0F]);
+}
+
+void I32CTT_ArduinoStreamInterface::out_dec(uint8_t value) {
+  if(value >= 100)
+    this->out_byte('0'+value/100);
+  if(value >= 10)
+    this->out_byte('0'+(value/10)%10);
+  this->out_byte('0'+value%10);
+}
+
+/**
+ * \brief Envía el buffer de salida con una escritura por tramo contiguo,
+ *        sin pasar de lo que availableForWrite() acepta sin bloquear.
+ *        Los puertos que no lo reportan (0 con el buffer vacío al
+ *        iniciar) se escriben bloqueando, como antes.
+ * \param blocking true para enviar todo aunque bloquee.
+ */
+void I32CTT_ArduinoStreamInterface::flush_output(uint8_t blocking) {
+  uint16_t size;
+  int room;
+
+  while(this->out_count > 0) {
+    size = this->out_count;
+    if(size > SER_OUT_SIZE-this->out_head)
+      size = SER_OUT_SIZE-this->out_head; // Up to the end of the ring
+    if(this->write_limited && !blocking) {
+      room = this->port->availableForWrite();
+      if(room <= 0)
+        break;
+      if(size > room)
+        size = room;
+    }
+    size = this->port->write(this->out_buffer+this->out_head, size);
+    if(size == 0)
+      break;
+    this->out_head = (this->out_head+size)%SER_OUT_SIZE;
+    this->out_count -= size;
   }
-  
 }
 
-uint16_t I32CTT_ArduinoStreamInterface::get_MTU() {
-  return SER_MTU_SIZE;
+/**
+ * \brief CRC-16 ITU-T (polinomio 0x1021 reflejado, valor inicial 0), el
+ *        mismo FCS de IEEE 802.15.4.
+ * \param crc Valor inicial (0) o CRC parcial para calcularlo por partes.
+ * \param buffer Datos.
+ * \param size Tamaño de los datos (en bytes).
+ */
+uint16_t I32CTT_ArduinoStreamInterface::crc16(uint16_t crc, uint8_t *buffer, uint16_t size) {
+  for(uint16_t i=0;i<size;i++) {
+    crc ^= buffer[i];
+    for(int j=0;j<8;j++)
+      crc = (crc & 1) ? (crc >> 1) ^ 0x8408 : (crc >> 1);
+  }
+  return crc;
 }
\ No newline at end of file
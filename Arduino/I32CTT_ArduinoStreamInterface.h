@@ -20,12 +20,56 @@
 #define I32CTT_ArduinoStreamInterface_H
 
 #ifdef ARDUINO
-#define SER_BUFF_SIZE 126
+#ifndef SER_MTU_SIZE
+#if I32CTT_SIZE_BITS == 8
 #define SER_MTU_SIZE 100
+#else
+#define SER_MTU_SIZE 1024 // 170 records per message
+#endif
+#endif
+#define SER_CRC_SIZE 2
+#define SER_BUFF_SIZE (SER_MTU_SIZE+SER_CRC_SIZE)
+#ifndef SER_READ_SIZE
+#if I32CTT_SIZE_BITS == 8
+#define SER_READ_SIZE 16 // Block read from the port
+#else
+#define SER_READ_SIZE 64
+#endif
+#endif
+#ifndef SER_UPDATE_BUDGET
+#define SER_UPDATE_BUDGET 256 // Bytes read per update() at most
+#endif
+// Longest text answer: "ar,255" + ",FFFF,FFFFFFFF" per record + CR LF
+#define SER_TEXT_ANSWER_MAX (8+(SER_MTU_SIZE-sizeof(I32CTT_Header))/sizeof(I32CTT_RegData)*14)
+#define SER_ANSWER_MAX (SER_READ_SIZE+SER_TEXT_ANSWER_MAX) // Echo of a block + longest answer
+#ifndef SER_OUT_SIZE
+#if I32CTT_SIZE_BITS == 8
+#define SER_OUT_SIZE SER_ANSWER_MAX // Output staging ring, one answer at a time on AVR
+#else
+#define SER_OUT_SIZE (SER_ANSWER_MAX+256)
+#endif
+#endif
+
+#define SLIP_END     0xC0 // RFC 1055 framing
+#define SLIP_ESC     0xDB
+#define SLIP_ESC_END 0xDC
+#define SLIP_ESC_ESC 0xDD
+
+enum I32CTT_STREAM_MODE {
+  STREAM_TEXT = 0, // ASCII lines for humans (r,mode,reg... / w,mode,reg,data...)
+  STREAM_BINARY    // SLIP framed I32CTT messages with CRC-16
+};
+
+enum I32CTT_STREAM_TEXT_FLAGS {
+  TEXT_DIGITS = 1,
+  TEXT_NUMBER_END = 1<<1, // Characters after the number are ignored
+  TEXT_NEGATIVE = 1<<2,
+  TEXT_DISCARD = 1<<3     // Invalid line, skipped up to its end
+};
 
 class I32CTT_ArduinoStreamInterface: public I32CTT_Interface {
   public:
-    I32CTT_ArduinoStreamInterface(Stream &port);
+    I32CTT_ArduinoStreamInterface(Stream &port, I32CTT_STREAM_MODE mode = STREAM_TEXT);
     ~I32CTT_ArduinoStreamInterface();
     void init();
     void update();
@@ -33,9 +77,40 @@ class I32CTT_ArduinoStreamInterface: public I32CTT_Interface {
     uint8_t data_available();
     void send();
     uint16_t get_MTU();
+    uint16_t get_rx_errors();
+    static uint16_t crc16(uint16_t crc, uint8_t *buffer, uint16_t size);
   private:
     Stream *port;
-    void process_buffer();
+    void echo_read(uint8_t skip);
+    void process_text(uint8_t c);
+    void end_field();
+    void process_binary(uint8_t c);
+    void send_binary();
+    void write_escaped(uint8_t c);
+    void out_byte(uint8_t c);
+    void out_write(uint8_t *buffer, uint16_t size);
+    void out_str(const char *str);
+    void out_hex(uint32_t value);
+    void out_dec(uint8_t value);
+    void flush_output(uint8_t blocking = false);
+    uint8_t mode;
+    uint8_t slip_escaped;
+    uint8_t slip_overrun;
+    uint8_t *read_buffer;
+    uint8_t read_pos;
+    uint8_t read_len;
+    uint8_t echo_pos;
+    uint8_t *out_buffer;
+    uint16_t out_head;
+    uint16_t out_count;
+    uint8_t write_limited; // The port reports availableForWrite()
+    I32CTT_Size_t text_field; // Field being parsed, 0 is the command
+    uint8_t text_cmd;
+    I32CTT_Size_t text_records;
+    uint8_t text_state;   // I32CTT_STREAM_TEXT_FLAGS
+    uint32_t text_value;
+    uint8_t last_cr;
+    uint16_t rx_errors;
     uint8_t d_available = 0;
     uint8_t *serial_buffer;
     uint16_t serial_size = 0;
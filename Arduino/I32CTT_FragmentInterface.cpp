@@ -0,0 +1,405 @@
+/*
+ *
+ * This file is part of I32CTT (Integer 32-bit Control & Telemetry Transport).
+ * Copyright (C) 2017 Mario Gomez / Hackerspace San Salvador.
+ *
+ * I32CTT is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * I32CTT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with I32CTT.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdint.h>
+#include <string.h>
+#include <Arduino.h>
+#include "I32CTT.h"
+#include "I32CTT_FragmentInterface.h"
+
+static uint32_t frag_mask(uint8_t count) {
+  return (count >= 32) ? 0xFFFFFFFF : ((1UL<<count)-1);
+}
+
+I32CTT_FragmentInterface::I32CTT_FragmentInterface(I32CTT_Interface &lower) {
+  this->lower = &lower;
+  this->tx_buffer = new uint8_t[FRAG_MAX_PAYLOAD];
+  memset(this->tx_buffer, 0, sizeof(uint8_t)*FRAG_MAX_PAYLOAD);
+  this->tx_size = 0;
+  memset(this->rx, 0, sizeof(I32CTT_FragRx)*FRAG_RX_SLOTS);
+  for(int i=0;i<FRAG_RX_SLOTS;i++) {
+    this->rx[i].buffer = new uint8_t[FRAG_MAX_PAYLOAD];
+    memset(this->rx[i].buffer, 0, sizeof(uint8_t)*FRAG_MAX_PAYLOAD);
+  }
+  this->rx_buffer = this->rx[0].buffer;
+  this->rx_size = 0;
+  this->rx_src = 0;
+
+  this->tx_state = FRAG_TX_IDLE;
+  this->tx_to_dst = false;
+  this->tx_msg_id = 0;
+  this->tx_count = 0;
+  this->tx_in_flight = 0;
+  this->tx_rounds = 0;
+  this->tx_pending = 0;
+  this->tx_unsent = 0;
+  this->tx_last_activity = 0;
+  this->d_available = 0;
+  this->tx_failures = 0;
+  this->retransmissions = 0;
+}
+
+I32CTT_FragmentInterface::~I32CTT_FragmentInterface() {
+  delete[] this->tx_buffer;
+  for(int i=0;i<FRAG_RX_SLOTS;i++)
+    delete[] this->rx[i].buffer;
+}
+
+void I32CTT_FragmentInterface::init() {
+  this->lower->init();
+}
+
+uint8_t I32CTT_FragmentInterface::chunk_size() {
+  uint16_t mtu = this->lower->get_MTU();
+  if(mtu > 255)
+    mtu = 255;
+  return mtu-sizeof(I32CTT_FragHeader);
+}
+
+/**
+ * \brief Actualiza la interfaz inferior y la máquina de fragmentación.
+ *        Los fragmentos y sus ACK se consumen aquí, cualquier otro
+ *        paquete se entrega tal cual al controlador sin copiarlo.
+ */
+void I32CTT_FragmentInterface::update() {
+  this->lower->update();
+
+  if(this->lower->data_available() && this->lower->rx_size > 0) {
+    switch(this->lower->rx_buffer[0]) {
+      case CMD_FRG:
+        receive_fragment();
+        break;
+      case CMD_FRGA:
+        receive_ack();
+        break;
+      default:
+        this->rx_buffer = this->lower->rx_buffer;
+        this->rx_size = this->lower->rx_size;
+        this->rx_src = this->lower->get_src();
+        this->d_available = 1;
+        break;
+    }
+  }
+
+  for(int i=0;i<FRAG_RX_SLOTS;i++) {
+    if(this->rx[i].active && (millis()-this->rx[i].last) > FRAG_REASSEMBLY_TIMEOUT) {
+      this->rx[i].used = false; // Sender gave up, drop partial message
+      this->rx[i].active = false;
+      this->rx[i].ack_pending = false;
+    }
+  }
+
+  send_ack();
+
+  pump_tx();
+}
+
+uint8_t I32CTT_FragmentInterface::available() {
+  return this->tx_state == FRAG_TX_IDLE && this->lower->available();
+}
+
+uint8_t I32CTT_FragmentInterface::data_available() {
+  uint8_t result = this->d_available;
+  this->d_available = 0;
+  return result;
+}
+
+void I32CTT_FragmentInterface::send() {
+  if(this->tx_state == FRAG_TX_IDLE)
+    start_tx(false);
+  update();
+}
+
+void I32CTT_FragmentInterface::send_to_dst() {
+  if(this->tx_state == FRAG_TX_IDLE)
+    start_tx(true);
+  update();
+}
+
+uint16_t I32CTT_FragmentInterface::get_MTU() {
+  uint16_t max_size = (uint16_t)chunk_size()*FRAG_MAX_FRAGMENTS;
+  return max_size < FRAG_MAX_PAYLOAD ? max_size : FRAG_MAX_PAYLOAD;
+}
+
+void I32CTT_FragmentInterface::set_dst(uint16_t addr) {
+  this->lower->set_dst(addr);
+}
+
+/**
+ * \brief Dirección del nodo que envió el mensaje en rx_buffer, también
+ *        para los mensajes reensamblados.
+ */
+uint16_t I32CTT_FragmentInterface::get_src() {
+  return this->rx_src;
+}
+
+uint16_t I32CTT_FragmentInterface::get_tx_failures() {
+  return this->tx_failures;
+}
+
+uint16_t I32CTT_FragmentInterface::get_retransmissions() {
+  return this->retransmissions;
+}
+
+void I32CTT_FragmentInterface::start_tx(uint8_t to_dst) {
+  uint8_t chunk = chunk_size();
+
+  if(this->tx_size == 0)
+    return; // Nothing to do.
+
+  this->tx_to_dst = to_dst;
+
+  if(this->tx_size <= this->lower->get_MTU()) {
+    // Fits in one frame, no fragment header needed
+    memcpy(this->lower->tx_buffer, this->tx_buffer, this->tx_size);
+    this->lower->tx_size = this->tx_size;
+    this->tx_state = FRAG_TX_PASS;
+    return;
+  }
+
+  this->tx_count = (this->tx_size+chunk-1)/chunk;
+  if(this->tx_count > FRAG_MAX_FRAGMENTS) {
+    this->tx_failures++;
+    this->tx_size = 0;
+    return;
+  }
+
+  this->tx_msg_id++;
+  this->tx_pending = frag_mask(this->tx_count);
+  this->tx_unsent = this->tx_pending;
+  this->tx_in_flight = 0;
+  this->tx_rounds = 0;
+  this->tx_last_activity = millis();
+  this->tx_state = FRAG_TX_FRAGMENTED;
+}
+
+void I32CTT_FragmentInterface::lower_send() {
+  if(this->tx_to_dst)
+    this->lower->send_to_dst();
+  else
+    this->lower->send();
+}
+
+/**
+ * \brief Envía los fragmentos pendientes dentro de la ventana.
+ *        Se envían hasta FRAG_WINDOW fragmentos sin esperar ACK. Si no
+ *        llega un ACK en FRAG_RETRY_TIMEOUT se reenvían únicamente los
+ *        fragmentos que el receptor no ha confirmado.
+ */
+void I32CTT_FragmentInterface::pump_tx() {
+  I32CTT_FragHeader header;
+  uint8_t chunk = chunk_size();
+  uint8_t len;
+  uint8_t idx;
+
+  if(this->tx_state == FRAG_TX_PASS) {
+    if(this->lower->tx_size > 0)
+      lower_send();
+    if(this->lower->tx_size == 0) {
+      this->tx_state = FRAG_TX_IDLE;
+      this->tx_size = 0;
+    }
+    return;
+  }
+
+  if(this->tx_state != FRAG_TX_FRAGMENTED)
+    return;
+
+  if(this->tx_pending == 0) {
+    // Receiver confirmed every fragment
+    this->tx_state = FRAG_TX_IDLE;
+    this->tx_size = 0;
+    return;
+  }
+
+  if(this->tx_unsent == 0 || this->tx_in_flight >= FRAG_WINDOW) {
+    if((millis()-this->tx_last_activity) <= FRAG_RETRY_TIMEOUT)
+      return; // Waiting for ACK
+
+    if(++this->tx_rounds > FRAG_MAX_RETRIES) {
+      this->tx_failures++;
+      this->tx_state = FRAG_TX_IDLE;
+      this->tx_size = 0;
+      return;
+    }
+    this->tx_unsent = this->tx_pending;
+    this->tx_in_flight = 0;
+  }
+
+  if(this->lower->tx_size > 0) {
+    lower_send(); // The lower interface kept the previous fragment, retry it
+    return;
+  }
+  if(!this->lower->available())
+    return; // Lower interface still busy with the previous fragment
+
+  for(idx=0;!(this->tx_unsent & (1UL<<idx));idx++);
+
+  header.cmd = CMD_FRG;
+  header.msg_id = this->tx_msg_id;
+  header.index = idx;
+  header.count = this->tx_count;
+  header.offset = (uint16_t)idx*chunk;
+  len = (this->tx_size-header.offset) < chunk ? (this->tx_size-header.offset) : chunk;
+
+  memcpy(this->lower->tx_buffer, &header, sizeof(I32CTT_FragHeader));
+  memcpy(this->lower->tx_buffer+sizeof(I32CTT_FragHeader), this->tx_buffer+header.offset, len);
+  this->lower->tx_size = sizeof(I32CTT_FragHeader)+len;
+  lower_send();
+
+  if(this->tx_rounds > 0)
+    this->retransmissions++;
+  this->tx_unsent &= ~(1UL<<idx);
+  this->tx_in_flight++;
+  this->tx_last_activity = millis();
+}
+
+void I32CTT_FragmentInterface::receive_ack() {
+  I32CTT_FragAck ack;
+
+  if(this->lower->rx_size < sizeof(I32CTT_FragAck))
+    return;
+  memcpy(&ack, this->lower->rx_buffer, sizeof(I32CTT_FragAck));
+
+  if(this->tx_state != FRAG_TX_FRAGMENTED || ack.msg_id != this->tx_msg_id)
+    return; // Stale ACK
+
+  if(this->tx_pending & ack.received)
+    this->tx_rounds = 0; // Progress, FRAG_MAX_RETRIES counts rounds without it
+  this->tx_pending &= ~ack.received;
+  this->tx_unsent &= ~ack.received;
+  this->tx_in_flight = 0;
+  this->tx_last_activity = millis();
+}
+
+/**
+ * \brief Reensamblado de un emisor. Si no hay uno se toma uno libre o el
+ *        del mensaje entregado hace más tiempo.
+ * \return NULL si todos reensamblan mensajes de otros emisores.
+ */
+I32CTT_FragRx *I32CTT_FragmentInterface::find_rx(uint16_t src) {
+  I32CTT_FragRx *oldest = NULL;
+
+  for(int i=0;i<FRAG_RX_SLOTS;i++) {
+    if(this->rx[i].used && this->rx[i].src == src)
+      return &this->rx[i];
+  }
+  for(int i=0;i<FRAG_RX_SLOTS;i++) {
+    if(!this->rx[i].used)
+      return &this->rx[i];
+    if(!this->rx[i].active && (oldest == NULL || (int32_t)(this->rx[i].last-oldest->last) < 0))
+      oldest = &this->rx[i];
+  }
+  return oldest;
+}
+
+/**
+ * \brief Coloca un fragmento recibido en el reensamblado de su emisor.
+ *        Se confirma cada FRAG_WINDOW fragmentos y al recibir el último
+ *        índice, el bitmap enviado le indica al emisor qué falta.
+ */
+void I32CTT_FragmentInterface::receive_fragment() {
+  I32CTT_FragHeader header;
+  I32CTT_FragRx *rx;
+  uint16_t src = this->lower->get_src();
+  uint8_t len;
+
+  if(this->lower->rx_size <= sizeof(I32CTT_FragHeader))
+    return;
+  memcpy(&header, this->lower->rx_buffer, sizeof(I32CTT_FragHeader));
+  len = this->lower->rx_size-sizeof(I32CTT_FragHeader);
+
+  if(
+    header.count == 0 ||
+    header.count > FRAG_MAX_FRAGMENTS ||
+    header.index >= header.count ||
+    (header.offset+len) > FRAG_MAX_PAYLOAD
+  )
+    return;
+
+  rx = find_rx(src);
+  if(rx == NULL)
+    return; // No room for one more sender, it sends again after FRAG_RETRY_TIMEOUT
+
+  if(rx->used && !rx->active && rx->src == src && header.msg_id == rx->msg_id) {
+    // Already delivered, our last ACK got lost
+    rx->ack_bitmap = frag_mask(header.count);
+    rx->ack_pending = true;
+    return;
+  }
+
+  if(!rx->used || rx->src != src || header.msg_id != rx->msg_id) {
+    rx->used = true;
+    rx->active = true;
+    rx->src = src;
+    rx->msg_id = header.msg_id;
+    rx->count = header.count;
+    rx->received = 0;
+    rx->total = 0;
+  }
+
+  if(!(rx->received & (1UL<<header.index))) {
+    memcpy(rx->buffer+header.offset, this->lower->rx_buffer+sizeof(I32CTT_FragHeader), len);
+    rx->received |= (1UL<<header.index);
+    if(header.index == header.count-1)
+      rx->total = header.offset+len;
+  }
+  rx->last = millis();
+
+  if(rx->received == frag_mask(rx->count)) {
+    rx->active = false;
+    this->rx_buffer = rx->buffer;
+    this->rx_size = rx->total;
+    this->rx_src = src;
+    this->d_available = 1;
+  } else if(((header.index+1)%FRAG_WINDOW) != 0 && header.index != header.count-1) {
+    return;
+  }
+
+  rx->ack_bitmap = rx->received;
+  rx->ack_pending = true;
+}
+
+/**
+ * \brief Envía el ACK pendiente del emisor del último paquete recibido.
+ *        El ACK sale con send(), de vuelta a ese emisor; los ACK de otros
+ *        emisores esperan a que estos reenvíen un fragmento.
+ */
+void I32CTT_FragmentInterface::send_ack() {
+  I32CTT_FragAck ack;
+  I32CTT_FragRx *rx = NULL;
+  uint16_t src = this->lower->get_src();
+
+  for(int i=0;i<FRAG_RX_SLOTS && rx == NULL;i++) {
+    if(this->rx[i].ack_pending && this->rx[i].src == src)
+      rx = &this->rx[i];
+  }
+  if(rx == NULL)
+    return;
+
+  if(this->lower->tx_size > 0 || !this->lower->available())
+    return; // Try again on next update
+
+  ack.cmd = CMD_FRGA;
+  ack.msg_id = rx->msg_id;
+  ack.received = rx->ack_bitmap;
+  memcpy(this->lower->tx_buffer, &ack, sizeof(I32CTT_FragAck));
+  this->lower->tx_size = sizeof(I32CTT_FragAck);
+  this->lower->send(); // Back to the fragment sender
+  rx->ack_pending = false;
+}
@@ -0,0 +1,114 @@
+/*
+ *
+ * This file is part of I32CTT (Integer 32-bit Control & Telemetry Transport).
+ * Copyright (C) 2017 Mario Gomez / Hackerspace San Salvador.
+ *
+ * I32CTT is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * I32CTT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with I32CTT.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef I32CTT_FragmentInterface_H
+#define I32CTT_FragmentInterface_H
+
+#ifndef FRAG_MAX_PAYLOAD
+#if I32CTT_SIZE_BITS == 8
+#define FRAG_MAX_PAYLOAD 255 // Limited by the 8-bit sizes of I32CTT_Interface
+#else
+#define FRAG_MAX_PAYLOAD 2048
+#endif
+#endif
+#define FRAG_MAX_FRAGMENTS 32 // One bit per fragment in I32CTT_FragAck
+#define FRAG_WINDOW 4 // Fragments sent before waiting for an ACK
+#define FRAG_RETRY_TIMEOUT 100 // ms without ACK before retransmitting
+#define FRAG_MAX_RETRIES 5
+#define FRAG_REASSEMBLY_TIMEOUT 500 // ms without fragments before dropping a message
+#ifndef FRAG_RX_SLOTS
+#if I32CTT_SIZE_BITS == 8
+#define FRAG_RX_SLOTS 1 // Senders reassembled at once, FRAG_MAX_PAYLOAD bytes each
+#else
+#define FRAG_RX_SLOTS 4
+#endif
+#endif
+
+// Reassembly of the messages of one sender, kept after delivery to
+// acknowledge again the fragments of a message whose last ACK was lost
+struct I32CTT_FragRx {
+  uint8_t used;
+  uint8_t active;      // Fragments still missing
+  uint16_t src;        // Sender, get_src() of the lower interface
+  uint8_t msg_id;
+  uint8_t count;
+  uint16_t total;
+  uint32_t received;
+  uint32_t last;       // ms, last fragment
+  uint8_t ack_pending;
+  uint32_t ack_bitmap;
+  uint8_t *buffer;
+};
+
+enum FRAG_TX_STATE {
+  FRAG_TX_IDLE = 0,
+  FRAG_TX_PASS,
+  FRAG_TX_FRAGMENTED
+};
+
+/*
+ * Sits between the controller and another interface. Messages that fit
+ * the lower MTU pass through unchanged, bigger ones are split in CMD_FRG
+ * fragments and acknowledged with CMD_FRGA bitmaps so only missing
+ * fragments are sent again. While a transfer is in progress available()
+ * returns 0 and tx_buffer must not be touched. Fragments are reassembled
+ * per sender (source address and message id), up to FRAG_RX_SLOTS senders
+ * at once; fragments of one more sender are dropped and sent again later.
+ */
+class I32CTT_FragmentInterface: public I32CTT_Interface {
+  public:
+    I32CTT_FragmentInterface(I32CTT_Interface &lower);
+    ~I32CTT_FragmentInterface();
+    void init();
+    void update();
+    uint8_t available();
+    uint8_t data_available();
+    void send();
+    void send_to_dst();
+    uint16_t get_MTU();
+    void set_dst(uint16_t addr);
+    uint16_t get_src();
+    uint16_t get_tx_failures();
+    uint16_t get_retransmissions();
+  private:
+    I32CTT_Interface *lower;
+    void start_tx(uint8_t to_dst);
+    void pump_tx();
+    void lower_send();
+    void send_ack();
+    void receive_fragment();
+    void receive_ack();
+    I32CTT_FragRx *find_rx(uint16_t src);
+    uint8_t chunk_size();
+    uint8_t tx_state;
+    uint8_t tx_to_dst;
+    uint8_t tx_msg_id;
+    uint8_t tx_count;
+    uint8_t tx_in_flight;
+    uint8_t tx_rounds;
+    uint32_t tx_pending;
+    uint32_t tx_unsent;
+    uint32_t tx_last_activity;
+    I32CTT_FragRx rx[FRAG_RX_SLOTS];
+    uint16_t rx_src;     // Sender of the message in rx_buffer
+    uint8_t d_available;
+    uint16_t tx_failures;
+    uint16_t retransmissions;
+};
+
+#endif
@@ -0,0 +1,93 @@
+/*
+ *
+ * This file is part of I32CTT (Integer 32-bit Control & Telemetry Transport).
+ * Copyright (C) 2017 Mario Gomez / Hackerspace San Salvador.
+ *
+ * I32CTT is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * I32CTT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with I32CTT.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdint.h>
+#include <Arduino.h>
+#include "I32CTT.h"
+#include "I32CTT_Arduino802154Interface.h"
+#include "I32CTT_LinkStatsEndpoint.h"
+
+I32CTT_LinkStatsEndpoint::I32CTT_LinkStatsEndpoint(uint32_t mode_id, I32CTT_Arduino802154Interface &iface) : I32CTT_Endpoint(mode_id) {
+  this->iface = &iface;
+}
+
+uint32_t I32CTT_LinkStatsEndpoint::read(uint16_t addr) {
+  I32CTT_802154Peer *peer;
+  uint8_t idx;
+
+  switch(addr) {
+    case 0x0000:
+      return this->id;
+    case 0x0001:
+      return this->iface->get_peer_count();
+  }
+
+  if(addr < LINK_STATS_PEER_BASE)
+    return 0;
+
+  idx = (addr-LINK_STATS_PEER_BASE)>>LINK_STATS_PEER_SHIFT;
+  peer = this->iface->get_peer_at(idx);
+  if(peer == NULL)
+    return 0; // Empty slot
+
+  switch(addr & ((1<<LINK_STATS_PEER_SHIFT)-1)) {
+    case LS_ADDR:
+      return peer->addr;
+    case LS_LQI:
+      return peer->stats.lqi>>LINK_EWMA_FRAC;
+    case LS_RSSI:
+      return (uint32_t)(int32_t)(peer->stats.rssi/(1<<LINK_EWMA_FRAC));
+    case LS_RX_FRAMES:
+      return peer->stats.rx_frames;
+    case LS_TX_SUCCESS:
+      return peer->stats.tx_success;
+    case LS_TX_NO_ACK:
+      return peer->stats.tx_no_ack;
+    case LS_TX_CHANNEL_ACCESS_FAILURE:
+      return peer->stats.tx_channel_access_failure;
+    case LS_TX_RETRIES:
+      return peer->stats.tx_retries;
+    case LS_TX_AIRTIME:
+      return peer->stats.tx_airtime;
+    case LS_RX_AIRTIME:
+      return peer->stats.rx_airtime;
+    case LS_AGE:
+      return millis()-peer->last_rx;
+    case LS_STREAM_TX:
+      return peer->stats.stream_tx;
+    case LS_STREAM_RX:
+      return peer->stats.stream_rx;
+    case LS_STREAM_LOST:
+      return peer->stats.stream_lost;
+  }
+  return 0;
+}
+
+uint16_t I32CTT_LinkStatsEndpoint::write(uint16_t addr, uint32_t data) {
+  if(addr == 0x0002)
+    this->iface->clear_link_stats();
+  return addr;
+}
+
+void I32CTT_LinkStatsEndpoint::init() {
+  // Do nothing.
+}
+
+void I32CTT_LinkStatsEndpoint::update() {
+  // Do nothing.
+}
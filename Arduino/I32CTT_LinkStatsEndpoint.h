@@ -0,0 +1,63 @@
+/*
+ *
+ * This file is part of I32CTT (Integer 32-bit Control & Telemetry Transport).
+ * Copyright (C) 2017 Mario Gomez / Hackerspace San Salvador.
+ *
+ * I32CTT is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * I32CTT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with I32CTT.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef I32CTT_LinkStatsEndpoint_H
+#define I32CTT_LinkStatsEndpoint_H
+
+#ifdef ARDUINO
+/*
+ * Register map:
+ *   0x0000          Endpoint ID
+ *   0x0001          Peer table size
+ *   0x0002          Write any value to clear the statistics
+ *   0x0100+16*n+f   Field f of peer n (see LINK_STATS_FIELD)
+ */
+#define LINK_STATS_PEER_BASE  0x0100
+#define LINK_STATS_PEER_SHIFT 4
+
+enum LINK_STATS_FIELD {
+  LS_ADDR = 0,
+  LS_LQI,
+  LS_RSSI,
+  LS_RX_FRAMES,
+  LS_TX_SUCCESS,
+  LS_TX_NO_ACK,
+  LS_TX_CHANNEL_ACCESS_FAILURE,
+  LS_TX_RETRIES,
+  LS_TX_AIRTIME,
+  LS_RX_AIRTIME,
+  LS_AGE,
+  LS_STREAM_TX,
+  LS_STREAM_RX,
+  LS_STREAM_LOST
+};
+
+class I32CTT_LinkStatsEndpoint: public I32CTT_Endpoint {
+  public:
+    I32CTT_LinkStatsEndpoint(uint32_t mode_id, I32CTT_Arduino802154Interface &iface);
+    void init();
+    uint32_t read(uint16_t addr);
+    uint16_t write(uint16_t addr, uint32_t data);
+    void update();
+  private:
+    I32CTT_Arduino802154Interface *iface;
+};
+
+#endif
+
+#endif
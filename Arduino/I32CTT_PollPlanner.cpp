@@ -0,0 +1,328 @@
+/*
+ *
+ * This file is part of I32CTT (Integer 32-bit Control & Telemetry Transport).
+ * Copyright (C) 2017 Mario Gomez / Hackerspace San Salvador.
+ *
+ * I32CTT is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * I32CTT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with I32CTT.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <Arduino.h>
+#include "I32CTT.h"
+#include "I32CTT_PollPlanner.h"
+
+static int poll_compare(const void *a, const void *b) {
+  const I32CTT_PollRegister *ra = (const I32CTT_PollRegister*)a;
+  const I32CTT_PollRegister *rb = (const I32CTT_PollRegister*)b;
+
+  if(ra->node != rb->node)
+    return ra->node < rb->node ? -1 : 1;
+  if(ra->mode != rb->mode)
+    return ra->mode < rb->mode ? -1 : 1;
+  if(ra->period != rb->period)
+    return ra->period < rb->period ? -1 : 1;
+  return 0;
+}
+
+I32CTT_PollPlanner::I32CTT_PollPlanner(I32CTT_Controller &controller, I32CTT_Interface &iface,
+    uint16_t max_registers) {
+  this->controller = &controller;
+  this->iface = &iface;
+  this->regs = new I32CTT_PollRegister[max_registers];
+  this->groups = new I32CTT_PollGroup[max_registers];
+  this->reg_count = 0;
+  this->max_registers = max_registers;
+  this->group_count = 0;
+  this->max_in_flight = POLL_MAX_IN_FLIGHT;
+  this->in_flight = 0;
+  this->answer_timeout = POLL_ANSWER_TIMEOUT;
+  memset(&this->stats, 0, sizeof(I32CTT_PollStats));
+}
+
+I32CTT_PollPlanner::~I32CTT_PollPlanner() {
+  delete[] this->regs;
+  delete[] this->groups;
+}
+
+/*
+ * Asks for reg of the node's endpoint to be read every period ms. Takes
+ * effect at the next plan(). Returns 0 if the table is full.
+ */
+uint8_t I32CTT_PollPlanner::add_register(uint16_t node, uint8_t mode, uint16_t reg, uint32_t period) {
+  I32CTT_PollRegister *r;
+
+  if(this->reg_count >= this->max_registers || period == 0)
+    return 0;
+
+  r = &this->regs[this->reg_count++];
+  memset(r, 0, sizeof(I32CTT_PollRegister));
+  r->node = node;
+  r->mode = mode;
+  r->reg = reg;
+  r->period = period;
+  return 1;
+}
+
+/*
+ * Builds the schedule from the registers added so far and starts it.
+ * Frames still waiting for an answer are forgotten.
+ */
+void I32CTT_PollPlanner::plan() {
+  I32CTT_PollGroup *g = NULL;
+  I32CTT_PollRegister *r;
+  uint32_t now = millis();
+  uint16_t i;
+  uint16_t j;
+
+  qsort(this->regs, this->reg_count, sizeof(I32CTT_PollRegister), poll_compare);
+
+  // One group per node and mode, the shortest period first
+  this->group_count = 0;
+  for(i = 0; i < this->reg_count; i++) {
+    r = &this->regs[i];
+    if(this->group_count == 0 || g->node != r->node || g->mode != r->mode) {
+      g = &this->groups[this->group_count++];
+      memset(g, 0, sizeof(I32CTT_PollGroup));
+      g->node = r->node;
+      g->mode = r->mode;
+      g->first_reg = i;
+      g->base = r->period;
+    }
+    g->reg_count++;
+  }
+
+  // Group i of n starts i/n of its base period in, whatever the base
+  for(i = 0; i < this->group_count; i++) {
+    g = &this->groups[i];
+    g->due = now+(uint32_t)((uint64_t)g->base*i/this->group_count);
+    for(j = 0; j < g->reg_count; j++)
+      this->regs[g->first_reg+j].due = g->due;
+  }
+  this->in_flight = 0;
+}
+
+/*
+ * Frames waiting for an answer at once, each to a different node. More
+ * than one only suits lower interfaces that do not lose answers while
+ * they send.
+ */
+void I32CTT_PollPlanner::set_max_in_flight(uint8_t count) {
+  this->max_in_flight = count > 0 ? count : 1;
+}
+
+void I32CTT_PollPlanner::set_answer_timeout(uint32_t ms) {
+  this->answer_timeout = ms > 0 ? ms : POLL_ANSWER_TIMEOUT;
+}
+
+/*
+ * Call after every run() of the controller: the master keeps only the
+ * last answer parsed.
+ */
+void I32CTT_PollPlanner::update() {
+  uint32_t now = millis();
+
+  if(this->controller->master.available(CMD_AR))
+    take_answer();
+  expire(now);
+
+  while(this->in_flight < this->max_in_flight && this->iface->tx_size == 0 && this->iface->available()) {
+    if(!send_next(now))
+      break;
+  }
+}
+
+uint16_t I32CTT_PollPlanner::get_register_count() {
+  return this->reg_count;
+}
+
+I32CTT_PollRegister *I32CTT_PollPlanner::get_register_at(uint16_t idx) {
+  return idx < this->reg_count ? &this->regs[idx] : NULL;
+}
+
+/*
+ * Mean ms between the answers of a register, 0 before its second one.
+ */
+uint32_t I32CTT_PollPlanner::get_achieved_period(uint16_t idx) {
+  I32CTT_PollRegister *r = get_register_at(idx);
+
+  if(r == NULL || r->answers < 2)
+    return 0;
+  return (r->updated-r->first)/(r->answers-1);
+}
+
+uint16_t I32CTT_PollPlanner::get_group_count() {
+  return this->group_count;
+}
+
+I32CTT_PollStats *I32CTT_PollPlanner::get_stats() {
+  return &this->stats;
+}
+
+/*
+ * Stores the values of the CMD_AR in the interface's rx_buffer in the
+ * registers of the group waiting for it, found by source node and mode.
+ */
+void I32CTT_PollPlanner::take_answer() {
+  I32CTT_PollGroup *g = NULL;
+  I32CTT_PollRegister *r;
+  uint8_t *ar = this->iface->rx_buffer;
+  uint16_t src = this->iface->get_src();
+  uint32_t now = millis();
+  I32CTT_Size_t records = this->controller->master.records_available();
+  I32CTT_Size_t i;
+  uint16_t reg;
+  uint16_t j;
+
+  for(j = 0; j < this->group_count; j++) {
+    if(!this->groups[j].in_flight || this->groups[j].mode != ar[1])
+      continue;
+    if(src != 0 && this->groups[j].node != src)
+      continue; // Interfaces without addresses report 0, take the oldest
+    if(g == NULL || (int32_t)(this->groups[j].sent-g->sent) < 0)
+      g = &this->groups[j];
+  }
+  if(g == NULL)
+    return; // Given up already, or not ours
+
+  for(i = 0; i < records; i++) {
+    reg = I32CTT_Controller::get_reg(ar, CMD_AR, i);
+    for(j = 0; j < g->reg_count && this->regs[g->first_reg+j].reg != reg; j++);
+    if(j == g->reg_count)
+      continue;
+    r = &this->regs[g->first_reg+j];
+    r->value = I32CTT_Controller::get_data(ar, CMD_AR, i);
+    if(r->answers == 0)
+      r->first = now;
+    r->updated = now;
+    r->answers++;
+  }
+  g->in_flight = 0;
+  this->in_flight--;
+  this->stats.answers++;
+}
+
+void I32CTT_PollPlanner::expire(uint32_t now) {
+  uint16_t i;
+
+  for(i = 0; i < this->group_count && this->in_flight > 0; i++) {
+    if(!this->groups[i].in_flight || now-this->groups[i].sent <= this->answer_timeout)
+      continue;
+    this->groups[i].in_flight = 0;
+    this->in_flight--;
+    this->stats.timeouts++;
+  }
+}
+
+/*
+ * 1 if the register is due, or with early set not due yet but within
+ * POLL_EARLY_PERCENT of its period.
+ */
+uint8_t I32CTT_PollPlanner::take_due(I32CTT_PollRegister *reg, uint32_t now, uint8_t early) {
+  if(early)
+    return (int32_t)(reg->due-now) > 0 &&
+      (int32_t)(reg->due-now) <= (int32_t)((uint64_t)reg->period*POLL_EARLY_PERCENT/100);
+  return (int32_t)(now-reg->due) >= 0;
+}
+
+void I32CTT_PollPlanner::update_due(I32CTT_PollGroup *group) {
+  uint32_t due;
+  uint16_t i;
+
+  group->due = this->regs[group->first_reg].due;
+  for(i = 1; i < group->reg_count; i++) {
+    due = this->regs[group->first_reg+i].due;
+    if((int32_t)(due-group->due) < 0)
+      group->due = due;
+  }
+}
+
+/*
+ * 1 if a frame to the node of the group waits for an answer, whatever
+ * its mode. plan() leaves the groups of a node next to each other.
+ */
+uint8_t I32CTT_PollPlanner::node_busy(uint16_t idx) {
+  uint16_t node = this->groups[idx].node;
+  uint16_t i;
+
+  for(i = idx; i > 0 && this->groups[i-1].node == node; i--);
+  for(; i < this->group_count && this->groups[i].node == node; i++) {
+    if(this->groups[i].in_flight)
+      return 1;
+  }
+  return 0;
+}
+
+/*
+ * Sends a frame to the most overdue group that is due and whose node has
+ * no frame waiting: its registers due first, then those due soon.
+ * Returns 0 if none is due.
+ */
+uint8_t I32CTT_PollPlanner::send_next(uint32_t now) {
+  I32CTT_PollGroup *g = NULL;
+  I32CTT_PollRegister *r;
+  I32CTT_Size_t max = this->controller->master.max_records(CMD_R);
+  I32CTT_Size_t count = 0;
+  uint32_t missed;
+  uint16_t due_end;
+  uint16_t i;
+
+  for(i = 0; i < this->group_count; i++) {
+    if((int32_t)(now-this->groups[i].due) < 0 || node_busy(i))
+      continue;
+    if(g == NULL || (int32_t)(this->groups[i].due-g->due) < 0)
+      g = &this->groups[i];
+  }
+  if(g == NULL || max == 0)
+    return 0;
+
+  this->iface->set_dst(g->node);
+  this->controller->master.set_mode(g->mode);
+  for(i = 0; i < g->reg_count && count < max; i++) {
+    if(take_due(&this->regs[g->first_reg+i], now, 0)) {
+      this->controller->master.read_record(this->regs[g->first_reg+i].reg);
+      count++;
+    }
+  }
+  due_end = i;
+  for(i = 0; i < g->reg_count && count < max; i++) {
+    r = &this->regs[g->first_reg+i];
+    if(!take_due(r, now, 1))
+      continue;
+    this->controller->master.read_record(r->reg);
+    count++;
+    r->due += r->period;
+  }
+
+  // Only now, or the early pass would take them again
+  for(i = 0; i < due_end; i++) {
+    r = &this->regs[g->first_reg+i];
+    if(!take_due(r, now, 0))
+      continue;
+    missed = (now-r->due)/r->period;
+    r->due += (missed+1)*r->period;
+    this->stats.late += missed;
+  }
+  update_due(g); // Registers that did not fit keep it due
+  if(count == 0)
+    return 1;
+
+  this->controller->master.try_send();
+  g->in_flight = 1;
+  g->sent = now;
+  this->in_flight++;
+  this->stats.frames++;
+  this->stats.records += count;
+  return 1;
+}
@@ -0,0 +1,120 @@
+/*
+ *
+ * This file is part of I32CTT (Integer 32-bit Control & Telemetry Transport).
+ * Copyright (C) 2017 Mario Gomez / Hackerspace San Salvador.
+ *
+ * I32CTT is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * I32CTT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with I32CTT.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef I32CTT_PollPlanner_H
+#define I32CTT_PollPlanner_H
+
+#define POLL_MAX_IN_FLIGHT 1      // Frames waiting for an answer at once, see set_max_in_flight()
+#ifndef POLL_ANSWER_TIMEOUT
+#define POLL_ANSWER_TIMEOUT 250   // ms before a frame is given up
+#endif
+#ifndef POLL_EARLY_PERCENT
+#define POLL_EARLY_PERCENT 35     // Of its period a register can be read early to share a frame
+#endif
+
+struct I32CTT_PollRegister {
+  uint16_t node;
+  uint8_t mode;
+  uint16_t reg;
+  uint32_t period;      // ms asked
+  uint32_t due;         // millis() of its next read
+  uint32_t value;
+  uint32_t updated;     // millis() of the last answer
+  uint32_t first;       // millis() of the first answer
+  uint32_t answers;
+};
+
+/*
+ * Registers of one node and mode, polled together. The group is due when
+ * its first register is.
+ */
+struct I32CTT_PollGroup {
+  uint16_t node;
+  uint8_t mode;
+  uint16_t first_reg;   // Index of its first register, they are contiguous
+  uint16_t reg_count;
+  uint32_t base;        // ms, the shortest period of the group
+  uint32_t due;         // millis(), the earliest due of its registers
+  uint8_t in_flight;
+  uint32_t sent;        // millis()
+};
+
+struct I32CTT_PollStats {
+  uint32_t frames;      // CMD_R sent
+  uint32_t records;     // Registers in them
+  uint32_t answers;     // CMD_AR taken
+  uint32_t timeouts;    // Frames never answered
+  uint32_t late;        // Reads skipped, their register was a whole period behind
+};
+
+/*
+ * Poll planner on top of the controller's MasterInterface. Registers are
+ * added with the period they should be read at; plan() groups them by
+ * node and mode and spreads the first reads of all the groups evenly
+ * over their shortest period so nodes do not all answer at once.
+ *
+ * Every register keeps its own period. When a group is due, its frame
+ * carries the registers due and, while max_records() allows, those due
+ * within POLL_EARLY_PERCENT of their period, so registers of close
+ * periods share frames. The next read of a register is due one period
+ * after the last was, not after it was sent, so reading early does not
+ * raise its rate.
+ *
+ * update(), called after every run() of the controller, takes the answer
+ * the controller parsed, gives up frames after the answer timeout and
+ * sends the most overdue group while fewer than set_max_in_flight()
+ * frames wait for an answer, one per node whatever its endpoints (the
+ * node answers one at a time). A register a whole period behind skips
+ * the reads it missed instead of sending them in a burst.
+ * get_achieved_period() tells how often a register was really read.
+ */
+class I32CTT_PollPlanner {
+  public:
+    I32CTT_PollPlanner(I32CTT_Controller &controller, I32CTT_Interface &iface, uint16_t max_registers);
+    ~I32CTT_PollPlanner();
+    uint8_t add_register(uint16_t node, uint8_t mode, uint16_t reg, uint32_t period);
+    void plan();
+    void set_max_in_flight(uint8_t count);
+    void set_answer_timeout(uint32_t ms);
+    void update();
+    uint16_t get_register_count();
+    I32CTT_PollRegister *get_register_at(uint16_t idx);
+    uint32_t get_achieved_period(uint16_t idx);
+    uint16_t get_group_count();
+    I32CTT_PollStats *get_stats();
+  private:
+    void take_answer();
+    void expire(uint32_t now);
+    uint8_t send_next(uint32_t now);
+    uint8_t take_due(I32CTT_PollRegister *reg, uint32_t now, uint8_t early);
+    void update_due(I32CTT_PollGroup *group);
+    uint8_t node_busy(uint16_t idx);
+    I32CTT_Controller *controller;
+    I32CTT_Interface *iface;
+    I32CTT_PollRegister *regs;
+    uint16_t reg_count;
+    uint16_t max_registers;
+    I32CTT_PollGroup *groups;
+    uint16_t group_count;
+    uint8_t max_in_flight;
+    uint8_t in_flight;
+    uint32_t answer_timeout;
+    I32CTT_PollStats stats;
+};
+
+#endif
@@ -0,0 +1,365 @@
+/*
+ *
+ * This file is part of I32CTT (Integer 32-bit Control & Telemetry Transport).
+ * Copyright (C) 2017 Mario Gomez / Hackerspace San Salvador.
+ *
+ * I32CTT is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * I32CTT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with I32CTT.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Dashboards polling the same slaves through the gateway interface over
+ * a simulated radio. Every dashboard is a Unix socket client that reads
+ * a few registers of each slave in turn, overlapping but not equal sets
+ * (dashboard d reads d%3 to d%3+3), with one read per slave at a time.
+ *
+ * It runs with every read forwarded, with set_collapsing() and with a
+ * collapse window too, checks that each dashboard gets exactly the
+ * registers it asked for, and reports answers per second, p50/p99
+ * latency, frames sent on the radio and the collapse ratio (reads asked
+ * by the dashboards per read sent).
+ *
+ * Dashboards started together ask their reads at the same time, so the
+ * gateway merges them into one frame and never has a read in flight to
+ * attach a later one to. A last run staggers them: dashboard d starts
+ * d*stagger ms in and reads one round every ROUND_PERIOD ms, so its reads
+ * find the ones of the dashboards before it on the air and wait on their
+ * answers (collapsed).
+ *
+ * Usage: collapse_sim [slaves] [dashboards] [rounds] [window] [collapse window ms] [seed] [stagger ms]
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <vector>
+#include <map>
+#include <string>
+#include <algorithm>
+#include "Arduino.h"
+#include "I32CTT.h"
+#include "I32CTT_Arduino802154Interface.h"
+#include "I32CTT_NullEndpoint.h"
+#include "I32CTT_SimRadio.h"
+#include "I32CTT_SimMedium.h"
+#include "I32CTT_LinuxGatewayInterface.h"
+
+#define PAN_ID        0x0023
+#define GATEWAY_ADDR  0x0001
+#define DASH_REGS     4
+#define NULL_PATTERN  0xAAAAAAAA // I32CTT_NullEndpoint reads of registers other than 0
+#define UNIX_PATH     "/tmp/i32ctt_collapse_sim.sock"
+#define MAX_VIRTUAL_S 300     // Virtual seconds before a run is given up
+#define CLIENT_TIMEOUT 2000000 // us before a dashboard gives a read up
+#define ROUND_PERIOD  100     // ms between the rounds of a staggered dashboard
+
+struct Node {
+  I32CTT_SimRadio *radio;
+  I32CTT_Arduino802154Interface *iface;
+  I32CTT_Controller *controller;
+};
+
+struct Dashboard {
+  int fd;
+  uint8_t first_reg;
+  std::string out;
+  std::string in;
+  uint32_t issued;
+  uint32_t answered;
+  uint32_t valid;
+  uint32_t lost;
+  uint32_t next_slave;
+  uint64_t start;  // Virtual us it asks its first read
+  uint64_t period; // Virtual us between rounds, 0 to read as fast as answered
+  std::map<uint16_t, uint64_t> outstanding; // Node to send time
+};
+
+struct World {
+  I32CTT_SimMedium *medium;
+  std::vector<Node> nodes;
+};
+
+static uint32_t null_id;
+
+static Node create_node(I32CTT_SimMedium &medium, uint16_t addr, I32CTT_Interface *upper,
+    I32CTT_Arduino802154Interface *iface) {
+  Node node;
+
+  node.radio = new I32CTT_SimRadio(medium);
+  node.iface = iface != NULL ? iface : new I32CTT_Arduino802154Interface();
+  node.controller = new I32CTT_Controller(1);
+
+  node.iface->set_pan_id(PAN_ID);
+  node.iface->set_short_addr(addr);
+  node.iface->set_channel(C2405);
+
+  I32CTT_SimRadio::select(node.radio);
+  node.controller->add_mode_driver(*new I32CTT_NullEndpoint(null_id));
+  node.controller->set_interface(upper != NULL ? *upper : *node.iface);
+  node.controller->init();
+  return node;
+}
+
+static int connect_unix(const char *path) {
+  struct sockaddr_un addr;
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  if(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+    close(fd);
+    return -1;
+  }
+  fcntl(fd, F_SETFL, O_NONBLOCK);
+  return fd;
+}
+
+static void queue_frame(Dashboard &dash, uint16_t node, const uint8_t *msg, uint16_t len) {
+  uint8_t header[GW_FRAME_HEADER];
+
+  header[0] = len & 0xFF;
+  header[1] = len >> 8;
+  header[2] = node & 0xFF;
+  header[3] = node >> 8;
+  dash.out.append((char*)header, GW_FRAME_HEADER);
+  dash.out.append((const char*)msg, len);
+}
+
+static void flush_dashboard(Dashboard &dash) {
+  ssize_t count;
+
+  while(!dash.out.empty()) {
+    count = send(dash.fd, dash.out.data(), dash.out.size(), MSG_NOSIGNAL);
+    if(count <= 0)
+      break;
+    dash.out.erase(0, count);
+  }
+}
+
+/*
+ * Next whole frame the dashboard received, 0 if none.
+ */
+static uint8_t next_frame(Dashboard &dash, uint16_t *node, std::string *msg) {
+  char buf[4096];
+  ssize_t count;
+  uint16_t len;
+
+  while((count = recv(dash.fd, buf, sizeof(buf), 0)) > 0)
+    dash.in.append(buf, count);
+  if(dash.in.size() < GW_FRAME_HEADER)
+    return 0;
+  len = (uint8_t)dash.in[0] | ((uint8_t)dash.in[1] << 8);
+  if(dash.in.size() < (size_t)GW_FRAME_HEADER+len)
+    return 0;
+  *node = (uint8_t)dash.in[2] | ((uint8_t)dash.in[3] << 8);
+  msg->assign(dash.in, GW_FRAME_HEADER, len);
+  dash.in.erase(0, GW_FRAME_HEADER+len);
+  return 1;
+}
+
+static void step(World &world) {
+  for(size_t i = 0; i < world.nodes.size(); i++) {
+    I32CTT_SimRadio::select(world.nodes[i].radio);
+    world.nodes[i].controller->run();
+  }
+  world.medium->advance(100);
+}
+
+/*
+ * 1 if the answer holds the dashboard's registers, in order, with what
+ * the null endpoint returns for them.
+ */
+static uint8_t check_answer(Dashboard &dash, uint8_t *ar, uint16_t size) {
+  uint32_t expected;
+  uint16_t reg;
+  uint8_t i;
+
+  if(ar[0] != CMD_AR || ar[1] != 0 || I32CTT_Controller::reg_count(CMD_AR, size) != DASH_REGS ||
+    size != sizeof(I32CTT_Header)+DASH_REGS*sizeof(I32CTT_RegData))
+    return 0;
+  for(i = 0; i < DASH_REGS; i++) {
+    reg = I32CTT_Controller::get_reg(ar, CMD_AR, i);
+    expected = reg == 0 ? null_id : NULL_PATTERN;
+    if(reg != dash.first_reg+i || I32CTT_Controller::get_data(ar, CMD_AR, i) != expected)
+      return 0;
+  }
+  return 1;
+}
+
+static void pump_dashboard(Dashboard &dash, uint64_t now, uint32_t slaves, uint32_t reads, uint32_t window,
+    std::vector<uint64_t> &latency) {
+  uint8_t msg[sizeof(I32CTT_Header)+DASH_REGS*sizeof(I32CTT_Reg)];
+  std::map<uint16_t, uint64_t>::iterator it;
+  std::string answer;
+  uint32_t allowed = reads;
+  uint16_t node;
+  uint8_t j;
+
+  for(it = dash.outstanding.begin(); it != dash.outstanding.end();) {
+    if(now-it->second > CLIENT_TIMEOUT) {
+      dash.outstanding.erase(it++);
+      dash.lost++;
+    } else {
+      it++;
+    }
+  }
+
+  if(now < dash.start)
+    allowed = 0;
+  else if(dash.period > 0)
+    allowed = std::min<uint64_t>(reads, ((now-dash.start)/dash.period+1)*slaves);
+
+  while(dash.issued < allowed && dash.outstanding.size() < window) {
+    node = GATEWAY_ADDR+1+dash.next_slave;
+    if(dash.outstanding.count(node))
+      break; // Still waiting on this slave from the last round
+    msg[0] = CMD_R;
+    msg[1] = 0;
+    for(j = 0; j < DASH_REGS; j++)
+      I32CTT_Controller::put_reg(msg, dash.first_reg+j, CMD_R, j);
+    queue_frame(dash, node, msg, sizeof(msg));
+    dash.outstanding[node] = now;
+    dash.next_slave = (dash.next_slave+1)%slaves;
+    dash.issued++;
+  }
+  flush_dashboard(dash);
+
+  while(next_frame(dash, &node, &answer)) {
+    it = dash.outstanding.find(node);
+    if(it != dash.outstanding.end()) {
+      latency.push_back(now-it->second);
+      dash.outstanding.erase(it);
+      dash.valid += check_answer(dash, (uint8_t*)answer.data(), answer.size());
+    }
+    dash.answered++;
+  }
+}
+
+static void run(const char *name, uint8_t collapsing, uint16_t collapse_window, uint32_t stagger,
+    uint32_t slaves, uint32_t dashboards, uint32_t rounds, uint32_t window, uint32_t seed) {
+  I32CTT_SimMedium medium(seed);
+  I32CTT_SimLink link;
+  I32CTT_Arduino802154Interface *radio_iface = new I32CTT_Arduino802154Interface();
+  I32CTT_LinuxGatewayInterface gateway(*radio_iface);
+  I32CTT_GatewayStats *stats;
+  std::vector<Dashboard> dashes;
+  std::vector<uint64_t> latency;
+  World world;
+  uint64_t begin;
+  uint32_t reads = rounds*slaves;
+  uint32_t done;
+  uint32_t issued = 0;
+  uint32_t answered = 0;
+  uint32_t valid = 0;
+  uint32_t lost = 0;
+  uint32_t i;
+
+  link.connected = 1;
+  link.loss = 0.0;
+  link.lqi = 0xFF;
+  link.rssi = -60;
+  link.latency_us = 0;
+  medium.set_default_link(link);
+  world.medium = &medium;
+
+  gateway.set_collapsing(collapsing);
+  gateway.set_collapse_window(collapse_window);
+  if(!gateway.listen_unix(UNIX_PATH)) {
+    fprintf(stderr, "listen: %s\n", strerror(errno));
+    exit(1);
+  }
+  world.nodes.push_back(create_node(medium, GATEWAY_ADDR, &gateway, radio_iface));
+  for(i = 0; i < slaves; i++)
+    world.nodes.push_back(create_node(medium, GATEWAY_ADDR+1+i, NULL, NULL));
+
+  for(i = 0; i < dashboards; i++) {
+    Dashboard dash;
+    dash.fd = connect_unix(UNIX_PATH);
+    dash.first_reg = i%3;
+    dash.issued = 0;
+    dash.answered = 0;
+    dash.valid = 0;
+    dash.lost = 0;
+    dash.next_slave = 0;
+    dash.start = medium.now()+i*stagger*1000ULL;
+    dash.period = stagger > 0 ? ROUND_PERIOD*1000ULL : 0;
+    if(dash.fd < 0) {
+      fprintf(stderr, "connect: %s\n", strerror(errno));
+      exit(1);
+    }
+    dashes.push_back(dash);
+  }
+
+  begin = medium.now();
+  do {
+    for(i = 0; i < dashboards; i++)
+      pump_dashboard(dashes[i], medium.now(), slaves, reads, window, latency);
+    step(world);
+    done = 0;
+    for(i = 0; i < dashboards; i++)
+      done += dashes[i].issued >= reads && dashes[i].outstanding.empty();
+  } while(done < dashboards && medium.now()-begin < MAX_VIRTUAL_S*1000000ULL);
+
+  for(i = 0; i < dashboards; i++) {
+    issued += dashes[i].issued;
+    answered += dashes[i].answered;
+    valid += dashes[i].valid;
+    lost += dashes[i].lost;
+    close(dashes[i].fd);
+  }
+  stats = gateway.get_stats();
+  std::sort(latency.begin(), latency.end());
+
+  printf("%s:\n", name);
+  printf("  answered %u/%u valid %u lost %u, %.1f answers/s\n", answered, issued, valid, lost,
+    answered*1e6/(medium.now()-begin));
+  if(!latency.empty())
+    printf("  latency p50 %.1f ms p99 %.1f ms\n",
+      latency[latency.size()/2]/1000.0, latency[latency.size()*99/100]/1000.0);
+  printf("  radio reads %u, collapse ratio %.2f (collapsed %u merged %u), timeouts %u\n", stats->requests,
+    stats->requests > 0 ? (double)issued/stats->requests : 0.0, stats->collapsed, stats->merged, stats->timeouts);
+}
+
+int main(int argc, char **argv) {
+  uint32_t slaves = argc > 1 ? atoi(argv[1]) : 4;
+  uint32_t dashboards = argc > 2 ? atoi(argv[2]) : 6;
+  uint32_t rounds = argc > 3 ? atoi(argv[3]) : 50;
+  uint32_t window = argc > 4 ? atoi(argv[4]) : 2;
+  uint32_t collapse_window = argc > 5 ? atoi(argv[5]) : 5;
+  uint32_t seed = argc > 6 ? atoi(argv[6]) : 1;
+  uint32_t stagger = argc > 7 ? atoi(argv[7]) : 2;
+  char name[64];
+
+  if(slaves == 0 || dashboards == 0 || dashboards >= GW_MAX_CLIENTS || rounds == 0 || window == 0 ||
+    window > slaves || window > GW_CLIENT_MAX_PENDING || stagger == 0 || stagger*dashboards > ROUND_PERIOD) {
+    fprintf(stderr, "Usage: %s [slaves] [dashboards] [rounds] [window 1-slaves] [collapse window ms] [seed] "
+      "[stagger ms, 1 to %u/dashboards]\n", argv[0], ROUND_PERIOD);
+    return 1;
+  }
+
+  null_id = I32CTT_Endpoint::str2id("NUL");
+  printf("slaves %u dashboards %u rounds %u window %u\n", slaves, dashboards, rounds, window);
+  run("every read forwarded", 0, 0, 0, slaves, dashboards, rounds, window, seed);
+  run("collapsed", 1, 0, 0, slaves, dashboards, rounds, window, seed);
+  snprintf(name, sizeof(name), "collapsed, %u ms window", collapse_window);
+  run(name, 1, collapse_window, 0, slaves, dashboards, rounds, window, seed);
+  snprintf(name, sizeof(name), "collapsed, dashboards %u ms apart every %u ms", stagger, ROUND_PERIOD);
+  run(name, 1, 0, stagger, slaves, dashboards, rounds, window, seed);
+  return 0;
+}
@@ -0,0 +1,321 @@
+/*
+ *
+ * This file is part of I32CTT (Integer 32-bit Control & Telemetry Transport).
+ * Copyright (C) 2017 Mario Gomez / Hackerspace San Salvador.
+ *
+ * I32CTT is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * I32CTT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with I32CTT.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * I32CTT_LinuxGatewayInterface in front of a simulated radio network. A
+ * few clients over TCP and a Unix socket keep a window of read requests
+ * to random slaves and check every answer. The run is repeated with an
+ * extra client that floods requests and never reads its answers, the
+ * other clients should only lose the share of the radio it takes.
+ *
+ * Usage: gateway_sim [slaves] [clients] [transactions per client] [window] [seed]
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <vector>
+#include <map>
+#include <string>
+#include <algorithm>
+#include "Arduino.h"
+#include "I32CTT.h"
+#include "I32CTT_Arduino802154Interface.h"
+#include "I32CTT_NullEndpoint.h"
+#include "I32CTT_SimRadio.h"
+#include "I32CTT_SimMedium.h"
+#include "I32CTT_LinuxGatewayInterface.h"
+
+#define PAN_ID        0x0023
+#define GATEWAY_ADDR  0x0001
+#define REGISTERS     4
+#define UNIX_PATH     "/tmp/i32ctt_gateway_sim.sock"
+#define MAX_VIRTUAL_S 120 // Virtual seconds before the run is given up
+#define CLIENT_TIMEOUT 2000000 // us before a client gives a request up
+
+struct Node {
+  I32CTT_SimRadio *radio;
+  I32CTT_Arduino802154Interface *iface;
+  I32CTT_Controller *controller;
+};
+
+struct Client {
+  int fd;
+  uint8_t slow;         // Floods requests, never reads
+  std::string out;      // Frames not written yet
+  std::string in;
+  uint32_t issued;
+  uint32_t answered;
+  uint32_t valid;
+  uint32_t lost;
+  std::map<uint16_t, uint64_t> outstanding; // Sequence to send time
+};
+
+static Node create_node(I32CTT_SimMedium &medium, uint16_t addr, I32CTT_Interface *upper) {
+  Node node;
+
+  node.radio = new I32CTT_SimRadio(medium);
+  node.iface = new I32CTT_Arduino802154Interface();
+  node.controller = new I32CTT_Controller(1);
+
+  node.iface->set_pan_id(PAN_ID);
+  node.iface->set_short_addr(addr);
+  node.iface->set_channel(C2405);
+
+  I32CTT_SimRadio::select(node.radio);
+  node.controller->add_mode_driver(*new I32CTT_NullEndpoint(I32CTT_Endpoint::str2id("NUL")));
+  node.controller->set_interface(upper != NULL ? *upper : *node.iface);
+  node.controller->init();
+  return node;
+}
+
+static int connect_tcp(uint16_t port, int rcvbuf) {
+  struct sockaddr_in addr;
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+  if(rcvbuf > 0)
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+    close(fd);
+    return -1;
+  }
+  fcntl(fd, F_SETFL, O_NONBLOCK);
+  return fd;
+}
+
+static int connect_unix(const char *path) {
+  struct sockaddr_un addr;
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  if(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+    close(fd);
+    return -1;
+  }
+  fcntl(fd, F_SETFL, O_NONBLOCK);
+  return fd;
+}
+
+static void queue_request(Client &client, uint16_t node, uint16_t seq) {
+  uint8_t frame[GW_FRAME_HEADER+sizeof(I32CTT_Header)+REGISTERS*sizeof(I32CTT_Reg)];
+  uint8_t *msg = frame+GW_FRAME_HEADER;
+  uint16_t len = sizeof(frame)-GW_FRAME_HEADER;
+
+  frame[0] = len & 0xFF;
+  frame[1] = len >> 8;
+  frame[2] = node & 0xFF;
+  frame[3] = node >> 8;
+  msg[0] = CMD_R;
+  msg[1] = 0;
+  for(uint8_t j = 0; j < REGISTERS; j++)
+    I32CTT_Controller::put_reg(msg, j == 0 ? seq : j, CMD_R, j);
+  client.out.append((char*)frame, sizeof(frame));
+}
+
+static void pump_client(Client &client, uint64_t now, uint32_t transactions, uint32_t window,
+    uint32_t slaves, std::vector<uint64_t> &latency) {
+  char buf[4096];
+  ssize_t count;
+
+  std::map<uint16_t, uint64_t>::iterator it;
+
+  for(it = client.outstanding.begin(); it != client.outstanding.end();) {
+    if(now-it->second > CLIENT_TIMEOUT) {
+      client.outstanding.erase(it++);
+      client.lost++;
+    } else {
+      it++;
+    }
+  }
+
+  while(client.issued < transactions && (client.slow || client.outstanding.size() < window)) {
+    uint16_t seq = client.issued;
+    queue_request(client, GATEWAY_ADDR+1+rand()%slaves, seq);
+    if(!client.slow)
+      client.outstanding[seq] = now;
+    client.issued++;
+    if(client.slow && client.out.size() > sizeof(buf))
+      break;
+  }
+
+  while(!client.out.empty()) {
+    count = send(client.fd, client.out.data(), client.out.size(), MSG_NOSIGNAL);
+    if(count <= 0)
+      break;
+    client.out.erase(0, count);
+  }
+
+  if(client.slow)
+    return;
+
+  while((count = recv(client.fd, buf, sizeof(buf), 0)) > 0)
+    client.in.append(buf, count);
+  while(client.in.size() >= GW_FRAME_HEADER) {
+    const uint8_t *frame = (const uint8_t*)client.in.data();
+    uint16_t len = frame[0] | (frame[1] << 8);
+    if(client.in.size() < (size_t)GW_FRAME_HEADER+len)
+      break;
+    uint8_t *msg = (uint8_t*)frame+GW_FRAME_HEADER;
+    if(msg[0] == CMD_AR && I32CTT_Controller::reg_count(CMD_AR, len) == REGISTERS) {
+      it = client.outstanding.find(I32CTT_Controller::get_reg(msg, CMD_AR, 0));
+      if(it != client.outstanding.end()) {
+        latency.push_back(now-it->second);
+        client.outstanding.erase(it);
+        client.valid++;
+      }
+    }
+    client.answered++;
+    client.in.erase(0, GW_FRAME_HEADER+len);
+  }
+}
+
+static void run(uint8_t with_slow, uint32_t slaves, uint32_t clients, uint32_t transactions,
+    uint32_t window, uint32_t seed) {
+  I32CTT_SimMedium medium(seed);
+  I32CTT_SimLink link;
+  I32CTT_Arduino802154Interface *radio_iface = new I32CTT_Arduino802154Interface();
+  I32CTT_LinuxGatewayInterface gateway(*radio_iface);
+  I32CTT_GatewayStats *stats;
+  std::vector<Node> nodes;
+  std::vector<Client> conns;
+  std::vector<uint64_t> latency;
+  uint64_t begin;
+  uint32_t done;
+  uint32_t answered = 0;
+  uint32_t valid = 0;
+  uint32_t lost = 0;
+  uint32_t i;
+
+  srand(seed);
+  link.connected = 1;
+  link.loss = 0.0;
+  link.lqi = 0xFF;
+  link.rssi = -60;
+  link.latency_us = 0;
+  medium.set_default_link(link);
+
+  // The gateway node's controller sits on the gateway interface
+  if(!gateway.listen_tcp("127.0.0.1", 0) || !gateway.listen_unix(UNIX_PATH)) {
+    fprintf(stderr, "listen: %s\n", strerror(errno));
+    exit(1);
+  }
+  {
+    Node node;
+    node.radio = new I32CTT_SimRadio(medium);
+    node.iface = radio_iface;
+    node.controller = new I32CTT_Controller(1);
+    node.iface->set_pan_id(PAN_ID);
+    node.iface->set_short_addr(GATEWAY_ADDR);
+    node.iface->set_channel(C2405);
+    I32CTT_SimRadio::select(node.radio);
+    node.controller->add_mode_driver(*new I32CTT_NullEndpoint(I32CTT_Endpoint::str2id("NUL")));
+    node.controller->set_interface(gateway);
+    node.controller->init();
+    nodes.push_back(node);
+  }
+  for(i = 0; i < slaves; i++)
+    nodes.push_back(create_node(medium, GATEWAY_ADDR+1+i, NULL));
+
+  for(i = 0; i < clients+with_slow; i++) {
+    Client client;
+    client.slow = i >= clients;
+    client.fd = (i%2 == 1 && !client.slow) ? connect_unix(UNIX_PATH) :
+      connect_tcp(gateway.get_tcp_port(), client.slow ? 2048 : 0);
+    client.issued = 0;
+    client.answered = 0;
+    client.valid = 0;
+    client.lost = 0;
+    if(client.fd < 0) {
+      fprintf(stderr, "connect: %s\n", strerror(errno));
+      exit(1);
+    }
+    conns.push_back(client);
+  }
+
+  begin = medium.now();
+  do {
+    for(i = 0; i < conns.size(); i++)
+      pump_client(conns[i], medium.now(), conns[i].slow ? 1000000 : transactions, window, slaves, latency);
+    for(i = 0; i < nodes.size(); i++) {
+      I32CTT_SimRadio::select(nodes[i].radio);
+      nodes[i].controller->run();
+    }
+    medium.advance(100);
+    done = 0;
+    for(i = 0; i < clients; i++)
+      done += conns[i].issued >= transactions && conns[i].outstanding.empty();
+  } while(done < clients && medium.now()-begin < MAX_VIRTUAL_S*1000000ULL);
+
+  for(i = 0; i < clients; i++) {
+    answered += conns[i].answered;
+    valid += conns[i].valid;
+    lost += conns[i].lost;
+  }
+  stats = gateway.get_stats();
+  std::sort(latency.begin(), latency.end());
+
+  printf("%s:\n", with_slow ? "with a client that never reads" : "well behaved clients");
+  printf("  answered %u/%u valid %u lost %u, %.1f answers/s\n", answered, clients*transactions, valid,
+    lost, answered*1e6/(medium.now()-begin));
+  if(!latency.empty())
+    printf("  latency p50 %.1f ms p99 %.1f ms\n",
+      latency[latency.size()/2]/1000.0, latency[latency.size()*99/100]/1000.0);
+  printf("  gateway: clients %u requests %u answers %u timeouts %u throttled %u overflows %u\n",
+    gateway.get_client_count(), stats->requests, stats->answers, stats->timeouts,
+    stats->throttled, stats->overflows);
+  if(with_slow)
+    printf("  never read client: %u requests written\n", conns[clients].issued-(uint32_t)(conns[clients].out.size()/
+      (GW_FRAME_HEADER+sizeof(I32CTT_Header)+REGISTERS*sizeof(I32CTT_Reg))));
+
+  for(i = 0; i < conns.size(); i++)
+    close(conns[i].fd);
+}
+
+int main(int argc, char **argv) {
+  uint32_t slaves = argc > 1 ? atoi(argv[1]) : 4;
+  uint32_t clients = argc > 2 ? atoi(argv[2]) : 3;
+  uint32_t transactions = argc > 3 ? atoi(argv[3]) : 200;
+  uint32_t window = argc > 4 ? atoi(argv[4]) : 4;
+  uint32_t seed = argc > 5 ? atoi(argv[5]) : 1;
+
+  if(slaves == 0 || clients == 0 || clients >= GW_MAX_CLIENTS || window == 0 ||
+    window > GW_CLIENT_MAX_PENDING) {
+    fprintf(stderr, "Usage: %s [slaves] [clients] [transactions per client] [window 1-%u] [seed]\n",
+      argv[0], GW_CLIENT_MAX_PENDING);
+    return 1;
+  }
+
+  printf("slaves %u clients %u transactions %u window %u\n", slaves, clients, transactions, window);
+  run(0, slaves, clients, transactions, window, seed);
+  run(1, slaves, clients, transactions, window, seed);
+  return 0;
+}
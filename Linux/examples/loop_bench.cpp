@@ -0,0 +1,306 @@
+/*
+ *
+ * This file is part of I32CTT (Integer 32-bit Control & Telemetry Transport).
+ * Copyright (C) 2017 Mario Gomez / Hackerspace San Salvador.
+ *
+ * I32CTT is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * I32CTT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with I32CTT.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Many virtual UDP slaves on 127.0.0.1 served by one I32CTT_LinuxEventLoop,
+ * once with io_uring and once with epoll. A client in a child process
+ * keeps a window of read requests in flight to random slaves and checks
+ * every answer. Reports frames per second (requests plus answers), p50/p99
+ * round trip latency and the loop's system calls per frame.
+ *
+ * Then a SLIP stream check: the loop drives a pty master as a node would,
+ * I32CTT_LinuxSerialInterface talks to it through the slave and sends a
+ * corrupted frame first.
+ *
+ * Usage: loop_bench [slaves] [transactions] [window] [registers]
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <vector>
+#include <algorithm>
+#include "Arduino.h"
+#include "I32CTT.h"
+#include "I32CTT_NullEndpoint.h"
+#include "I32CTT_LinuxSerialInterface.h"
+#include "I32CTT_LinuxEventLoop.h"
+
+#define CLIENT_BATCH 64
+#define IDLE_TIMEOUT 2000 // ms without answers before the run is given up
+
+static const uint8_t bad_frame[] = {SLIP_END, CMD_R, 0, 0, 0, 0x12, 0x34, SLIP_END};
+
+struct Slave {
+  int fd;
+  struct sockaddr_in addr;
+  I32CTT_NullEndpoint *endpoint;
+  I32CTT_Controller *controller;
+  I32CTT_LinuxLoopInterface *iface;
+};
+
+static uint64_t now_ns() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec*1000000000ULL+ts.tv_nsec;
+}
+
+static void build_request(uint8_t *msg, uint16_t seq, uint32_t registers) {
+  msg[0] = CMD_R;
+  msg[1] = 0;
+  for(uint32_t j = 0; j < registers; j++)
+    I32CTT_Controller::put_reg(msg, j == 0 ? seq : j, CMD_R, j);
+}
+
+static uint16_t request_size(uint32_t registers) {
+  return sizeof(I32CTT_Header)+registers*sizeof(I32CTT_Reg);
+}
+
+/*
+ * Runs in the child, talks to the slaves with sendmmsg()/recvmmsg() from
+ * one unbound socket.
+ */
+static void client(std::vector<Slave> &slaves, uint32_t transactions, uint32_t window, uint32_t registers) {
+  static uint8_t requests[CLIENT_BATCH][LOOP_MTU_SIZE];
+  static uint8_t answers[CLIENT_BATCH][LOOP_MTU_SIZE];
+  struct mmsghdr msgs[CLIENT_BATCH];
+  struct iovec iov[CLIENT_BATCH];
+  std::vector<uint64_t> sent_at(65536);
+  std::vector<uint64_t> latency;
+  struct pollfd pfd;
+  uint64_t begin = now_ns();
+  uint64_t last_answer = begin;
+  uint64_t elapsed;
+  uint32_t answered = 0;
+  uint32_t valid = 0;
+  uint32_t issued = 0;
+  uint32_t count;
+  uint32_t i;
+  int fd;
+  int n;
+
+  fd = socket(AF_INET, SOCK_DGRAM, 0);
+  srand(1);
+  latency.reserve(transactions);
+  while(answered < transactions && now_ns()-last_answer < IDLE_TIMEOUT*1000000ULL) {
+    count = std::min(window-(issued-answered), transactions-issued);
+    count = std::min<uint32_t>(count, CLIENT_BATCH);
+    for(i = 0; i < count; i++) {
+      build_request(requests[i], issued+i, registers);
+      iov[i].iov_base = requests[i];
+      iov[i].iov_len = request_size(registers);
+      memset(&msgs[i], 0, sizeof(struct mmsghdr));
+      msgs[i].msg_hdr.msg_name = &slaves[rand()%slaves.size()].addr;
+      msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+      msgs[i].msg_hdr.msg_iov = &iov[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+      sent_at[(uint16_t)(issued+i)] = now_ns();
+    }
+    if(count > 0) {
+      n = sendmmsg(fd, msgs, count, MSG_DONTWAIT);
+      if(n > 0)
+        issued += n;
+    }
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    poll(&pfd, 1, 100);
+    for(i = 0; i < CLIENT_BATCH; i++) {
+      iov[i].iov_base = answers[i];
+      iov[i].iov_len = LOOP_MTU_SIZE;
+      memset(&msgs[i], 0, sizeof(struct mmsghdr));
+      msgs[i].msg_hdr.msg_iov = &iov[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    n = recvmmsg(fd, msgs, CLIENT_BATCH, MSG_DONTWAIT, NULL);
+    for(i = 0; n > 0 && i < (uint32_t)n; i++) {
+      uint64_t t = now_ns();
+      answered++;
+      latency.push_back(t-sent_at[I32CTT_Controller::get_reg(answers[i], CMD_AR, 0)]);
+      valid += answers[i][0] == CMD_AR && I32CTT_Controller::reg_count(CMD_AR, msgs[i].msg_len) == registers;
+    }
+    if(n > 0)
+      last_answer = now_ns();
+  }
+  elapsed = now_ns()-begin;
+
+  std::sort(latency.begin(), latency.end());
+  printf("  answered %u/%u valid %u, %.2f M frames/s\n", answered, transactions, valid,
+    2.0*answered*1e3/elapsed);
+  if(!latency.empty())
+    printf("  latency p50 %.1f us p99 %.1f us\n", latency[latency.size()/2]/1000.0,
+      latency[latency.size()*99/100]/1000.0);
+  fflush(stdout);
+}
+
+static uint8_t udp_run(I32CTT_LOOP_BACKEND backend, uint32_t slave_count, uint32_t transactions,
+    uint32_t window, uint32_t registers) {
+  I32CTT_LinuxEventLoop loop(backend);
+  std::vector<Slave> slaves(slave_count);
+  I32CTT_LoopStats *stats;
+  socklen_t len;
+  uint32_t i;
+  pid_t child;
+
+  if(!loop.init()) {
+    printf("%s: not available\n", backend == LOOP_IO_URING ? "io_uring" : "epoll");
+    return 1;
+  }
+  for(i = 0; i < slave_count; i++) {
+    Slave &slave = slaves[i];
+    slave.fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    memset(&slave.addr, 0, sizeof(slave.addr));
+    slave.addr.sin_family = AF_INET;
+    slave.addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    len = sizeof(slave.addr);
+    if(slave.fd < 0 || bind(slave.fd, (struct sockaddr*)&slave.addr, len) != 0 ||
+      getsockname(slave.fd, (struct sockaddr*)&slave.addr, &len) != 0) {
+      fprintf(stderr, "socket: %s\n", strerror(errno));
+      return 0;
+    }
+    slave.endpoint = new I32CTT_NullEndpoint(I32CTT_Endpoint::str2id("NUL"));
+    slave.controller = new I32CTT_Controller(1);
+    slave.iface = new I32CTT_LinuxLoopInterface(slave.fd);
+    slave.controller->add_mode_driver(*slave.endpoint);
+    if(!loop.add(*slave.controller, *slave.iface)) {
+      fprintf(stderr, "loop full at %u slaves\n", i);
+      return 0;
+    }
+    slave.controller->init();
+  }
+
+  printf("%s, %u slaves:\n", loop.get_backend() == LOOP_IO_URING ? "io_uring" : "epoll", slave_count);
+  fflush(stdout);
+  child = fork();
+  if(child == 0) {
+    client(slaves, transactions, window, registers);
+    _exit(0);
+  }
+  while(waitpid(child, NULL, WNOHANG) == 0)
+    loop.run(100);
+
+  stats = loop.get_stats();
+  printf("  loop: %.3f syscalls per frame, %.1f frames per iteration, rearms %u, dropped rx %u tx %u\n",
+    stats->rx_frames+stats->tx_frames ? (double)stats->syscalls/(stats->rx_frames+stats->tx_frames) : 0.0,
+    stats->iterations ? (double)(stats->rx_frames+stats->tx_frames)/stats->iterations : 0.0,
+    stats->rearms, stats->rx_dropped, stats->tx_dropped);
+
+  // Controllers and endpoints are left to the process exit
+  for(i = 0; i < slave_count; i++) {
+    loop.remove(*slaves[i].iface);
+    close(slaves[i].fd);
+  }
+  return 1;
+}
+
+/*
+ * The loop plays the node on a pty master, the host opens the slave.
+ */
+static uint8_t slip_run(I32CTT_LOOP_BACKEND backend, uint32_t transactions, uint32_t registers) {
+  I32CTT_LinuxEventLoop loop(backend);
+  I32CTT_NullEndpoint endpoint(I32CTT_Endpoint::str2id("NUL"));
+  I32CTT_Controller node(1);
+  uint64_t last_answer;
+  uint32_t answered = 0;
+  uint32_t valid = 0;
+  uint32_t issued = 0;
+  int master;
+
+  if(!loop.init())
+    return 1;
+  master = posix_openpt(O_RDWR | O_NOCTTY);
+  if(master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+    fprintf(stderr, "pty: %s\n", strerror(errno));
+    return 0;
+  }
+  fcntl(master, F_SETFL, O_NONBLOCK);
+
+  I32CTT_LinuxLoopInterface iface(master, LOOP_SLIP);
+  I32CTT_LinuxSerialInterface host(ptsname(master));
+  node.add_mode_driver(endpoint);
+  loop.add(node, iface);
+  node.init();
+  host.init();
+  if(host.get_fd() < 0 || write(host.get_fd(), bad_frame, sizeof(bad_frame)) != sizeof(bad_frame)) {
+    fprintf(stderr, "%s: %s\n", ptsname(master), strerror(errno));
+    return 0;
+  }
+
+  last_answer = now_ns();
+  while(answered < transactions && now_ns()-last_answer < IDLE_TIMEOUT*1000000ULL) {
+    while(issued-answered < 16 && issued < transactions && host.available()) {
+      build_request(host.tx_buffer, issued, registers);
+      host.tx_size = request_size(registers);
+      host.send();
+      issued++;
+    }
+    host.flush();
+    loop.run(10);
+    for(;;) {
+      host.update();
+      if(!host.data_available())
+        break;
+      answered++;
+      last_answer = now_ns();
+      valid += host.rx_buffer[0] == CMD_AR && I32CTT_Controller::reg_count(CMD_AR, host.rx_size) == registers &&
+        I32CTT_Controller::get_reg(host.rx_buffer, CMD_AR, 0) == (uint16_t)(answered-1);
+    }
+  }
+
+  printf("slip over pty, %s: answered %u/%u in order %u, corrupted frames dropped %u\n",
+    loop.get_backend() == LOOP_IO_URING ? "io_uring" : "epoll", answered, transactions, valid,
+    loop.get_stats()->rx_dropped);
+  loop.remove(iface);
+  close(master);
+  return answered == transactions && valid == transactions;
+}
+
+int main(int argc, char **argv) {
+  uint32_t slave_count = argc > 1 ? atoi(argv[1]) : 1000;
+  uint32_t transactions = argc > 2 ? atoi(argv[2]) : 1000000;
+  uint32_t window = argc > 3 ? atoi(argv[3]) : 256;
+  uint32_t registers = argc > 4 ? atoi(argv[4]) : 8;
+  uint8_t result = 1;
+
+  if(slave_count == 0 || slave_count > LOOP_MAX_INTERFACES || transactions == 0 || window == 0 ||
+    window > 60000 || registers == 0 || registers > (LOOP_MTU_SIZE-sizeof(I32CTT_Header))/sizeof(I32CTT_RegData)) {
+    fprintf(stderr, "Usage: %s [slaves 1-%u] [transactions] [window] [registers 1-%u]\n", argv[0],
+      LOOP_MAX_INTERFACES, (unsigned)((LOOP_MTU_SIZE-sizeof(I32CTT_Header))/sizeof(I32CTT_RegData)));
+    return 1;
+  }
+  printf("transactions %u window %u registers %u, %ld CPUs\n", transactions, window, registers,
+    sysconf(_SC_NPROCESSORS_ONLN));
+
+  result &= udp_run(LOOP_IO_URING, slave_count, transactions, window, registers);
+  result &= udp_run(LOOP_EPOLL, slave_count, transactions, window, registers);
+  result &= slip_run(LOOP_IO_URING, 1000, registers);
+  result &= slip_run(LOOP_EPOLL, 1000, registers);
+  return result ? 0 : 1;
+}
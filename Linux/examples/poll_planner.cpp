@@ -0,0 +1,303 @@
+/*
+ *
+ * This file is part of I32CTT (Integer 32-bit Control & Telemetry Transport).
+ * Copyright (C) 2017 Mario Gomez / Hackerspace San Salvador.
+ *
+ * I32CTT is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * I32CTT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with I32CTT.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A master polling a fleet of simulated slaves, each with its own set of
+ * registers and periods. It runs once the naive way, one CMD_R per
+ * register when it is due and one request on the air, then with
+ * I32CTT_PollPlanner and one request on the air. An in flight count over
+ * 1 adds a run with the planner pipelined to several nodes: on the half
+ * duplex radio it sends no more frames and loses answers. A last run
+ * stalls the master for LATE_STALL ms every STALL_EVERY ms, so groups
+ * come up more than 65% of a period late. For each run it reports frames
+ * per second, registers per frame, how the achieved read rates compare
+ * to the requested ones and registers asked twice in one frame.
+ *
+ * Usage: poll_planner [slaves] [max registers per slave] [virtual seconds] [in flight] [seed]
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include "Arduino.h"
+#include "I32CTT.h"
+#include "I32CTT_Arduino802154Interface.h"
+#include "I32CTT_NullEndpoint.h"
+#include "I32CTT_PollPlanner.h"
+#include "I32CTT_SimRadio.h"
+#include "I32CTT_SimMedium.h"
+
+#define PAN_ID          0x0023
+#define MASTER_ADDR     0x0001
+#define ANSWER_TIMEOUT  250 // ms, also the naive master's
+#define STALL_EVERY     10000 // ms
+#define LATE_STALL      1500  // ms, 75% of the shortest period
+
+static const uint32_t periods[] = {2000, 3000, 5000, 10000, 20000}; // ms
+
+struct Node {
+  I32CTT_SimRadio *radio;
+  I32CTT_Arduino802154Interface *iface;
+  I32CTT_Controller *controller;
+};
+
+struct Wanted {
+  uint16_t node;
+  uint16_t reg;
+  uint32_t period;
+};
+
+struct Naive {
+  uint32_t due;         // ms
+  uint32_t answers;
+  uint32_t first;
+  uint32_t updated;
+};
+
+static Node create_node(I32CTT_SimMedium &medium, uint16_t addr) {
+  Node node;
+
+  node.radio = new I32CTT_SimRadio(medium);
+  node.iface = new I32CTT_Arduino802154Interface();
+  node.controller = new I32CTT_Controller(1);
+
+  node.iface->set_pan_id(PAN_ID);
+  node.iface->set_short_addr(addr);
+  node.iface->set_channel(C2405);
+
+  I32CTT_SimRadio::select(node.radio);
+  // The master needs an endpoint too, answers for modes it does not have are dropped
+  node.controller->add_mode_driver(*new I32CTT_NullEndpoint(I32CTT_Endpoint::str2id("NUL")));
+  node.controller->set_interface(*node.iface);
+  node.controller->enable_scheduler();
+  node.controller->init();
+  return node;
+}
+
+static void step(I32CTT_SimMedium &medium, std::vector<Node> &nodes) {
+  for(size_t i = 0; i < nodes.size(); i++) {
+    I32CTT_SimRadio::select(nodes[i].radio);
+    nodes[i].controller->run();
+  }
+  medium.advance(100);
+}
+
+static void create_fleet(I32CTT_SimMedium &medium, std::vector<Node> &nodes, uint32_t slaves) {
+  I32CTT_SimLink link;
+  uint32_t i;
+
+  link.connected = 1;
+  link.loss = 0.0;
+  link.lqi = 0xFF;
+  link.rssi = -60;
+  link.latency_us = 0;
+  medium.set_default_link(link);
+  for(i = 0; i <= slaves; i++)
+    nodes.push_back(create_node(medium, MASTER_ADDR+i));
+}
+
+/*
+ * Requested over achieved rate of each register: mean, and the share of
+ * registers read at least 90% as often as asked.
+ */
+static void print_rates(const char *name, uint32_t seconds, uint32_t frames, uint32_t records,
+    uint32_t timeouts, const std::vector<Wanted> &wanted, const std::vector<uint32_t> &achieved) {
+  double sum = 0.0;
+  uint32_t met = 0;
+  size_t i;
+
+  for(i = 0; i < wanted.size(); i++) {
+    double ratio = achieved[i] > 0 ? (double)wanted[i].period/achieved[i] : 0.0;
+    sum += ratio;
+    met += ratio >= 0.9;
+  }
+  printf("%s:\n", name);
+  printf("  %.1f frames/s, %.1f registers per frame, %u timeouts\n", (double)frames/seconds,
+    frames > 0 ? (double)records/frames : 0.0, timeouts);
+  printf("  achieved/requested rate %.2f on average, %.1f%% of registers at 90%% or more\n",
+    sum/wanted.size(), 100.0*met/wanted.size());
+}
+
+static void run_naive(uint32_t slaves, uint32_t seconds, uint32_t seed, const std::vector<Wanted> &wanted) {
+  I32CTT_SimMedium medium(seed);
+  std::vector<Node> nodes;
+  std::vector<Naive> state(wanted.size());
+  std::vector<uint32_t> achieved(wanted.size());
+  uint32_t frames = 0;
+  uint32_t timeouts = 0;
+  uint32_t sent = 0;
+  int32_t waiting = -1;
+  uint32_t now;
+  size_t next;
+  size_t i;
+
+  create_fleet(medium, nodes, slaves);
+  Node &master = nodes[0];
+  now = millis();
+  for(i = 0; i < wanted.size(); i++) {
+    state[i].due = now;
+    state[i].answers = 0;
+  }
+
+  while(medium.now() < (uint64_t)seconds*1000000) {
+    step(medium, nodes);
+    now = millis();
+    if(waiting >= 0 && master.controller->master.available(CMD_AR)) {
+      Naive &n = state[waiting];
+      if(n.answers == 0)
+        n.first = now;
+      n.updated = now;
+      n.answers++;
+      waiting = -1;
+    }
+    if(waiting >= 0 && now-sent > ANSWER_TIMEOUT) {
+      timeouts++;
+      waiting = -1;
+    }
+    if(waiting >= 0)
+      continue;
+
+    // The register that has been due the longest
+    next = wanted.size();
+    for(i = 0; i < wanted.size(); i++) {
+      if((int32_t)(now-state[i].due) >= 0 && (next == wanted.size() || (int32_t)(state[i].due-state[next].due) < 0))
+        next = i;
+    }
+    if(next == wanted.size())
+      continue;
+
+    I32CTT_SimRadio::select(master.radio);
+    master.iface->set_dst(wanted[next].node);
+    master.controller->master.set_mode(0);
+    master.controller->master.read_record(wanted[next].reg);
+    master.controller->master.try_send();
+    state[next].due = now+wanted[next].period;
+    waiting = next;
+    sent = now;
+    frames++;
+  }
+
+  for(i = 0; i < wanted.size(); i++)
+    achieved[i] = state[i].answers > 1 ? (state[i].updated-state[i].first)/(state[i].answers-1) : 0;
+  print_rates("naive, one register per request", seconds, frames, frames, timeouts, wanted, achieved);
+}
+
+/*
+ * Registers the CMD_R the planner just sent asks more than once.
+ */
+static uint32_t repeated_regs(I32CTT_Interface *iface, uint32_t records) {
+  uint32_t repeated = 0;
+  uint32_t a;
+  uint32_t b;
+
+  for(a = 0; a < records; a++) {
+    for(b = 0; b < a && I32CTT_Controller::get_reg(iface->tx_buffer, CMD_R, a) !=
+      I32CTT_Controller::get_reg(iface->tx_buffer, CMD_R, b); b++);
+    repeated += b < a;
+  }
+  return repeated;
+}
+
+static void run_planner(const char *name, uint32_t slaves, uint32_t seconds, uint32_t in_flight, uint32_t stall,
+    uint32_t seed, const std::vector<Wanted> &wanted) {
+  I32CTT_SimMedium medium(seed);
+  std::vector<Node> nodes;
+  std::vector<uint32_t> achieved(wanted.size());
+  I32CTT_PollStats *stats;
+  uint32_t frames = 0;
+  uint32_t records = 0;
+  uint32_t repeated = 0;
+  uint16_t i;
+  size_t j;
+
+  create_fleet(medium, nodes, slaves);
+  Node &master = nodes[0];
+  I32CTT_SimRadio::select(master.radio);
+  I32CTT_PollPlanner planner(*master.controller, *master.iface, wanted.size());
+  planner.set_max_in_flight(in_flight);
+  planner.set_answer_timeout(ANSWER_TIMEOUT);
+  for(j = 0; j < wanted.size(); j++)
+    planner.add_register(wanted[j].node, 0, wanted[j].reg, wanted[j].period);
+  planner.plan();
+  stats = planner.get_stats();
+
+  while(medium.now() < (uint64_t)seconds*1000000) {
+    step(medium, nodes);
+    if(stall > 0 && millis()%STALL_EVERY >= STALL_EVERY-stall)
+      continue; // The master is busy with something else
+    I32CTT_SimRadio::select(master.radio);
+    planner.update();
+    if(stats->frames == frames+1)
+      repeated += repeated_regs(master.iface, stats->records-records);
+    frames = stats->frames;
+    records = stats->records;
+  }
+
+  // plan() sorted the table, match the registers back
+  for(i = 0; i < planner.get_register_count(); i++) {
+    I32CTT_PollRegister *r = planner.get_register_at(i);
+    for(j = 0; j < wanted.size() && (wanted[j].node != r->node || wanted[j].reg != r->reg); j++);
+    achieved[j] = planner.get_achieved_period(i);
+  }
+  print_rates(name, seconds, stats->frames, stats->records, stats->timeouts, wanted, achieved);
+  printf("  %u groups, %u reads skipped late, %u registers asked twice in a frame\n", planner.get_group_count(),
+    stats->late, repeated);
+}
+
+int main(int argc, char **argv) {
+  uint32_t slaves = argc > 1 ? atoi(argv[1]) : 100;
+  uint32_t max_regs = argc > 2 ? atoi(argv[2]) : 24;
+  uint32_t seconds = argc > 3 ? atoi(argv[3]) : 100;
+  uint32_t in_flight = argc > 4 ? atoi(argv[4]) : 1;
+  uint32_t seed = argc > 5 ? atoi(argv[5]) : 1;
+  std::vector<Wanted> wanted;
+  char name[64];
+  uint32_t count;
+  uint32_t i;
+  uint32_t j;
+
+  if(slaves == 0 || slaves > 1000 || max_regs == 0 || seconds == 0 || in_flight == 0) {
+    fprintf(stderr, "Usage: %s [slaves] [max registers per slave] [virtual seconds] [in flight] [seed]\n",
+      argv[0]);
+    return 1;
+  }
+
+  srand(seed);
+  for(i = 0; i < slaves; i++) {
+    count = 1+rand()%max_regs;
+    for(j = 0; j < count; j++) {
+      Wanted w;
+      w.node = MASTER_ADDR+1+i;
+      w.reg = j;
+      w.period = periods[rand()%(sizeof(periods)/sizeof(periods[0]))];
+      wanted.push_back(w);
+    }
+  }
+
+  printf("slaves %u registers %u over %u virtual seconds\n", slaves, (unsigned)wanted.size(), seconds);
+  run_naive(slaves, seconds, seed, wanted);
+  run_planner("planner, one request on the air", slaves, seconds, 1, 0, seed, wanted);
+  if(in_flight > 1) {
+    snprintf(name, sizeof(name), "planner, %u nodes at once", in_flight);
+    run_planner(name, slaves, seconds, in_flight, 0, seed, wanted);
+  }
+  snprintf(name, sizeof(name), "planner, master stalled %u ms every %u s", LATE_STALL, STALL_EVERY/1000);
+  run_planner(name, slaves, seconds, 1, LATE_STALL, seed, wanted);
+  return 0;
+}
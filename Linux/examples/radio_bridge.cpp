@@ -0,0 +1,426 @@
+/*
+ *
+ * This file is part of I32CTT (Integer 32-bit Control & Telemetry Transport).
+ * Copyright (C) 2017 Mario Gomez / Hackerspace San Salvador.
+ *
+ * I32CTT is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * I32CTT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with I32CTT.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Radio to IP bridge: the gateway interface owns the 802.15.4 interface
+ * of the bridge node and serves local clients over a Unix socket. It
+ * discovers the slaves and their endpoints first, a client reads the
+ * directory from GW_LOCAL_NODE, then every client keeps a window of reads
+ * to random endpoints of the directory. Before the reads, the client finds
+ * which nodes host the TMP and RLY endpoints twice: with one FND to
+ * GW_LOCAL_NODE, answered from the bridge's index, and with one FND to
+ * each node of the directory, answered by the nodes.
+ *
+ * The bridge keeps one request on the air at a time, as the Python driver
+ * does, and answers are told apart by their source address. It does not
+ * pipeline requests to several slaves: the radio is half duplex, an
+ * answer that comes while the bridge transmits the next request runs out
+ * of MAC retries, and a pipelined bridge both lost answers and answered
+ * fewer per second than this one.
+ *
+ * Usage: radio_bridge [slaves] [clients] [transactions per client] [window] [seed]
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <vector>
+#include <map>
+#include <string>
+#include <algorithm>
+#include "Arduino.h"
+#include "I32CTT.h"
+#include "I32CTT_Arduino802154Interface.h"
+#include "I32CTT_NullEndpoint.h"
+#include "I32CTT_SimRadio.h"
+#include "I32CTT_SimMedium.h"
+#include "I32CTT_LinuxGatewayInterface.h"
+
+#define PAN_ID        0x0023
+#define BRIDGE_ADDR   0x0001
+#define ABSENT        2       // Addresses after the last slave that discovery also asks
+#define REGISTERS     4
+#define UNIX_PATH     "/tmp/i32ctt_radio_bridge.sock"
+#define MAX_VIRTUAL_S 300     // Virtual seconds before a phase is given up
+#define CLIENT_TIMEOUT 2000000 // us before a client gives a request up
+
+static const char *endpoint_names[] = {"NUL", "TMP", "RLY"};
+
+struct Node {
+  I32CTT_SimRadio *radio;
+  I32CTT_Arduino802154Interface *iface;
+  I32CTT_Controller *controller;
+};
+
+struct Target {
+  uint16_t node;
+  uint8_t endpoint;
+};
+
+struct Client {
+  int fd;
+  std::string out;
+  std::string in;
+  uint32_t issued;
+  uint32_t answered;
+  uint32_t valid;
+  uint32_t lost;
+  std::map<uint16_t, uint64_t> outstanding; // Sequence to send time
+};
+
+struct World {
+  I32CTT_SimMedium *medium;
+  std::vector<Node> nodes;
+};
+
+static Node create_node(I32CTT_SimMedium &medium, uint16_t addr, uint8_t endpoints, I32CTT_Interface *upper,
+    I32CTT_Arduino802154Interface *iface) {
+  Node node;
+  uint8_t i;
+
+  node.radio = new I32CTT_SimRadio(medium);
+  node.iface = iface != NULL ? iface : new I32CTT_Arduino802154Interface();
+  node.controller = new I32CTT_Controller(endpoints);
+
+  node.iface->set_pan_id(PAN_ID);
+  node.iface->set_short_addr(addr);
+  node.iface->set_channel(C2405);
+
+  I32CTT_SimRadio::select(node.radio);
+  for(i = 0; i < endpoints; i++)
+    node.controller->add_mode_driver(*new I32CTT_NullEndpoint(I32CTT_Endpoint::str2id(endpoint_names[i%3])));
+  node.controller->set_interface(upper != NULL ? *upper : *node.iface);
+  node.controller->init();
+  return node;
+}
+
+static int connect_unix(const char *path) {
+  struct sockaddr_un addr;
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  if(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+    close(fd);
+    return -1;
+  }
+  fcntl(fd, F_SETFL, O_NONBLOCK);
+  return fd;
+}
+
+static void queue_frame(Client &client, uint16_t node, const uint8_t *msg, uint16_t len) {
+  uint8_t header[GW_FRAME_HEADER];
+
+  header[0] = len & 0xFF;
+  header[1] = len >> 8;
+  header[2] = node & 0xFF;
+  header[3] = node >> 8;
+  client.out.append((char*)header, GW_FRAME_HEADER);
+  client.out.append((const char*)msg, len);
+}
+
+static void flush_client(Client &client) {
+  ssize_t count;
+
+  while(!client.out.empty()) {
+    count = send(client.fd, client.out.data(), client.out.size(), MSG_NOSIGNAL);
+    if(count <= 0)
+      break;
+    client.out.erase(0, count);
+  }
+}
+
+/*
+ * Next whole frame the client received, 0 if none.
+ */
+static uint8_t next_frame(Client &client, uint16_t *node, std::string *msg) {
+  char buf[4096];
+  ssize_t count;
+  uint16_t len;
+
+  while((count = recv(client.fd, buf, sizeof(buf), 0)) > 0)
+    client.in.append(buf, count);
+  if(client.in.size() < GW_FRAME_HEADER)
+    return 0;
+  len = (uint8_t)client.in[0] | ((uint8_t)client.in[1] << 8);
+  if(client.in.size() < (size_t)GW_FRAME_HEADER+len)
+    return 0;
+  *node = (uint8_t)client.in[2] | ((uint8_t)client.in[3] << 8);
+  msg->assign(client.in, GW_FRAME_HEADER, len);
+  client.in.erase(0, GW_FRAME_HEADER+len);
+  return 1;
+}
+
+static void step(World &world) {
+  for(size_t i = 0; i < world.nodes.size(); i++) {
+    I32CTT_SimRadio::select(world.nodes[i].radio);
+    world.nodes[i].controller->run();
+  }
+  world.medium->advance(100);
+}
+
+/*
+ * Reads the bridge's directory page by page, one target per endpoint.
+ */
+static uint8_t read_directory(World &world, Client &client, std::vector<Target> &targets) {
+  const uint16_t header = sizeof(I32CTT_CMD)+2*sizeof(I32CTT_Endpoint_t);
+  uint64_t begin = world.medium->now();
+  uint8_t request[2] = {CMD_LST, 0};
+  std::string msg;
+  uint16_t node;
+  uint16_t i;
+
+  queue_frame(client, GW_LOCAL_NODE, request, sizeof(request));
+  while(world.medium->now()-begin < MAX_VIRTUAL_S*1000000ULL) {
+    flush_client(client);
+    step(world);
+    while(next_frame(client, &node, &msg)) {
+      const uint8_t *lsta = (const uint8_t*)msg.data();
+      if(msg.size() < header || lsta[0] != CMD_LSTA)
+        continue;
+      if(node == GW_LOCAL_NODE) {
+        if(lsta[1] == 0xFF || lsta[2] > lsta[1])
+          return 1; // Past the last node
+        request[1] = lsta[2];
+        queue_frame(client, GW_LOCAL_NODE, request, sizeof(request));
+        continue;
+      }
+      printf("  node 0x%04X:", node);
+      for(i = 0; i < (msg.size()-header)/sizeof(I32CTT_Id); i++) {
+        Target target = {node, (uint8_t)i};
+        uint32_t id = I32CTT_Controller::get_id((uint8_t*)lsta, CMD_LSTA, i);
+        targets.push_back(target);
+        printf(" %u=%c%c%c", i, (char)id, (char)(id >> 8), (char)(id >> 16));
+      }
+      printf("\n");
+    }
+  }
+  return 0;
+}
+
+/*
+ * Finds the TMP and RLY endpoints with one FND to GW_LOCAL_NODE, or with
+ * one FND to each node of the targets after another. Returns how many
+ * were found, 0xFFFFFFFF if the answers did not come.
+ */
+static uint32_t find_hosts(World &world, Client &client, std::vector<Target> &targets, uint8_t local) {
+  uint8_t request[sizeof(I32CTT_CMD)+2*sizeof(I32CTT_Id)];
+  std::vector<uint16_t> nodes;
+  uint64_t begin = world.medium->now();
+  uint32_t found = 0;
+  size_t next = 0;
+  std::string msg;
+  uint16_t node;
+  uint16_t i;
+
+  request[0] = CMD_FND;
+  I32CTT_Controller::put_id(request, I32CTT_Endpoint::str2id("TMP"), CMD_FND, 0);
+  I32CTT_Controller::put_id(request, I32CTT_Endpoint::str2id("RLY"), CMD_FND, 1);
+  if(local) {
+    nodes.push_back(GW_LOCAL_NODE);
+  } else {
+    for(i = 0; i < targets.size(); i++) {
+      if(nodes.empty() || nodes.back() != targets[i].node)
+        nodes.push_back(targets[i].node);
+    }
+  }
+
+  queue_frame(client, nodes[next], request, sizeof(request));
+  while(world.medium->now()-begin < MAX_VIRTUAL_S*1000000ULL) {
+    flush_client(client);
+    step(world);
+    while(next_frame(client, &node, &msg)) {
+      const uint8_t *fnda = (const uint8_t*)msg.data();
+      if(msg.empty() || fnda[0] != CMD_FNDA)
+        continue;
+      for(i = 0; i < I32CTT_Controller::reg_count(CMD_FNDA, msg.size()); i++)
+        found += I32CTT_Controller::get_endpoint((uint8_t*)fnda, CMD_FNDA, i) != 0xFF;
+      if(local && node != GW_LOCAL_NODE)
+        continue; // The end frame comes last
+      if(++next == nodes.size()) {
+        printf("  find TMP,RLY %s: %u found in %.1f ms\n", local ? "from the index" : "node by node", found,
+          (world.medium->now()-begin)/1000.0);
+        return found;
+      }
+      queue_frame(client, nodes[next], request, sizeof(request));
+    }
+  }
+  return 0xFFFFFFFF;
+}
+
+static void pump_client(Client &client, uint64_t now, uint32_t transactions, uint32_t window,
+    std::vector<Target> &targets, std::vector<uint64_t> &latency) {
+  uint8_t msg[sizeof(I32CTT_Header)+REGISTERS*sizeof(I32CTT_Reg)];
+  std::map<uint16_t, uint64_t>::iterator it;
+  std::string answer;
+  uint16_t node;
+
+  for(it = client.outstanding.begin(); it != client.outstanding.end();) {
+    if(now-it->second > CLIENT_TIMEOUT) {
+      client.outstanding.erase(it++);
+      client.lost++;
+    } else {
+      it++;
+    }
+  }
+
+  while(client.issued < transactions && client.outstanding.size() < window) {
+    Target &target = targets[rand()%targets.size()];
+    uint16_t seq = client.issued;
+    msg[0] = CMD_R;
+    msg[1] = target.endpoint;
+    for(uint8_t j = 0; j < REGISTERS; j++)
+      I32CTT_Controller::put_reg(msg, j == 0 ? seq : j, CMD_R, j);
+    queue_frame(client, target.node, msg, sizeof(msg));
+    client.outstanding[seq] = now;
+    client.issued++;
+  }
+  flush_client(client);
+
+  while(next_frame(client, &node, &answer)) {
+    uint8_t *ar = (uint8_t*)answer.data();
+    if(ar[0] == CMD_AR && I32CTT_Controller::reg_count(CMD_AR, answer.size()) == REGISTERS) {
+      it = client.outstanding.find(I32CTT_Controller::get_reg(ar, CMD_AR, 0));
+      if(it != client.outstanding.end()) {
+        latency.push_back(now-it->second);
+        client.outstanding.erase(it);
+        client.valid++;
+      }
+    }
+    client.answered++;
+  }
+}
+
+static void run(uint32_t slaves, uint32_t clients, uint32_t transactions,
+    uint32_t window, uint32_t seed) {
+  I32CTT_SimMedium medium(seed);
+  I32CTT_SimLink link;
+  I32CTT_Arduino802154Interface *radio_iface = new I32CTT_Arduino802154Interface();
+  I32CTT_LinuxGatewayInterface bridge(*radio_iface);
+  I32CTT_GatewayStats *stats;
+  std::vector<Target> targets;
+  std::vector<Client> conns;
+  std::vector<uint64_t> latency;
+  World world;
+  uint64_t begin;
+  uint32_t done;
+  uint32_t answered = 0;
+  uint32_t valid = 0;
+  uint32_t lost = 0;
+  uint32_t i;
+
+  srand(seed);
+  link.connected = 1;
+  link.loss = 0.0;
+  link.lqi = 0xFF;
+  link.rssi = -60;
+  link.latency_us = 0;
+  medium.set_default_link(link);
+  world.medium = &medium;
+
+  if(!bridge.listen_unix(UNIX_PATH)) {
+    fprintf(stderr, "listen: %s\n", strerror(errno));
+    exit(1);
+  }
+  world.nodes.push_back(create_node(medium, BRIDGE_ADDR, 1, &bridge, radio_iface));
+  for(i = 0; i < slaves; i++)
+    world.nodes.push_back(create_node(medium, BRIDGE_ADDR+1+i, 1+i%3, NULL, NULL));
+
+  begin = medium.now();
+  bridge.discover(BRIDGE_ADDR+1, BRIDGE_ADDR+slaves+ABSENT);
+  while(bridge.discovering() && medium.now()-begin < MAX_VIRTUAL_S*1000000ULL)
+    step(world);
+  printf("  discovery: %u nodes %u endpoints in %.2f s, %u probes\n", bridge.get_node_count(),
+    bridge.get_index_count(), (medium.now()-begin)/1e6, bridge.get_stats()->probes);
+
+  for(i = 0; i < clients; i++) {
+    Client client;
+    client.fd = connect_unix(UNIX_PATH);
+    client.issued = 0;
+    client.answered = 0;
+    client.valid = 0;
+    client.lost = 0;
+    if(client.fd < 0) {
+      fprintf(stderr, "connect: %s\n", strerror(errno));
+      exit(1);
+    }
+    conns.push_back(client);
+  }
+  if(!read_directory(world, conns[0], targets) || targets.empty()) {
+    fprintf(stderr, "no directory\n");
+    exit(1);
+  }
+  printf("  directory: %u endpoints\n", (unsigned)targets.size());
+  if(find_hosts(world, conns[0], targets, 1) != find_hosts(world, conns[0], targets, 0))
+    fprintf(stderr, "index and nodes disagree\n");
+
+  begin = medium.now();
+  do {
+    for(i = 0; i < conns.size(); i++)
+      pump_client(conns[i], medium.now(), transactions, window, targets, latency);
+    step(world);
+    done = 0;
+    for(i = 0; i < clients; i++)
+      done += conns[i].issued >= transactions && conns[i].outstanding.empty();
+  } while(done < clients && medium.now()-begin < MAX_VIRTUAL_S*1000000ULL);
+
+  for(i = 0; i < clients; i++) {
+    answered += conns[i].answered;
+    valid += conns[i].valid;
+    lost += conns[i].lost;
+  }
+  stats = bridge.get_stats();
+  std::sort(latency.begin(), latency.end());
+
+  printf("  answered %u/%u valid %u lost %u, %.1f answers/s\n", answered, clients*transactions, valid,
+    lost, answered*1e6/(medium.now()-begin));
+  if(!latency.empty())
+    printf("  latency p50 %.1f ms p99 %.1f ms\n",
+      latency[latency.size()/2]/1000.0, latency[latency.size()*99/100]/1000.0);
+  printf("  bridge: requests %u answers %u timeouts %u node waits %u listings %u finds %u\n",
+    stats->requests, stats->answers, stats->timeouts, stats->node_waits, stats->listings, stats->finds);
+
+  for(i = 0; i < conns.size(); i++)
+    close(conns[i].fd);
+}
+
+int main(int argc, char **argv) {
+  uint32_t slaves = argc > 1 ? atoi(argv[1]) : 8;
+  uint32_t clients = argc > 2 ? atoi(argv[2]) : 4;
+  uint32_t transactions = argc > 3 ? atoi(argv[3]) : 200;
+  uint32_t window = argc > 4 ? atoi(argv[4]) : 4;
+  uint32_t seed = argc > 5 ? atoi(argv[5]) : 1;
+
+  if(slaves == 0 || slaves > GW_DIR_MAX_NODES || clients == 0 || clients >= GW_MAX_CLIENTS || window == 0 ||
+    window > GW_CLIENT_MAX_PENDING) {
+    fprintf(stderr, "Usage: %s [slaves 1-%u] [clients] [transactions per client] [window 1-%u] [seed]\n",
+      argv[0], GW_DIR_MAX_NODES, GW_CLIENT_MAX_PENDING);
+    return 1;
+  }
+
+  printf("slaves %u clients %u transactions %u window %u\n", slaves, clients, transactions, window);
+  run(slaves, clients, transactions, window, seed);
+  return 0;
+}
@@ -0,0 +1,226 @@
+/*
+ *
+ * This file is part of I32CTT (Integer 32-bit Control & Telemetry Transport).
+ * Copyright (C) 2017 Mario Gomez / Hackerspace San Salvador.
+ *
+ * I32CTT is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * I32CTT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with I32CTT.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * I32CTT_LinuxSerialInterface against a node running
+ * I32CTT_ArduinoStreamInterface in binary mode, through a pty pair instead
+ * of a USB serial adapter. The node owns the pty master, the host opens
+ * the slave like any /dev/ttyACM port. A corrupted frame is sent each way
+ * first, then the host keeps a window of read requests in flight and
+ * checks every answer. Reports transactions per second, p50/p99 latency
+ * and the host's read()/write() calls per frame.
+ *
+ * Usage: serial_pty [transactions] [window] [registers] [baud]
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <vector>
+#include <algorithm>
+#include "Arduino.h"
+#include "I32CTT.h"
+#include "I32CTT_ArduinoStreamInterface.h"
+#include "I32CTT_NullEndpoint.h"
+#include "I32CTT_LinuxSerialInterface.h"
+
+#define PTY_READ_SIZE 4096
+#define IDLE_TIMEOUT 1000 // ms without answers before the run is given up
+
+// A non-blocking file descriptor as an Arduino Stream, reads are buffered
+class FdStream: public Stream {
+  public:
+    int fd;
+    uint8_t buffer[PTY_READ_SIZE];
+    uint32_t pos;
+    uint32_t len;
+    uint64_t moved; // Bytes read or written so far
+    FdStream(int fd) {
+      this->fd = fd;
+      this->pos = 0;
+      this->len = 0;
+      this->moved = 0;
+    }
+    size_t write(uint8_t c) {
+      return write(&c, 1);
+    }
+    size_t write(const uint8_t *data, size_t size) {
+      ssize_t count = ::write(this->fd, data, size);
+
+      if(count <= 0)
+        return 0;
+      this->moved += count;
+      return count;
+    }
+    int availableForWrite() {
+      return PTY_READ_SIZE; // write() takes what fits and says so
+    }
+    int available() {
+      ssize_t count;
+
+      if(this->pos == this->len) {
+        count = ::read(this->fd, this->buffer, PTY_READ_SIZE);
+        this->pos = 0;
+        this->len = count > 0 ? count : 0;
+      }
+      return this->len-this->pos;
+    }
+    int read() {
+      if(available() <= 0)
+        return -1;
+      this->moved++;
+      return this->buffer[this->pos++];
+    }
+    int peek() {
+      return available() > 0 ? this->buffer[this->pos] : -1;
+    }
+    using Print::write;
+};
+
+static uint64_t now_ns() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec*1000000000ULL+ts.tv_nsec;
+}
+
+// Runs the node until it neither reads nor writes
+static void run_node(I32CTT_Controller &controller, FdStream &port) {
+  uint64_t before;
+
+  do {
+    before = port.moved;
+    controller.run();
+  } while(port.moved != before);
+}
+
+int main(int argc, char **argv) {
+  uint32_t transactions = argc > 1 ? atoi(argv[1]) : 100000;
+  uint32_t window = argc > 2 ? atoi(argv[2]) : 8;
+  uint32_t registers = argc > 3 ? atoi(argv[3]) : 8;
+  uint32_t baud = argc > 4 ? atoi(argv[4]) : 3000000;
+  const uint8_t bad_frame[] = {SLIP_END, CMD_R, 0, 0, 0, 0x12, 0x34, SLIP_END};
+  std::vector<uint64_t> sent_at(65536);
+  std::vector<uint64_t> latency;
+  I32CTT_SerialStats *stats;
+  uint64_t begin;
+  uint64_t elapsed;
+  uint64_t last_answer;
+  uint32_t issued = 0;
+  uint32_t answered = 0;
+  uint32_t valid = 0;
+  uint32_t j;
+  int master;
+
+  if(transactions == 0 || window == 0 || window > 60000 || registers == 0 ||
+    registers > (SERIAL_MTU_SIZE-sizeof(I32CTT_Header))/sizeof(I32CTT_RegData)) {
+    fprintf(stderr, "Usage: %s [transactions] [window] [registers 1-%u] [baud]\n", argv[0],
+      (unsigned)((SERIAL_MTU_SIZE-sizeof(I32CTT_Header))/sizeof(I32CTT_RegData)));
+    return 1;
+  }
+
+  master = posix_openpt(O_RDWR | O_NOCTTY);
+  if(master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+    fprintf(stderr, "pty: %s\n", strerror(errno));
+    return 1;
+  }
+  fcntl(master, F_SETFL, O_NONBLOCK);
+
+  FdStream port(master);
+  I32CTT_ArduinoStreamInterface node_iface(port, STREAM_BINARY);
+  I32CTT_NullEndpoint endpoint(I32CTT_Endpoint::str2id("NUL"));
+  I32CTT_Controller node(1);
+  I32CTT_LinuxSerialInterface host(ptsname(master), baud);
+
+  node.add_mode_driver(endpoint);
+  node.set_interface(node_iface);
+  node.init();
+  host.init();
+  if(host.get_fd() < 0) {
+    fprintf(stderr, "%s: %s\n", ptsname(master), strerror(errno));
+    return 1;
+  }
+  printf("transactions %u window %u registers %u baud %u, %s low latency %s\n", transactions, window,
+    registers, baud, ptsname(master), host.is_low_latency() ? "on" : "not supported");
+
+  // A bad CRC each way must be counted and skipped
+  if(write(master, bad_frame, sizeof(bad_frame)) != sizeof(bad_frame) ||
+    write(host.get_fd(), bad_frame, sizeof(bad_frame)) != sizeof(bad_frame)) {
+    fprintf(stderr, "write: %s\n", strerror(errno));
+    return 1;
+  }
+  run_node(node, port);
+  host.update();
+  host.data_available();
+  printf("corrupted frames: host rx errors %u, node rx errors %u\n",
+    host.get_stats()->rx_errors, node_iface.get_rx_errors());
+
+  begin = now_ns();
+  last_answer = begin;
+  while(answered < transactions && now_ns()-last_answer < IDLE_TIMEOUT*1000000ULL) {
+    // Host: top the window up, the first register carries the sequence
+    while(issued-answered < window && issued < transactions && host.available()) {
+      uint16_t seq = issued;
+      host.tx_buffer[0] = CMD_R;
+      host.tx_buffer[1] = 0;
+      for(j = 0; j < registers; j++)
+        I32CTT_Controller::put_reg(host.tx_buffer, j == 0 ? seq : j, CMD_R, j);
+      host.tx_size = sizeof(I32CTT_Header)+registers*sizeof(I32CTT_Reg);
+      sent_at[seq] = now_ns();
+      host.send();
+      issued++;
+    }
+
+    run_node(node, port);
+
+    // Host: one message per update(), as under a controller
+    for(;;) {
+      host.update();
+      if(!host.data_available())
+        break;
+      uint64_t t = now_ns();
+      uint16_t seq = I32CTT_Controller::get_reg(host.rx_buffer, CMD_AR, 0);
+      answered++;
+      last_answer = t;
+      latency.push_back(t-sent_at[seq]);
+      valid += host.rx_buffer[0] == CMD_AR &&
+        I32CTT_Controller::reg_count(CMD_AR, host.rx_size) == registers;
+    }
+  }
+  elapsed = now_ns()-begin;
+
+  stats = host.get_stats();
+  std::sort(latency.begin(), latency.end());
+  printf("answered %u/%u valid %u, %.0f transactions/s\n", answered, transactions, valid,
+    answered*1e9/elapsed);
+  if(!latency.empty())
+    printf("latency p50 %.1f us p99 %.1f us\n",
+      latency[latency.size()/2]/1000.0, latency[latency.size()*99/100]/1000.0);
+  printf("host: read() per frame %.3f, write() per frame %.3f, %.1f bytes per read, dropped %u\n",
+    stats->rx_frames ? (double)stats->rx_reads/stats->rx_frames : 0.0,
+    stats->tx_frames ? (double)stats->tx_writes/stats->tx_frames : 0.0,
+    stats->rx_reads ? (double)stats->rx_bytes/stats->rx_reads : 0.0, stats->tx_dropped);
+
+  close(master);
+  return 0;
+}
@@ -0,0 +1,335 @@
+/*
+ *
+ * This file is part of I32CTT (Integer 32-bit Control & Telemetry Transport).
+ * Copyright (C) 2017 Mario Gomez / Hackerspace San Salvador.
+ *
+ * I32CTT is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * I32CTT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with I32CTT.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * I32CTT_LinuxGatewayInterface in front of an I32CTT_LinuxShardPool. A
+ * child process serves N virtual UDP slaves with an event loop, node n on
+ * base port plus n. Every shard talks to them through its own UDP
+ * interface. Clients over a Unix socket keep a window of reads to random
+ * nodes and check every answer.
+ *
+ * The run is done with one shard, with all of them, and then with most
+ * requests going to the nodes of shard 0.
+ * Reports answers per second, p50/p99 latency and the shards' counters.
+ *
+ * Usage: shard_gateway [slaves] [shards] [clients] [transactions per client] [window] [base port]
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include "Arduino.h"
+#include "I32CTT.h"
+#include "I32CTT_NullEndpoint.h"
+#include "I32CTT_LinuxUDPInterface.h"
+#include "I32CTT_LinuxEventLoop.h"
+#include "I32CTT_LinuxGatewayInterface.h"
+#include "I32CTT_LinuxShardPool.h"
+
+#define REGISTERS    4
+#define UNIX_PATH    "/tmp/i32ctt_shard_gateway.sock"
+#define HOT_SHARE    90   // % of requests for shard 0's nodes in the skewed runs
+#define IDLE_TIMEOUT 2000 // ms without answers before a client gives up
+
+struct Client {
+  int fd;
+  std::string out;
+  std::string in;
+  uint32_t issued;
+  uint32_t answered;
+  uint32_t valid;
+  std::vector<uint64_t> sent_at; // By sequence, 0 once answered
+};
+
+static uint64_t now_ns() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec*1000000000ULL+ts.tv_nsec;
+}
+
+/*
+ * Child process: the slaves, never returns.
+ */
+static void serve_slaves(uint32_t slaves, uint16_t base) {
+  I32CTT_LinuxEventLoop loop;
+  struct sockaddr_in addr;
+  uint32_t i;
+  int fd;
+
+  if(!loop.init()) {
+    fprintf(stderr, "event loop: %s\n", strerror(errno));
+    _exit(1);
+  }
+  for(i = 1; i <= slaves; i++) {
+    fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(base+i);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(fd < 0 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+      fprintf(stderr, "port %u: %s\n", base+i, strerror(errno));
+      _exit(1);
+    }
+    I32CTT_Controller *controller = new I32CTT_Controller(1);
+    I32CTT_LinuxLoopInterface *iface = new I32CTT_LinuxLoopInterface(fd);
+    controller->add_mode_driver(*new I32CTT_NullEndpoint(I32CTT_Endpoint::str2id("NUL")));
+    loop.add(*controller, *iface);
+    controller->init();
+  }
+  for(;;)
+    loop.run(100);
+}
+
+static uint16_t pick_node(uint32_t slaves, uint32_t shards, uint8_t skewed) {
+  uint32_t hot = slaves/shards; // Nodes shards, 2*shards... belong to shard 0
+
+  if(skewed && shards > 1 && hot > 0 && (uint32_t)(rand()%100) < HOT_SHARE)
+    return shards*(1+rand()%hot);
+  return 1+rand()%slaves;
+}
+
+static void queue_request(Client &client, uint16_t node, uint16_t seq) {
+  uint8_t frame[GW_FRAME_HEADER+sizeof(I32CTT_Header)+REGISTERS*sizeof(I32CTT_Reg)];
+  uint8_t *msg = frame+GW_FRAME_HEADER;
+  uint16_t len = sizeof(frame)-GW_FRAME_HEADER;
+
+  frame[0] = len & 0xFF;
+  frame[1] = len >> 8;
+  frame[2] = node & 0xFF;
+  frame[3] = node >> 8;
+  msg[0] = CMD_R;
+  msg[1] = 0;
+  for(uint8_t j = 0; j < REGISTERS; j++)
+    I32CTT_Controller::put_reg(msg, j == 0 ? seq : j, CMD_R, j);
+  client.out.append((char*)frame, sizeof(frame));
+}
+
+/*
+ * Child process: the clients, prints what they saw.
+ */
+static void run_clients(uint32_t count, uint32_t transactions, uint32_t window, uint32_t slaves,
+    uint32_t shards, uint8_t skewed) {
+  std::vector<Client> clients(count);
+  std::vector<struct pollfd> fds(count);
+  std::vector<uint64_t> latency;
+  struct sockaddr_un addr;
+  uint64_t begin = now_ns();
+  uint64_t last_answer = begin;
+  uint64_t elapsed;
+  uint32_t answered = 0;
+  uint32_t valid = 0;
+  uint32_t done;
+  uint32_t i;
+  char buf[4096];
+  ssize_t n;
+
+  srand(1);
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, UNIX_PATH);
+  for(i = 0; i < count; i++) {
+    Client &client = clients[i];
+    client.fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(connect(client.fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+      fprintf(stderr, "connect: %s\n", strerror(errno));
+      _exit(1);
+    }
+    fcntl(client.fd, F_SETFL, O_NONBLOCK);
+    client.issued = 0;
+    client.answered = 0;
+    client.valid = 0;
+    client.sent_at.assign(transactions, 0);
+  }
+  latency.reserve(count*transactions);
+
+  do {
+    for(i = 0; i < count; i++) {
+      Client &client = clients[i];
+      while(client.issued < transactions && client.issued-client.answered < window) {
+        client.sent_at[client.issued] = now_ns();
+        queue_request(client, pick_node(slaves, shards, skewed), client.issued);
+        client.issued++;
+      }
+      while(!client.out.empty() && (n = send(client.fd, client.out.data(), client.out.size(), MSG_NOSIGNAL)) > 0)
+        client.out.erase(0, n);
+      fds[i].fd = client.fd;
+      fds[i].events = POLLIN;
+    }
+    poll(&fds[0], count, 100);
+
+    for(i = 0; i < count; i++) {
+      Client &client = clients[i];
+      while((n = recv(client.fd, buf, sizeof(buf), 0)) > 0)
+        client.in.append(buf, n);
+      while(client.in.size() >= GW_FRAME_HEADER) {
+        const uint8_t *frame = (const uint8_t*)client.in.data();
+        uint16_t len = frame[0] | (frame[1] << 8);
+        if(client.in.size() < (size_t)GW_FRAME_HEADER+len)
+          break;
+        const uint8_t *msg = frame+GW_FRAME_HEADER;
+        uint16_t seq = I32CTT_Controller::get_reg((uint8_t*)msg, CMD_AR, 0);
+        if(msg[0] == CMD_AR && I32CTT_Controller::reg_count(CMD_AR, len) == REGISTERS &&
+          seq < transactions && client.sent_at[seq] != 0) {
+          latency.push_back(now_ns()-client.sent_at[seq]);
+          client.sent_at[seq] = 0;
+          client.valid++;
+        }
+        client.answered++;
+        last_answer = now_ns();
+        client.in.erase(0, GW_FRAME_HEADER+len);
+      }
+    }
+
+    done = 0;
+    for(i = 0; i < count; i++)
+      done += clients[i].answered >= transactions;
+  } while(done < count && now_ns()-last_answer < IDLE_TIMEOUT*1000000ULL);
+  elapsed = now_ns()-begin;
+
+  for(i = 0; i < count; i++) {
+    answered += clients[i].answered;
+    valid += clients[i].valid;
+    close(clients[i].fd);
+  }
+  std::sort(latency.begin(), latency.end());
+  printf("  answered %u/%u valid %u, %.0f answers/s\n", answered, count*transactions, valid,
+    answered*1e9/elapsed);
+  if(!latency.empty())
+    printf("  latency p50 %.1f us p99 %.1f us\n", latency[latency.size()/2]/1000.0,
+      latency[latency.size()*99/100]/1000.0);
+  fflush(stdout);
+  _exit(answered == count*transactions && valid == answered ? 0 : 1);
+}
+
+static uint8_t run(uint32_t shard_count, uint8_t skewed, uint32_t slaves,
+    uint32_t clients, uint32_t transactions, uint32_t window, uint16_t base) {
+  I32CTT_LinuxShardPool pool;
+  I32CTT_LinuxGatewayInterface gateway(pool);
+  I32CTT_NullEndpoint endpoint(I32CTT_Endpoint::str2id("NUL"));
+  I32CTT_Controller controller(1);
+  std::vector<I32CTT_LinuxUDPInterface*> lowers;
+  std::vector<I32CTT_Controller*> masters;
+  std::vector<I32CTT_NullEndpoint*> endpoints;
+  I32CTT_ShardStats stats;
+  uint32_t i;
+  pid_t child;
+  int status;
+
+  for(i = 0; i < shard_count; i++) {
+    lowers.push_back(new I32CTT_LinuxUDPInterface(0, "127.0.0.1"));
+    masters.push_back(new I32CTT_Controller(1));
+    endpoints.push_back(new I32CTT_NullEndpoint(I32CTT_Endpoint::str2id("NUL")));
+    masters[i]->add_mode_driver(*endpoints[i]);
+    lowers[i]->init(); // The worker sleeps on the socket
+    if(!lowers[i]->set_node_base("127.0.0.1", base) ||
+      !pool.add_shard(*masters[i], *lowers[i], -1, lowers[i]->get_fd())) {
+      fprintf(stderr, "shard %u: %s\n", i, strerror(errno));
+      return 0;
+    }
+    masters[i]->init();
+  }
+  gateway.set_max_in_flight(GW_MAX_PENDING);
+  controller.add_mode_driver(endpoint);
+  controller.set_interface(gateway);
+  controller.init();
+  if(!gateway.listen_unix(UNIX_PATH)) {
+    fprintf(stderr, "listen: %s\n", strerror(errno));
+    return 0;
+  }
+
+  printf("%u shard%s, %s:\n", shard_count, shard_count > 1 ? "s" : "",
+    skewed ? "skewed to shard 0" : "uniform");
+  fflush(stdout);
+  child = fork();
+  if(child == 0)
+    run_clients(clients, transactions, window, slaves, shard_count, skewed);
+
+  if(!pool.start()) {
+    fprintf(stderr, "start: %s\n", strerror(errno));
+    return 0;
+  }
+  while(waitpid(child, &status, WNOHANG) == 0) {
+    controller.run();
+    pool.wait(gateway.get_epoll_fd(), 10);
+  }
+  pool.stop();
+
+  for(i = 0; i < shard_count; i++) {
+    pool.get_stats(i, &stats);
+    printf("  shard %u: jobs %u answers %u timeouts %u refused %u queue max %u sleeps %u\n", i,
+      stats.jobs, stats.answers, stats.timeouts, stats.refused, stats.queue_max, stats.sleeps);
+  }
+  printf("  gateway: requests %u answers %u timeouts %u\n", gateway.get_stats()->requests,
+    gateway.get_stats()->answers, gateway.get_stats()->timeouts);
+
+  // Shards' interfaces, controllers and endpoints are left to the process exit
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+int main(int argc, char **argv) {
+  uint32_t slaves = argc > 1 ? atoi(argv[1]) : 64;
+  uint32_t shards = argc > 2 ? atoi(argv[2]) : 4;
+  uint32_t clients = argc > 3 ? atoi(argv[3]) : 4;
+  uint32_t transactions = argc > 4 ? atoi(argv[4]) : 20000;
+  uint32_t window = argc > 5 ? atoi(argv[5]) : 16;
+  uint16_t base = argc > 6 ? atoi(argv[6]) : 47000;
+  uint8_t result = 1;
+  pid_t slave_pid;
+
+  if(slaves == 0 || slaves+base > 65535 || shards == 0 || shards > SHARD_MAX_SHARDS || clients == 0 ||
+    clients >= GW_MAX_CLIENTS || transactions == 0 || transactions > 65536 || window == 0 ||
+    window > GW_CLIENT_MAX_PENDING) {
+    fprintf(stderr, "Usage: %s [slaves] [shards 1-%u] [clients] [transactions per client 1-65536] "
+      "[window 1-%u] [base port]\n", argv[0], SHARD_MAX_SHARDS, GW_CLIENT_MAX_PENDING);
+    return 1;
+  }
+  printf("slaves %u clients %u transactions %u window %u, %ld CPUs\n", slaves, clients, transactions,
+    window, sysconf(_SC_NPROCESSORS_ONLN));
+  fflush(stdout);
+
+  slave_pid = fork();
+  if(slave_pid == 0)
+    serve_slaves(slaves, base);
+  usleep(100000); // Let the slaves bind
+
+  result &= run(1, 0, slaves, clients, transactions, window, base);
+  if(shards > 1) {
+    result &= run(shards, 0, slaves, clients, transactions, window, base);
+    result &= run(shards, 1, slaves, clients, transactions, window, base);
+  }
+
+  kill(slave_pid, SIGTERM);
+  waitpid(slave_pid, NULL, 0);
+  return result ? 0 : 1;
+}
@@ -0,0 +1,359 @@
+/*
+ *
+ * This file is part of I32CTT (Integer 32-bit Control & Telemetry Transport).
+ * Copyright (C) 2017 Mario Gomez / Hackerspace San Salvador.
+ *
+ * I32CTT is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * I32CTT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with I32CTT.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A virtual slave in a child process answers read requests from the
+ * parent over three transports: a Unix datagram socket pair with one
+ * message per syscall, I32CTT_LinuxUDPInterface on 127.0.0.1 with
+ * recvmmsg()/sendmmsg() batches, and I32CTT_LinuxShmInterface. The parent
+ * keeps a window of requests in flight and checks every answer. Reports
+ * frames per second (requests plus answers), p50/p99 round trip latency
+ * and the futex sleeps and wakeups of the shared memory run.
+ *
+ * Usage: shm_bench [transactions] [window] [registers] [spin polls]
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <vector>
+#include <algorithm>
+#include "Arduino.h"
+#include "I32CTT.h"
+#include "I32CTT_NullEndpoint.h"
+#include "I32CTT_LinuxUDPInterface.h"
+#include "I32CTT_LinuxShmInterface.h"
+
+#define SHM_NAME "/i32ctt_shm_bench"
+#define CLIENT_BATCH 64
+#define IDLE_TIMEOUT 2000 // ms without answers before the run is given up
+
+// One datagram per recv()/send(), how the daemons talk today
+class UnixPairInterface: public I32CTT_Interface {
+  public:
+    UnixPairInterface(int fd) {
+      this->fd = fd;
+      this->rx_buffer = new uint8_t[SHM_MTU_SIZE];
+      this->tx_buffer = new uint8_t[SHM_MTU_SIZE];
+      this->rx_size = 0;
+      this->tx_size = 0;
+      this->d_available = 0;
+    }
+    void init() {}
+    void update() {
+      ssize_t count;
+
+      if(this->d_available)
+        return;
+      count = recv(this->fd, this->rx_buffer, SHM_MTU_SIZE, MSG_DONTWAIT);
+      if(count > 0) {
+        this->rx_size = count;
+        this->d_available = 1;
+      }
+    }
+    uint8_t available() {
+      return 1;
+    }
+    uint8_t data_available() {
+      uint8_t result = this->d_available;
+      this->d_available = 0;
+      return result;
+    }
+    void send() {
+      ::send(this->fd, this->tx_buffer, this->tx_size, 0);
+      this->tx_size = 0;
+    }
+    uint16_t get_MTU() {
+      return SHM_MTU_SIZE;
+    }
+  private:
+    int fd;
+    uint8_t d_available;
+};
+
+struct Result {
+  uint32_t answered;
+  uint32_t valid;
+  uint64_t elapsed;
+  std::vector<uint64_t> latency;
+};
+
+static uint64_t now_ns() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec*1000000000ULL+ts.tv_nsec;
+}
+
+static void build_request(uint8_t *msg, uint16_t seq, uint32_t registers) {
+  msg[0] = CMD_R;
+  msg[1] = 0;
+  for(uint32_t j = 0; j < registers; j++)
+    I32CTT_Controller::put_reg(msg, j == 0 ? seq : j, CMD_R, j);
+}
+
+static uint16_t request_size(uint32_t registers) {
+  return sizeof(I32CTT_Header)+registers*sizeof(I32CTT_Reg);
+}
+
+static void check_answer(Result &result, std::vector<uint64_t> &sent_at, uint8_t *msg, uint16_t size,
+    uint32_t registers) {
+  uint64_t t = now_ns();
+
+  result.answered++;
+  result.latency.push_back(t-sent_at[I32CTT_Controller::get_reg(msg, CMD_AR, 0)]);
+  result.valid += msg[0] == CMD_AR && I32CTT_Controller::reg_count(CMD_AR, size) == registers;
+}
+
+// Runs a slave on iface until killed, idle() waits for the next request
+static void slave(I32CTT_Interface &iface, void (*idle)(I32CTT_Interface&)) {
+  I32CTT_NullEndpoint endpoint(I32CTT_Endpoint::str2id("NUL"));
+  I32CTT_Controller controller(1);
+  uint32_t idle_runs = 0;
+
+  controller.add_mode_driver(endpoint);
+  controller.set_interface(iface);
+  controller.init();
+  for(;;) {
+    iface.rx_size = 0;
+    controller.run();
+    idle_runs = iface.rx_size > 0 ? 0 : idle_runs+1;
+    if(idle_runs > 1)
+      idle(iface);
+  }
+}
+
+static int unix_fd = -1;
+
+static void idle_fd(I32CTT_Interface &) {
+  struct pollfd pfd;
+
+  pfd.fd = unix_fd;
+  pfd.events = POLLIN;
+  poll(&pfd, 1, 100);
+}
+
+static void idle_shm(I32CTT_Interface &iface) {
+  ((I32CTT_LinuxShmInterface&)iface).wait(100);
+}
+
+/*
+ * Client over a datagram socket, sendmmsg()/recvmmsg() batches so the
+ * client side costs the same for both socket transports.
+ */
+static void socket_client(Result &result, int fd, uint32_t transactions, uint32_t window,
+    uint32_t registers) {
+  static uint8_t requests[CLIENT_BATCH][SHM_MTU_SIZE];
+  static uint8_t answers[CLIENT_BATCH][SHM_MTU_SIZE];
+  struct mmsghdr msgs[CLIENT_BATCH];
+  struct iovec iov[CLIENT_BATCH];
+  std::vector<uint64_t> sent_at(65536);
+  struct pollfd pfd;
+  uint64_t begin = now_ns();
+  uint64_t last_answer = begin;
+  uint32_t issued = 0;
+  uint32_t count;
+  uint32_t i;
+  int n;
+
+  while(result.answered < transactions && now_ns()-last_answer < IDLE_TIMEOUT*1000000ULL) {
+    count = std::min(window-(issued-result.answered), transactions-issued);
+    count = std::min<uint32_t>(count, CLIENT_BATCH);
+    for(i = 0; i < count; i++) {
+      build_request(requests[i], issued+i, registers);
+      iov[i].iov_base = requests[i];
+      iov[i].iov_len = request_size(registers);
+      memset(&msgs[i], 0, sizeof(struct mmsghdr));
+      msgs[i].msg_hdr.msg_iov = &iov[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+      sent_at[(uint16_t)(issued+i)] = now_ns();
+    }
+    if(count > 0) {
+      n = sendmmsg(fd, msgs, count, MSG_DONTWAIT);
+      if(n > 0)
+        issued += n;
+    }
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    poll(&pfd, 1, 100);
+    for(i = 0; i < CLIENT_BATCH; i++) {
+      iov[i].iov_base = answers[i];
+      iov[i].iov_len = SHM_MTU_SIZE;
+      memset(&msgs[i], 0, sizeof(struct mmsghdr));
+      msgs[i].msg_hdr.msg_iov = &iov[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    n = recvmmsg(fd, msgs, CLIENT_BATCH, MSG_DONTWAIT, NULL);
+    for(i = 0; n > 0 && i < (uint32_t)n; i++)
+      check_answer(result, sent_at, answers[i], msgs[i].msg_len, registers);
+    if(n > 0)
+      last_answer = now_ns();
+  }
+  result.elapsed = now_ns()-begin;
+}
+
+static void shm_client(Result &result, I32CTT_LinuxShmInterface &iface, uint32_t transactions,
+    uint32_t window, uint32_t registers) {
+  std::vector<uint64_t> sent_at(65536);
+  uint64_t begin = now_ns();
+  uint64_t last_answer = begin;
+  uint32_t issued = 0;
+  uint8_t progress;
+
+  while(result.answered < transactions && now_ns()-last_answer < IDLE_TIMEOUT*1000000ULL) {
+    while(issued-result.answered < window && issued < transactions && iface.available()) {
+      build_request(iface.tx_buffer, issued, registers);
+      iface.tx_size = request_size(registers);
+      sent_at[(uint16_t)issued] = now_ns();
+      iface.send();
+      issued++;
+    }
+
+    progress = 0;
+    for(;;) {
+      iface.update();
+      if(!iface.data_available())
+        break;
+      check_answer(result, sent_at, iface.rx_buffer, iface.rx_size, registers);
+      progress = 1;
+    }
+    if(progress)
+      last_answer = now_ns();
+    else
+      iface.wait(100);
+  }
+  result.elapsed = now_ns()-begin;
+}
+
+static void report(const char *name, Result &result, uint32_t transactions) {
+  std::sort(result.latency.begin(), result.latency.end());
+  printf("%s:\n", name);
+  printf("  answered %u/%u valid %u, %.2f M frames/s\n", result.answered, transactions, result.valid,
+    2.0*result.answered*1e3/result.elapsed);
+  if(!result.latency.empty())
+    printf("  latency p50 %.1f us p99 %.1f us\n", result.latency[result.latency.size()/2]/1000.0,
+      result.latency[result.latency.size()*99/100]/1000.0);
+}
+
+static void finish(pid_t child) {
+  kill(child, SIGKILL);
+  waitpid(child, NULL, 0);
+}
+
+int main(int argc, char **argv) {
+  uint32_t transactions = argc > 1 ? atoi(argv[1]) : 1000000;
+  uint32_t window = argc > 2 ? atoi(argv[2]) : 256;
+  uint32_t registers = argc > 3 ? atoi(argv[3]) : 8;
+  uint32_t spin = argc > 4 ? atoi(argv[4]) : (sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SHM_SPIN_POLLS : 0);
+  struct sockaddr_in addr;
+  int fds[2];
+  pid_t child;
+  int fd;
+
+  if(transactions == 0 || window == 0 || window > SHM_RING_SLOTS || registers == 0 ||
+    registers > (UDP_MTU_SIZE-sizeof(I32CTT_Header))/sizeof(I32CTT_RegData)) {
+    fprintf(stderr, "Usage: %s [transactions] [window 1-%u] [registers 1-%u] [spin polls]\n", argv[0],
+      SHM_RING_SLOTS, (unsigned)((UDP_MTU_SIZE-sizeof(I32CTT_Header))/sizeof(I32CTT_RegData)));
+    return 1;
+  }
+  printf("transactions %u window %u registers %u spin %u, %ld CPUs\n", transactions, window,
+    registers, spin, sysconf(_SC_NPROCESSORS_ONLN));
+
+  // Unix datagram socket pair, one syscall per message on the slave
+  {
+    Result result = Result();
+    if(socketpair(AF_UNIX, SOCK_DGRAM, 0, fds) != 0) {
+      fprintf(stderr, "socketpair: %s\n", strerror(errno));
+      return 1;
+    }
+    child = fork();
+    if(child == 0) {
+      close(fds[0]);
+      unix_fd = fds[1];
+      UnixPairInterface iface(fds[1]);
+      slave(iface, idle_fd);
+    }
+    close(fds[1]);
+    socket_client(result, fds[0], transactions, window, registers);
+    finish(child);
+    close(fds[0]);
+    report("unix socket pair, one message per syscall", result, transactions);
+  }
+
+  // UDP on 127.0.0.1, batched on both sides
+  {
+    Result result = Result();
+    I32CTT_LinuxUDPInterface iface(0, "127.0.0.1");
+    iface.init();
+    child = fork();
+    if(child == 0) {
+      unix_fd = iface.get_fd();
+      slave(iface, idle_fd);
+    }
+    fd = socket(AF_INET, SOCK_DGRAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(iface.get_port());
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+      fprintf(stderr, "udp: %s\n", strerror(errno));
+      finish(child);
+      return 1;
+    }
+    socket_client(result, fd, transactions, window, registers);
+    finish(child);
+    close(fd);
+    report("udp 127.0.0.1, recvmmsg/sendmmsg", result, transactions);
+  }
+
+  // Shared memory rings, the parent owns the segment
+  {
+    Result result = Result();
+    I32CTT_LinuxShmInterface iface(SHM_NAME, SHM_OWNER, spin);
+    iface.init();
+    if(!iface.is_open()) {
+      fprintf(stderr, "shm_open: %s\n", strerror(errno));
+      return 1;
+    }
+    child = fork();
+    if(child == 0) {
+      I32CTT_LinuxShmInterface peer(SHM_NAME, SHM_PEER, spin);
+      peer.init();
+      if(!peer.is_open())
+        _exit(1);
+      slave(peer, idle_shm);
+    }
+    shm_client(result, iface, transactions, window, registers);
+    finish(child);
+    report("shared memory rings", result, transactions);
+    printf("  client futex sleeps %u wakeups %u, dropped %u, invalid received %u\n", iface.get_stats()->sleeps,
+      iface.get_stats()->wakeups, iface.get_stats()->tx_dropped, iface.get_stats()->rx_invalid);
+  }
+  return 0;
+}
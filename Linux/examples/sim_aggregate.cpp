@@ -0,0 +1,193 @@
+/*
+ *
+ * This file is part of I32CTT (Integer 32-bit Control & Telemetry Transport).
+ * Copyright (C) 2017 Mario Gomez / Hackerspace San Salvador.
+ *
+ * I32CTT is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * I32CTT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with I32CTT.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * One master reading every endpoint of N slaves, first one request per
+ * frame waiting for each answer, then with MAC level aggregation: the
+ * requests for a slave travel in one frame and its answers come back in
+ * another, slaves are still polled one at a time. Reports messages per second and frames on the air.
+ *
+ * Usage: sim_aggregate [slaves] [endpoints] [registers] [rounds] [loss] [seed]
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include "Arduino.h"
+#include "I32CTT.h"
+#include "I32CTT_Arduino802154Interface.h"
+#include "I32CTT_NullEndpoint.h"
+#include "I32CTT_SimRadio.h"
+#include "I32CTT_SimMedium.h"
+
+#define PAN_ID          0x0023
+#define MASTER_ADDR     0x0001
+#define ANSWER_TIMEOUT  100000 // us
+
+struct Node {
+  I32CTT_SimRadio *radio;
+  I32CTT_Arduino802154Interface *iface;
+  I32CTT_Controller *controller;
+};
+
+static Node create_node(I32CTT_SimMedium &medium, uint16_t addr, uint8_t endpoints, uint8_t hold) {
+  Node node;
+
+  node.radio = new I32CTT_SimRadio(medium);
+  node.iface = new I32CTT_Arduino802154Interface();
+  node.controller = new I32CTT_Controller(endpoints);
+
+  node.iface->set_pan_id(PAN_ID);
+  node.iface->set_short_addr(addr);
+  node.iface->set_channel(C2405);
+  node.iface->set_aggregation(hold);
+
+  I32CTT_SimRadio::select(node.radio);
+  for(uint8_t i = 0; i < endpoints; i++)
+    node.controller->add_mode_driver(*new I32CTT_NullEndpoint(I32CTT_Endpoint::str2id("NUL")));
+  node.controller->set_interface(*node.iface);
+  node.controller->enable_scheduler();
+  node.controller->init();
+  return node;
+}
+
+static uint32_t run_nodes(std::vector<Node> &nodes) {
+  uint32_t answers = 0;
+
+  for(uint32_t i = 0; i < nodes.size(); i++) {
+    I32CTT_SimRadio::select(nodes[i].radio);
+    nodes[i].controller->run();
+    if(i == 0 && nodes[0].controller->master.available(CMD_AR))
+      answers++;
+  }
+  return answers;
+}
+
+static void request(Node &master, uint16_t dst, uint8_t mode, uint8_t registers) {
+  I32CTT_SimRadio::select(master.radio);
+  master.iface->set_dst_addr(dst);
+  master.controller->master.set_mode(mode);
+  for(uint8_t j = 0; j < registers; j++)
+    master.controller->master.read_record(j);
+  master.controller->master.try_send();
+}
+
+static void run(uint8_t hold, uint32_t slaves, uint32_t endpoints, uint32_t registers,
+    uint32_t rounds, double loss, uint32_t seed) {
+  I32CTT_SimMedium medium(seed);
+  I32CTT_SimLink link;
+  I32CTT_802154AggStats *agg;
+  std::vector<Node> nodes;
+  uint64_t begin;
+  uint64_t start;
+  uint64_t elapsed;
+  uint32_t expected = 0;
+  uint32_t answered = 0;
+  uint32_t got;
+  uint32_t frames = 0;
+  uint32_t agg_frames = 0;
+  uint32_t agg_messages = 0;
+  uint32_t agg_dropped = 0;
+  uint32_t r;
+  uint32_t s;
+  uint32_t m;
+
+  link.connected = 1;
+  link.loss = loss;
+  link.lqi = 0xFF;
+  link.rssi = -60;
+  link.latency_us = 0;
+  medium.set_default_link(link);
+
+  nodes.push_back(create_node(medium, MASTER_ADDR, endpoints, hold)); // Answers need the mode to exist
+  for(s = 0; s < slaves; s++)
+    nodes.push_back(create_node(medium, MASTER_ADDR+1+s, endpoints, hold));
+
+  begin = medium.now();
+  for(r = 0; r < rounds; r++) {
+    if(hold == 0) {
+      // One request per frame, each waits for its answer
+      for(s = 0; s < slaves; s++) {
+        for(m = 0; m < endpoints; m++) {
+          request(nodes[0], MASTER_ADDR+1+s, m, registers);
+          expected++;
+          start = medium.now();
+          while(medium.now()-start < ANSWER_TIMEOUT) {
+            if(run_nodes(nodes) > 0) {
+              answered++;
+              break;
+            }
+          }
+        }
+      }
+      continue;
+    }
+
+    // The requests for a slave are issued back to back, the interface
+    // packs them in one frame and the slave packs its answers
+    for(s = 0; s < slaves; s++) {
+      for(m = 0; m < endpoints; m++)
+        request(nodes[0], MASTER_ADDR+1+s, m, registers);
+      expected += endpoints;
+      got = 0;
+      start = medium.now();
+      while(got < endpoints && medium.now()-start < ANSWER_TIMEOUT)
+        got += run_nodes(nodes);
+      answered += got;
+    }
+  }
+  elapsed = medium.now()-begin;
+
+  for(s = 0; s < nodes.size(); s++) {
+    frames += nodes[s].radio->stats.frames_tx;
+    agg = nodes[s].iface->get_aggregation_stats();
+    agg_frames += agg->tx_frames;
+    agg_messages += agg->tx_messages;
+    agg_dropped += agg->rx_dropped;
+  }
+
+  printf("%s:\n", hold ? "aggregated" : "one message per frame");
+  printf("  answered %u/%u, %.1f answers/s, %.1f records/s\n", answered, expected,
+    answered*1e6/elapsed, answered*registers*1e6/elapsed);
+  printf("  frames %u (%.2f per answer), busy %.1f%%, collisions %u\n",
+    frames, answered ? (double)frames/answered : 0.0,
+    medium.stats.busy_us[C2405]*100.0/elapsed, medium.stats.collisions);
+  if(hold)
+    printf("  containers %u with %u messages, cut short %u\n", agg_frames, agg_messages, agg_dropped);
+}
+
+int main(int argc, char **argv) {
+  uint32_t slaves = argc > 1 ? atoi(argv[1]) : 4;
+  uint32_t endpoints = argc > 2 ? atoi(argv[2]) : 4;
+  uint32_t registers = argc > 3 ? atoi(argv[3]) : 2;
+  uint32_t rounds = argc > 4 ? atoi(argv[4]) : 50;
+  double loss = argc > 5 ? atof(argv[5]) : 0.0;
+  uint32_t seed = argc > 6 ? atoi(argv[6]) : 1;
+
+  if(slaves == 0 || endpoints == 0 || registers == 0 || registers > 10) {
+    fprintf(stderr, "Usage: %s [slaves] [endpoints] [registers 1-10] [rounds] [loss] [seed]\n", argv[0]);
+    return 1;
+  }
+
+  printf("slaves %u endpoints %u registers %u rounds %u loss %.3f\n",
+    slaves, endpoints, registers, rounds, loss);
+  run(0, slaves, endpoints, registers, rounds, loss, seed);
+  run(AGGREGATION_HOLD_TIME, slaves, endpoints, registers, rounds, loss, seed);
+  return 0;
+}
@@ -0,0 +1,244 @@
+/*
+ *
+ * This file is part of I32CTT (Integer 32-bit Control & Telemetry Transport).
+ * Copyright (C) 2017 Mario Gomez / Hackerspace San Salvador.
+ *
+ * I32CTT is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * I32CTT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with I32CTT.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Several gateways, each polling its own slaves spread over a set of home
+ * channels. A gateway reads one slave at a time and waits for its answer,
+ * slaves are visited grouped by home channel so the gateway retunes once
+ * per group. The same load runs first with every node on one channel and
+ * then hopping over the channels, reports answers per source, throughput,
+ * channel utilization and the time spent retuning.
+ *
+ * Usage: sim_channels [gateways] [slaves per gateway] [channels] [rounds] [seed]
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include <algorithm>
+#include "Arduino.h"
+#include "I32CTT.h"
+#include "I32CTT_Arduino802154Interface.h"
+#include "I32CTT_NullEndpoint.h"
+#include "I32CTT_SimRadio.h"
+#include "I32CTT_SimMedium.h"
+
+#define PAN_ID          0x0023
+#define ANSWER_TIMEOUT  50000    // us a gateway waits for each answer
+#define MAX_VIRTUAL_US  60000000 // Before a run is given up
+
+struct Node {
+  I32CTT_SimRadio *radio;
+  I32CTT_Arduino802154Interface *iface;
+  I32CTT_NullEndpoint *endpoint;
+  I32CTT_Controller *controller;
+};
+
+struct Gateway {
+  std::vector<uint16_t> slaves; // Grouped by home channel
+  uint32_t next;                // Reads issued
+  uint16_t waiting_for;         // 0 while no read is out
+  uint64_t sent_at;
+};
+
+struct Result {
+  uint32_t sent;
+  uint32_t answered;
+  uint32_t lost;
+  uint32_t stray;      // Answers from a slave nobody was waiting for
+  uint32_t dropped;    // Held frames that found the pool empty
+  uint32_t retunes;
+  uint32_t retune_time;
+  uint64_t elapsed;
+};
+
+static Node create_node(I32CTT_SimMedium &medium, uint16_t addr, uint16_t mask, IEEE_802154_CHANNEL channel) {
+  Node node;
+
+  node.radio = new I32CTT_SimRadio(medium);
+  node.iface = new I32CTT_Arduino802154Interface();
+  node.endpoint = new I32CTT_NullEndpoint(I32CTT_Endpoint::str2id("NUL"));
+  node.controller = new I32CTT_Controller(1);
+
+  node.iface->set_pan_id(PAN_ID);
+  node.iface->set_short_addr(addr);
+  node.iface->set_channel_mask(mask);
+  node.iface->set_channel(channel);
+
+  I32CTT_SimRadio::select(node.radio);
+  node.controller->add_mode_driver(*node.endpoint);
+  node.controller->set_interface(*node.iface);
+  node.controller->enable_scheduler();
+  node.controller->init();
+  return node;
+}
+
+static void run_nodes(std::vector<Node> &nodes) {
+  for(uint32_t i = 0; i < nodes.size(); i++) {
+    I32CTT_SimRadio::select(nodes[i].radio);
+    nodes[i].controller->run();
+  }
+}
+
+static uint16_t gateway_addr(uint32_t g) {
+  return 0x0100*(g+1);
+}
+
+static IEEE_802154_CHANNEL home_of(Node &gateway, uint16_t addr) {
+  I32CTT_SimRadio::select(gateway.radio);
+  return gateway.iface->get_home_channel(addr);
+}
+
+/*
+ * Polls every slave of every gateway rounds times on channels channels,
+ * hopping if there is more than one.
+ */
+static Result run(uint32_t gateways, uint32_t slaves, uint32_t channels, uint32_t rounds, uint32_t seed) {
+  I32CTT_SimMedium medium(seed);
+  I32CTT_802154ChannelStats *stats;
+  std::vector<Node> nodes;
+  std::vector<Gateway> polls(gateways);
+  Result result = {0, 0, 0, 0, 0, 0, 0, 0};
+  uint16_t mask = channels == CHANNEL_COUNT ? 0xFFFF : (1<<channels)-1;
+  uint16_t addr;
+  uint64_t begin;
+  uint64_t dwell;
+  uint32_t done;
+  uint32_t g;
+  uint32_t i;
+
+  // Gateways first (nodes[g]), each starts on a different channel
+  for(g = 0; g < gateways; g++) {
+    nodes.push_back(create_node(medium, gateway_addr(g), mask,
+      (IEEE_802154_CHANNEL)(C2405+g%channels)));
+    nodes[g].iface->set_channel_hopping(channels > 1);
+  }
+  for(g = 0; g < gateways; g++) {
+    for(i = 0; i < slaves; i++) {
+      addr = gateway_addr(g)+1+i;
+      nodes.push_back(create_node(medium, addr, mask, home_of(nodes[0], addr)));
+    }
+    for(uint8_t ch = C2405; ch < C2405+channels; ch++) {
+      for(i = 0; i < slaves; i++) {
+        addr = gateway_addr(g)+1+i;
+        if(home_of(nodes[g], addr) == ch)
+          polls[g].slaves.push_back(addr);
+      }
+    }
+    polls[g].next = 0;
+    polls[g].waiting_for = 0;
+  }
+
+  begin = medium.now();
+  do {
+    for(g = 0; g < gateways; g++) {
+      Gateway &poll = polls[g];
+      if(poll.waiting_for != 0 || poll.next >= rounds*slaves)
+        continue;
+      poll.waiting_for = poll.slaves[poll.next%slaves];
+      poll.sent_at = medium.now();
+      poll.next++;
+      I32CTT_SimRadio::select(nodes[g].radio);
+      nodes[g].iface->set_dst_addr(poll.waiting_for);
+      nodes[g].controller->master.set_mode(0);
+      nodes[g].controller->master.read_record(0);
+      nodes[g].controller->master.read_record(1);
+      nodes[g].controller->master.try_send();
+      result.sent++;
+    }
+
+    run_nodes(nodes);
+    done = 0;
+    for(g = 0; g < gateways; g++) {
+      Gateway &poll = polls[g];
+      if(nodes[g].controller->master.available(CMD_AR)) {
+        if(poll.waiting_for != 0 && nodes[g].iface->get_src() == poll.waiting_for) {
+          result.answered++;
+          poll.waiting_for = 0;
+        } else {
+          result.stray++;
+        }
+      }
+      if(poll.waiting_for != 0 && medium.now()-poll.sent_at > ANSWER_TIMEOUT) {
+        result.lost++;
+        poll.waiting_for = 0;
+      }
+      done += poll.waiting_for == 0 && poll.next >= rounds*slaves;
+    }
+  } while(done < gateways && medium.now()-begin < MAX_VIRTUAL_US);
+  result.elapsed = medium.now()-begin;
+
+  for(g = 0; g < gateways; g++) {
+    I32CTT_SimRadio::select(nodes[g].radio);
+    result.retunes += nodes[g].iface->get_retunes();
+    result.retune_time += nodes[g].iface->get_retune_time();
+    result.dropped += nodes[g].iface->get_held_dropped();
+  }
+
+  printf("%s:\n", channels > 1 ? "hopping" : "one channel");
+  printf("  reads %u answered %u lost %u stray %u, %.1f answers/s\n", result.sent, result.answered,
+    result.lost, result.stray, result.answered*1e6/result.elapsed);
+  printf("  channel  busy%%  gateway dwell%%  tx_frames rx_frames visits\n");
+  for(i = 0; i < channels; i++) {
+    uint32_t tx_frames = 0;
+    uint32_t rx_frames = 0;
+    uint32_t visits = 0;
+
+    dwell = 0;
+    for(g = 0; g < gateways; g++) {
+      I32CTT_SimRadio::select(nodes[g].radio);
+      stats = nodes[g].iface->get_channel_stats((IEEE_802154_CHANNEL)(C2405+i));
+      dwell += stats->dwell_time;
+      tx_frames += stats->tx_frames;
+      rx_frames += stats->rx_frames;
+      visits += stats->visits;
+    }
+    printf("    %5u %6.1f %15.1f %10u %9u %6u\n", C2405+i,
+      medium.stats.busy_us[C2405+i]*100.0/result.elapsed,
+      dwell*100.0/gateways/result.elapsed, tx_frames, rx_frames, visits);
+  }
+  printf("  gateways: retunes %u retune time %u us (%.3f%% of airtime budget), held frames dropped %u\n",
+    result.retunes, result.retune_time, result.retune_time*100.0/gateways/result.elapsed, result.dropped);
+  printf("  medium: transmissions %u deliveries %u collisions %u losses %u\n",
+    medium.stats.transmissions, medium.stats.deliveries,
+    medium.stats.collisions, medium.stats.losses);
+  return result;
+}
+
+int main(int argc, char **argv) {
+  uint32_t gateways = argc > 1 ? atoi(argv[1]) : 4;
+  uint32_t slaves = argc > 2 ? atoi(argv[2]) : 8;
+  uint32_t channels = argc > 3 ? atoi(argv[3]) : 4;
+  uint32_t rounds = argc > 4 ? atoi(argv[4]) : 50;
+  uint32_t seed = argc > 5 ? atoi(argv[5]) : 1;
+  Result single;
+  Result hopping;
+
+  if(gateways == 0 || slaves == 0 || slaves > 0xFF || channels < 2 || channels > CHANNEL_COUNT) {
+    fprintf(stderr, "Usage: %s [gateways] [slaves per gateway] [channels 2-16] [rounds] [seed]\n", argv[0]);
+    return 1;
+  }
+
+  printf("gateways %u slaves %u channels %u rounds %u\n", gateways, slaves, channels, rounds);
+  single = run(gateways, slaves, 1, rounds, seed);
+  hopping = run(gateways, slaves, channels, rounds, seed);
+  printf("hopping over %u channels: %.2fx the answers/s of one channel\n", channels,
+    (hopping.answered*1e6/hopping.elapsed)/(single.answered*1e6/single.elapsed));
+  return 0;
+}
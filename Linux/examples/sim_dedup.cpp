@@ -0,0 +1,145 @@
+/*
+ *
+ * This file is part of I32CTT (Integer 32-bit Control & Telemetry Transport).
+ * Copyright (C) 2017 Mario Gomez / Hackerspace San Salvador.
+ *
+ * I32CTT is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * I32CTT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with I32CTT.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Several masters writing to one slave over a lossy link. A lost ACK makes
+ * the master's radio retry a frame the slave already got, the slave must
+ * drop the copy (a write is not idempotent). Every write carries a per
+ * master counter so the slave counts the copies that got through. Runs
+ * with fewer masters than the slave's peer table holds and then with more.
+ *
+ * Usage: sim_dedup [masters] [loss] [seconds] [seed]
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "Arduino.h"
+#include "I32CTT.h"
+#include "I32CTT_Arduino802154Interface.h"
+#include "I32CTT_SimRadio.h"
+#include "I32CTT_SimMedium.h"
+
+#define PAN_ID           0x0023
+#define SLAVE_ADDR       0x0001
+#define MASTER_BASE_ADDR 0x0010
+
+struct Node {
+  I32CTT_SimRadio *radio;
+  I32CTT_Arduino802154Interface *iface;
+};
+
+static Node create_node(I32CTT_SimMedium &medium, uint16_t addr) {
+  Node node;
+
+  node.radio = new I32CTT_SimRadio(medium);
+  node.iface = new I32CTT_Arduino802154Interface();
+  node.iface->set_pan_id(PAN_ID);
+  node.iface->set_short_addr(addr);
+  node.iface->set_channel(C2405);
+
+  I32CTT_SimRadio::select(node.radio);
+  node.iface->init();
+  return node;
+}
+
+static void run(uint32_t masters, double loss, uint32_t seconds, uint32_t seed) {
+  I32CTT_SimMedium medium(seed);
+  I32CTT_SimLink link;
+  Node slave;
+  std::vector<Node> nodes;
+  std::vector<uint32_t> written(masters, 0);
+  std::vector<uint32_t> last(masters, 0);
+  uint64_t end;
+  uint32_t received = 0;
+  uint32_t duplicates = 0;
+  uint32_t retries = 0;
+  uint32_t counter;
+  uint16_t src;
+  uint32_t i;
+
+  link.connected = 1;
+  link.loss = loss;
+  link.lqi = 0xFF;
+  link.rssi = -60;
+  link.latency_us = 0;
+  medium.set_default_link(link);
+
+  slave = create_node(medium, SLAVE_ADDR);
+  for(i = 0; i < masters; i++) {
+    nodes.push_back(create_node(medium, MASTER_BASE_ADDR+i));
+    nodes[i].iface->set_dst_addr(SLAVE_ADDR);
+  }
+
+  end = medium.now()+(uint64_t)seconds*1000000;
+  while(medium.now() < end) {
+    for(i = 0; i < masters; i++) {
+      I32CTT_SimRadio::select(nodes[i].radio);
+      if(nodes[i].iface->tx_size == 0) {
+        // Next write once the previous one left tx_buffer, acknowledged
+        // or not
+        counter = ++written[i];
+        nodes[i].iface->tx_buffer[0] = CMD_W;
+        memcpy(nodes[i].iface->tx_buffer+1, &counter, sizeof(uint32_t));
+        nodes[i].iface->tx_size = 1+sizeof(uint32_t);
+      }
+      nodes[i].iface->send_to_dst();
+    }
+
+    I32CTT_SimRadio::select(slave.radio);
+    slave.iface->update();
+    if(slave.iface->data_available()) {
+      src = slave.iface->get_src()-MASTER_BASE_ADDR;
+      memcpy(&counter, slave.iface->rx_buffer+1, sizeof(uint32_t));
+      if(src < masters) {
+        if(counter == last[src])
+          duplicates++;
+        last[src] = counter;
+      }
+      received++;
+    }
+  }
+
+  for(i = 0; i < masters; i++)
+    retries += nodes[i].radio->stats.aret_retries;
+
+  printf("%u masters (peer table %u):\n", masters, PEER_TABLE_SIZE);
+  printf("  writes received %u duplicates executed %u\n", received, duplicates);
+  printf("  slave: dedup hits %u acks sent %u, masters: retries %u\n",
+    slave.iface->get_dedup_hits(), slave.radio->stats.acks_tx, retries);
+}
+
+int main(int argc, char **argv) {
+  uint32_t masters = argc > 1 ? atoi(argv[1]) : PEER_TABLE_SIZE*3;
+  double loss = argc > 2 ? atof(argv[2]) : 0.2;
+  uint32_t seconds = argc > 3 ? atoi(argv[3]) : 10;
+  uint32_t seed = argc > 4 ? atoi(argv[4]) : 1;
+
+  if(masters == 0 || seconds == 0) {
+    fprintf(stderr, "Usage: %s [masters] [loss] [seconds] [seed]\n", argv[0]);
+    return 1;
+  }
+
+  printf("loss %.3f, %u s\n", loss, seconds);
+  if(masters > PEER_TABLE_SIZE/2)
+    run(PEER_TABLE_SIZE/2, loss, seconds, seed);
+  run(masters, loss, seconds, seed);
+  return 0;
+}
@@ -0,0 +1,218 @@
+/*
+ *
+ * This file is part of I32CTT (Integer 32-bit Control & Telemetry Transport).
+ * Copyright (C) 2017 Mario Gomez / Hackerspace San Salvador.
+ *
+ * I32CTT is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * I32CTT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with I32CTT.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Several senders each send messages bigger than the 802.15.4 MTU to one
+ * receiver through I32CTT_FragmentInterface, all at once so their
+ * fragments interleave on the air. The message ids of the senders run in
+ * step, so the receiver must tell the messages apart by source. It checks
+ * every reassembled message (size, source and contents) and reports what
+ * was delivered, lost, duplicated or corrupt.
+ *
+ * Usage: sim_fragment [senders] [messages per sender] [message bytes] [loss] [seed]
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include "Arduino.h"
+#include "I32CTT.h"
+#include "I32CTT_Arduino802154Interface.h"
+#include "I32CTT_FragmentInterface.h"
+#include "I32CTT_SimRadio.h"
+#include "I32CTT_SimMedium.h"
+
+#define PAN_ID         0x0023
+#define RECEIVER_ADDR  0x0001
+#define MSG_HEADER     5         // [CMD_W][sender][sequence], 16-bit each
+#define MAX_VIRTUAL_US 120000000 // Before the run is given up
+
+struct Node {
+  I32CTT_SimRadio *radio;
+  I32CTT_Arduino802154Interface *iface;
+  I32CTT_FragmentInterface *frag;
+};
+
+struct Sender {
+  Node node;
+  uint16_t addr;
+  uint32_t sent;
+  uint8_t overlapped;   // The message in flight crossed another sender's
+  uint32_t interleaved; // Messages that crossed another sender's
+  uint32_t delivered;
+  uint32_t duplicates;
+  int32_t last_seq;
+};
+
+static Node create_node(I32CTT_SimMedium &medium, uint16_t addr) {
+  Node node;
+
+  node.radio = new I32CTT_SimRadio(medium);
+  node.iface = new I32CTT_Arduino802154Interface();
+  node.frag = new I32CTT_FragmentInterface(*node.iface);
+  node.iface->set_pan_id(PAN_ID);
+  node.iface->set_short_addr(addr);
+  node.iface->set_channel(C2405);
+
+  I32CTT_SimRadio::select(node.radio);
+  node.frag->init();
+  return node;
+}
+
+static uint8_t pattern(uint16_t addr, uint16_t seq, uint16_t i) {
+  return (addr*31+seq*7+i) & 0xFF;
+}
+
+/*
+ * Checks a reassembled message, returns the index of its sender or -1.
+ */
+static int check_message(std::vector<Sender> &senders, I32CTT_FragmentInterface *frag, uint16_t size) {
+  const uint8_t *msg = frag->rx_buffer;
+  uint16_t addr;
+  uint16_t seq;
+  uint16_t i;
+
+  if(frag->rx_size != size || msg[0] != CMD_W)
+    return -1;
+  addr = msg[1] | (msg[2] << 8);
+  seq = msg[3] | (msg[4] << 8);
+  if(addr != frag->get_src())
+    return -1;
+  for(i = MSG_HEADER; i < size; i++) {
+    if(msg[i] != pattern(addr, seq, i))
+      return -1;
+  }
+  for(i = 0; i < senders.size(); i++) {
+    if(senders[i].addr != addr)
+      continue;
+    if((int32_t)seq <= senders[i].last_seq) {
+      senders[i].duplicates++;
+    } else {
+      senders[i].last_seq = seq;
+      senders[i].delivered++;
+    }
+    return i;
+  }
+  return -1;
+}
+
+int main(int argc, char **argv) {
+  uint32_t count = argc > 1 ? atoi(argv[1]) : 2;
+  uint32_t messages = argc > 2 ? atoi(argv[2]) : 50;
+  uint32_t size = argc > 3 ? atoi(argv[3]) : 600;
+  double loss = argc > 4 ? atof(argv[4]) : 0.02;
+  uint32_t seed = argc > 5 ? atoi(argv[5]) : 1;
+  I32CTT_SimMedium medium(seed);
+  I32CTT_SimLink link;
+  std::vector<Sender> senders;
+  Node receiver;
+  uint64_t begin;
+  uint32_t corrupt = 0;
+  uint32_t failures = 0;
+  uint32_t retransmissions = 0;
+  uint32_t busy;
+  uint32_t done;
+  uint32_t i;
+  uint32_t j;
+
+  receiver = create_node(medium, RECEIVER_ADDR);
+  if(count == 0 || count > 0xFF || messages == 0 || size <= MSG_HEADER || size > receiver.frag->get_MTU()) {
+    fprintf(stderr, "Usage: %s [senders 1-255] [messages per sender] [message bytes %u-%u] [loss] [seed]\n",
+      argv[0], MSG_HEADER+1, receiver.frag->get_MTU());
+    return 1;
+  }
+
+  link.connected = 1;
+  link.loss = loss;
+  link.lqi = 0xFF;
+  link.rssi = -60;
+  link.latency_us = 0;
+  medium.set_default_link(link);
+
+  for(i = 0; i < count; i++) {
+    Sender sender;
+    sender.addr = RECEIVER_ADDR+1+i;
+    sender.node = create_node(medium, sender.addr);
+    sender.sent = 0;
+    sender.overlapped = 0;
+    sender.interleaved = 0;
+    sender.delivered = 0;
+    sender.duplicates = 0;
+    sender.last_seq = -1;
+    sender.node.iface->set_dst_addr(RECEIVER_ADDR);
+    senders.push_back(sender);
+  }
+
+  begin = medium.now();
+  do {
+    busy = 0;
+    done = 0;
+    for(i = 0; i < senders.size(); i++) {
+      Sender &sender = senders[i];
+      I32CTT_FragmentInterface *frag = sender.node.frag;
+
+      I32CTT_SimRadio::select(sender.node.radio);
+      if(frag->tx_size == 0 && frag->available()) {
+        sender.interleaved += sender.overlapped;
+        sender.overlapped = 0;
+        if(sender.sent < messages) {
+          frag->tx_buffer[0] = CMD_W;
+          frag->tx_buffer[1] = sender.addr & 0xFF;
+          frag->tx_buffer[2] = sender.addr >> 8;
+          frag->tx_buffer[3] = sender.sent & 0xFF;
+          frag->tx_buffer[4] = sender.sent >> 8;
+          for(j = MSG_HEADER; j < size; j++)
+            frag->tx_buffer[j] = pattern(sender.addr, sender.sent, j);
+          frag->tx_size = size;
+          frag->send_to_dst();
+          sender.sent++;
+        }
+      } else {
+        frag->update();
+      }
+      busy += frag->tx_size > 0;
+      done += sender.sent == messages && frag->tx_size == 0;
+    }
+    for(i = 0; i < senders.size() && busy > 1; i++)
+      senders[i].overlapped |= senders[i].node.frag->tx_size > 0;
+
+    I32CTT_SimRadio::select(receiver.radio);
+    receiver.frag->update();
+    if(receiver.frag->data_available() && check_message(senders, receiver.frag, size) < 0)
+      corrupt++;
+
+    medium.advance(100);
+  } while(done < senders.size() && medium.now()-begin < MAX_VIRTUAL_US);
+
+  printf("senders %u messages %u bytes %u loss %.3f\n", count, messages, size, loss);
+  for(i = 0; i < senders.size(); i++) {
+    Sender &sender = senders[i];
+    I32CTT_SimRadio::select(sender.node.radio);
+    failures += sender.node.frag->get_tx_failures();
+    retransmissions += sender.node.frag->get_retransmissions();
+    printf("  sender 0x%04X: sent %u interleaved %u delivered %u duplicates %u tx failures %u\n",
+      sender.addr, sender.sent, sender.interleaved, sender.delivered, sender.duplicates,
+      sender.node.frag->get_tx_failures());
+  }
+  printf("  corrupt or misattributed %u, fragments sent again %u, %.2f s\n", corrupt, retransmissions,
+    (medium.now()-begin)/1e6);
+  printf("  medium: transmissions %u collisions %u losses %u\n",
+    medium.stats.transmissions, medium.stats.collisions, medium.stats.losses);
+  return 0;
+}
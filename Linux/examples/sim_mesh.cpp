@@ -0,0 +1,169 @@
+/*
+ *
+ * This file is part of I32CTT (Integer 32-bit Control & Telemetry Transport).
+ * Copyright (C) 2017 Mario Gomez / Hackerspace San Salvador.
+ *
+ * I32CTT is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * I32CTT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with I32CTT.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Multi-hop reads over a chain of nodes in mesh mode. Each node only hears
+ * its direct neighbours, the master sits at one end and polls every other
+ * node. Prints the master's routing table with hop count and round trip
+ * time per route.
+ *
+ * Usage: sim_mesh [nodes] [loss] [transactions] [seed]
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include "Arduino.h"
+#include "I32CTT.h"
+#include "I32CTT_Arduino802154Interface.h"
+#include "I32CTT_NullEndpoint.h"
+#include "I32CTT_SimRadio.h"
+#include "I32CTT_SimMedium.h"
+
+#define PAN_ID          0x0023
+#define MASTER_ADDR     0x0001
+#define WARMUP_TIME     10000000 // us, lets beacons spread the routes
+#define ANSWER_TIMEOUT  200000   // us
+
+struct Node {
+  I32CTT_SimRadio *radio;
+  I32CTT_Arduino802154Interface *iface;
+  I32CTT_NullEndpoint *endpoint;
+  I32CTT_Controller *controller;
+};
+
+static Node create_node(I32CTT_SimMedium &medium, uint16_t addr) {
+  Node node;
+
+  node.radio = new I32CTT_SimRadio(medium);
+  node.iface = new I32CTT_Arduino802154Interface();
+  node.endpoint = new I32CTT_NullEndpoint(I32CTT_Endpoint::str2id("NUL"));
+  node.controller = new I32CTT_Controller(1);
+
+  node.iface->set_pan_id(PAN_ID);
+  node.iface->set_short_addr(addr);
+  node.iface->set_channel(C2405);
+  node.iface->set_mesh(true);
+
+  I32CTT_SimRadio::select(node.radio);
+  node.controller->add_mode_driver(*node.endpoint);
+  node.controller->set_interface(*node.iface);
+  node.controller->enable_scheduler();
+  node.controller->init();
+  return node;
+}
+
+static void run_nodes(std::vector<Node> &nodes) {
+  for(uint32_t i = 0; i < nodes.size(); i++) {
+    I32CTT_SimRadio::select(nodes[i].radio);
+    nodes[i].controller->run();
+  }
+}
+
+int main(int argc, char **argv) {
+  uint32_t count = argc > 1 ? atoi(argv[1]) : 5;
+  double loss = argc > 2 ? atof(argv[2]) : 0.0;
+  uint32_t transactions = argc > 3 ? atoi(argv[3]) : 200;
+  uint32_t seed = argc > 4 ? atoi(argv[4]) : 1;
+  I32CTT_SimMedium medium(seed);
+  I32CTT_SimLink link;
+  I32CTT_802154Route *route;
+  std::vector<Node> nodes;
+  uint64_t start;
+  uint32_t answered = 0;
+  uint32_t timeouts = 0;
+  uint32_t forwarded = 0;
+  uint32_t dropped = 0;
+  uint32_t i;
+
+  if(count < 2) {
+    fprintf(stderr, "Usage: %s [nodes >= 2] [loss] [transactions] [seed]\n", argv[0]);
+    return 1;
+  }
+
+  link.connected = 0;
+  link.loss = 0.0;
+  link.lqi = 0;
+  link.rssi = -100;
+  link.latency_us = 0;
+  medium.set_default_link(link);
+
+  for(i = 0; i < count; i++)
+    nodes.push_back(create_node(medium, MASTER_ADDR+i));
+
+  // Chain topology, LQI drops a little with each link
+  link.connected = 1;
+  link.loss = loss;
+  link.rssi = -75;
+  for(i = 0; i+1 < count; i++) {
+    link.lqi = 0xFF-(i%4)*0x20;
+    medium.set_link(nodes[i].radio, nodes[i+1].radio, link);
+  }
+
+  while(medium.now() < WARMUP_TIME)
+    run_nodes(nodes);
+
+  for(i = 0; i < transactions; i++) {
+    Node &master = nodes[0];
+    uint16_t dst = MASTER_ADDR+1+(i%(count-1));
+
+    I32CTT_SimRadio::select(master.radio);
+    master.iface->set_dst_addr(dst);
+    master.controller->master.set_mode(0);
+    master.controller->master.read_record(0);
+    master.controller->master.read_record(1);
+
+    start = medium.now();
+    master.controller->master.try_send();
+
+    for(;;) {
+      run_nodes(nodes);
+      if(master.controller->master.available(CMD_AR)) {
+        answered++;
+        break;
+      }
+      if(medium.now()-start > ANSWER_TIMEOUT) {
+        timeouts++;
+        break;
+      }
+    }
+  }
+
+  for(i = 0; i < nodes.size(); i++) {
+    forwarded += nodes[i].iface->get_mesh_forwarded();
+    dropped += nodes[i].iface->get_mesh_dropped();
+  }
+
+  printf("nodes %u loss %.3f transactions %u\n", count, loss, transactions);
+  printf("answered %u timeouts %u forwarded %u dropped %u\n", answered, timeouts, forwarded, dropped);
+  printf("master routes:\n");
+  printf("  dst   next  hops cost  rtt_us  samples\n");
+  for(i = 0; i < nodes[0].iface->get_route_count(); i++) {
+    route = nodes[0].iface->get_route_at(i);
+    if(route == NULL)
+      continue;
+    printf("  %04x  %04x  %4u %4u %7u %8u\n", route->dst, route->next_hop,
+      route->hops, route->cost, route->rtt, route->rtt_samples);
+  }
+  printf("medium: transmissions %u deliveries %u collisions %u losses %u\n",
+    medium.stats.transmissions, medium.stats.deliveries,
+    medium.stats.collisions, medium.stats.losses);
+
+  return 0;
+}
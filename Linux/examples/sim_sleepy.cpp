@@ -0,0 +1,198 @@
+/*
+ *
+ * This file is part of I32CTT (Integer 32-bit Control & Telemetry Transport).
+ * Copyright (C) 2017 Mario Gomez / Hackerspace San Salvador.
+ *
+ * I32CTT is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * I32CTT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with I32CTT.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Duty-cycled slaves: the master holds each read request until the
+ * sleepy slave polls for it. Reports request latency, the fraction of
+ * time each slave's transceiver was awake and its air time.
+ *
+ * Usage: sim_sleepy [slaves] [poll_interval_ms] [transactions] [loss] [seed]
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include <algorithm>
+#include "Arduino.h"
+#include "I32CTT.h"
+#include "I32CTT_Arduino802154Interface.h"
+#include "I32CTT_NullEndpoint.h"
+#include "I32CTT_SimRadio.h"
+#include "I32CTT_SimMedium.h"
+
+#define PAN_ID          0x0023
+#define MASTER_ADDR     0x0001
+#define IDLE_TIME       2000000 // us between bursts of requests
+
+struct Node {
+  I32CTT_SimRadio *radio;
+  I32CTT_Arduino802154Interface *iface;
+  I32CTT_NullEndpoint *endpoint;
+  I32CTT_Controller *controller;
+};
+
+static Node create_node(I32CTT_SimMedium &medium, uint16_t addr) {
+  Node node;
+
+  node.radio = new I32CTT_SimRadio(medium);
+  node.iface = new I32CTT_Arduino802154Interface();
+  node.endpoint = new I32CTT_NullEndpoint(I32CTT_Endpoint::str2id("NUL"));
+  node.controller = new I32CTT_Controller(1);
+
+  node.iface->set_pan_id(PAN_ID);
+  node.iface->set_short_addr(addr);
+  node.iface->set_channel(C2405);
+
+  I32CTT_SimRadio::select(node.radio);
+  node.controller->add_mode_driver(*node.endpoint);
+  node.controller->set_interface(*node.iface);
+  node.controller->enable_scheduler();
+  node.controller->init();
+  return node;
+}
+
+static void run_nodes(std::vector<Node> &nodes) {
+  for(uint32_t i = 0; i < nodes.size(); i++) {
+    I32CTT_SimRadio::select(nodes[i].radio);
+    nodes[i].controller->run();
+  }
+}
+
+int main(int argc, char **argv) {
+  uint32_t slaves = argc > 1 ? atoi(argv[1]) : 4;
+  uint32_t poll_interval = argc > 2 ? atoi(argv[2]) : 250;
+  uint32_t transactions = argc > 3 ? atoi(argv[3]) : 100;
+  double loss = argc > 4 ? atof(argv[4]) : 0.0;
+  uint32_t seed = argc > 5 ? atoi(argv[5]) : 1;
+  I32CTT_SimMedium medium(seed);
+  I32CTT_SimLink link;
+  I32CTT_802154Child *child;
+  I32CTT_802154SleepStats *sleep;
+  I32CTT_802154Peer *peer;
+  std::vector<Node> nodes;
+  std::vector<uint64_t> latencies;
+  uint64_t start;
+  uint64_t timeout = (uint64_t)poll_interval*2000+100000;
+  uint64_t airtime;
+  uint32_t answered = 0;
+  uint32_t timeouts = 0;
+  uint32_t i;
+  uint32_t j;
+
+  if(slaves == 0 || slaves > CHILD_TABLE_SIZE || poll_interval == 0) {
+    fprintf(stderr, "Usage: %s [slaves 1-%u] [poll_interval_ms > 0] [transactions] [loss] [seed]\n",
+      argv[0], CHILD_TABLE_SIZE);
+    return 1;
+  }
+
+  link.connected = 1;
+  link.loss = loss;
+  link.lqi = 0xFF;
+  link.rssi = -60;
+  link.latency_us = 0;
+  medium.set_default_link(link);
+
+  for(i = 0; i <= slaves; i++)
+    nodes.push_back(create_node(medium, MASTER_ADDR+i));
+
+  I32CTT_SimRadio::select(nodes[0].radio);
+  for(i = 1; i <= slaves; i++)
+    nodes[0].iface->add_sleepy_child(MASTER_ADDR+i);
+  for(i = 1; i <= slaves; i++) {
+    I32CTT_SimRadio::select(nodes[i].radio);
+    nodes[i].iface->set_sleepy(MASTER_ADDR, poll_interval);
+  }
+
+  for(i = 0; i < transactions; i++) {
+    Node &master = nodes[0];
+    uint16_t dst = MASTER_ADDR+1+(i%slaves);
+
+    // Requests come in bursts, one per slave, then the network idles
+    if(i%slaves == 0) {
+      start = medium.now();
+      while(medium.now()-start < IDLE_TIME)
+        run_nodes(nodes);
+    }
+
+    I32CTT_SimRadio::select(master.radio);
+    master.iface->set_dst_addr(dst);
+    master.controller->master.set_mode(0);
+    master.controller->master.read_record(0);
+    master.controller->master.read_record(1);
+
+    start = medium.now();
+    master.controller->master.try_send();
+
+    for(;;) {
+      run_nodes(nodes);
+      if(master.controller->master.available(CMD_AR)) {
+        latencies.push_back(medium.now()-start);
+        answered++;
+        break;
+      }
+      if(medium.now()-start > timeout) {
+        timeouts++;
+        break;
+      }
+    }
+  }
+
+  std::sort(latencies.begin(), latencies.end());
+  printf("slaves %u poll_interval %u ms transactions %u loss %.3f\n",
+    slaves, poll_interval, transactions, loss);
+  printf("answered %u timeouts %u indirect dropped %u\n",
+    answered, timeouts, nodes[0].iface->get_indirect_dropped());
+  if(!latencies.empty()) {
+    printf("latency p50 %llu us p99 %llu us\n",
+      (unsigned long long)latencies[latencies.size()/2],
+      (unsigned long long)latencies[latencies.size()*99/100]);
+  }
+
+  printf("master children:\n");
+  printf("  addr  polls delivered expired avg_latency_ms max_latency_ms\n");
+  for(i = 0; i < nodes[0].iface->get_child_count(); i++) {
+    child = nodes[0].iface->get_child_at(i);
+    if(child == NULL)
+      continue;
+    printf("  %04x %6u %9u %7u %14u %14u\n", child->addr, child->polls,
+      child->delivered, child->expired,
+      child->delivered ? child->latency/child->delivered : 0, child->latency_max);
+  }
+
+  printf("slaves:\n");
+  printf("  addr  wakeups  polls pending frames  awake%%  airtime_us\n");
+  for(i = 1; i < nodes.size(); i++) {
+    sleep = nodes[i].iface->get_sleep_stats();
+    airtime = 0;
+    for(j = 0; j < nodes[i].iface->get_peer_count(); j++) {
+      peer = nodes[i].iface->get_peer_at(j);
+      if(peer != NULL)
+        airtime += peer->stats.tx_airtime+peer->stats.rx_airtime;
+    }
+    printf("  %04x %8u %6u %7u %6u %6.2f %11llu\n", MASTER_ADDR+i,
+      sleep->wakeups, sleep->polls, sleep->polls_pending, sleep->frames,
+      sleep->awake_time*100.0/medium.now(),
+      (unsigned long long)airtime);
+  }
+  printf("medium: transmissions %u deliveries %u collisions %u losses %u\n",
+    medium.stats.transmissions, medium.stats.deliveries,
+    medium.stats.collisions, medium.stats.losses);
+
+  return 0;
+}
@@ -0,0 +1,188 @@
+/*
+ *
+ * This file is part of I32CTT (Integer 32-bit Control & Telemetry Transport).
+ * Copyright (C) 2017 Mario Gomez / Hackerspace San Salvador.
+ *
+ * I32CTT is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * I32CTT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with I32CTT.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * High rate telemetry from one node to another, first with acknowledged
+ * frames and then in streaming mode (no ACK, no retries, back to back
+ * from the TX queue). Reports goodput and the delivery rate measured by
+ * the receiver from sequence gaps. The last run streams while the sender
+ * also hears more neighbours than its peer table holds, which must not
+ * disturb the sequence the receiver checks.
+ *
+ * Usage: sim_stream [loss] [payload bytes] [seconds] [seed] [neighbours]
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "Arduino.h"
+#include "I32CTT.h"
+#include "I32CTT_Arduino802154Interface.h"
+#include "I32CTT_SimRadio.h"
+#include "I32CTT_SimMedium.h"
+
+#define PAN_ID        0x0023
+#define SENDER_ADDR   0x0001
+#define RECEIVER_ADDR 0x0002
+#define NEIGHBOUR_BASE_ADDR 0x0010
+#define NEIGHBOUR_INTERVAL  2000 // ms between the frames of each neighbour
+#define SAMPLE_INTERVAL     10   // ms between blocks when neighbours share the channel
+
+struct Node {
+  I32CTT_SimRadio *radio;
+  I32CTT_Arduino802154Interface *iface;
+};
+
+static Node create_node(I32CTT_SimMedium &medium, uint16_t addr) {
+  Node node;
+
+  node.radio = new I32CTT_SimRadio(medium);
+  node.iface = new I32CTT_Arduino802154Interface();
+  node.iface->set_pan_id(PAN_ID);
+  node.iface->set_short_addr(addr);
+  node.iface->set_channel(C2405);
+
+  I32CTT_SimRadio::select(node.radio);
+  node.iface->init();
+  return node;
+}
+
+static void run(uint8_t streaming, double loss, uint8_t payload, uint32_t seconds, uint32_t seed,
+                uint8_t neighbours) {
+  I32CTT_SimMedium medium(seed);
+  I32CTT_SimLink link;
+  I32CTT_802154Peer *peer = NULL;
+  Node sender;
+  Node receiver;
+  Node *others = new Node[neighbours];
+  uint64_t *next_chat = new uint64_t[neighbours];
+  uint64_t end;
+  uint64_t next_sample;
+  uint32_t sent = 0;
+  uint32_t received = 0;
+  uint32_t bytes = 0;
+  uint32_t heard = 0;
+  uint32_t i;
+
+  link.connected = 1;
+  link.loss = loss;
+  link.lqi = 0xFF;
+  link.rssi = -60;
+  link.latency_us = 0;
+  medium.set_default_link(link);
+
+  sender = create_node(medium, SENDER_ADDR);
+  receiver = create_node(medium, RECEIVER_ADDR);
+  I32CTT_SimRadio::select(sender.radio);
+  sender.iface->set_dst_addr(RECEIVER_ADDR);
+  sender.iface->set_streaming(streaming);
+  for(i = 0; i < neighbours; i++) {
+    others[i] = create_node(medium, NEIGHBOUR_BASE_ADDR+i);
+    others[i].iface->set_dst_addr(SENDER_ADDR);
+    next_chat[i] = medium.now()+(uint64_t)i*NEIGHBOUR_INTERVAL*1000/neighbours;
+  }
+
+  next_sample = medium.now();
+  end = medium.now()+(uint64_t)seconds*1000000;
+  while(medium.now() < end) {
+    for(i = 0; i < neighbours; i++) {
+      // Each neighbour reports to the sender now and then, every one takes
+      // a peer table entry on the sender
+      I32CTT_SimRadio::select(others[i].radio);
+      if(others[i].iface->tx_size == 0 && medium.now() >= next_chat[i]) {
+        others[i].iface->tx_buffer[0] = CMD_W;
+        others[i].iface->tx_size = 1;
+        next_chat[i] += NEIGHBOUR_INTERVAL*1000;
+      }
+      others[i].iface->send_to_dst();
+    }
+
+    I32CTT_SimRadio::select(sender.radio);
+    if(sender.iface->tx_size == 0 && medium.now() >= next_sample) {
+      // A new sample block whenever the previous one left tx_buffer, the
+      // first byte is a command like in any I32CTT message. With
+      // neighbours the blocks are paced, a saturated sender never goes
+      // back to RX to hear them.
+      sender.iface->tx_buffer[0] = CMD_W;
+      for(i = 1; i < payload; i++)
+        sender.iface->tx_buffer[i] = sent+i;
+      sender.iface->tx_size = payload;
+      sent++;
+      if(neighbours > 0)
+        next_sample += SAMPLE_INTERVAL*1000;
+    }
+    sender.iface->send_to_dst();
+    if(sender.iface->data_available())
+      heard++;
+
+    I32CTT_SimRadio::select(receiver.radio);
+    receiver.iface->update();
+    if(receiver.iface->data_available()) {
+      received++;
+      bytes += receiver.iface->rx_size;
+    }
+  }
+
+  for(i = 0; i < receiver.iface->get_peer_count(); i++) {
+    peer = receiver.iface->get_peer_at(i);
+    if(peer != NULL && peer->addr == SENDER_ADDR)
+      break;
+    peer = NULL;
+  }
+
+  if(neighbours > 0)
+    printf("streaming every %u ms, sender hears %u neighbours (peer table %u):\n",
+      SAMPLE_INTERVAL, neighbours, PEER_TABLE_SIZE);
+  else
+    printf("%s:\n", streaming ? "streaming (no ACK)" : "acknowledged");
+  printf("  sent %u received %u goodput %.1f kb/s\n",
+    sent, received, bytes*8.0/1000/seconds);
+  if(peer != NULL && streaming) {
+    printf("  receiver: stream frames %u lost %u (%u never arrived) delivery %u%%\n",
+      peer->stats.stream_rx, peer->stats.stream_lost, sent-received,
+      receiver.iface->stream_delivery(SENDER_ADDR));
+  }
+  printf("  sender radio: frames %u aret success %u retries %u no ack %u\n",
+    sender.radio->stats.frames_tx, sender.radio->stats.aret_success,
+    sender.radio->stats.aret_retries, sender.radio->stats.aret_no_ack);
+  if(neighbours > 0)
+    printf("  sender heard %u neighbour frames\n", heard);
+
+  delete[] others;
+  delete[] next_chat;
+}
+
+int main(int argc, char **argv) {
+  double loss = argc > 1 ? atof(argv[1]) : 0.05;
+  uint32_t payload = argc > 2 ? atoi(argv[2]) : 100;
+  uint32_t seconds = argc > 3 ? atoi(argv[3]) : 5;
+  uint32_t seed = argc > 4 ? atoi(argv[4]) : 1;
+  uint32_t neighbours = argc > 5 ? atoi(argv[5]) : PEER_TABLE_SIZE+2;
+
+  if(payload == 0 || payload > IEEE_802154_MTU || seconds == 0 || neighbours > 0xFF) {
+    fprintf(stderr, "Usage: %s [loss] [payload 1-%u] [seconds] [seed] [neighbours]\n", argv[0], IEEE_802154_MTU);
+    return 1;
+  }
+
+  printf("loss %.3f payload %u bytes, %u s\n", loss, payload, seconds);
+  run(false, loss, payload, seconds, seed, 0);
+  run(true, loss, payload, seconds, seed, 0);
+  if(neighbours > 0)
+    run(true, loss, payload, seconds, seed, neighbours);
+  return 0;
+}
@@ -0,0 +1,166 @@
+/*
+ *
+ * This file is part of I32CTT (Integer 32-bit Control & Telemetry Transport).
+ * Copyright (C) 2017 Mario Gomez / Hackerspace San Salvador.
+ *
+ * I32CTT is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * I32CTT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with I32CTT.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Throughput and latency of read requests from one master to N slaves
+ * over the simulated medium, measured in virtual time.
+ *
+ * Usage: sim_throughput [slaves] [loss] [registers] [transactions] [seed]
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include <algorithm>
+#include "Arduino.h"
+#include "I32CTT.h"
+#include "I32CTT_Arduino802154Interface.h"
+#include "I32CTT_NullEndpoint.h"
+#include "I32CTT_SimRadio.h"
+#include "I32CTT_SimMedium.h"
+
+#define PAN_ID          0x0023
+#define MASTER_ADDR     0x0001
+#define ANSWER_TIMEOUT  100000 // us
+
+struct Node {
+  I32CTT_SimRadio *radio;
+  I32CTT_Arduino802154Interface *iface;
+  I32CTT_NullEndpoint *endpoint;
+  I32CTT_Controller *controller;
+};
+
+static Node create_node(I32CTT_SimMedium &medium, uint16_t addr) {
+  Node node;
+
+  node.radio = new I32CTT_SimRadio(medium);
+  node.iface = new I32CTT_Arduino802154Interface();
+  node.endpoint = new I32CTT_NullEndpoint(I32CTT_Endpoint::str2id("NUL"));
+  node.controller = new I32CTT_Controller(1);
+
+  node.iface->set_pan_id(PAN_ID);
+  node.iface->set_short_addr(addr);
+  node.iface->set_channel(C2405);
+
+  I32CTT_SimRadio::select(node.radio);
+  node.controller->add_mode_driver(*node.endpoint);
+  node.controller->set_interface(*node.iface);
+  node.controller->enable_scheduler();
+  node.controller->init();
+  return node;
+}
+
+static void run_node(Node &node) {
+  I32CTT_SimRadio::select(node.radio);
+  node.controller->run();
+}
+
+int main(int argc, char **argv) {
+  uint32_t slaves = argc > 1 ? atoi(argv[1]) : 4;
+  double loss = argc > 2 ? atof(argv[2]) : 0.0;
+  uint32_t registers = argc > 3 ? atoi(argv[3]) : 8;
+  uint32_t transactions = argc > 4 ? atoi(argv[4]) : 1000;
+  uint32_t seed = argc > 5 ? atoi(argv[5]) : 1;
+  I32CTT_SimMedium medium(seed);
+  I32CTT_SimLink link;
+  std::vector<Node> nodes;
+  std::vector<uint64_t> latencies;
+  uint64_t start;
+  uint64_t begin;
+  uint64_t elapsed;
+  uint32_t answered = 0;
+  uint32_t timeouts = 0;
+  uint32_t records = 0;
+  uint32_t spi_bytes = 0;
+  uint32_t dedup_hits = 0;
+  uint32_t dedup_replays = 0;
+  uint32_t i;
+  uint32_t j;
+
+  if(slaves == 0 || registers == 0 || registers > 19) {
+    fprintf(stderr, "Usage: %s [slaves] [loss] [registers 1-19] [transactions] [seed]\n", argv[0]);
+    return 1;
+  }
+
+  link.connected = 1;
+  link.loss = loss;
+  link.lqi = 0xFF;
+  link.rssi = -60;
+  link.latency_us = 0;
+  medium.set_default_link(link);
+
+  for(i = 0; i <= slaves; i++)
+    nodes.push_back(create_node(medium, MASTER_ADDR+i));
+
+  begin = medium.now();
+  for(i = 0; i < transactions; i++) {
+    Node &master = nodes[0];
+    uint16_t dst = MASTER_ADDR+1+(i%slaves);
+
+    I32CTT_SimRadio::select(master.radio);
+    master.iface->set_dst_addr(dst);
+    master.controller->master.set_mode(0);
+    for(j = 0; j < registers; j++)
+      master.controller->master.read_record(j);
+
+    start = medium.now();
+    master.controller->master.try_send();
+
+    for(;;) {
+      for(j = 0; j < nodes.size(); j++)
+        run_node(nodes[j]);
+      if(master.controller->master.available(CMD_AR)) {
+        latencies.push_back(medium.now()-start);
+        records += master.controller->master.records_available();
+        answered++;
+        break;
+      }
+      if(medium.now()-start > ANSWER_TIMEOUT) {
+        timeouts++;
+        break;
+      }
+    }
+  }
+  elapsed = medium.now()-begin;
+
+  for(i = 0; i < nodes.size(); i++) {
+    spi_bytes += nodes[i].radio->stats.spi_bytes;
+    dedup_hits += nodes[i].iface->get_dedup_hits();
+    dedup_replays += nodes[i].iface->get_dedup_replays();
+  }
+
+  std::sort(latencies.begin(), latencies.end());
+  printf("slaves %u loss %.3f registers %u transactions %u\n", slaves, loss, registers, transactions);
+  printf("answered %u timeouts %u records %u\n", answered, timeouts, records);
+  if(!latencies.empty()) {
+    printf("latency p50 %llu us p99 %llu us\n",
+      (unsigned long long)latencies[latencies.size()/2],
+      (unsigned long long)latencies[latencies.size()*99/100]);
+  }
+  printf("throughput %.1f transactions/s %.1f records/s\n",
+    answered*1e6/elapsed, records*1e6/elapsed);
+  printf("medium: transmissions %u deliveries %u collisions %u losses %u busy %.1f%%\n",
+    medium.stats.transmissions, medium.stats.deliveries,
+    medium.stats.collisions, medium.stats.losses,
+    medium.stats.busy_us[C2405]*100.0/elapsed);
+  printf("nodes: dedup hits %u replays %u, spi bytes %u\n",
+    dedup_hits, dedup_replays, spi_bytes);
+
+  return 0;
+}
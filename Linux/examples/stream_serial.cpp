@@ -0,0 +1,278 @@
+/*
+ *
+ * This file is part of I32CTT (Integer 32-bit Control & Telemetry Transport).
+ * Copyright (C) 2017 Mario Gomez / Hackerspace San Salvador.
+ *
+ * I32CTT is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * I32CTT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with I32CTT.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Read requests to a node behind I32CTT_ArduinoStreamInterface over an
+ * in-memory serial port, first with the text protocol and then in binary
+ * mode (SLIP + CRC-16). Checks every answer and reports the bytes on the
+ * wire, the run() calls and the write() calls per transaction. With a
+ * transmit FIFO size the port reports availableForWrite() and drains that
+ * many bytes per run(), bytes written past the free space would have
+ * blocked the controller.
+ *
+ * Usage: stream_serial [registers] [transactions] [baud] [tx fifo]
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <deque>
+#include <algorithm>
+#include "Arduino.h"
+#include "I32CTT.h"
+#include "I32CTT_ArduinoStreamInterface.h"
+#include "I32CTT_NullEndpoint.h"
+
+#define MAX_ITERATIONS 100000 // run() calls before a transaction is given up
+
+// Both directions of a serial link, as seen from the node
+class PipeStream: public Stream {
+  public:
+    std::deque<uint8_t> in;  // Host to node
+    std::deque<uint8_t> out; // Node to host
+    uint32_t fifo;    // Transmit FIFO size, 0 if not reported
+    uint32_t pending; // Bytes in the transmit FIFO
+    uint64_t writes;
+    uint64_t blocked;
+    PipeStream(uint32_t fifo) {
+      this->fifo = fifo;
+      this->pending = 0;
+      this->writes = 0;
+      this->blocked = 0;
+    }
+    size_t write(uint8_t c) {
+      return write(&c, 1);
+    }
+    size_t write(const uint8_t *buffer, size_t size) {
+      this->writes++;
+      if(this->fifo) {
+        if(this->pending+size > this->fifo)
+          this->blocked += this->pending+size-this->fifo;
+        this->pending = std::min<uint32_t>(this->pending+size, this->fifo);
+      }
+      this->out.insert(this->out.end(), buffer, buffer+size);
+      return size;
+    }
+    int availableForWrite() {
+      return this->fifo-this->pending;
+    }
+    // The UART sends what was in the FIFO since the last run()
+    void drain() {
+      this->pending = 0;
+    }
+    int available() {
+      return this->in.size();
+    }
+    int read() {
+      int c;
+
+      if(this->in.empty())
+        return -1;
+      c = this->in.front();
+      this->in.pop_front();
+      return c;
+    }
+    int peek() {
+      return this->in.empty() ? -1 : this->in.front();
+    }
+    using Print::write;
+};
+
+static void slip_put(std::deque<uint8_t> &out, uint8_t c) {
+  if(c == SLIP_END) {
+    out.push_back(SLIP_ESC);
+    out.push_back(SLIP_ESC_END);
+  } else if(c == SLIP_ESC) {
+    out.push_back(SLIP_ESC);
+    out.push_back(SLIP_ESC_ESC);
+  } else {
+    out.push_back(c);
+  }
+}
+
+static void send_binary(PipeStream &port, uint8_t *msg, uint16_t size) {
+  uint16_t crc = I32CTT_ArduinoStreamInterface::crc16(0, msg, size);
+
+  port.in.push_back(SLIP_END);
+  for(uint16_t i = 0; i < size; i++)
+    slip_put(port.in, msg[i]);
+  slip_put(port.in, crc & 0xFF);
+  slip_put(port.in, crc >> 8);
+  port.in.push_back(SLIP_END);
+}
+
+/*
+ * Takes the first complete SLIP frame out of the node's output, returns
+ * its length without CRC or -1 if none is complete or the CRC is wrong.
+ */
+static int recv_binary(PipeStream &port, uint8_t *msg) {
+  std::deque<uint8_t>::iterator end;
+  uint16_t crc;
+  int size = 0;
+  uint8_t escaped = 0;
+
+  while(!port.out.empty() && port.out.front() == SLIP_END)
+    port.out.pop_front();
+  for(end = port.out.begin(); end != port.out.end() && *end != SLIP_END; end++);
+  if(end == port.out.end())
+    return -1;
+
+  while(port.out.front() != SLIP_END) {
+    uint8_t c = port.out.front();
+    port.out.pop_front();
+    if(c == SLIP_ESC) {
+      escaped = 1;
+      continue;
+    }
+    if(escaped)
+      c = c == SLIP_ESC_END ? SLIP_END : SLIP_ESC;
+    escaped = 0;
+    if(size < SER_BUFF_SIZE)
+      msg[size++] = c;
+  }
+  if(size < 3)
+    return -1;
+  size -= 2;
+  crc = msg[size] | (msg[size+1]<<8);
+  return crc == I32CTT_ArduinoStreamInterface::crc16(0, msg, size) ? size : -1;
+}
+
+// Takes the "ar,..." answer line out of the node's output, "" if none yet
+static std::string recv_text(PipeStream &port) {
+  std::string line;
+
+  for(;;) {
+    std::deque<uint8_t>::iterator it;
+    for(it = port.out.begin(); it != port.out.end() && *it != '\n'; it++);
+    if(it == port.out.end())
+      return "";
+    line.assign(port.out.begin(), it);
+    port.out.erase(port.out.begin(), it+1);
+    if(line.compare(0, 3, "ar,") == 0)
+      return line;
+  }
+}
+
+static void run(I32CTT_STREAM_MODE mode, uint32_t registers, uint32_t transactions,
+    uint32_t baud, uint32_t fifo) {
+  PipeStream port(fifo);
+  I32CTT_ArduinoStreamInterface iface(port, mode);
+  I32CTT_NullEndpoint endpoint(I32CTT_Endpoint::str2id("NUL"));
+  I32CTT_Controller controller(1);
+  uint8_t msg[SER_BUFF_SIZE];
+  uint64_t bytes_in = 0;
+  uint64_t bytes_out = 0;
+  uint64_t iterations = 0;
+  uint32_t answered = 0;
+  uint32_t valid = 0;
+  uint32_t i;
+  uint32_t j;
+
+  controller.add_mode_driver(endpoint);
+  controller.set_interface(iface);
+  controller.init();
+  port.out.clear(); // Banner
+  port.drain();
+  port.writes = 0;
+  port.blocked = 0;
+
+  for(i = 0; i < transactions; i++) {
+    uint16_t first = i%100;
+    uint32_t calls = 0;
+    size_t queued;
+
+    if(mode == STREAM_BINARY) {
+      msg[0] = CMD_R;
+      msg[1] = 0;
+      for(j = 0; j < registers; j++)
+        I32CTT_Controller::put_reg(msg, first+j, CMD_R, j);
+      send_binary(port, msg, sizeof(I32CTT_Header)+registers*sizeof(I32CTT_Reg));
+    } else {
+      std::string line = "r,0";
+      for(j = 0; j < registers; j++)
+        line += "," + std::to_string(first+j);
+      line += "\r\n";
+      port.in.insert(port.in.end(), line.begin(), line.end());
+    }
+    bytes_in += port.in.size();
+
+    for(;;) {
+      controller.run();
+      port.drain();
+      calls++;
+      queued = port.out.size();
+      if(mode == STREAM_BINARY) {
+        int size = recv_binary(port, msg);
+        if(size > 0) {
+          bytes_out += queued;
+          answered++;
+          if(msg[0] == CMD_AR && I32CTT_Controller::reg_count(CMD_AR, size) == registers) {
+            for(j = 0; j < registers; j++) {
+              if(I32CTT_Controller::get_reg(msg, CMD_AR, j) != first+j)
+                break;
+            }
+            valid += j == registers;
+          }
+          break;
+        }
+      } else {
+        std::string line = recv_text(port);
+        if(!line.empty()) {
+          bytes_out += queued;
+          answered++;
+          valid += (uint32_t)std::count(line.begin(), line.end(), ',') == 1+registers*2;
+          break;
+        }
+      }
+      if(calls >= MAX_ITERATIONS)
+        break;
+    }
+    iterations += calls;
+    port.out.clear();
+  }
+
+  printf("%s:\n", mode == STREAM_BINARY ? "binary (SLIP + CRC-16)" : "text");
+  printf("  answered %u/%u valid %u\n", answered, transactions, valid);
+  printf("  bytes per transaction: request %.1f answer %.1f, %.2f ms at %u baud\n",
+    (double)bytes_in/transactions, (double)bytes_out/transactions,
+    (bytes_in+bytes_out)*10.0*1000/baud/transactions, baud);
+  printf("  run() calls per transaction %.1f, write() calls per transaction %.1f\n",
+    (double)iterations/transactions, (double)port.writes/transactions);
+  if(fifo)
+    printf("  bytes past the transmit FIFO %llu\n", (unsigned long long)port.blocked);
+}
+
+int main(int argc, char **argv) {
+  uint32_t registers = argc > 1 ? atoi(argv[1]) : 8;
+  uint32_t transactions = argc > 2 ? atoi(argv[2]) : 100;
+  uint32_t baud = argc > 3 ? atoi(argv[3]) : 115200;
+  uint32_t fifo = argc > 4 ? atoi(argv[4]) : 64;
+
+  if(registers == 0 || registers > (SER_MTU_SIZE-sizeof(I32CTT_Header))/sizeof(I32CTT_RegData) ||
+    transactions == 0 || baud == 0) {
+    fprintf(stderr, "Usage: %s [registers 1-%u] [transactions] [baud] [tx fifo]\n", argv[0],
+      (unsigned)((SER_MTU_SIZE-sizeof(I32CTT_Header))/sizeof(I32CTT_RegData)));
+    return 1;
+  }
+
+  printf("registers %u transactions %u tx fifo %u\n", registers, transactions, fifo);
+  run(STREAM_TEXT, registers, transactions, baud, fifo);
+  run(STREAM_BINARY, registers, transactions, baud, fifo);
+  return 0;
+}
@@ -0,0 +1,192 @@
+/*
+ *
+ * This file is part of I32CTT (Integer 32-bit Control & Telemetry Transport).
+ * Copyright (C) 2017 Mario Gomez / Hackerspace San Salvador.
+ *
+ * I32CTT is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * I32CTT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with I32CTT.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A virtual slave behind I32CTT_LinuxUDPInterface on 127.0.0.1 and a
+ * client socket keeping a window of read requests in flight, both in the
+ * same thread. Runs once with one datagram per syscall and once with
+ * batches, reports answers per second, p50/p99 round trip latency and
+ * the slave's syscalls per frame.
+ *
+ * Usage: udp_loopback [transactions] [window] [registers]
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <vector>
+#include <algorithm>
+#include "Arduino.h"
+#include "I32CTT.h"
+#include "I32CTT_NullEndpoint.h"
+#include "I32CTT_LinuxUDPInterface.h"
+
+#define CLIENT_BATCH 64
+#define IDLE_TIMEOUT 1000 // ms without answers before the run is given up
+
+static uint64_t now_ns() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec*1000000000ULL+ts.tv_nsec;
+}
+
+static int client_socket(uint16_t port) {
+  struct sockaddr_in addr;
+  int fd;
+
+  fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+  if(fd < 0)
+    return -1;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static void run(uint8_t batch, uint32_t transactions, uint32_t window, uint32_t registers) {
+  I32CTT_LinuxUDPInterface iface(0, "127.0.0.1", batch);
+  I32CTT_NullEndpoint endpoint(I32CTT_Endpoint::str2id("NUL"));
+  I32CTT_Controller controller(1);
+  I32CTT_UDPStats *stats;
+  static uint8_t requests[CLIENT_BATCH][UDP_MTU_SIZE];
+  static uint8_t answers[CLIENT_BATCH][UDP_MTU_SIZE];
+  struct mmsghdr msgs[CLIENT_BATCH];
+  struct iovec iov[CLIENT_BATCH];
+  std::vector<uint64_t> sent_at(65536);
+  std::vector<uint64_t> latency;
+  uint64_t begin;
+  uint64_t elapsed;
+  uint64_t last_answer;
+  uint32_t issued = 0;
+  uint32_t answered = 0;
+  uint32_t valid = 0;
+  uint32_t before;
+  uint32_t count;
+  uint32_t i;
+  uint32_t j;
+  int fd;
+  int n;
+
+  controller.add_mode_driver(endpoint);
+  controller.set_interface(iface);
+  controller.init();
+  fd = client_socket(iface.get_port());
+  if(iface.get_fd() < 0 || fd < 0) {
+    fprintf(stderr, "socket: %s\n", strerror(errno));
+    return;
+  }
+
+  begin = now_ns();
+  last_answer = begin;
+  while(answered < transactions && now_ns()-last_answer < IDLE_TIMEOUT*1000000ULL) {
+    // Client: top the window up, the first register carries the sequence
+    count = std::min(window-(issued-answered), transactions-issued);
+    count = std::min<uint32_t>(count, CLIENT_BATCH);
+    for(i = 0; i < count; i++) {
+      uint16_t seq = issued+i;
+      requests[i][0] = CMD_R;
+      requests[i][1] = 0;
+      for(j = 0; j < registers; j++)
+        I32CTT_Controller::put_reg(requests[i], j == 0 ? seq : j, CMD_R, j);
+      iov[i].iov_base = requests[i];
+      iov[i].iov_len = sizeof(I32CTT_Header)+registers*sizeof(I32CTT_Reg);
+      memset(&msgs[i], 0, sizeof(struct mmsghdr));
+      msgs[i].msg_hdr.msg_iov = &iov[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+      sent_at[seq] = now_ns();
+    }
+    if(count > 0) {
+      n = sendmmsg(fd, msgs, count, 0);
+      if(n > 0)
+        issued += n;
+    }
+
+    // Slave: run until a pass neither receives nor sends
+    stats = iface.get_stats();
+    do {
+      before = stats->rx_frames+stats->tx_frames;
+      controller.run();
+    } while(stats->rx_frames+stats->tx_frames != before);
+
+    // Client: collect the answers
+    for(i = 0; i < CLIENT_BATCH; i++) {
+      iov[i].iov_base = answers[i];
+      iov[i].iov_len = UDP_MTU_SIZE;
+      memset(&msgs[i], 0, sizeof(struct mmsghdr));
+      msgs[i].msg_hdr.msg_iov = &iov[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    n = recvmmsg(fd, msgs, CLIENT_BATCH, MSG_DONTWAIT, NULL);
+    for(i = 0; n > 0 && i < (uint32_t)n; i++) {
+      uint64_t t = now_ns();
+      uint16_t seq = I32CTT_Controller::get_reg(answers[i], CMD_AR, 0);
+      answered++;
+      last_answer = t;
+      latency.push_back(t-sent_at[seq]);
+      valid += answers[i][0] == CMD_AR &&
+        I32CTT_Controller::reg_count(CMD_AR, msgs[i].msg_len) == registers;
+    }
+  }
+  elapsed = now_ns()-begin;
+  close(fd);
+
+  stats = iface.get_stats();
+  std::sort(latency.begin(), latency.end());
+  printf("%s (batch %u):\n", batch > 1 ? "recvmmsg/sendmmsg" : "one datagram per syscall", batch);
+  printf("  answered %u/%u valid %u, %.0f frames/s\n", answered, transactions, valid,
+    answered*1e9/elapsed);
+  if(!latency.empty())
+    printf("  latency p50 %.1f us p99 %.1f us\n",
+      latency[latency.size()/2]/1000.0, latency[latency.size()*99/100]/1000.0);
+  printf("  slave syscalls per frame: receive %.3f send %.3f, dropped %u\n",
+    stats->rx_frames ? (double)stats->rx_batches/stats->rx_frames : 0.0,
+    stats->tx_frames ? (double)stats->tx_batches/stats->tx_frames : 0.0,
+    stats->rx_dropped+stats->tx_dropped);
+}
+
+int main(int argc, char **argv) {
+  uint32_t transactions = argc > 1 ? atoi(argv[1]) : 200000;
+  uint32_t window = argc > 2 ? atoi(argv[2]) : 32;
+  uint32_t registers = argc > 3 ? atoi(argv[3]) : 8;
+
+  if(transactions == 0 || window == 0 || window > 60000 || registers == 0 ||
+    registers > (UDP_MTU_SIZE-sizeof(I32CTT_Header))/sizeof(I32CTT_RegData)) {
+    fprintf(stderr, "Usage: %s [transactions] [window] [registers 1-%u]\n", argv[0],
+      (unsigned)((UDP_MTU_SIZE-sizeof(I32CTT_Header))/sizeof(I32CTT_RegData)));
+    return 1;
+  }
+
+  printf("transactions %u window %u registers %u\n", transactions, window, registers);
+  run(1, transactions, window, registers);
+  run(UDP_BATCH_SIZE, transactions, window, registers);
+  return 0;
+}
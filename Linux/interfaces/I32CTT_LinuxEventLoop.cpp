@@ -0,0 +1,1171 @@
+/*
+ *
+ * This file is part of I32CTT (Integer 32-bit Control & Telemetry Transport).
+ * Copyright (C) 2017 Mario Gomez / Hackerspace San Salvador.
+ *
+ * I32CTT is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * I32CTT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with I32CTT.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/epoll.h>
+#include <linux/io_uring.h>
+#include "I32CTT.h"
+#include "I32CTT_LinuxSerialInterface.h"
+#include "I32CTT_LinuxEventLoop.h"
+
+// liburing is not required, the three system calls are used directly
+#define LOOP_OP_RECV 1
+#define LOOP_OP_SEND 2
+#define LOOP_OP_CANCEL 3
+#define LOOP_BUFFER_GROUP 0
+#define LOOP_NAME_SIZE sizeof(struct sockaddr_storage)
+// Datagram buffers: [io_uring_recvmsg_out][name, LOOP_NAME_SIZE][payload]
+#define LOOP_PAYLOAD_OFFSET (sizeof(struct io_uring_recvmsg_out)+LOOP_NAME_SIZE)
+#define LOOP_USER_DATA(op, iface, slot) (((uint64_t)(op) << 56) | ((uint64_t)(iface) << 32) | (uint32_t)(slot))
+
+enum I32CTT_LOOP_LIST {
+  LOOP_LIST_READY = 0, // Messages waiting for the controller
+  LOOP_LIST_REARM,     // Receive to submit again
+  LOOP_LIST_OUTPUT     // SLIP frames to write
+};
+
+static int loop_uring_setup(uint32_t entries, struct io_uring_params *params) {
+  return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int loop_uring_enter(int fd, uint32_t submit, uint32_t min_complete, uint32_t flags, void *arg, size_t size) {
+  return syscall(__NR_io_uring_enter, fd, submit, min_complete, flags, arg, size);
+}
+
+static int loop_uring_register(int fd, uint32_t opcode, void *arg, uint32_t count) {
+  return syscall(__NR_io_uring_register, fd, opcode, arg, count);
+}
+
+/*
+ * fd is opened, configured and non-blocking already, the interface does
+ * not close it.
+ */
+I32CTT_LinuxLoopInterface::I32CTT_LinuxLoopInterface(int fd, I32CTT_LOOP_FRAMING framing) {
+  this->loop = NULL;
+  this->controller = NULL;
+  this->fd = fd;
+  this->framing = framing;
+  this->index = 0;
+  this->rx_first = -1;
+  this->rx_last = -1;
+  this->rx_held = -1;
+  this->rx_pos = 0;
+  this->frame = framing == LOOP_SLIP ? new uint8_t[LOOP_MTU_SIZE+SERIAL_CRC_SIZE] : NULL;
+  this->frame_size = 0;
+  this->escaped = 0;
+  this->overrun = 0;
+  this->tx_slot = -1;
+  this->out_first = -1;
+  this->out_slot = -1;
+  this->out_busy = -1;
+  this->out_done = 0;
+  this->scratch = new uint8_t[LOOP_MTU_SIZE];
+  this->armed = 0;
+  this->closed = 0;
+  this->listed = 0;
+  this->d_available = 0;
+  this->last_len = 0;
+  this->dst_len = 0;
+
+  this->rx_buffer = NULL;
+  this->rx_size = 0;
+  this->tx_buffer = this->scratch;
+  this->tx_size = 0;
+}
+
+I32CTT_LinuxLoopInterface::~I32CTT_LinuxLoopInterface() {
+  if(this->loop != NULL)
+    this->loop->remove(*this);
+  delete[] this->frame;
+  delete[] this->scratch;
+}
+
+void I32CTT_LinuxLoopInterface::init() {
+  // The loop owns the descriptor's I/O, see I32CTT_LinuxEventLoop::add()
+}
+
+/*
+ * Gives the buffer of the message parsed last back to the pool and
+ * presents the next message.
+ */
+void I32CTT_LinuxLoopInterface::update() {
+  if(this->loop == NULL || this->d_available)
+    return;
+
+  release();
+  if(this->framing == LOOP_DATAGRAM)
+    next_datagram();
+  else
+    next_slip();
+}
+
+void I32CTT_LinuxLoopInterface::release() {
+  if(this->rx_held >= 0) {
+    this->loop->return_rx(this->rx_held);
+    this->rx_held = -1;
+  }
+}
+
+uint8_t I32CTT_LinuxLoopInterface::next_datagram() {
+  struct io_uring_recvmsg_out *out;
+  uint8_t *data;
+  int32_t buffer;
+
+  while(this->rx_first >= 0) {
+    buffer = this->rx_first;
+    this->rx_first = this->loop->rx_next[buffer];
+    if(this->rx_first < 0)
+      this->rx_last = -1;
+
+    data = this->loop->rx_data(buffer);
+    out = (struct io_uring_recvmsg_out*)data;
+    if((out->flags & MSG_TRUNC) || out->payloadlen == 0 || out->payloadlen > LOOP_MTU_SIZE ||
+      out->namelen > LOOP_NAME_SIZE) {
+      this->loop->stats.rx_dropped++;
+      this->loop->return_rx(buffer);
+      continue;
+    }
+
+    memcpy(&this->last_addr, data+sizeof(struct io_uring_recvmsg_out), out->namelen);
+    this->last_len = out->namelen;
+    this->rx_buffer = data+LOOP_PAYLOAD_OFFSET;
+    this->rx_size = out->payloadlen;
+    this->rx_held = buffer;
+    this->loop->stats.rx_frames++;
+    this->d_available = 1;
+    return 1;
+  }
+  return 0;
+}
+
+/*
+ * Decodes received chunks up to the end of a message, as
+ * I32CTT_LinuxSerialInterface does. A chunk goes back to the pool once
+ * all its bytes are decoded.
+ */
+uint8_t I32CTT_LinuxLoopInterface::next_slip() {
+  uint8_t *data;
+  uint32_t len;
+  uint16_t size;
+  uint16_t crc;
+  int32_t buffer;
+  uint8_t c;
+
+  while(this->rx_first >= 0) {
+    buffer = this->rx_first;
+    data = this->loop->rx_data(buffer);
+    len = this->loop->rx_len[buffer];
+    if(this->rx_pos >= len) {
+      this->rx_first = this->loop->rx_next[buffer];
+      if(this->rx_first < 0)
+        this->rx_last = -1;
+      this->rx_pos = 0;
+      this->loop->return_rx(buffer);
+      continue;
+    }
+
+    c = data[this->rx_pos++];
+    if(this->escaped) {
+      c = c == SLIP_ESC_END ? SLIP_END : (c == SLIP_ESC_ESC ? SLIP_ESC : c);
+      this->escaped = 0;
+    } else if(c == SLIP_ESC) {
+      this->escaped = 1;
+      continue;
+    } else if(c == SLIP_END) {
+      size = this->frame_size;
+      this->frame_size = 0;
+      if(this->overrun || (size > 0 && size <= SERIAL_CRC_SIZE)) {
+        this->overrun = 0;
+        this->loop->stats.rx_dropped++;
+        continue;
+      }
+      if(size == 0)
+        continue; // Separator before every frame
+      size -= SERIAL_CRC_SIZE;
+      crc = this->frame[size] | (this->frame[size+1] << 8);
+      if(crc != I32CTT_LinuxSerialInterface::crc16(0, this->frame, size)) {
+        this->loop->stats.rx_dropped++;
+        continue;
+      }
+      this->rx_buffer = this->frame;
+      this->rx_size = size;
+      this->loop->stats.rx_frames++;
+      this->d_available = 1;
+      return 1;
+    }
+
+    if(this->frame_size < LOOP_MTU_SIZE+SERIAL_CRC_SIZE)
+      this->frame[this->frame_size++] = c;
+    else
+      this->overrun = 1;
+  }
+  return 0;
+}
+
+uint8_t I32CTT_LinuxLoopInterface::available() {
+  if(this->loop == NULL)
+    return 0;
+  if(this->framing == LOOP_SLIP)
+    return this->out_slot >= 0 || this->loop->tx_free_count > 0;
+  if(this->tx_slot < 0 && this->tx_size == 0)
+    take_tx_buffer();
+  return this->tx_slot >= 0;
+}
+
+uint8_t I32CTT_LinuxLoopInterface::data_available() {
+  uint8_t result = this->d_available;
+  this->d_available = 0;
+  return result;
+}
+
+void I32CTT_LinuxLoopInterface::send() {
+  if(this->framing == LOOP_SLIP)
+    encode_slip();
+  else
+    queue(&this->last_addr, this->last_len);
+}
+
+void I32CTT_LinuxLoopInterface::send_to_dst() {
+  if(this->framing == LOOP_SLIP)
+    encode_slip(); // A stream has one peer
+  else
+    queue(&this->dst_addr, this->dst_len);
+}
+
+uint16_t I32CTT_LinuxLoopInterface::get_MTU() {
+  return LOOP_MTU_SIZE;
+}
+
+/*
+ * Destination of send_to_dst() on datagram sockets.
+ */
+void I32CTT_LinuxLoopInterface::set_dst_addr(const struct sockaddr *addr, socklen_t len) {
+  if(len > sizeof(struct sockaddr_storage))
+    len = sizeof(struct sockaddr_storage);
+  memcpy(&this->dst_addr, addr, len);
+  this->dst_len = len;
+}
+
+int I32CTT_LinuxLoopInterface::get_fd() {
+  return this->fd;
+}
+
+/*
+ * Datagram answers are written straight into a transmit buffer, scratch
+ * only stands in while the pool is empty.
+ */
+void I32CTT_LinuxLoopInterface::take_tx_buffer() {
+  this->tx_slot = this->loop->take_tx();
+  this->tx_buffer = this->tx_slot >= 0 ? this->loop->tx_data(this->tx_slot) : this->scratch;
+}
+
+void I32CTT_LinuxLoopInterface::queue(const struct sockaddr_storage *addr, socklen_t len) {
+  I32CTT_LinuxEventLoop *loop = this->loop;
+  int32_t slot;
+
+  if(this->tx_size == 0)
+    return;
+  if(loop != NULL && this->tx_slot < 0) {
+    take_tx_buffer();
+    if(this->tx_slot >= 0)
+      memcpy(this->tx_buffer, this->scratch, this->tx_size);
+  }
+  if(loop == NULL || this->tx_slot < 0 || len == 0 || this->tx_size > LOOP_MTU_SIZE) {
+    if(loop != NULL)
+      loop->stats.tx_dropped++;
+    this->tx_size = 0;
+    return;
+  }
+
+  slot = this->tx_slot;
+  memcpy(&loop->tx_addrs[slot], addr, len);
+  loop->tx_msgs[slot].msg_namelen = len;
+  loop->tx_iov[slot].iov_len = this->tx_size;
+  this->tx_size = 0;
+  this->tx_slot = -1;
+  loop->queue_datagram(this, slot);
+  take_tx_buffer();
+}
+
+/*
+ * Appends tx_buffer as a SLIP frame to the output list, a new buffer is
+ * linked when the last one cannot take the frame escaped in full. The
+ * loop writes the list buffer by buffer.
+ */
+void I32CTT_LinuxLoopInterface::encode_slip() {
+  I32CTT_LinuxEventLoop *loop = this->loop;
+  uint32_t need = 2+2*((uint32_t)this->tx_size+SERIAL_CRC_SIZE);
+  int32_t slot;
+  uint16_t crc;
+  uint8_t *out;
+  uint8_t c;
+  uint32_t i;
+
+  if(this->tx_size == 0)
+    return;
+  if(loop == NULL || this->tx_size > LOOP_MTU_SIZE) {
+    if(loop != NULL)
+      loop->stats.tx_dropped++;
+    this->tx_size = 0;
+    return;
+  }
+  if(this->out_slot < 0 || loop->tx_iov[this->out_slot].iov_len+need > LOOP_BUFFER_SIZE) {
+    slot = loop->take_tx();
+    if(slot < 0) {
+      loop->stats.tx_dropped++;
+      this->tx_size = 0;
+      return;
+    }
+    loop->tx_iov[slot].iov_len = 0;
+    loop->tx_next[slot] = -1;
+    if(this->out_slot >= 0)
+      loop->tx_next[this->out_slot] = slot;
+    else
+      this->out_first = slot;
+    this->out_slot = slot;
+  }
+
+  crc = I32CTT_LinuxSerialInterface::crc16(0, this->tx_buffer, this->tx_size);
+  out = loop->tx_data(this->out_slot)+loop->tx_iov[this->out_slot].iov_len;
+  *out++ = SLIP_END;
+  for(i = 0; i < (uint32_t)this->tx_size+SERIAL_CRC_SIZE; i++) {
+    c = i < this->tx_size ? this->tx_buffer[i] : (i == this->tx_size ? crc & 0xFF : crc >> 8);
+    if(c == SLIP_END) {
+      *out++ = SLIP_ESC;
+      *out++ = SLIP_ESC_END;
+    } else if(c == SLIP_ESC) {
+      *out++ = SLIP_ESC;
+      *out++ = SLIP_ESC_ESC;
+    } else {
+      *out++ = c;
+    }
+  }
+  *out++ = SLIP_END;
+  loop->tx_iov[this->out_slot].iov_len = out-loop->tx_data(this->out_slot);
+  this->tx_size = 0;
+  loop->stats.tx_frames++;
+  loop->add_to_list(this, LOOP_LIST_OUTPUT);
+}
+
+I32CTT_LinuxEventLoop::I32CTT_LinuxEventLoop(I32CTT_LOOP_BACKEND backend) {
+  int32_t i;
+
+  this->backend = backend;
+  this->ring_fd = -1;
+  this->epoll_fd = -1;
+  this->sq_map = NULL;
+  this->cq_map = NULL;
+  this->sqes = NULL;
+  this->buf_ring = NULL;
+  this->sq_local = 0;
+  this->to_submit = 0;
+  this->fixed_tx = 0;
+  this->buf_tail = 0;
+  memset(&this->recv_msg, 0, sizeof(struct msghdr));
+  this->recv_msg.msg_namelen = LOOP_NAME_SIZE;
+
+  this->rx_pool = (uint8_t*)aligned_alloc(4096, LOOP_RX_BUFFERS*LOOP_BUFFER_SIZE);
+  this->rx_next = new int32_t[LOOP_RX_BUFFERS];
+  this->rx_len = new uint32_t[LOOP_RX_BUFFERS];
+  this->rx_free = new int32_t[LOOP_RX_BUFFERS];
+  this->rx_free_count = 0;
+
+  this->tx_pool = (uint8_t*)aligned_alloc(4096, LOOP_TX_BUFFERS*LOOP_BUFFER_SIZE);
+  this->tx_msgs = new struct msghdr[LOOP_TX_BUFFERS];
+  this->tx_iov = new struct iovec[LOOP_TX_BUFFERS];
+  this->tx_addrs = new struct sockaddr_storage[LOOP_TX_BUFFERS];
+  this->tx_next = new int32_t[LOOP_TX_BUFFERS];
+  this->tx_free = new int32_t[LOOP_TX_BUFFERS];
+  this->tx_pending = new int32_t[LOOP_TX_BUFFERS];
+  this->tx_pending_iface = new uint16_t[LOOP_TX_BUFFERS];
+  this->tx_pending_count = 0;
+  memset(this->tx_msgs, 0, sizeof(struct msghdr)*LOOP_TX_BUFFERS);
+  for(i = 0; i < LOOP_TX_BUFFERS; i++) {
+    this->tx_iov[i].iov_base = tx_data(i);
+    this->tx_iov[i].iov_len = 0;
+    this->tx_msgs[i].msg_name = &this->tx_addrs[i];
+    this->tx_msgs[i].msg_iov = &this->tx_iov[i];
+    this->tx_msgs[i].msg_iovlen = 1;
+    this->tx_free[i] = LOOP_TX_BUFFERS-1-i;
+  }
+  this->tx_free_count = LOOP_TX_BUFFERS;
+
+  this->interfaces = new I32CTT_LinuxLoopInterface*[LOOP_MAX_INTERFACES];
+  for(i = 0; i < 3; i++) {
+    this->lists[i] = new uint16_t[LOOP_MAX_INTERFACES];
+    this->list_count[i] = 0;
+  }
+  this->interface_count = 0;
+  memset(&this->stats, 0, sizeof(I32CTT_LoopStats));
+}
+
+I32CTT_LinuxEventLoop::~I32CTT_LinuxEventLoop() {
+  uint16_t i;
+
+  for(i = 0; i < this->interface_count; i++) {
+    if(this->interfaces[i] != NULL)
+      this->interfaces[i]->loop = NULL;
+  }
+  close_uring();
+  if(this->epoll_fd >= 0)
+    close(this->epoll_fd);
+  free(this->rx_pool);
+  free(this->tx_pool);
+  delete[] this->rx_next;
+  delete[] this->rx_len;
+  delete[] this->rx_free;
+  delete[] this->tx_msgs;
+  delete[] this->tx_iov;
+  delete[] this->tx_addrs;
+  delete[] this->tx_next;
+  delete[] this->tx_free;
+  delete[] this->tx_pending;
+  delete[] this->tx_pending_iface;
+  delete[] this->interfaces;
+  for(i = 0; i < 3; i++)
+    delete[] this->lists[i];
+}
+
+/*
+ * Sets the backend up. LOOP_AUTO tries io_uring and falls back to epoll,
+ * an explicit LOOP_IO_URING fails instead. Returns 0 on failure.
+ */
+uint8_t I32CTT_LinuxEventLoop::init() {
+  if(this->rx_pool == NULL || this->tx_pool == NULL)
+    return 0;
+  if(this->ring_fd >= 0 || this->epoll_fd >= 0)
+    return 1;
+
+  if(this->backend != LOOP_EPOLL) {
+    if(init_uring()) {
+      this->backend = LOOP_IO_URING;
+      return 1;
+    }
+    if(this->backend == LOOP_IO_URING)
+      return 0;
+  }
+  this->backend = LOOP_EPOLL;
+  return init_epoll();
+}
+
+/*
+ * Maps the rings, registers the provided buffer ring for receives and
+ * the transmit pool as a fixed buffer (optional, RLIMIT_MEMLOCK may
+ * refuse it), then checks that multishot recvmsg() works.
+ */
+uint8_t I32CTT_LinuxEventLoop::init_uring() {
+  struct io_uring_params params;
+  struct io_uring_buf_reg reg;
+  struct iovec pool;
+  int32_t i;
+
+  memset(&params, 0, sizeof(params));
+  params.flags = IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN | IORING_SETUP_SINGLE_ISSUER;
+  this->ring_fd = loop_uring_setup(LOOP_RING_ENTRIES, &params);
+  if(this->ring_fd < 0 && errno == EINVAL) {
+    memset(&params, 0, sizeof(params)); // Kernel older than 6.0
+    this->ring_fd = loop_uring_setup(LOOP_RING_ENTRIES, &params);
+  }
+  if(this->ring_fd < 0)
+    return 0;
+  if(!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_EXT_ARG)) {
+    close_uring();
+    return 0;
+  }
+
+  this->sq_map_size = params.sq_off.array+params.sq_entries*sizeof(uint32_t);
+  this->cq_map_size = params.cq_off.cqes+params.cq_entries*sizeof(struct io_uring_cqe);
+  if(this->cq_map_size > this->sq_map_size)
+    this->sq_map_size = this->cq_map_size;
+  this->sq_map = (uint8_t*)mmap(NULL, this->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+    this->ring_fd, IORING_OFF_SQ_RING);
+  this->sqes = (struct io_uring_sqe*)mmap(NULL, params.sq_entries*sizeof(struct io_uring_sqe),
+    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this->ring_fd, IORING_OFF_SQES);
+  if(this->sq_map == MAP_FAILED || this->sqes == MAP_FAILED) {
+    if(this->sq_map == MAP_FAILED)
+      this->sq_map = NULL;
+    if(this->sqes == MAP_FAILED)
+      this->sqes = NULL;
+    close_uring();
+    return 0;
+  }
+  this->cq_map = this->sq_map;
+  this->sq_entries = params.sq_entries;
+  this->sq_head = (uint32_t*)(this->sq_map+params.sq_off.head);
+  this->sq_tail = (uint32_t*)(this->sq_map+params.sq_off.tail);
+  this->sq_mask = (uint32_t*)(this->sq_map+params.sq_off.ring_mask);
+  this->sq_array = (uint32_t*)(this->sq_map+params.sq_off.array);
+  this->cq_head = (uint32_t*)(this->cq_map+params.cq_off.head);
+  this->cq_tail = (uint32_t*)(this->cq_map+params.cq_off.tail);
+  this->cq_mask = (uint32_t*)(this->cq_map+params.cq_off.ring_mask);
+  this->cqes = (struct io_uring_cqe*)(this->cq_map+params.cq_off.cqes);
+  this->sq_local = *this->sq_tail;
+
+  this->buf_ring = (struct io_uring_buf_ring*)aligned_alloc(4096,
+    LOOP_RX_BUFFERS*sizeof(struct io_uring_buf));
+  if(this->buf_ring == NULL) {
+    close_uring();
+    return 0;
+  }
+  memset(this->buf_ring, 0, LOOP_RX_BUFFERS*sizeof(struct io_uring_buf));
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = (uint64_t)(uintptr_t)this->buf_ring;
+  reg.ring_entries = LOOP_RX_BUFFERS;
+  reg.bgid = LOOP_BUFFER_GROUP;
+  if(loop_uring_register(this->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+    close_uring();
+    return 0;
+  }
+  this->buf_tail = 0;
+  for(i = 0; i < LOOP_RX_BUFFERS; i++)
+    return_rx(i);
+
+  pool.iov_base = this->tx_pool;
+  pool.iov_len = LOOP_TX_BUFFERS*LOOP_BUFFER_SIZE;
+  this->fixed_tx = loop_uring_register(this->ring_fd, IORING_REGISTER_BUFFERS, &pool, 1) == 0;
+
+  if(!probe_multishot()) {
+    close_uring();
+    return 0;
+  }
+  return 1;
+}
+
+/*
+ * Multishot recvmsg() came with Linux 6.0, a ring can be set up on older
+ * kernels that reject it. One datagram over a socket pair tells.
+ */
+uint8_t I32CTT_LinuxEventLoop::probe_multishot() {
+  struct io_uring_sqe *sqe;
+  struct io_uring_cqe *cqe;
+  uint8_t result = 0;
+  uint8_t byte = 0;
+  int fds[2];
+
+  if(socketpair(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds) != 0)
+    return 0;
+
+  sqe = get_sqe();
+  sqe->opcode = IORING_OP_RECVMSG;
+  sqe->fd = fds[0];
+  sqe->addr = (uint64_t)(uintptr_t)&this->recv_msg;
+  sqe->len = 1;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = LOOP_BUFFER_GROUP;
+  sqe->user_data = LOOP_USER_DATA(LOOP_OP_RECV, 0xFFFF, 0);
+  if(send(fds[1], &byte, 1, 0) == 1) {
+    __atomic_store_n(this->sq_tail, this->sq_local, __ATOMIC_RELEASE);
+    if(loop_uring_enter(this->ring_fd, this->to_submit, 1, IORING_ENTER_GETEVENTS, NULL, 0) >= 0) {
+      this->to_submit = 0;
+      if(*this->cq_head != __atomic_load_n(this->cq_tail, __ATOMIC_ACQUIRE)) {
+        cqe = &this->cqes[*this->cq_head & *this->cq_mask];
+        result = cqe->res > 0 && (cqe->flags & IORING_CQE_F_MORE) && (cqe->flags & IORING_CQE_F_BUFFER);
+        if(cqe->flags & IORING_CQE_F_BUFFER)
+          return_rx(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+        __atomic_store_n(this->cq_head, *this->cq_head+1, __ATOMIC_RELEASE);
+      }
+    }
+  }
+  close(fds[0]); // Ends the multishot receive, its last completion is ignored
+  close(fds[1]);
+  return result;
+}
+
+void I32CTT_LinuxEventLoop::close_uring() {
+  if(this->sqes != NULL)
+    munmap(this->sqes, this->sq_entries*sizeof(struct io_uring_sqe));
+  if(this->sq_map != NULL)
+    munmap(this->sq_map, this->sq_map_size);
+  if(this->ring_fd >= 0)
+    close(this->ring_fd);
+  free(this->buf_ring);
+  this->sqes = NULL;
+  this->sq_map = NULL;
+  this->cq_map = NULL;
+  this->ring_fd = -1;
+  this->buf_ring = NULL;
+}
+
+uint8_t I32CTT_LinuxEventLoop::init_epoll() {
+  int32_t i;
+
+  this->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if(this->epoll_fd < 0)
+    return 0;
+  for(i = 0; i < LOOP_RX_BUFFERS; i++)
+    this->rx_free[i] = LOOP_RX_BUFFERS-1-i;
+  this->rx_free_count = LOOP_RX_BUFFERS;
+  return 1;
+}
+
+/*
+ * Attaches controller and interface, the controller must not be run by
+ * anything else. Returns 0 if the loop is full or not initialized.
+ */
+uint8_t I32CTT_LinuxEventLoop::add(I32CTT_Controller &controller, I32CTT_LinuxLoopInterface &iface) {
+  struct epoll_event ev;
+
+  if(this->interface_count >= LOOP_MAX_INTERFACES || iface.loop != NULL ||
+    (this->ring_fd < 0 && this->epoll_fd < 0))
+    return 0;
+
+  if(this->backend == LOOP_EPOLL) {
+    ev.events = EPOLLIN;
+    ev.data.u32 = this->interface_count;
+    if(epoll_ctl(this->epoll_fd, EPOLL_CTL_ADD, iface.fd, &ev) != 0)
+      return 0;
+  }
+
+  iface.loop = this;
+  iface.controller = &controller;
+  iface.index = this->interface_count;
+  this->interfaces[this->interface_count++] = &iface;
+  controller.set_interface(iface);
+  if(iface.framing == LOOP_DATAGRAM)
+    iface.take_tx_buffer();
+  if(this->backend == LOOP_IO_URING)
+    arm(&iface);
+  return 1;
+}
+
+/*
+ * Detaches the interface, its buffers go back to the pools. Indexes are
+ * not reused, completions still in flight for it are dropped.
+ */
+void I32CTT_LinuxEventLoop::remove(I32CTT_LinuxLoopInterface &iface) {
+  struct io_uring_sqe *sqe;
+  int32_t buffer;
+
+  if(iface.loop != this)
+    return;
+
+  if(this->backend == LOOP_EPOLL) {
+    epoll_ctl(this->epoll_fd, EPOLL_CTL_DEL, iface.fd, NULL);
+  } else if(iface.armed) {
+    sqe = get_sqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = LOOP_USER_DATA(LOOP_OP_RECV, iface.index, 0);
+    sqe->user_data = LOOP_USER_DATA(LOOP_OP_CANCEL, iface.index, 0);
+  }
+
+  iface.release();
+  while(iface.rx_first >= 0) {
+    buffer = iface.rx_first;
+    iface.rx_first = this->rx_next[buffer];
+    return_rx(buffer);
+  }
+  while(iface.out_first >= 0) {
+    buffer = iface.out_first;
+    iface.out_first = this->tx_next[buffer];
+    return_tx(buffer);
+  }
+  if(iface.tx_slot >= 0)
+    return_tx(iface.tx_slot);
+  iface.tx_slot = -1;
+  iface.out_slot = -1;
+  iface.tx_buffer = iface.scratch;
+  this->interfaces[iface.index] = NULL;
+  iface.loop = NULL;
+}
+
+/*
+ * One iteration: queued output and receives to submit again go out with
+ * the wait for input, then every interface with messages has its
+ * controller run.
+ */
+void I32CTT_LinuxEventLoop::run(int timeout_ms) {
+  I32CTT_LinuxLoopInterface *iface;
+  uint32_t count;
+  uint32_t kept;
+  uint32_t i;
+  uint8_t budget;
+
+  if(this->ring_fd < 0 && this->epoll_fd < 0)
+    return;
+  this->stats.iterations++;
+
+  count = this->list_count[LOOP_LIST_OUTPUT];
+  this->list_count[LOOP_LIST_OUTPUT] = 0;
+  for(i = 0; i < count; i++) {
+    iface = this->interfaces[this->lists[LOOP_LIST_OUTPUT][i]];
+    if(iface == NULL)
+      continue;
+    iface->listed &= ~(1 << LOOP_LIST_OUTPUT);
+    if(iface->out_busy < 0)
+      write_stream(iface);
+  }
+
+  if(this->backend == LOOP_IO_URING) {
+    count = this->list_count[LOOP_LIST_REARM];
+    this->list_count[LOOP_LIST_REARM] = 0;
+    for(i = 0; i < count; i++) {
+      iface = this->interfaces[this->lists[LOOP_LIST_REARM][i]];
+      if(iface == NULL)
+        continue;
+      iface->listed &= ~(1 << LOOP_LIST_REARM);
+      if(!iface->armed && !iface->closed) {
+        arm(iface);
+        this->stats.rearms++;
+      }
+    }
+    submit_and_wait(this->list_count[LOOP_LIST_READY] > 0 ? 0 : timeout_ms);
+    reap();
+  } else {
+    flush_datagrams();
+    wait_epoll(this->list_count[LOOP_LIST_READY] > 0 ? 0 : timeout_ms);
+  }
+
+  count = this->list_count[LOOP_LIST_READY];
+  kept = 0;
+  for(i = 0; i < count; i++) {
+    iface = this->interfaces[this->lists[LOOP_LIST_READY][i]];
+    if(iface == NULL)
+      continue;
+    for(budget = 0; budget < LOOP_RUN_BUDGET && iface->rx_first >= 0; budget++)
+      iface->controller->run();
+    if(!iface->d_available)
+      iface->release(); // An idle interface holds no buffer
+    if(iface->rx_first >= 0)
+      this->lists[LOOP_LIST_READY][kept++] = iface->index;
+    else
+      iface->listed &= ~(1 << LOOP_LIST_READY);
+  }
+  // Interfaces made ready while running stay after the kept ones
+  for(i = count; i < this->list_count[LOOP_LIST_READY]; i++)
+    this->lists[LOOP_LIST_READY][kept++] = this->lists[LOOP_LIST_READY][i];
+  this->list_count[LOOP_LIST_READY] = kept;
+}
+
+I32CTT_LOOP_BACKEND I32CTT_LinuxEventLoop::get_backend() {
+  return (I32CTT_LOOP_BACKEND)this->backend;
+}
+
+I32CTT_LoopStats *I32CTT_LinuxEventLoop::get_stats() {
+  return &this->stats;
+}
+
+/*
+ * Next free submission entry, zeroed. A full queue is submitted first.
+ */
+struct io_uring_sqe *I32CTT_LinuxEventLoop::get_sqe() {
+  struct io_uring_sqe *sqe;
+  uint32_t idx;
+  int count;
+
+  if(this->sq_local-__atomic_load_n(this->sq_head, __ATOMIC_ACQUIRE) >= this->sq_entries) {
+    __atomic_store_n(this->sq_tail, this->sq_local, __ATOMIC_RELEASE);
+    count = loop_uring_enter(this->ring_fd, this->to_submit, 0, 0, NULL, 0);
+    this->stats.syscalls++;
+    if(count > 0)
+      this->to_submit -= count;
+  }
+
+  idx = this->sq_local & *this->sq_mask;
+  sqe = &this->sqes[idx];
+  memset(sqe, 0, sizeof(struct io_uring_sqe));
+  this->sq_array[idx] = idx;
+  this->sq_local++;
+  this->to_submit++;
+  return sqe;
+}
+
+/*
+ * Datagram sockets get a multishot recvmsg(), streams a read() that is
+ * submitted again after every chunk (ttys have no multishot receive).
+ * Both take their buffer from the provided buffer ring.
+ */
+void I32CTT_LinuxEventLoop::arm(I32CTT_LinuxLoopInterface *iface) {
+  struct io_uring_sqe *sqe = get_sqe();
+
+  sqe->fd = iface->fd;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = LOOP_BUFFER_GROUP;
+  sqe->user_data = LOOP_USER_DATA(LOOP_OP_RECV, iface->index, 0);
+  if(iface->framing == LOOP_DATAGRAM) {
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->addr = (uint64_t)(uintptr_t)&this->recv_msg;
+    sqe->len = 1;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+  } else {
+    sqe->opcode = IORING_OP_READ;
+    sqe->len = LOOP_BUFFER_SIZE;
+    sqe->off = (uint64_t)-1; // Current position, streams have none
+  }
+  iface->armed = 1;
+}
+
+/*
+ * Submits everything queued and, with nothing ready to run, waits for at
+ * least one completion, all in one io_uring_enter().
+ */
+void I32CTT_LinuxEventLoop::submit_and_wait(int timeout_ms) {
+  struct io_uring_getevents_arg arg;
+  struct __kernel_timespec ts;
+  uint32_t wait;
+  int count;
+
+  __atomic_store_n(this->sq_tail, this->sq_local, __ATOMIC_RELEASE);
+  wait = timeout_ms != 0 && *this->cq_head == __atomic_load_n(this->cq_tail, __ATOMIC_ACQUIRE);
+  if(this->to_submit == 0 && !wait)
+    return;
+
+  memset(&arg, 0, sizeof(arg));
+  ts.tv_sec = timeout_ms/1000;
+  ts.tv_nsec = (timeout_ms%1000)*1000000L;
+  if(timeout_ms > 0)
+    arg.ts = (uint64_t)(uintptr_t)&ts;
+  count = loop_uring_enter(this->ring_fd, this->to_submit, wait,
+    (wait ? IORING_ENTER_GETEVENTS : 0) | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+  this->stats.syscalls++;
+  if(count > 0)
+    this->to_submit -= count < (int)this->to_submit ? count : this->to_submit;
+  else if(count < 0 && errno != ETIME && errno != EINTR && errno != EBUSY)
+    this->to_submit = 0;
+}
+
+void I32CTT_LinuxEventLoop::reap() {
+  uint32_t head = *this->cq_head;
+  uint32_t tail = __atomic_load_n(this->cq_tail, __ATOMIC_ACQUIRE);
+
+  while(head != tail) {
+    complete(&this->cqes[head & *this->cq_mask]);
+    head++;
+  }
+  __atomic_store_n(this->cq_head, head, __ATOMIC_RELEASE);
+}
+
+void I32CTT_LinuxEventLoop::complete(struct io_uring_cqe *cqe) {
+  I32CTT_LinuxLoopInterface *iface = NULL;
+  uint8_t op = cqe->user_data >> 56;
+  uint32_t idx = (cqe->user_data >> 32) & 0xFFFF;
+  int32_t slot = cqe->user_data & 0xFFFFFFFF;
+  int32_t buffer = -1;
+
+  if(idx < this->interface_count)
+    iface = this->interfaces[idx];
+  if(cqe->flags & IORING_CQE_F_BUFFER)
+    buffer = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+
+  if(op == LOOP_OP_RECV) {
+    if(buffer >= 0) {
+      if(iface != NULL && cqe->res > 0)
+        on_receive(iface, buffer, cqe->res);
+      else
+        return_rx(buffer);
+    }
+    if(iface == NULL || (cqe->flags & IORING_CQE_F_MORE))
+      return;
+    iface->armed = 0;
+    if(cqe->res == 0 && iface->framing == LOOP_SLIP) {
+      iface->closed = 1; // End of stream
+    } else if(cqe->res < 0 && cqe->res != -ENOBUFS && cqe->res != -EAGAIN && cqe->res != -EINTR) {
+      iface->closed = 1;
+      this->stats.rx_dropped++;
+    } else {
+      add_to_list(iface, LOOP_LIST_REARM);
+    }
+  } else if(op == LOOP_OP_SEND) {
+    if(iface != NULL && iface->framing == LOOP_SLIP) {
+      stream_written(iface, cqe->res);
+      return;
+    }
+    if(cqe->res < 0)
+      this->stats.tx_dropped++;
+    else
+      this->stats.tx_frames++;
+    return_tx(slot);
+  }
+}
+
+void I32CTT_LinuxEventLoop::wait_epoll(int timeout_ms) {
+  struct epoll_event events[LOOP_EPOLL_BATCH];
+  I32CTT_LinuxLoopInterface *iface;
+  int count;
+  int i;
+
+  count = epoll_wait(this->epoll_fd, events, LOOP_EPOLL_BATCH, timeout_ms);
+  this->stats.syscalls++;
+  for(i = 0; i < count; i++) {
+    iface = this->interfaces[events[i].data.u32];
+    if(iface == NULL)
+      continue;
+    if(events[i].events & EPOLLOUT)
+      stream_written(iface, 0);
+    if(events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+      read_epoll(iface);
+  }
+}
+
+/*
+ * One batch per readiness, level triggered epoll reports the socket again
+ * if more is waiting. The datagram layout is the one of multishot
+ * recvmsg() so the interface reads both the same way.
+ */
+void I32CTT_LinuxEventLoop::read_epoll(I32CTT_LinuxLoopInterface *iface) {
+  struct mmsghdr msgs[LOOP_EPOLL_BATCH];
+  struct iovec iov[LOOP_EPOLL_BATCH];
+  struct io_uring_recvmsg_out *out;
+  int32_t buffers[LOOP_EPOLL_BATCH];
+  uint8_t *data;
+  int count;
+  int i;
+
+  if(iface->framing == LOOP_SLIP) {
+    if(this->rx_free_count == 0)
+      return;
+    buffers[0] = this->rx_free[--this->rx_free_count];
+    count = read(iface->fd, rx_data(buffers[0]), LOOP_BUFFER_SIZE);
+    this->stats.syscalls++;
+    if(count > 0) {
+      on_receive(iface, buffers[0], count);
+      return;
+    }
+    return_rx(buffers[0]);
+    if(count == 0 || (errno != EAGAIN && errno != EINTR)) {
+      iface->closed = 1;
+      epoll_ctl(this->epoll_fd, EPOLL_CTL_DEL, iface->fd, NULL);
+    }
+    return;
+  }
+
+  for(count = 0; count < LOOP_EPOLL_BATCH && this->rx_free_count > 0; count++) {
+    buffers[count] = this->rx_free[--this->rx_free_count];
+    data = rx_data(buffers[count]);
+    iov[count].iov_base = data+LOOP_PAYLOAD_OFFSET;
+    iov[count].iov_len = LOOP_BUFFER_SIZE-LOOP_PAYLOAD_OFFSET;
+    memset(&msgs[count], 0, sizeof(struct mmsghdr));
+    msgs[count].msg_hdr.msg_name = data+sizeof(struct io_uring_recvmsg_out);
+    msgs[count].msg_hdr.msg_namelen = LOOP_NAME_SIZE;
+    msgs[count].msg_hdr.msg_iov = &iov[count];
+    msgs[count].msg_hdr.msg_iovlen = 1;
+  }
+  if(count == 0)
+    return;
+
+  i = recvmmsg(iface->fd, msgs, count, MSG_DONTWAIT, NULL);
+  this->stats.syscalls++;
+  for(i = i > 0 ? i : 0; i < count; i++)
+    return_rx(buffers[i]); // Not filled
+  for(i = 0; i < count && msgs[i].msg_len > 0; i++) {
+    out = (struct io_uring_recvmsg_out*)rx_data(buffers[i]);
+    out->namelen = msgs[i].msg_hdr.msg_namelen;
+    out->controllen = 0;
+    out->payloadlen = msgs[i].msg_len;
+    out->flags = msgs[i].msg_hdr.msg_flags;
+    on_receive(iface, buffers[i], LOOP_PAYLOAD_OFFSET+msgs[i].msg_len);
+  }
+}
+
+/*
+ * Sends the queued datagrams with one sendmmsg() per run of the same
+ * interface, answers of one interface are queued together.
+ */
+void I32CTT_LinuxEventLoop::flush_datagrams() {
+  struct mmsghdr msgs[LOOP_EPOLL_BATCH];
+  I32CTT_LinuxLoopInterface *iface;
+  uint32_t first = 0;
+  uint32_t count;
+  uint32_t i;
+  int sent;
+
+  while(first < this->tx_pending_count) {
+    for(count = 0; count < LOOP_EPOLL_BATCH && first+count < this->tx_pending_count &&
+      this->tx_pending_iface[first+count] == this->tx_pending_iface[first]; count++) {
+      msgs[count].msg_hdr = this->tx_msgs[this->tx_pending[first+count]];
+      msgs[count].msg_len = 0;
+    }
+    iface = this->interfaces[this->tx_pending_iface[first]];
+    sent = iface != NULL ? sendmmsg(iface->fd, msgs, count, MSG_DONTWAIT) : -1;
+    this->stats.syscalls++;
+    if(sent < 0)
+      sent = 0;
+    this->stats.tx_frames += sent;
+    this->stats.tx_dropped += count-sent;
+    for(i = 0; i < count; i++)
+      return_tx(this->tx_pending[first+i]);
+    first += count;
+  }
+  this->tx_pending_count = 0;
+}
+
+/*
+ * Starts writing the first buffer of a stream's output list, one write in
+ * flight at a time keeps the bytes in order.
+ */
+void I32CTT_LinuxEventLoop::write_stream(I32CTT_LinuxLoopInterface *iface) {
+  struct io_uring_sqe *sqe;
+  int32_t slot;
+
+  if(iface->out_busy >= 0 || iface->out_first < 0)
+    return;
+  slot = iface->out_busy = iface->out_first;
+  iface->out_first = this->tx_next[slot];
+  if(iface->out_slot == slot)
+    iface->out_slot = -1;
+  iface->out_done = 0;
+
+  if(this->backend == LOOP_EPOLL) {
+    stream_written(iface, 0);
+    return;
+  }
+  sqe = get_sqe();
+  sqe->opcode = this->fixed_tx ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+  sqe->fd = iface->fd;
+  sqe->addr = (uint64_t)(uintptr_t)tx_data(slot);
+  sqe->len = this->tx_iov[slot].iov_len;
+  sqe->off = (uint64_t)-1;
+  sqe->buf_index = 0;
+  sqe->user_data = LOOP_USER_DATA(LOOP_OP_SEND, iface->index, slot);
+}
+
+/*
+ * A write of the busy buffer finished with result bytes (io_uring), or
+ * the stream can take more (epoll, result 0 and the write is done here).
+ * Short writes continue where they stopped.
+ */
+void I32CTT_LinuxEventLoop::stream_written(I32CTT_LinuxLoopInterface *iface, int result) {
+  struct io_uring_sqe *sqe;
+  struct epoll_event ev;
+  int32_t slot = iface->out_busy;
+  uint32_t len;
+  ssize_t count;
+
+  if(slot < 0)
+    return;
+  len = this->tx_iov[slot].iov_len;
+
+  if(this->backend == LOOP_EPOLL) {
+    while(iface->out_done < len) {
+      count = write(iface->fd, tx_data(slot)+iface->out_done, len-iface->out_done);
+      this->stats.syscalls++;
+      if(count <= 0)
+        break;
+      iface->out_done += count;
+    }
+    if(iface->out_done < len && (count == 0 || errno == EAGAIN || errno == EINTR)) {
+      ev.events = EPOLLIN | EPOLLOUT; // Writable again later
+      ev.data.u32 = iface->index;
+      epoll_ctl(this->epoll_fd, EPOLL_CTL_MOD, iface->fd, &ev);
+      return;
+    }
+    if(iface->out_done < len)
+      this->stats.tx_dropped++;
+    ev.events = EPOLLIN;
+    ev.data.u32 = iface->index;
+    epoll_ctl(this->epoll_fd, EPOLL_CTL_MOD, iface->fd, &ev);
+  } else {
+    if(result > 0)
+      iface->out_done += result;
+    if(iface->out_done < len && (result > 0 || result == -EAGAIN || result == -EINTR)) {
+      sqe = get_sqe();
+      sqe->opcode = IORING_OP_WRITE;
+      sqe->fd = iface->fd;
+      sqe->addr = (uint64_t)(uintptr_t)(tx_data(slot)+iface->out_done);
+      sqe->len = len-iface->out_done;
+      sqe->off = (uint64_t)-1;
+      sqe->user_data = LOOP_USER_DATA(LOOP_OP_SEND, iface->index, slot);
+      return;
+    }
+    if(iface->out_done < len)
+      this->stats.tx_dropped++;
+  }
+
+  iface->out_busy = -1;
+  return_tx(slot);
+  if(iface->out_first >= 0)
+    add_to_list(iface, LOOP_LIST_OUTPUT);
+}
+
+void I32CTT_LinuxEventLoop::on_receive(I32CTT_LinuxLoopInterface *iface, int32_t buffer, uint32_t len) {
+  this->rx_len[buffer] = len;
+  this->rx_next[buffer] = -1;
+  if(iface->rx_last >= 0)
+    this->rx_next[iface->rx_last] = buffer;
+  else
+    iface->rx_first = buffer;
+  iface->rx_last = buffer;
+  add_to_list(iface, LOOP_LIST_READY);
+}
+
+void I32CTT_LinuxEventLoop::add_to_list(I32CTT_LinuxLoopInterface *iface, uint8_t list) {
+  if(iface->listed & (1 << list))
+    return;
+  iface->listed |= 1 << list;
+  this->lists[list][this->list_count[list]++] = iface->index;
+}
+
+void I32CTT_LinuxEventLoop::queue_datagram(I32CTT_LinuxLoopInterface *iface, int32_t slot) {
+  struct io_uring_sqe *sqe;
+
+  if(this->backend == LOOP_EPOLL) {
+    this->tx_pending[this->tx_pending_count] = slot;
+    this->tx_pending_iface[this->tx_pending_count++] = iface->index;
+    return;
+  }
+  sqe = get_sqe();
+  sqe->opcode = IORING_OP_SENDMSG;
+  sqe->fd = iface->fd;
+  sqe->addr = (uint64_t)(uintptr_t)&this->tx_msgs[slot];
+  sqe->len = 1;
+  sqe->user_data = LOOP_USER_DATA(LOOP_OP_SEND, iface->index, slot);
+}
+
+/*
+ * io_uring: the buffer goes back to the provided buffer ring, the kernel
+ * sees it once the tail is published. epoll: back to the free stack.
+ */
+void I32CTT_LinuxEventLoop::return_rx(int32_t buffer) {
+  struct io_uring_buf *entry;
+
+  if(this->buf_ring == NULL) {
+    this->rx_free[this->rx_free_count++] = buffer;
+    return;
+  }
+  // Entries start at the ring itself, the tail overlays the first one's
+  // resv field. bufs is not used: in C++ the uapi header puts it at 8.
+  entry = (struct io_uring_buf*)this->buf_ring+(this->buf_tail & (LOOP_RX_BUFFERS-1));
+  entry->addr = (uint64_t)(uintptr_t)rx_data(buffer);
+  entry->len = LOOP_BUFFER_SIZE;
+  entry->bid = buffer;
+  this->buf_tail++;
+  __atomic_store_n(&this->buf_ring->tail, this->buf_tail, __ATOMIC_RELEASE);
+}
+
+int32_t I32CTT_LinuxEventLoop::take_tx() {
+  return this->tx_free_count > 0 ? this->tx_free[--this->tx_free_count] : -1;
+}
+
+void I32CTT_LinuxEventLoop::return_tx(int32_t slot) {
+  this->tx_free[this->tx_free_count++] = slot;
+}
+
+uint8_t *I32CTT_LinuxEventLoop::rx_data(int32_t buffer) {
+  return this->rx_pool+(uint32_t)buffer*LOOP_BUFFER_SIZE;
+}
+
+uint8_t *I32CTT_LinuxEventLoop::tx_data(int32_t slot) {
+  return this->tx_pool+(uint32_t)slot*LOOP_BUFFER_SIZE;
+}
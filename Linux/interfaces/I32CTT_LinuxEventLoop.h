@@ -0,0 +1,224 @@
+/*
+ *
+ * This file is part of I32CTT (Integer 32-bit Control & Telemetry Transport).
+ * Copyright (C) 2017 Mario Gomez / Hackerspace San Salvador.
+ *
+ * I32CTT is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * I32CTT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with I32CTT.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef I32CTT_LinuxEventLoop_H
+#define I32CTT_LinuxEventLoop_H
+
+#include <stdint.h>
+#include <sys/socket.h>
+
+#ifndef LOOP_MTU_SIZE
+#if I32CTT_SIZE_BITS == 8
+#define LOOP_MTU_SIZE 255
+#else
+#define LOOP_MTU_SIZE 1024
+#endif
+#endif
+#define LOOP_FRAME_MAX (2+2*(LOOP_MTU_SIZE+2)) // SLIP frame, every byte escaped
+#define LOOP_BUFFER_SIZE ((LOOP_FRAME_MAX+255)/256*256)
+#ifndef LOOP_RX_BUFFERS
+#define LOOP_RX_BUFFERS 4096    // Receive pool, a power of two
+#endif
+#ifndef LOOP_TX_BUFFERS
+#define LOOP_TX_BUFFERS 2048    // Transmit pool
+#endif
+#ifndef LOOP_MAX_INTERFACES
+#define LOOP_MAX_INTERFACES 4096
+#endif
+#define LOOP_RING_ENTRIES 4096  // Submission queue, the completion queue is twice as big
+#define LOOP_RUN_BUDGET 32      // Messages one interface parses per run()
+#define LOOP_EPOLL_BATCH 32     // Datagrams per recvmmsg()/sendmmsg() in the epoll loop
+
+enum I32CTT_LOOP_BACKEND {
+  LOOP_AUTO = 0,  // io_uring if the kernel has what is needed, else epoll
+  LOOP_IO_URING,
+  LOOP_EPOLL
+};
+
+enum I32CTT_LOOP_FRAMING {
+  LOOP_DATAGRAM = 0, // One message per datagram (UDP, Unix datagram sockets)
+  LOOP_SLIP          // SLIP + CRC-16 byte stream (serial ports, TCP), as the stream interface
+};
+
+struct I32CTT_LoopStats {
+  uint32_t iterations;  // run() calls
+  uint32_t syscalls;    // io_uring_enter(), epoll_wait(), reads and writes
+  uint32_t rx_frames;
+  uint32_t rx_dropped;  // Truncated, bad CRC or no buffer left
+  uint32_t tx_frames;
+  uint32_t tx_dropped;  // No transmit buffer or the send failed
+  uint32_t rearms;      // Multishot receives submitted again
+};
+
+class I32CTT_LinuxEventLoop;
+
+/*
+ * An I32CTT_Interface whose file descriptor is read and written by an
+ * I32CTT_LinuxEventLoop. The descriptor is opened and configured by the
+ * caller (a bound UDP socket, a connected TCP socket, a serial port in raw
+ * mode) and set non-blocking. Received messages wait in buffers of the
+ * loop's pool and rx_buffer points into them. Datagram answers are
+ * written in place in a transmit buffer, send() answers the peer of the
+ * message being parsed and send_to_dst() goes to set_dst_addr().
+ */
+class I32CTT_LinuxLoopInterface: public I32CTT_Interface {
+  friend class I32CTT_LinuxEventLoop;
+  public:
+    I32CTT_LinuxLoopInterface(int fd, I32CTT_LOOP_FRAMING framing = LOOP_DATAGRAM);
+    ~I32CTT_LinuxLoopInterface();
+    void init();
+    void update();
+    uint8_t available();
+    uint8_t data_available();
+    void send();
+    void send_to_dst();
+    uint16_t get_MTU();
+    void set_dst_addr(const struct sockaddr *addr, socklen_t len);
+    int get_fd();
+  private:
+    void release();
+    uint8_t next_datagram();
+    uint8_t next_slip();
+    void take_tx_buffer();
+    void encode_slip();
+    void queue(const struct sockaddr_storage *addr, socklen_t len);
+    I32CTT_LinuxEventLoop *loop;
+    I32CTT_Controller *controller;
+    int fd;
+    uint8_t framing;
+    uint16_t index;
+    int32_t rx_first;     // Received buffers, linked through the loop
+    int32_t rx_last;
+    int32_t rx_held;      // Buffer rx_buffer points into
+    uint32_t rx_pos;      // SLIP: next byte of rx_first
+    uint8_t *frame;       // SLIP: message and CRC being decoded
+    uint16_t frame_size;
+    uint8_t escaped;
+    uint8_t overrun;
+    int32_t tx_slot;      // Datagram: transmit buffer behind tx_buffer
+    int32_t out_first;    // SLIP: encoded frames not submitted yet, linked through the loop
+    int32_t out_slot;     // SLIP: last of them, being filled
+    int32_t out_busy;     // SLIP: buffer being written
+    uint32_t out_done;    // SLIP: bytes of out_busy already written
+    uint8_t *scratch;
+    uint8_t armed;        // Receive in flight (io_uring)
+    uint8_t closed;       // End of stream or receive error, not read any more
+    uint8_t listed;       // In the loop's ready, rearm and output lists, one bit each
+    uint8_t d_available;
+    struct sockaddr_storage last_addr;
+    socklen_t last_len;
+    struct sockaddr_storage dst_addr;
+    socklen_t dst_len;
+};
+
+/*
+ * Drives many controllers and their I32CTT_LinuxLoopInterface from one
+ * thread. run() does one iteration: it submits the queued transmissions
+ * and waits for input in a single system call, then runs the controller
+ * of every interface with messages, LOOP_RUN_BUDGET at most each.
+ *
+ * With io_uring every interface has one multishot receive that picks
+ * buffers from a provided buffer ring, nothing has to be submitted again
+ * per message. Answers are queued as send requests and leave with the
+ * next io_uring_enter(), which also waits for completions; stream writes
+ * use the transmit pool registered as a fixed buffer. Without io_uring
+ * (old kernel, seccomp, LOOP_EPOLL) the same loop uses epoll,
+ * recvmmsg()/sendmmsg() for datagrams and read()/write() for streams.
+ */
+class I32CTT_LinuxEventLoop {
+  friend class I32CTT_LinuxLoopInterface;
+  public:
+    I32CTT_LinuxEventLoop(I32CTT_LOOP_BACKEND backend = LOOP_AUTO);
+    ~I32CTT_LinuxEventLoop();
+    uint8_t init();
+    uint8_t add(I32CTT_Controller &controller, I32CTT_LinuxLoopInterface &iface);
+    void remove(I32CTT_LinuxLoopInterface &iface);
+    void run(int timeout_ms);
+    I32CTT_LOOP_BACKEND get_backend();
+    I32CTT_LoopStats *get_stats();
+  private:
+    uint8_t init_uring();
+    uint8_t probe_multishot();
+    void close_uring();
+    uint8_t init_epoll();
+    struct io_uring_sqe *get_sqe();
+    void arm(I32CTT_LinuxLoopInterface *iface);
+    void submit_and_wait(int timeout_ms);
+    void reap();
+    void complete(struct io_uring_cqe *cqe);
+    void wait_epoll(int timeout_ms);
+    void read_epoll(I32CTT_LinuxLoopInterface *iface);
+    void flush_datagrams();
+    void write_stream(I32CTT_LinuxLoopInterface *iface);
+    void stream_written(I32CTT_LinuxLoopInterface *iface, int result);
+    void on_receive(I32CTT_LinuxLoopInterface *iface, int32_t buffer, uint32_t len);
+    void add_to_list(I32CTT_LinuxLoopInterface *iface, uint8_t list);
+    void queue_datagram(I32CTT_LinuxLoopInterface *iface, int32_t slot);
+    void return_rx(int32_t buffer);
+    int32_t take_tx();
+    void return_tx(int32_t slot);
+    uint8_t *rx_data(int32_t buffer);
+    uint8_t *tx_data(int32_t slot);
+    uint8_t backend;
+    int ring_fd;
+    int epoll_fd;
+    // io_uring rings, mapped from the kernel
+    uint8_t *sq_map;
+    uint8_t *cq_map;
+    uint32_t sq_map_size;
+    uint32_t cq_map_size;
+    struct io_uring_sqe *sqes;
+    uint32_t *sq_head;
+    uint32_t *sq_tail;
+    uint32_t *sq_mask;
+    uint32_t *sq_array;
+    uint32_t *cq_head;
+    uint32_t *cq_tail;
+    uint32_t *cq_mask;
+    struct io_uring_cqe *cqes;
+    uint32_t sq_entries;
+    uint32_t sq_local;     // Tail of the submissions not given to the kernel yet
+    uint32_t to_submit;
+    uint8_t fixed_tx;      // Transmit pool registered, stream writes use it fixed
+    struct io_uring_buf_ring *buf_ring;
+    uint16_t buf_tail;
+    struct msghdr recv_msg; // Template of the multishot recvmsg()
+    // Buffer pools
+    uint8_t *rx_pool;
+    int32_t *rx_next;      // Links of the per interface receive lists
+    uint32_t *rx_len;
+    int32_t *rx_free;      // epoll: free receive buffers
+    uint32_t rx_free_count;
+    uint8_t *tx_pool;
+    struct msghdr *tx_msgs;
+    struct iovec *tx_iov;
+    struct sockaddr_storage *tx_addrs;
+    int32_t *tx_next;      // Links of the per stream output lists
+    int32_t *tx_free;
+    uint32_t tx_free_count;
+    int32_t *tx_pending;   // epoll: datagrams queued for sendmmsg()
+    uint16_t *tx_pending_iface;
+    uint32_t tx_pending_count;
+    I32CTT_LinuxLoopInterface **interfaces;
+    uint16_t *lists[3];    // LOOP_LIST_READY, LOOP_LIST_REARM, LOOP_LIST_OUTPUT
+    uint32_t list_count[3];
+    uint16_t interface_count;
+    I32CTT_LoopStats stats;
+};
+
+#endif
@@ -0,0 +1,1485 @@
+/*
+ *
+ * This file is part of I32CTT (Integer 32-bit Control & Telemetry Transport).
+ * Copyright (C) 2017 Mario Gomez / Hackerspace San Salvador.
+ *
+ * I32CTT is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * I32CTT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with I32CTT.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include "Arduino.h"
+#include "I32CTT.h"
+#include "I32CTT_LinuxGatewayInterface.h"
+
+#define GW_LISTENER_TAG (1ULL<<63) // epoll data of listening sockets
+
+// Command that answers a request, 0 if none is expected
+static uint8_t gw_answer_cmd(uint8_t cmd) {
+  switch(cmd) {
+    case CMD_R:
+      return CMD_AR;
+    case CMD_W:
+      return CMD_AW;
+    case CMD_LST:
+      return CMD_LSTA;
+    case CMD_FND:
+      return CMD_FNDA;
+    default:
+      return 0;
+  }
+}
+
+/*
+ * Registers of a read that set_collapsing() can share, 0 if there are
+ * none or more than GW_COLLAPSE_MAX_REGS.
+ */
+static uint16_t gw_read_regs(const uint8_t *msg, uint16_t len) {
+  uint16_t count;
+
+  if(msg[0] != CMD_R || len <= sizeof(I32CTT_Header) || (len-sizeof(I32CTT_Header))%sizeof(I32CTT_Reg) != 0)
+    return 0;
+  count = (len-sizeof(I32CTT_Header))/sizeof(I32CTT_Reg);
+  return count <= GW_COLLAPSE_MAX_REGS ? count : 0;
+}
+
+I32CTT_LinuxGatewayInterface::I32CTT_LinuxGatewayInterface(I32CTT_Interface &lower) {
+  uint8_t i;
+
+  this->lower = &lower;
+  this->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  this->listener_count = 0;
+  for(i = 0; i < GW_MAX_LISTENERS; i++) {
+    this->listeners[i] = -1;
+    this->listener_path[i] = NULL;
+  }
+  memset(this->clients, 0, sizeof(this->clients));
+  for(i = 0; i < GW_MAX_CLIENTS; i++)
+    this->clients[i].fd = -1;
+  memset(this->pending, 0, sizeof(this->pending));
+  this->pending_count = 0;
+  this->max_in_flight = GW_MAX_IN_FLIGHT;
+  this->node_max_in_flight = GW_NODE_MAX_IN_FLIGHT;
+  this->answer_timeout = GW_ANSWER_TIMEOUT;
+  this->collapsing = 0;
+  this->collapse_window = 0;
+  this->follower_count = 0;
+  this->pending_seq = 0;
+  this->next_client = 0;
+  this->tx_state = GW_TX_IDLE;
+  this->tx_to_dst = 0;
+  this->dst_node = 0;
+  this->d_available = 0;
+  this->nodes = new I32CTT_GatewayNode[GW_DIR_MAX_NODES];
+  this->node_count = 0;
+  this->probe_next = 0;
+  this->probe_last = 0;
+  this->probe_active = 0;
+  this->probes_in_flight = 0;
+  this->retry_count = 0;
+  this->id_index = new I32CTT_GatewayIndexEntry[GW_INDEX_MAX_ENTRIES];
+  this->index_count = 0;
+  memset(&this->stats, 0, sizeof(I32CTT_GatewayStats));
+
+  this->rx_buffer = NULL;
+  this->rx_size = 0;
+  this->tx_buffer = new uint8_t[GW_MAX_MESSAGE];
+  this->tx_size = 0;
+}
+
+I32CTT_LinuxGatewayInterface::~I32CTT_LinuxGatewayInterface() {
+  uint8_t i;
+
+  for(i = 0; i < GW_MAX_CLIENTS; i++) {
+    if(this->clients[i].fd >= 0)
+      close_client(i);
+    free(this->clients[i].in);
+    free(this->clients[i].out);
+  }
+  for(i = 0; i < this->listener_count; i++) {
+    close(this->listeners[i]);
+    if(this->listener_path[i] != NULL) {
+      unlink(this->listener_path[i]);
+      free(this->listener_path[i]);
+    }
+  }
+  if(this->epoll_fd >= 0)
+    close(this->epoll_fd);
+  delete[] this->nodes;
+  delete[] this->id_index;
+  delete[] this->tx_buffer;
+}
+
+/*
+ * Accepts clients on a TCP port, every local address if host is NULL.
+ * Port 0 picks a free port, see get_tcp_port(). Returns 0 on failure.
+ */
+uint8_t I32CTT_LinuxGatewayInterface::listen_tcp(const char *host, uint16_t port) {
+  struct addrinfo hints;
+  struct addrinfo *res;
+  struct addrinfo *ai;
+  char service[8];
+  int one = 1;
+  int fd = -1;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+  snprintf(service, sizeof(service), "%u", port);
+  if(getaddrinfo(host, service, &hints, &res) != 0)
+    return 0;
+
+  for(ai = res; ai != NULL; ai = ai->ai_next) {
+    fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+    if(fd < 0)
+      continue;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if(bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 && listen(fd, SOMAXCONN) == 0)
+      break;
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(res);
+
+  if(fd < 0)
+    return 0;
+  return add_listener(fd, NULL);
+}
+
+/*
+ * Accepts clients on a Unix socket, a stale socket file is replaced.
+ */
+uint8_t I32CTT_LinuxGatewayInterface::listen_unix(const char *path) {
+  struct sockaddr_un addr;
+  int fd;
+
+  if(strlen(path) >= sizeof(addr.sun_path))
+    return 0;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+
+  fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if(fd < 0)
+    return 0;
+  unlink(path);
+  if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0) {
+    close(fd);
+    return 0;
+  }
+  return add_listener(fd, path);
+}
+
+uint8_t I32CTT_LinuxGatewayInterface::add_listener(int fd, const char *path) {
+  struct epoll_event ev;
+  uint8_t idx = this->listener_count;
+
+  if(idx >= GW_MAX_LISTENERS || this->epoll_fd < 0) {
+    close(fd);
+    return 0;
+  }
+
+  ev.events = EPOLLIN | EPOLLET;
+  ev.data.u64 = GW_LISTENER_TAG | idx;
+  if(epoll_ctl(this->epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+    close(fd);
+    return 0;
+  }
+  this->listeners[idx] = fd;
+  this->listener_path[idx] = path != NULL ? strdup(path) : NULL;
+  this->listener_count++;
+  return 1;
+}
+
+/*
+ * Port of the first TCP listener, 0 if there is none.
+ */
+uint16_t I32CTT_LinuxGatewayInterface::get_tcp_port() {
+  struct sockaddr_storage addr;
+  socklen_t len;
+  uint8_t i;
+
+  for(i = 0; i < this->listener_count; i++) {
+    if(this->listener_path[i] != NULL)
+      continue;
+    len = sizeof(addr);
+    if(getsockname(this->listeners[i], (struct sockaddr*)&addr, &len) != 0)
+      return 0;
+    if(addr.ss_family == AF_INET6)
+      return ntohs(((struct sockaddr_in6*)&addr)->sin6_port);
+    return ntohs(((struct sockaddr_in*)&addr)->sin_port);
+  }
+  return 0;
+}
+
+/*
+ * Readable when a client or listener needs attention, a host loop with
+ * nothing else to do can wait on it between updates.
+ */
+int I32CTT_LinuxGatewayInterface::get_epoll_fd() {
+  return this->epoll_fd;
+}
+
+/*
+ * Requests waiting for an answer at once, up to GW_MAX_PENDING. More than
+ * one only suits lower interfaces that do not lose answers crossing new
+ * requests (UDP, I32CTT_LinuxShardPool).
+ */
+void I32CTT_LinuxGatewayInterface::set_max_in_flight(uint8_t count) {
+  if(count == 0)
+    count = 1;
+  this->max_in_flight = count < GW_MAX_PENDING ? count : GW_MAX_PENDING;
+}
+
+/*
+ * Requests waiting for an answer from one node, up to GW_MAX_PENDING. At
+ * 1 with a higher set_max_in_flight() requests to different nodes overlap
+ * and each node still sees one at a time. Not for a radio, see
+ * GW_MAX_IN_FLIGHT.
+ */
+void I32CTT_LinuxGatewayInterface::set_node_max_in_flight(uint8_t count) {
+  if(count == 0)
+    count = 1;
+  this->node_max_in_flight = count < GW_MAX_PENDING ? count : GW_MAX_PENDING;
+}
+
+/*
+ * ms a request waits for its answer before its slot is given to another.
+ * A radio that loses answers while it transmits wants it near the
+ * slowest round trip, a lost answer then only holds its slot that long.
+ */
+void I32CTT_LinuxGatewayInterface::set_answer_timeout(uint32_t ms) {
+  this->answer_timeout = ms > 0 ? ms : GW_ANSWER_TIMEOUT;
+}
+
+/*
+ * Lets concurrent reads of the same node and mode share one request on
+ * the lower interface. Only for endpoints whose reads have no side
+ * effects, a shared read is done once.
+ */
+void I32CTT_LinuxGatewayInterface::set_collapsing(uint8_t enabled) {
+  this->collapsing = enabled;
+}
+
+/*
+ * ms a read waits at the head of its client for reads of other clients
+ * to be packed with it, 0 packs only the ones already waiting.
+ */
+void I32CTT_LinuxGatewayInterface::set_collapse_window(uint16_t ms) {
+  this->collapse_window = ms;
+}
+
+/*
+ * Sends LST to every address from first to last, between client
+ * requests, and to known nodes again until all their endpoint ids are
+ * in the directory. Nodes that do not answer are left out.
+ */
+void I32CTT_LinuxGatewayInterface::discover(uint16_t first, uint16_t last) {
+  if(first > last)
+    return;
+  this->probe_next = first;
+  this->probe_last = last;
+  this->probe_active = 1;
+  this->retry_count = 0;
+}
+
+/*
+ * 1 while discover() has addresses or endpoints left to ask.
+ */
+uint8_t I32CTT_LinuxGatewayInterface::discovering() {
+  uint16_t i;
+
+  if(this->probe_active || this->retry_count > 0)
+    return 1;
+  for(i = 0; i < GW_MAX_PENDING; i++) {
+    if(this->pending[i].used && this->pending[i].client == GW_SELF)
+      return 1;
+  }
+  for(i = 0; i < this->node_count; i++) {
+    if(this->nodes[i].probing || this->nodes[i].known < this->nodes[i].endpoints)
+      return 1;
+  }
+  return 0;
+}
+
+uint16_t I32CTT_LinuxGatewayInterface::get_node_count() {
+  return this->node_count;
+}
+
+I32CTT_GatewayNode *I32CTT_LinuxGatewayInterface::get_node_at(uint16_t idx) {
+  return idx < this->node_count ? &this->nodes[idx] : NULL;
+}
+
+/*
+ * Nodes and endpoints known to host the id, by node address, up to max
+ * of them in nodes and endpoints. Returns how many there are, which can
+ * be more than max.
+ */
+uint16_t I32CTT_LinuxGatewayInterface::lookup(uint32_t id, uint16_t *nodes, uint8_t *endpoints, uint16_t max) {
+  uint16_t i = index_find(id, 0, 0);
+  uint16_t count = 0;
+
+  for(; i < this->index_count && this->id_index[i].id == id; i++, count++) {
+    if(count >= max)
+      continue;
+    nodes[count] = this->id_index[i].node;
+    endpoints[count] = this->id_index[i].endpoint;
+  }
+  return count;
+}
+
+uint16_t I32CTT_LinuxGatewayInterface::get_index_count() {
+  return this->index_count;
+}
+
+uint8_t I32CTT_LinuxGatewayInterface::get_client_count() {
+  uint8_t count = 0;
+  uint8_t i;
+
+  for(i = 0; i < GW_MAX_CLIENTS; i++)
+    count += this->clients[i].fd >= 0;
+  return count;
+}
+
+I32CTT_GatewayStats *I32CTT_LinuxGatewayInterface::get_stats() {
+  return &this->stats;
+}
+
+void I32CTT_LinuxGatewayInterface::init() {
+  this->lower->init();
+}
+
+void I32CTT_LinuxGatewayInterface::update() {
+  uint8_t i;
+
+  // Answers only go to client buffers, several are routed per update().
+  // The first message for the controller stops it.
+  for(i = 0; i < GW_FORWARD_BUDGET; i++) {
+    this->lower->update();
+    if(this->d_available || !this->lower->data_available())
+      break;
+    if(this->lower->rx_size > 0 && !route_answer()) {
+      this->rx_buffer = this->lower->rx_buffer;
+      this->rx_size = this->lower->rx_size;
+      this->d_available = 1;
+    }
+  }
+
+  poll_events();
+  for(i = 0; i < GW_MAX_CLIENTS; i++) {
+    if(this->clients[i].fd >= 0)
+      service_client(i);
+  }
+  expire_pending();
+  pump_tx();
+}
+
+uint8_t I32CTT_LinuxGatewayInterface::available() {
+  return this->tx_size == 0 && this->lower->available();
+}
+
+uint8_t I32CTT_LinuxGatewayInterface::data_available() {
+  uint8_t result = this->d_available;
+  this->d_available = 0;
+  return result;
+}
+
+void I32CTT_LinuxGatewayInterface::send() {
+  this->tx_to_dst = 0;
+  pump_tx();
+}
+
+void I32CTT_LinuxGatewayInterface::send_to_dst() {
+  this->tx_to_dst = 1;
+  pump_tx();
+}
+
+uint16_t I32CTT_LinuxGatewayInterface::get_MTU() {
+  uint16_t mtu = this->lower->get_MTU();
+
+  return mtu < GW_MAX_MESSAGE ? mtu : GW_MAX_MESSAGE;
+}
+
+/*
+ * Node of the controller's own send_to_dst(), client requests select
+ * their node on the lower interface before each message.
+ */
+void I32CTT_LinuxGatewayInterface::set_dst(uint16_t addr) {
+  this->dst_node = addr;
+}
+
+uint16_t I32CTT_LinuxGatewayInterface::get_src() {
+  return this->lower->get_src();
+}
+
+void I32CTT_LinuxGatewayInterface::poll_events() {
+  struct epoll_event events[GW_EPOLL_EVENTS];
+  I32CTT_GatewayClient *client;
+  uint32_t idx;
+  int count;
+  int i;
+
+  if(this->epoll_fd < 0)
+    return;
+
+  count = epoll_wait(this->epoll_fd, events, GW_EPOLL_EVENTS, 0);
+  for(i = 0; i < count; i++) {
+    if(events[i].data.u64 & GW_LISTENER_TAG) {
+      accept_clients(this->listeners[events[i].data.u64 & 0xFF]);
+      continue;
+    }
+    idx = events[i].data.u64 & 0xFFFFFFFF;
+    client = &this->clients[idx];
+    if(client->fd < 0 || client->generation != (events[i].data.u64 >> 32))
+      continue; // Closed since the event was queued
+    if(events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+      client->readable = 1;
+    if(events[i].events & EPOLLOUT)
+      client->writable = 1;
+  }
+}
+
+void I32CTT_LinuxGatewayInterface::accept_clients(int listen_fd) {
+  struct epoll_event ev;
+  I32CTT_GatewayClient *client;
+  uint8_t idx;
+  int one = 1;
+  int fd;
+
+  for(;;) {
+    fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if(fd < 0) {
+      if(errno == EINTR || errno == ECONNABORTED)
+        continue;
+      return; // EAGAIN, the backlog is empty
+    }
+
+    for(idx = 0; idx < GW_MAX_CLIENTS && this->clients[idx].fd >= 0; idx++);
+    if(idx >= GW_MAX_CLIENTS) {
+      close(fd);
+      continue;
+    }
+
+    client = &this->clients[idx];
+    if(client->in == NULL)
+      client->in = (uint8_t*)malloc(GW_CLIENT_IN_SIZE);
+    if(client->out == NULL)
+      client->out = (uint8_t*)malloc(GW_CLIENT_OUT_SIZE);
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)); // Fails quietly on Unix sockets
+
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.u64 = ((uint64_t)client->generation << 32) | idx;
+    if(client->in == NULL || client->out == NULL ||
+      epoll_ctl(this->epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+      close(fd);
+      continue;
+    }
+
+    client->fd = fd;
+    client->readable = 0;
+    client->writable = 1;
+    client->closing = 0;
+    client->pending = 0;
+    client->in_pos = 0;
+    client->in_size = 0;
+    client->out_head = 0;
+    client->out_count = 0;
+    client->answers = 0;
+    client->head_seen = 0;
+    this->stats.accepted++;
+  }
+}
+
+void I32CTT_LinuxGatewayInterface::service_client(uint8_t idx) {
+  I32CTT_GatewayClient *client = &this->clients[idx];
+
+  if(client->readable)
+    read_client(client);
+  if(client->writable && client->out_count > 0)
+    write_client(client);
+  if(client->closing)
+    close_client(idx);
+}
+
+/*
+ * Reads until EAGAIN or a full input buffer. A client whose buffer stays
+ * full (requests throttled) keeps readable set and is read again once
+ * frames are forwarded, the edge will not come back by itself.
+ */
+void I32CTT_LinuxGatewayInterface::read_client(I32CTT_GatewayClient *client) {
+  uint16_t len;
+  ssize_t count;
+
+  if(client->in_pos > 0) {
+    memmove(client->in, client->in+client->in_pos, client->in_size-client->in_pos);
+    client->in_size -= client->in_pos;
+    client->in_pos = 0;
+  }
+
+  while(client->readable && client->in_size < GW_CLIENT_IN_SIZE) {
+    count = recv(client->fd, client->in+client->in_size, GW_CLIENT_IN_SIZE-client->in_size, MSG_DONTWAIT);
+    if(count > 0) {
+      client->in_size += count;
+    } else if(count < 0 && errno == EINTR) {
+      continue;
+    } else if(count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      client->readable = 0;
+    } else {
+      client->readable = 0; // Closed by the peer or failed
+      client->closing = 1;
+    }
+  }
+
+  if(client->in_size >= GW_FRAME_HEADER) {
+    len = client->in[0] | (client->in[1] << 8);
+    if(len > GW_MAX_MESSAGE) {
+      this->stats.invalid++; // Framing is lost, nothing after it can be trusted
+      client->closing = 1;
+    }
+  }
+}
+
+void I32CTT_LinuxGatewayInterface::write_client(I32CTT_GatewayClient *client) {
+  uint16_t size;
+  ssize_t count;
+
+  while(client->writable && client->out_count > 0) {
+    size = client->out_count;
+    if(size > GW_CLIENT_OUT_SIZE-client->out_head)
+      size = GW_CLIENT_OUT_SIZE-client->out_head;
+    count = ::send(client->fd, client->out+client->out_head, size, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if(count > 0) {
+      client->out_head = (client->out_head+count)%GW_CLIENT_OUT_SIZE;
+      client->out_count -= count;
+    } else if(count < 0 && errno == EINTR) {
+      continue;
+    } else if(count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      client->writable = 0;
+    } else {
+      client->writable = 0;
+      client->closing = 1;
+    }
+  }
+}
+
+/*
+ * Pending requests of the client stay in the table until answered or
+ * expired, the generation tells their answers are orphans.
+ */
+void I32CTT_LinuxGatewayInterface::close_client(uint8_t idx) {
+  I32CTT_GatewayClient *client = &this->clients[idx];
+
+  epoll_ctl(this->epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+  close(client->fd);
+  client->fd = -1;
+  client->generation++;
+  client->pending = 0;
+  client->in_pos = 0;
+  client->in_size = 0;
+  client->out_count = 0;
+  client->head_seen = 0;
+  this->stats.closed++;
+}
+
+/*
+ * Gives the message in the lower rx_buffer to the client waiting for it,
+ * the oldest request of the same node, answer command and mode. Returns
+ * 0 if no client is waiting.
+ */
+uint8_t I32CTT_LinuxGatewayInterface::route_answer() {
+  I32CTT_GatewayPending *match = NULL;
+  I32CTT_GatewayPending *p;
+  uint8_t cmd = this->lower->rx_buffer[0];
+  uint8_t mode = this->lower->rx_size > 1 ? this->lower->rx_buffer[1] : 0;
+  uint16_t src = this->lower->get_src();
+  uint8_t i;
+
+  if(cmd != CMD_AR && cmd != CMD_AW && cmd != CMD_LSTA && cmd != CMD_FNDA)
+    return 0;
+  if(cmd == CMD_LSTA && src != 0)
+    learn_endpoints(src); // Whoever asked, the directory learns from it
+  else if(cmd == CMD_FNDA && src != 0)
+    learn_found(src);
+  else if(src != 0)
+    learn_traffic(src, mode);
+
+  for(i = 0; i < GW_MAX_PENDING; i++) {
+    p = &this->pending[i];
+    if(!p->used || p->answer != cmd || p->leader != GW_NO_LEADER)
+      continue;
+    if((cmd == CMD_AR || cmd == CMD_AW) && p->mode != mode)
+      continue; // LSTA and FNDA do not carry the mode
+    if(src != 0 && p->node != src)
+      continue; // Lower interfaces without addresses report 0
+    if(match == NULL || p->seq < match->seq)
+      match = p;
+  }
+  if(match == NULL)
+    return 0;
+
+  match->used = 0;
+  this->pending_count--;
+  if(match->client == GW_SELF) {
+    this->probes_in_flight--;
+    return 1;
+  }
+  deliver_answer(match, src);
+
+  for(i = 0; i < GW_MAX_PENDING && this->follower_count > 0; i++) {
+    p = &this->pending[i];
+    if(!p->used || p->leader != match-this->pending)
+      continue;
+    p->used = 0;
+    this->follower_count--;
+    deliver_answer(p, src);
+  }
+  return 1;
+}
+
+/*
+ * Queues the answer in the lower rx_buffer to the client of a pending
+ * request, an AR cut down to the registers it asked for.
+ */
+void I32CTT_LinuxGatewayInterface::deliver_answer(I32CTT_GatewayPending *p, uint16_t src) {
+  I32CTT_GatewayClient *client = &this->clients[p->client];
+  uint8_t answer[sizeof(I32CTT_Header)+GW_COLLAPSE_MAX_REGS*sizeof(I32CTT_RegData)];
+  uint8_t *data = this->lower->rx_buffer;
+  uint16_t size = this->lower->rx_size;
+  uint16_t records;
+  uint16_t count = 0;
+  uint16_t i;
+  uint16_t j;
+
+  if(client->fd < 0 || client->generation != p->generation) {
+    this->stats.orphans++;
+    return;
+  }
+  client->pending--;
+
+  if(p->reg_count > 0 && data[0] == CMD_AR && size >= sizeof(I32CTT_Header)) {
+    records = I32CTT_Controller::reg_count(CMD_AR, size);
+    for(i = 0; i < p->reg_count; i++) {
+      for(j = 0; j < records && I32CTT_Controller::get_reg(data, CMD_AR, j) != p->regs[i]; j++);
+      if(j == records)
+        continue; // Not in the answer, the client sees it missing as usual
+      I32CTT_Controller::put_reg(answer, p->regs[i], CMD_AR, count);
+      I32CTT_Controller::put_data(answer, I32CTT_Controller::get_data(data, CMD_AR, j), CMD_AR, count);
+      count++;
+    }
+    answer[0] = CMD_AR;
+    answer[1] = p->mode;
+    data = answer;
+    size = sizeof(I32CTT_Header)+count*sizeof(I32CTT_RegData);
+  }
+
+  if(!queue_answer(client, src, data, size)) {
+    this->stats.overflows++;
+    return;
+  }
+  client->answers++;
+  this->stats.answers++;
+
+  write_client(client);
+}
+
+/*
+ * Appends a framed message to the client's output ring. Returns 0 if it
+ * does not fit.
+ */
+uint8_t I32CTT_LinuxGatewayInterface::queue_answer(I32CTT_GatewayClient *client, uint16_t node,
+    const uint8_t *data, uint16_t size) {
+  uint8_t header[GW_FRAME_HEADER];
+  uint16_t pos;
+  uint8_t i;
+
+  if(GW_CLIENT_OUT_SIZE-client->out_count < GW_FRAME_HEADER+size)
+    return 0;
+
+  header[0] = size & 0xFF;
+  header[1] = size >> 8;
+  header[2] = node & 0xFF;
+  header[3] = node >> 8;
+  pos = (client->out_head+client->out_count)%GW_CLIENT_OUT_SIZE;
+  for(i = 0; i < GW_FRAME_HEADER; i++) {
+    client->out[pos] = header[i];
+    pos = (pos+1)%GW_CLIENT_OUT_SIZE;
+  }
+  client->out_count += GW_FRAME_HEADER;
+  if(pos+size <= GW_CLIENT_OUT_SIZE) {
+    memcpy(client->out+pos, data, size);
+  } else {
+    memcpy(client->out+pos, data, GW_CLIENT_OUT_SIZE-pos);
+    memcpy(client->out, data+GW_CLIENT_OUT_SIZE-pos, size-(GW_CLIENT_OUT_SIZE-pos));
+  }
+  client->out_count += size;
+  return 1;
+}
+
+void I32CTT_LinuxGatewayInterface::expire_pending() {
+  uint32_t now;
+  I32CTT_GatewayPending *p;
+  I32CTT_GatewayClient *client;
+  I32CTT_GatewayNode *node;
+  uint8_t i;
+  uint8_t j;
+
+  if(this->pending_count == 0)
+    return;
+
+  now = millis();
+  for(i = 0; i < GW_MAX_PENDING; i++) {
+    p = &this->pending[i];
+    if(!p->used || p->leader != GW_NO_LEADER || now-p->sent <= this->answer_timeout)
+      continue;
+    p->used = 0;
+    this->pending_count--;
+    for(j = 0; j < GW_MAX_PENDING && this->follower_count > 0; j++) {
+      if(!this->pending[j].used || this->pending[j].leader != i)
+        continue;
+      this->pending[j].used = 0;
+      this->follower_count--;
+      this->stats.timeouts++;
+      client = &this->clients[this->pending[j].client];
+      if(client->fd >= 0 && client->generation == this->pending[j].generation)
+        client->pending--;
+    }
+    if(p->client == GW_SELF) {
+      this->probes_in_flight--;
+      node = find_node(p->node, 0);
+      if(node == NULL && p->mode+1 < GW_PROBE_TRIES && this->retry_count < GW_MAX_PENDING) {
+        this->retry_nodes[this->retry_count] = p->node;
+        this->retry_tries[this->retry_count++] = p->mode+1;
+      }
+      if(node != NULL && ++node->tries >= GW_PROBE_TRIES)
+        node->endpoints = node->known; // Gone quiet, keep what it told
+      if(node != NULL)
+        node->probing = 0;
+      continue;
+    }
+    this->stats.timeouts++;
+    client = &this->clients[p->client];
+    if(client->fd >= 0 && client->generation == p->generation)
+      client->pending--;
+  }
+}
+
+/*
+ * Feeds the lower interface: first a message it did not take yet, then
+ * the controller's own message, discovery requests and then client
+ * requests in round robin while the lower interface accepts them.
+ */
+void I32CTT_LinuxGatewayInterface::pump_tx() {
+  uint8_t forwarded = 0;
+  uint8_t found;
+  uint8_t i;
+
+  if(this->tx_state != GW_TX_IDLE) {
+    if(this->lower->tx_size > 0) {
+      if(this->tx_state == GW_TX_TO_DST)
+        this->lower->send_to_dst();
+      else
+        this->lower->send();
+    }
+    if(this->lower->tx_size > 0)
+      return;
+    this->tx_state = GW_TX_IDLE;
+  }
+
+  if(this->tx_size > 0) {
+    if(this->lower->tx_size > 0 || !this->lower->available())
+      return;
+    memcpy(this->lower->tx_buffer, this->tx_buffer, this->tx_size);
+    this->lower->tx_size = this->tx_size;
+    this->tx_size = 0;
+    if(this->tx_to_dst) {
+      this->lower->set_dst(this->dst_node);
+      this->lower->send_to_dst();
+    } else {
+      this->lower->send();
+    }
+    if(this->lower->tx_size > 0) {
+      this->tx_state = this->tx_to_dst ? GW_TX_TO_DST : GW_TX_SEND;
+      return;
+    }
+  }
+
+  while(forwarded < GW_PROBE_BUDGET && this->tx_state == GW_TX_IDLE && this->lower->tx_size == 0 &&
+    this->lower->available() && send_probe())
+    forwarded++;
+
+  while(forwarded < GW_FORWARD_BUDGET && this->tx_state == GW_TX_IDLE) {
+    if(this->lower->tx_size > 0 || !this->lower->available())
+      return;
+    found = 0;
+    for(i = 0; i < GW_MAX_CLIENTS && !found; i++) {
+      if(forward_request((this->next_client+i)%GW_MAX_CLIENTS)) {
+        this->next_client = (this->next_client+i+1)%GW_MAX_CLIENTS;
+        found = 1;
+      }
+    }
+    if(!found)
+      return;
+    forwarded++;
+  }
+}
+
+/*
+ * Sends the next complete frame of a client to its node. Requests that
+ * expect an answer wait while the client has too many pending or its
+ * output buffer could not hold one more answer. Returns 1 if a message
+ * went to the lower interface.
+ */
+uint8_t I32CTT_LinuxGatewayInterface::forward_request(uint8_t idx) {
+  I32CTT_GatewayClient *client = &this->clients[idx];
+  I32CTT_GatewayPending *p = NULL;
+  uint8_t *frame;
+  uint16_t len;
+  uint16_t node;
+  uint16_t mtu = this->lower->get_MTU();
+  uint16_t regs = 0;
+  uint8_t answer;
+  uint8_t i;
+
+  if(client->fd < 0 || client->closing)
+    return 0;
+
+  for(;;) {
+    if(client->in_size-client->in_pos < GW_FRAME_HEADER)
+      return 0;
+    frame = client->in+client->in_pos;
+    len = frame[0] | (frame[1] << 8);
+    node = frame[2] | (frame[3] << 8);
+    if(len > GW_MAX_MESSAGE || client->in_size-client->in_pos < GW_FRAME_HEADER+len)
+      return 0;
+    if(len > 0 && len <= mtu)
+      break;
+    this->stats.invalid++;
+    client->in_pos += GW_FRAME_HEADER+len;
+  }
+
+  if(node == GW_LOCAL_NODE)
+    return answer_local(client, frame+GW_FRAME_HEADER, len);
+
+  answer = gw_answer_cmd(frame[GW_FRAME_HEADER]);
+  if(this->collapsing)
+    regs = gw_read_regs(frame+GW_FRAME_HEADER, len);
+  if(regs > 0) {
+    if(attach_read(idx, frame+GW_FRAME_HEADER, len, node))
+      return 1;
+    if(!client->head_seen) {
+      client->head_seen = 1;
+      client->head_since = millis();
+    }
+    if(millis()-client->head_since < this->collapse_window)
+      return 0; // Other reads can still join it
+  }
+  if(answer != 0) {
+    if(client->pending >= GW_CLIENT_MAX_PENDING || this->pending_count >= this->max_in_flight)
+      return 0;
+    if(node_in_flight(node) >= this->node_max_in_flight) {
+      this->stats.node_waits++;
+      return 0;
+    }
+    if((uint32_t)(GW_CLIENT_OUT_SIZE-client->out_count) < (uint32_t)(client->pending+1)*(GW_FRAME_HEADER+mtu)) {
+      this->stats.throttled++;
+      return 0;
+    }
+  }
+
+  if(answer != 0) {
+    p = add_pending(idx, node, answer, len > 1 ? frame[GW_FRAME_HEADER+1] : 0);
+    this->pending_count++;
+    client->pending++;
+  }
+  if(this->collapsing && regs == 0)
+    close_reads(node, len > 1 ? frame[GW_FRAME_HEADER+1] : 0);
+
+  memcpy(this->lower->tx_buffer, frame+GW_FRAME_HEADER, len);
+  this->lower->tx_size = len;
+  client->in_pos += GW_FRAME_HEADER+len;
+  client->head_seen = 0;
+  if(regs > 0) {
+    for(i = 0; i < regs; i++)
+      p->regs[i] = I32CTT_Controller::get_reg(this->lower->tx_buffer, CMD_R, i);
+    p->reg_count = regs;
+    this->stats.reads++;
+    merge_reads(idx, p-this->pending, node);
+  }
+  this->lower->set_dst(node);
+  this->lower->send_to_dst();
+  if(this->lower->tx_size > 0)
+    this->tx_state = GW_TX_TO_DST;
+  this->stats.requests++;
+
+  if(client->readable && client->in_size == GW_CLIENT_IN_SIZE)
+    read_client(client); // Room again for what the socket is holding
+  return 1;
+}
+
+/*
+ * Takes a free entry of the pending table for a request of the client,
+ * GW_SELF for the gateway's own. The caller counts it.
+ */
+I32CTT_GatewayPending *I32CTT_LinuxGatewayInterface::add_pending(uint8_t client, uint16_t node, uint8_t answer,
+    uint8_t mode) {
+  I32CTT_GatewayPending *p;
+  uint8_t i;
+
+  for(i = 0; i < GW_MAX_PENDING && this->pending[i].used; i++);
+  p = &this->pending[i];
+  p->used = 1;
+  p->client = client;
+  p->generation = client != GW_SELF ? this->clients[client].generation : 0;
+  p->node = node;
+  p->answer = answer;
+  p->mode = mode;
+  p->seq = this->pending_seq++;
+  p->sent = millis();
+  p->leader = GW_NO_LEADER;
+  p->open = 1;
+  p->reg_count = 0;
+  return p;
+}
+
+/*
+ * Makes the read at the head of the client wait for the answer of a read
+ * in flight to the same node and mode that asked all its registers.
+ * Returns 1 if it did.
+ */
+uint8_t I32CTT_LinuxGatewayInterface::attach_read(uint8_t idx, const uint8_t *msg, uint16_t len, uint16_t node) {
+  I32CTT_GatewayClient *client = &this->clients[idx];
+  I32CTT_GatewayPending *p;
+  I32CTT_GatewayPending *follower;
+  uint16_t regs = gw_read_regs(msg, len);
+  uint16_t r;
+  uint8_t i;
+
+  if(!can_share(idx, node))
+    return 0;
+
+  for(i = 0; i < GW_MAX_PENDING; i++) {
+    p = &this->pending[i];
+    if(!p->used || p->leader != GW_NO_LEADER || !p->open || p->answer != CMD_AR || p->node != node ||
+      p->mode != msg[1])
+      continue;
+    for(r = 0; r < regs && covers(i, I32CTT_Controller::get_reg((uint8_t*)msg, CMD_R, r)); r++);
+    if(r == regs)
+      break;
+  }
+  if(i == GW_MAX_PENDING)
+    return 0;
+
+  follower = add_pending(idx, node, CMD_AR, msg[1]);
+  follower->leader = i;
+  for(r = 0; r < regs; r++)
+    follower->regs[r] = I32CTT_Controller::get_reg((uint8_t*)msg, CMD_R, r);
+  follower->reg_count = regs;
+  this->follower_count++;
+  client->pending++;
+  client->in_pos += GW_FRAME_HEADER+len;
+  client->head_seen = 0;
+  this->stats.reads++;
+  this->stats.collapsed++;
+  return 1;
+}
+
+/*
+ * Packs into the read in the lower tx_buffer the reads of the same node
+ * and mode at the head of the other clients, while the frame fits the
+ * MTU. Each of them shares the answer of the leader entry.
+ */
+void I32CTT_LinuxGatewayInterface::merge_reads(uint8_t idx, uint8_t leader, uint16_t node) {
+  I32CTT_GatewayClient *client;
+  I32CTT_GatewayPending *follower;
+  uint8_t *tx = this->lower->tx_buffer;
+  uint8_t *frame;
+  uint16_t mtu = this->lower->get_MTU();
+  uint16_t size;
+  uint16_t len;
+  uint16_t regs;
+  uint16_t added;
+  uint16_t reg;
+  uint16_t r;
+  uint16_t k;
+  uint8_t c;
+  uint8_t i;
+
+  for(i = 1; i < GW_MAX_CLIENTS; i++) {
+    c = (idx+i)%GW_MAX_CLIENTS;
+    client = &this->clients[c];
+    if(client->fd < 0 || client->closing || client->in_size-client->in_pos < GW_FRAME_HEADER)
+      continue;
+    frame = client->in+client->in_pos;
+    len = frame[0] | (frame[1] << 8);
+    if((frame[2] | (frame[3] << 8)) != node || len > GW_MAX_MESSAGE ||
+      client->in_size-client->in_pos < GW_FRAME_HEADER+len)
+      continue;
+    regs = gw_read_regs(frame+GW_FRAME_HEADER, len);
+    if(regs == 0 || frame[GW_FRAME_HEADER+1] != tx[1] || !can_share(c, node))
+      continue;
+
+    // Registers the frame does not ask yet
+    size = this->lower->tx_size;
+    added = 0;
+    for(r = 0; r < regs; r++) {
+      reg = I32CTT_Controller::get_reg(frame+GW_FRAME_HEADER, CMD_R, r);
+      for(k = 0; k < (size-sizeof(I32CTT_Header))/sizeof(I32CTT_Reg)+added &&
+        I32CTT_Controller::get_reg(tx, CMD_R, k) != reg; k++);
+      if(k < (size-sizeof(I32CTT_Header))/sizeof(I32CTT_Reg)+added)
+        continue;
+      if(size+(added+1)*sizeof(I32CTT_Reg) > mtu)
+        break;
+      I32CTT_Controller::put_reg(tx, reg, CMD_R, k);
+      added++;
+    }
+    if(r < regs)
+      continue; // Does not fit, what was written past tx_size is ignored
+    this->lower->tx_size = size+added*sizeof(I32CTT_Reg);
+
+    follower = add_pending(c, node, CMD_AR, tx[1]);
+    follower->leader = leader;
+    for(r = 0; r < regs; r++)
+      follower->regs[r] = I32CTT_Controller::get_reg(frame+GW_FRAME_HEADER, CMD_R, r);
+    follower->reg_count = regs;
+    this->follower_count++;
+    client->pending++;
+    client->in_pos += GW_FRAME_HEADER+len;
+    client->head_seen = 0;
+    this->stats.reads++;
+    this->stats.merged++;
+    if(client->readable && client->in_size == GW_CLIENT_IN_SIZE)
+      read_client(client);
+  }
+}
+
+/*
+ * 1 if a read of the client can wait on another's answer: there is room
+ * for it and its other requests to the node were answered, so the
+ * answers to the client keep their order.
+ */
+uint8_t I32CTT_LinuxGatewayInterface::can_share(uint8_t idx, uint16_t node) {
+  I32CTT_GatewayClient *client = &this->clients[idx];
+  uint16_t mtu = this->lower->get_MTU();
+  uint8_t i;
+
+  if(this->max_in_flight+this->follower_count >= GW_MAX_PENDING || client->pending >= GW_CLIENT_MAX_PENDING)
+    return 0;
+  if((uint32_t)(GW_CLIENT_OUT_SIZE-client->out_count) < (uint32_t)(client->pending+1)*(GW_FRAME_HEADER+mtu))
+    return 0;
+  for(i = 0; i < GW_MAX_PENDING; i++) {
+    if(this->pending[i].used && this->pending[i].client == idx && this->pending[i].node == node)
+      return 0;
+  }
+  return 1;
+}
+
+/*
+ * 1 if the register is asked by the leader entry or one of the reads
+ * that share its answer, so it is in the frame that was sent.
+ */
+uint8_t I32CTT_LinuxGatewayInterface::covers(uint8_t leader, uint16_t reg) {
+  I32CTT_GatewayPending *p;
+  uint8_t i;
+  uint8_t r;
+
+  for(i = 0; i < GW_MAX_PENDING; i++) {
+    p = &this->pending[i];
+    if(!p->used || (i != leader && p->leader != leader))
+      continue;
+    for(r = 0; r < p->reg_count; r++) {
+      if(p->regs[r] == reg)
+        return 1;
+    }
+  }
+  return 0;
+}
+
+/*
+ * Any other request to the node, a write first of all, could change what
+ * the reads in flight return: later reads do not share them.
+ */
+void I32CTT_LinuxGatewayInterface::close_reads(uint16_t node, uint8_t mode) {
+  uint8_t i;
+
+  for(i = 0; i < GW_MAX_PENDING; i++) {
+    if(this->pending[i].used && this->pending[i].node == node && this->pending[i].mode == mode)
+      this->pending[i].open = 0;
+  }
+}
+
+uint8_t I32CTT_LinuxGatewayInterface::node_in_flight(uint16_t node) {
+  uint8_t count = 0;
+  uint8_t i;
+
+  if(this->node_max_in_flight >= GW_MAX_PENDING)
+    return 0; // No limit, nothing to count
+  for(i = 0; i < GW_MAX_PENDING; i++)
+    count += this->pending[i].used && this->pending[i].node == node;
+  return count;
+}
+
+/*
+ * Sends one LST for discover(): the rest of the endpoints of a known node
+ * first, then an address of the range that did not answer yet, then the
+ * next address of the range. Discovery keeps at most
+ * half of the in flight limit, at least one, for itself. Returns 1 if a
+ * message went to the lower interface.
+ */
+uint8_t I32CTT_LinuxGatewayInterface::send_probe() {
+  I32CTT_GatewayNode *entry = NULL;
+  uint16_t node = 0;
+  uint8_t next = 0;
+  uint8_t tries = 0;
+  uint16_t i;
+
+  if(this->pending_count >= this->max_in_flight)
+    return 0;
+  if(this->probes_in_flight > 0 && this->probes_in_flight >= this->max_in_flight/2)
+    return 0;
+
+  for(i = 0; i < this->node_count && entry == NULL; i++) {
+    if(!this->nodes[i].probing && this->nodes[i].known < this->nodes[i].endpoints &&
+      node_in_flight(this->nodes[i].node) < this->node_max_in_flight)
+      entry = &this->nodes[i];
+  }
+  if(entry != NULL) {
+    node = entry->node;
+    next = entry->known;
+    entry->probing = 1;
+  } else if(this->retry_count > 0) {
+    node = this->retry_nodes[0];
+    tries = this->retry_tries[0];
+    if(node_in_flight(node) >= this->node_max_in_flight)
+      return 0;
+    this->retry_count--;
+    memmove(this->retry_nodes, this->retry_nodes+1, this->retry_count*sizeof(uint16_t));
+    memmove(this->retry_tries, this->retry_tries+1, this->retry_count);
+  } else if(this->probe_active) {
+    node = this->probe_next;
+    if(node == GW_LOCAL_NODE || node_in_flight(node) >= this->node_max_in_flight)
+      return 0;
+    if(node == this->probe_last)
+      this->probe_active = 0;
+    else
+      this->probe_next++;
+  } else {
+    return 0;
+  }
+
+  this->lower->tx_buffer[0] = CMD_LST;
+  this->lower->tx_buffer[1] = next;
+  this->lower->tx_size = sizeof(I32CTT_CMD)+sizeof(I32CTT_Endpoint_t);
+  this->lower->set_dst(node);
+  this->lower->send_to_dst();
+  if(this->lower->tx_size > 0)
+    this->tx_state = GW_TX_TO_DST;
+  this->stats.probes++;
+
+  add_pending(GW_SELF, node, CMD_LSTA, tries); // The mode keeps the tries of an address
+  this->pending_count++;
+  this->probes_in_flight++;
+  return 1;
+}
+
+I32CTT_GatewayNode *I32CTT_LinuxGatewayInterface::find_node(uint16_t node, uint8_t create) {
+  I32CTT_GatewayNode *entry;
+  uint16_t i;
+
+  for(i = 0; i < this->node_count; i++) {
+    if(this->nodes[i].node == node)
+      return &this->nodes[i];
+  }
+  if(!create || this->node_count >= GW_DIR_MAX_NODES)
+    return NULL;
+
+  entry = &this->nodes[this->node_count++];
+  memset(entry, 0, sizeof(I32CTT_GatewayNode));
+  entry->node = node;
+  return entry;
+}
+
+/*
+ * Takes the endpoint ids of the LSTA in the lower rx_buffer:
+ * [LSTA][last endpoint][first endpoint of the page][ids...].
+ */
+void I32CTT_LinuxGatewayInterface::learn_endpoints(uint16_t node) {
+  const uint16_t header = sizeof(I32CTT_CMD)+2*sizeof(I32CTT_Endpoint_t);
+  I32CTT_GatewayNode *entry;
+  uint8_t *msg = this->lower->rx_buffer;
+  uint16_t size = this->lower->rx_size;
+  uint16_t records;
+  uint16_t endpoints;
+  uint16_t ep;
+  uint16_t i;
+
+  if(size < header || (size-header)%sizeof(I32CTT_Id) != 0)
+    return;
+  entry = find_node(node, 1);
+  if(entry == NULL)
+    return;
+
+  // A node without endpoints reports 0xFF as the last one
+  endpoints = msg[1] < GW_DIR_MAX_ENDPOINTS ? msg[1]+1 : 0;
+  records = (size-header)/sizeof(I32CTT_Id);
+  entry->endpoints = endpoints;
+  entry->probing = 0;
+  entry->tries = 0;
+  for(i = 0; i < records; i++) {
+    ep = msg[2]+i;
+    if(ep >= endpoints)
+      break;
+    set_endpoint_id(entry, ep, I32CTT_Controller::get_id(msg, CMD_LSTA, i));
+  }
+  while(entry->known > endpoints) {
+    entry->known--;
+    index_remove(entry->ids[entry->known], entry->node, entry->known);
+  }
+}
+
+/*
+ * Takes the records of the FNDA in the lower rx_buffer, a node hosting
+ * an id at an endpoint past the ones the directory knows is asked for
+ * its list again by discovery.
+ */
+void I32CTT_LinuxGatewayInterface::learn_found(uint16_t node) {
+  I32CTT_GatewayNode *entry;
+  uint8_t *msg = this->lower->rx_buffer;
+  uint16_t size = this->lower->rx_size;
+  uint16_t records;
+  uint32_t id;
+  uint8_t ep;
+  uint16_t i;
+
+  if(size <= sizeof(I32CTT_CMD) || (size-sizeof(I32CTT_CMD))%sizeof(I32CTT_IdEndpoint) != 0)
+    return;
+  entry = find_node(node, 1);
+  if(entry == NULL)
+    return;
+
+  records = (size-sizeof(I32CTT_CMD))/sizeof(I32CTT_IdEndpoint);
+  for(i = 0; i < records; i++) {
+    id = I32CTT_Controller::get_id(msg, CMD_FNDA, i);
+    ep = I32CTT_Controller::get_endpoint(msg, CMD_FNDA, i);
+    if(id == GW_NOT_FOUND_ID || ep >= GW_DIR_MAX_ENDPOINTS)
+      continue;
+    if(ep <= entry->known)
+      set_endpoint_id(entry, ep, id);
+    if(ep >= entry->endpoints)
+      entry->endpoints = ep+1;
+  }
+}
+
+/*
+ * An answer of a node for an endpoint the directory does not know,
+ * discovery asks it for its list.
+ */
+void I32CTT_LinuxGatewayInterface::learn_traffic(uint16_t node, uint8_t mode) {
+  I32CTT_GatewayNode *entry;
+
+  if(mode >= GW_DIR_MAX_ENDPOINTS || node == GW_LOCAL_NODE)
+    return;
+  entry = find_node(node, 0);
+  if(entry != NULL && entry->tries >= GW_PROBE_TRIES)
+    return; // Does not answer LST, leave it
+  if(entry == NULL)
+    entry = find_node(node, 1);
+  if(entry != NULL && mode >= entry->endpoints)
+    entry->endpoints = mode+1;
+}
+
+/*
+ * Stores the id of an endpoint of the node, known or the first unknown
+ * one, and keeps the index in step.
+ */
+void I32CTT_LinuxGatewayInterface::set_endpoint_id(I32CTT_GatewayNode *entry, uint8_t ep, uint32_t id) {
+  if(ep < entry->known) {
+    if(entry->ids[ep] == id)
+      return;
+    index_remove(entry->ids[ep], entry->node, ep);
+  } else if(ep == entry->known) {
+    entry->known++;
+  }
+  entry->ids[ep] = id;
+  if(ep < entry->known)
+    index_add(id, entry->node, ep);
+}
+
+/*
+ * Position of the first index entry not before (id, node, ep).
+ */
+uint16_t I32CTT_LinuxGatewayInterface::index_find(uint32_t id, uint16_t node, uint8_t ep) {
+  I32CTT_GatewayIndexEntry *e;
+  uint16_t low = 0;
+  uint16_t high = this->index_count;
+  uint16_t mid;
+
+  while(low < high) {
+    mid = low+(high-low)/2;
+    e = &this->id_index[mid];
+    if(e->id < id || (e->id == id && (e->node < node || (e->node == node && e->endpoint < ep))))
+      low = mid+1;
+    else
+      high = mid;
+  }
+  return low;
+}
+
+void I32CTT_LinuxGatewayInterface::index_add(uint32_t id, uint16_t node, uint8_t ep) {
+  uint16_t i = index_find(id, node, ep);
+  I32CTT_GatewayIndexEntry *e = &this->id_index[i];
+
+  if(i < this->index_count && e->id == id && e->node == node && e->endpoint == ep)
+    return;
+  if(this->index_count >= GW_INDEX_MAX_ENTRIES)
+    return;
+  memmove(e+1, e, (this->index_count-i)*sizeof(I32CTT_GatewayIndexEntry));
+  e->id = id;
+  e->node = node;
+  e->endpoint = ep;
+  this->index_count++;
+}
+
+void I32CTT_LinuxGatewayInterface::index_remove(uint32_t id, uint16_t node, uint8_t ep) {
+  uint16_t i = index_find(id, node, ep);
+  I32CTT_GatewayIndexEntry *e = &this->id_index[i];
+
+  if(i >= this->index_count || e->id != id || e->node != node || e->endpoint != ep)
+    return;
+  memmove(e, e+1, (this->index_count-i-1)*sizeof(I32CTT_GatewayIndexEntry));
+  this->index_count--;
+}
+
+/*
+ * Directory page for a client, see the class comment. Returns 0 while the
+ * client's buffer cannot take the end frame and one node.
+ */
+uint8_t I32CTT_LinuxGatewayInterface::answer_local(I32CTT_GatewayClient *client, const uint8_t *msg, uint16_t len) {
+  const uint16_t header = sizeof(I32CTT_CMD)+2*sizeof(I32CTT_Endpoint_t);
+  uint8_t answer[header+GW_DIR_MAX_ENDPOINTS*sizeof(I32CTT_Id)];
+  uint16_t mtu = get_MTU();
+  I32CTT_GatewayNode *entry;
+  uint16_t idx;
+  uint16_t size;
+  uint16_t ep;
+
+  if(msg[0] == CMD_FND)
+    return answer_find(client, msg, len);
+  if(msg[0] != CMD_LST || len != sizeof(I32CTT_CMD)+sizeof(I32CTT_Endpoint_t)) {
+    this->stats.invalid++;
+    client->in_pos += GW_FRAME_HEADER+len;
+    return 1;
+  }
+  if((uint32_t)(GW_CLIENT_OUT_SIZE-client->out_count) < 2*GW_FRAME_HEADER+header+sizeof(answer)) {
+    this->stats.throttled++;
+    return 0;
+  }
+
+  for(idx = msg[1]; idx < this->node_count; idx++) {
+    entry = &this->nodes[idx];
+    answer[0] = CMD_LSTA;
+    answer[1] = entry->endpoints > 0 ? entry->endpoints-1 : 0xFF;
+    answer[2] = 0;
+    size = header;
+    for(ep = 0; ep < entry->known && size+sizeof(I32CTT_Id) <= mtu; ep++) {
+      I32CTT_Controller::put_id(answer, entry->ids[ep], CMD_LSTA, ep);
+      size += sizeof(I32CTT_Id);
+    }
+    if(GW_CLIENT_OUT_SIZE-client->out_count < 2*GW_FRAME_HEADER+header+size)
+      break; // Room for the end frame is kept
+    queue_answer(client, entry->node, answer, size);
+  }
+
+  answer[0] = CMD_LSTA;
+  answer[1] = this->node_count > 0 ? this->node_count-1 : 0xFF;
+  answer[2] = idx < 0xFF ? idx : 0xFF;
+  queue_answer(client, GW_LOCAL_NODE, answer, header);
+  client->in_pos += GW_FRAME_HEADER+len;
+  this->stats.listings++;
+  write_client(client);
+  return 1;
+}
+
+/*
+ * FND for a client from the index, see the class comment. An id with
+ * more hosts than the client's buffer can hold gets the ones that fit and
+ * a GW_NOT_FOUND_ID record in the end frame. Returns 0 while the client's
+ * buffer cannot take the whole answer.
+ */
+uint8_t I32CTT_LinuxGatewayInterface::answer_find(I32CTT_GatewayClient *client, const uint8_t *msg, uint16_t len) {
+  const uint16_t frame = GW_FRAME_HEADER+sizeof(I32CTT_CMD)+sizeof(I32CTT_IdEndpoint);
+  uint8_t answer[sizeof(I32CTT_CMD)+sizeof(I32CTT_IdEndpoint)];
+  I32CTT_GatewayIndexEntry *e;
+  uint32_t needed = frame; // The end frame
+  uint16_t records;
+  uint16_t i;
+  uint16_t j;
+  uint32_t id;
+  uint8_t truncated = 0;
+
+  if(len <= sizeof(I32CTT_CMD) || (len-sizeof(I32CTT_CMD))%sizeof(I32CTT_Id) != 0) {
+    this->stats.invalid++;
+    client->in_pos += GW_FRAME_HEADER+len;
+    return 1;
+  }
+  records = (len-sizeof(I32CTT_CMD))/sizeof(I32CTT_Id);
+  for(i = 0; i < records; i++) {
+    id = I32CTT_Controller::get_id((uint8_t*)msg, CMD_FND, i);
+    for(j = index_find(id, 0, 0); j < this->index_count && this->id_index[j].id == id; j++)
+      needed += frame;
+  }
+  if(needed > GW_CLIENT_OUT_SIZE)
+    needed = GW_CLIENT_OUT_SIZE; // Takes what fits in an empty buffer
+  if((uint32_t)(GW_CLIENT_OUT_SIZE-client->out_count) < needed) {
+    this->stats.throttled++;
+    return 0;
+  }
+
+  answer[0] = CMD_FNDA;
+  for(i = 0; i < records; i++) {
+    id = I32CTT_Controller::get_id((uint8_t*)msg, CMD_FND, i);
+    for(j = index_find(id, 0, 0); j < this->index_count && this->id_index[j].id == id; j++) {
+      e = &this->id_index[j];
+      if(GW_CLIENT_OUT_SIZE-client->out_count < 2*frame) {
+        truncated = 1; // Room for the end frame is kept
+        break;
+      }
+      I32CTT_Controller::put_id(answer, e->id, CMD_FNDA, 0);
+      I32CTT_Controller::put_endpoint(answer, e->endpoint, CMD_FNDA, 0);
+      queue_answer(client, e->node, answer, sizeof(answer));
+    }
+  }
+
+  if(truncated) {
+    I32CTT_Controller::put_id(answer, GW_NOT_FOUND_ID, CMD_FNDA, 0);
+    I32CTT_Controller::put_endpoint(answer, 0xFF, CMD_FNDA, 0);
+    queue_answer(client, GW_LOCAL_NODE, answer, sizeof(answer));
+    this->stats.overflows++;
+  } else {
+    queue_answer(client, GW_LOCAL_NODE, answer, sizeof(I32CTT_CMD));
+  }
+  client->in_pos += GW_FRAME_HEADER+len;
+  this->stats.finds++;
+  write_client(client);
+  return 1;
+}
@@ -0,0 +1,288 @@
+/*
+ *
+ * This file is part of I32CTT (Integer 32-bit Control & Telemetry Transport).
+ * Copyright (C) 2017 Mario Gomez / Hackerspace San Salvador.
+ *
+ * I32CTT is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * I32CTT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with I32CTT.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef I32CTT_LinuxGatewayInterface_H
+#define I32CTT_LinuxGatewayInterface_H
+
+#include <stdint.h>
+
+#ifndef GW_MAX_CLIENTS
+#define GW_MAX_CLIENTS 64
+#endif
+#define GW_MAX_LISTENERS 4
+#define GW_MAX_MESSAGE 1024      // Biggest message accepted from a client
+#define GW_FRAME_HEADER 4        // [length][node], little endian 16-bit each
+#define GW_CLIENT_IN_SIZE (2*(GW_FRAME_HEADER+GW_MAX_MESSAGE))
+#ifndef GW_CLIENT_OUT_SIZE
+#define GW_CLIENT_OUT_SIZE 32768 // Answers waiting for a slow client
+#endif
+#define GW_CLIENT_MAX_PENDING 16 // Requests of a client waiting for an answer
+#define GW_MAX_PENDING 128       // Requests waiting for an answer in total
+#ifndef GW_MAX_IN_FLIGHT
+#define GW_MAX_IN_FLIGHT 1       // Requests on the lower interface at once, for a radio, see set_max_in_flight()
+#endif
+#ifndef GW_NODE_MAX_IN_FLIGHT
+#define GW_NODE_MAX_IN_FLIGHT GW_MAX_PENDING // Of them to one node, see set_node_max_in_flight()
+#endif
+#define GW_FORWARD_BUDGET 16     // Client requests forwarded and answers routed per update()
+#define GW_EPOLL_EVENTS 32
+#ifndef GW_ANSWER_TIMEOUT
+#define GW_ANSWER_TIMEOUT 1000   // ms before a pending request is forgotten
+#endif
+#define GW_LOCAL_NODE 0xFFFE     // Frames to this node are answered by the gateway (directory)
+#define GW_SELF 0xFF             // Client of the gateway's own discovery requests
+#ifndef GW_DIR_MAX_NODES
+#define GW_DIR_MAX_NODES 255     // Nodes the directory remembers, indexes fit a byte
+#endif
+#define GW_DIR_MAX_ENDPOINTS 64  // Endpoints per node, MAX_MODE_COUNT
+#define GW_PROBE_TRIES 3         // Unanswered LST before an address or a node's missing endpoints are given up
+#define GW_PROBE_BUDGET (GW_FORWARD_BUDGET/2) // Discovery requests sent per update()
+#define GW_INDEX_MAX_ENTRIES (GW_DIR_MAX_NODES*GW_DIR_MAX_ENDPOINTS)
+#define GW_NOT_FOUND_ID 0xFFFFFFFF // FNDA record of an id the index could not list in full
+#ifndef GW_COLLAPSE_MAX_REGS
+#define GW_COLLAPSE_MAX_REGS 32  // Registers of a read that can share another read's answer
+#endif
+#define GW_NO_LEADER 0xFF        // Pending request that went to the lower interface itself
+
+enum GW_TX_STATE {
+  GW_TX_IDLE = 0,
+  GW_TX_SEND,    // Lower interface busy with send()
+  GW_TX_TO_DST   // Lower interface busy with send_to_dst()
+};
+
+struct I32CTT_GatewayStats {
+  uint32_t accepted;
+  uint32_t closed;
+  uint32_t requests;    // Forwarded to the lower interface
+  uint32_t answers;     // Routed back to a client
+  uint32_t timeouts;    // Requests never answered
+  uint32_t orphans;     // Answers for a client that left
+  uint32_t invalid;     // Client frames dropped (empty, too big)
+  uint32_t overflows;   // Answers that did not fit a client buffer
+  uint32_t throttled;   // Times a client was skipped for a full buffer
+  uint32_t node_waits;  // Times a client was skipped for a busy node
+  uint32_t probes;      // Discovery requests sent
+  uint32_t listings;    // Directory pages given to clients
+  uint32_t reads;       // Client reads seen with set_collapsing()
+  uint32_t collapsed;   // Of them answered by a read already in flight
+  uint32_t merged;      // Of them packed into another client's read
+  uint32_t finds;       // FND answered from the index
+};
+
+struct I32CTT_GatewayClient {
+  int fd;
+  uint16_t generation;  // Tells a reused slot from the one a request came from
+  uint8_t readable;     // Edge seen, not drained to EAGAIN yet
+  uint8_t writable;
+  uint8_t closing;
+  uint8_t pending;      // Requests waiting for an answer
+  uint8_t *in;          // Bytes received, frames not forwarded yet
+  uint16_t in_pos;      // First byte not forwarded
+  uint16_t in_size;
+  uint8_t *out;         // Ring of framed answers
+  uint16_t out_head;
+  uint16_t out_count;
+  uint32_t answers;
+  uint8_t head_seen;    // The first frame is a read held for set_collapse_window()
+  uint32_t head_since;  // millis() it was first seen
+};
+
+struct I32CTT_GatewayNode {
+  uint16_t node;
+  uint8_t endpoints;    // Endpoints the node reported
+  uint8_t known;        // Of them, with their id below
+  uint8_t probing;      // Discovery request waiting for an answer
+  uint8_t tries;        // Of them unanswered in a row
+  uint32_t ids[GW_DIR_MAX_ENDPOINTS];
+};
+
+/*
+ * Entry of the endpoint index, sorted by id, node and endpoint.
+ */
+struct I32CTT_GatewayIndexEntry {
+  uint32_t id;
+  uint16_t node;
+  uint8_t endpoint;
+};
+
+struct I32CTT_GatewayPending {
+  uint8_t used;
+  uint8_t client;
+  uint16_t generation;
+  uint16_t node;
+  uint8_t answer;      // Command that answers the request
+  uint8_t mode;
+  uint32_t seq;        // Oldest first among equal matches
+  uint32_t sent;       // millis()
+  uint8_t leader;      // Entry whose answer this read shares, GW_NO_LEADER if sent
+  uint8_t open;        // Later reads can still share this one's answer
+  uint8_t reg_count;   // Registers the client asked for, 0 takes the whole answer
+  uint16_t regs[GW_COLLAPSE_MAX_REGS];
+};
+
+/*
+ * Host gateway between many TCP or Unix socket clients and a lower
+ * interface (the field network). Clients send length prefixed frames,
+ * [length][node][message], each message goes to that node through
+ * set_dst() and send_to_dst(). Answers are matched to the oldest pending
+ * request of the same node, answer command and mode, and go back to the
+ * client that sent it framed with the source node. Clients take turns and
+ * only GW_MAX_IN_FLIGHT requests wait for an answer at once. The default
+ * of 1 is for the 802.15.4 radio: it is half duplex and an answer that
+ * comes while it transmits the next request runs out of MAC retries.
+ * Lower interfaces that do not lose answers that way (UDP,
+ * I32CTT_LinuxShardPool) should raise it with set_max_in_flight().
+ * set_node_max_in_flight() limits requests per node on top of that.
+ *
+ * The gateway keeps a directory of the nodes and endpoint ids it saw in
+ * LSTA answers; discover() walks a range of addresses with LST requests
+ * that share the lower interface with the clients. A client sends LST to
+ * GW_LOCAL_NODE to read it: [LST][first index] is answered with the LSTA
+ * of each known node from that index on, framed with the node's address,
+ * as many as fit the client's buffer, and then [LSTA][last index][next
+ * index] from GW_LOCAL_NODE. The client asks again from next index while
+ * it is not past last index.
+ *
+ * The known endpoint ids are also kept in an index sorted by id, so FND
+ * sent to GW_LOCAL_NODE is answered without asking the field: each node
+ * hosting one of the ids gets a [FNDA][id][endpoint] frame framed with
+ * its address, then [FNDA] alone comes from GW_LOCAL_NODE. lookup() reads
+ * the index directly. discover() keeps up to half of the in flight limit
+ * busy with LST, so a lower interface that takes many requests at once
+ * sweeps the range in parallel. The directory and index follow the
+ * traffic too: every LSTA and FNDA from a node, asked for or sent on its
+ * own as a notification, updates it, and a node that answers for an
+ * endpoint the directory does not know is asked for its list again.
+ *
+ * With set_collapsing() reads share the radio: a read whose registers
+ * are all asked by a read of the same node and mode already in flight
+ * waits for that answer instead of being sent, and reads of the same
+ * node and mode at the head of other clients are packed into the frame
+ * being sent, up to the MTU. Each client gets an AR with just the
+ * registers it asked for. set_collapse_window() holds a read that long
+ * for others to join it. A write to the node closes its reads in flight
+ * to later reads, and a client never shares an answer while it has other
+ * requests to the node waiting, so its answers keep their order.
+ *
+ * Sockets are non-blocking and registered edge-triggered in one epoll
+ * instance that update() polls without waiting. Every client has its own
+ * output buffer, a client stops being read while its buffer could not
+ * hold the answers to all its pending requests, so a slow reader never
+ * blocks the lower interface or the other clients.
+ *
+ * Messages for the gateway itself (requests from the field and answers
+ * no client is waiting for) are given to the controller as usual, and the
+ * controller's answers go out through the lower interface.
+ */
+class I32CTT_LinuxGatewayInterface: public I32CTT_Interface {
+  public:
+    I32CTT_LinuxGatewayInterface(I32CTT_Interface &lower);
+    ~I32CTT_LinuxGatewayInterface();
+    uint8_t listen_tcp(const char *host, uint16_t port);
+    uint8_t listen_unix(const char *path);
+    uint16_t get_tcp_port();
+    int get_epoll_fd();
+    uint8_t get_client_count();
+    void set_max_in_flight(uint8_t count);
+    void set_node_max_in_flight(uint8_t count);
+    void set_answer_timeout(uint32_t ms);
+    void set_collapsing(uint8_t enabled);
+    void set_collapse_window(uint16_t ms);
+    void discover(uint16_t first, uint16_t last);
+    uint8_t discovering();
+    uint16_t get_node_count();
+    I32CTT_GatewayNode *get_node_at(uint16_t idx);
+    uint16_t lookup(uint32_t id, uint16_t *nodes, uint8_t *endpoints, uint16_t max);
+    uint16_t get_index_count();
+    I32CTT_GatewayStats *get_stats();
+    void init();
+    void update();
+    uint8_t available();
+    uint8_t data_available();
+    void send();
+    void send_to_dst();
+    uint16_t get_MTU();
+    void set_dst(uint16_t addr);
+    uint16_t get_src();
+  private:
+    uint8_t add_listener(int fd, const char *path);
+    void poll_events();
+    void accept_clients(int fd);
+    void service_client(uint8_t idx);
+    void read_client(I32CTT_GatewayClient *client);
+    void write_client(I32CTT_GatewayClient *client);
+    void close_client(uint8_t idx);
+    uint8_t route_answer();
+    void expire_pending();
+    void pump_tx();
+    uint8_t forward_request(uint8_t idx);
+    I32CTT_GatewayPending *add_pending(uint8_t client, uint16_t node, uint8_t answer, uint8_t mode);
+    void deliver_answer(I32CTT_GatewayPending *p, uint16_t src);
+    uint8_t attach_read(uint8_t idx, const uint8_t *msg, uint16_t len, uint16_t node);
+    void merge_reads(uint8_t idx, uint8_t leader, uint16_t node);
+    uint8_t can_share(uint8_t idx, uint16_t node);
+    uint8_t covers(uint8_t leader, uint16_t reg);
+    void close_reads(uint16_t node, uint8_t mode);
+    uint8_t queue_answer(I32CTT_GatewayClient *client, uint16_t node, const uint8_t *data, uint16_t size);
+    uint8_t node_in_flight(uint16_t node);
+    uint8_t send_probe();
+    I32CTT_GatewayNode *find_node(uint16_t node, uint8_t create);
+    void learn_endpoints(uint16_t node);
+    void learn_found(uint16_t node);
+    void learn_traffic(uint16_t node, uint8_t mode);
+    void set_endpoint_id(I32CTT_GatewayNode *entry, uint8_t ep, uint32_t id);
+    uint16_t index_find(uint32_t id, uint16_t node, uint8_t ep);
+    void index_add(uint32_t id, uint16_t node, uint8_t ep);
+    void index_remove(uint32_t id, uint16_t node, uint8_t ep);
+    uint8_t answer_local(I32CTT_GatewayClient *client, const uint8_t *msg, uint16_t len);
+    uint8_t answer_find(I32CTT_GatewayClient *client, const uint8_t *msg, uint16_t len);
+    I32CTT_Interface *lower;
+    int epoll_fd;
+    int listeners[GW_MAX_LISTENERS];
+    char *listener_path[GW_MAX_LISTENERS]; // Unix sockets, removed on exit
+    uint8_t listener_count;
+    I32CTT_GatewayClient clients[GW_MAX_CLIENTS];
+    I32CTT_GatewayPending pending[GW_MAX_PENDING];
+    uint8_t pending_count;
+    uint8_t max_in_flight;  // GW_MAX_IN_FLIGHT unless set_max_in_flight()
+    uint8_t node_max_in_flight;
+    uint32_t answer_timeout; // ms, GW_ANSWER_TIMEOUT unless set_answer_timeout()
+    uint8_t collapsing;
+    uint16_t collapse_window; // ms
+    uint8_t follower_count; // Pending reads sharing another's answer
+    uint32_t pending_seq;
+    uint8_t next_client;    // Round robin start for forwarding
+    uint8_t tx_state;
+    uint8_t tx_to_dst;      // Controller message goes to dst_node
+    uint16_t dst_node;
+    uint8_t d_available;
+    I32CTT_GatewayNode *nodes; // Directory, in the order nodes were found
+    uint16_t node_count;
+    uint16_t probe_next;    // Next address discover() asks
+    uint16_t probe_last;
+    uint8_t probe_active;
+    uint8_t probes_in_flight;
+    uint16_t retry_nodes[GW_MAX_PENDING]; // Addresses of the range whose LST went unanswered
+    uint8_t retry_tries[GW_MAX_PENDING];
+    uint8_t retry_count;
+    I32CTT_GatewayIndexEntry *id_index; // Endpoint ids of the directory, sorted
+    uint16_t index_count;
+    I32CTT_GatewayStats stats;
+};
+
+#endif
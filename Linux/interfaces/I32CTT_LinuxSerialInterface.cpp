@@ -0,0 +1,386 @@
+/*
+ *
+ * This file is part of I32CTT (Integer 32-bit Control & Telemetry Transport).
+ * Copyright (C) 2017 Mario Gomez / Hackerspace San Salvador.
+ *
+ * I32CTT is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * I32CTT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with I32CTT.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+#include <linux/serial.h>
+#include "I32CTT.h"
+#include "I32CTT_LinuxSerialInterface.h"
+
+static uint16_t crc_table[256];
+
+// termios constant of a baud rate, B0 if the kernel has none for it
+static speed_t serial_speed(uint32_t baud) {
+  switch(baud) {
+    case 9600: return B9600;
+    case 19200: return B19200;
+    case 38400: return B38400;
+    case 57600: return B57600;
+    case 115200: return B115200;
+    case 230400: return B230400;
+    case 460800: return B460800;
+    case 500000: return B500000;
+    case 576000: return B576000;
+    case 921600: return B921600;
+    case 1000000: return B1000000;
+    case 1152000: return B1152000;
+    case 1500000: return B1500000;
+    case 2000000: return B2000000;
+    case 2500000: return B2500000;
+    case 3000000: return B3000000;
+    case 3500000: return B3500000;
+    case 4000000: return B4000000;
+    default: return B0;
+  }
+}
+
+/*
+ * Opens the device once init() is called.
+ */
+I32CTT_LinuxSerialInterface::I32CTT_LinuxSerialInterface(const char *device, uint32_t baud) {
+  this->fd = -1;
+  this->device = strdup(device);
+  this->baud = baud;
+  this->low_latency = 0;
+
+  this->read_buffer = new uint8_t[SERIAL_READ_SIZE];
+  this->read_pos = 0;
+  this->read_len = 0;
+  this->frame = new uint8_t[SERIAL_MTU_SIZE+SERIAL_CRC_SIZE];
+  this->frame_size = 0;
+  this->escaped = 0;
+  this->overrun = 0;
+  this->out_buffer = new uint8_t[SERIAL_OUT_SIZE];
+  this->out_pos = 0;
+  this->out_len = 0;
+  this->d_available = 0;
+  memset(&this->stats, 0, sizeof(I32CTT_SerialStats));
+
+  this->rx_buffer = this->frame;
+  this->rx_size = 0;
+  this->tx_buffer = new uint8_t[SERIAL_MTU_SIZE];
+  this->tx_size = 0;
+}
+
+I32CTT_LinuxSerialInterface::~I32CTT_LinuxSerialInterface() {
+  if(this->fd >= 0)
+    close(this->fd);
+  free(this->device);
+  delete[] this->read_buffer;
+  delete[] this->frame;
+  delete[] this->out_buffer;
+  delete[] this->tx_buffer;
+}
+
+/*
+ * Opens and configures the port. On failure get_fd() stays negative and
+ * available() returns 0.
+ */
+void I32CTT_LinuxSerialInterface::init() {
+  if(this->fd >= 0)
+    return;
+
+  this->fd = open(this->device, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+  if(this->fd < 0)
+    return;
+  if(!configure()) {
+    close(this->fd);
+    this->fd = -1;
+  }
+}
+
+uint8_t I32CTT_LinuxSerialInterface::configure() {
+  struct termios tio;
+  speed_t speed = serial_speed(this->baud);
+#ifdef TIOCGSERIAL
+  struct serial_struct serial;
+#endif
+
+  if(speed == B0 || tcgetattr(this->fd, &tio) != 0)
+    return 0;
+
+  cfmakeraw(&tio);
+  tio.c_cflag |= CLOCAL | CREAD;
+  tio.c_cflag &= ~(CRTSCTS | CSTOPB);
+  tio.c_cc[VMIN] = 0;  // read() never waits for bytes...
+  tio.c_cc[VTIME] = 0; // ...nor for a gap between them
+  cfsetispeed(&tio, speed);
+  cfsetospeed(&tio, speed);
+  if(tcsetattr(this->fd, TCSANOW, &tio) != 0)
+    return 0;
+
+  ioctl(this->fd, TIOCEXCL); // Another process opening the port would steal bytes
+#ifdef TIOCGSERIAL
+  // Not every driver has it (ptys, most USB-CDC), the port works anyway
+  if(ioctl(this->fd, TIOCGSERIAL, &serial) == 0) {
+    serial.flags |= ASYNC_LOW_LATENCY;
+    this->low_latency = ioctl(this->fd, TIOCSSERIAL, &serial) == 0;
+  }
+#endif
+  tcflush(this->fd, TCIOFLUSH); // Whatever arrived before is not ours
+  return 1;
+}
+
+/*
+ * Writes pending output first, then presents the next complete message of
+ * the current chunk or reads a new chunk. One message per call, the
+ * controller parses one per run().
+ */
+void I32CTT_LinuxSerialInterface::update() {
+  if(this->fd < 0)
+    return;
+  if(this->out_len > 0)
+    flush();
+  if(this->d_available)
+    return;
+
+  if(decode())
+    return;
+  receive();
+  decode();
+}
+
+void I32CTT_LinuxSerialInterface::receive() {
+  ssize_t count;
+
+  do {
+    count = read(this->fd, this->read_buffer, SERIAL_READ_SIZE);
+  } while(count < 0 && errno == EINTR);
+
+  this->read_pos = 0;
+  this->read_len = count > 0 ? count : 0;
+  if(count > 0) {
+    this->stats.rx_reads++;
+    this->stats.rx_bytes += count;
+  }
+}
+
+/*
+ * Decodes the rest of the chunk up to the end of a message. Plain bytes
+ * are copied in runs, only SLIP specials are looked at one by one.
+ * Returns 1 if a valid message is in rx_buffer.
+ */
+uint8_t I32CTT_LinuxSerialInterface::decode() {
+  const uint8_t *data;
+  uint16_t room;
+  uint16_t run;
+  uint16_t n;
+  uint8_t c;
+
+  while(this->read_pos < this->read_len) {
+    data = this->read_buffer+this->read_pos;
+    n = this->read_len-this->read_pos;
+
+    run = 0;
+    if(!this->escaped)
+      while(run < n && data[run] != SLIP_END && data[run] != SLIP_ESC)
+        run++;
+    if(run > 0) {
+      room = SERIAL_MTU_SIZE+SERIAL_CRC_SIZE-this->frame_size;
+      if(run > room)
+        this->overrun = 1;
+      memcpy(this->frame+this->frame_size, data, run < room ? run : room);
+      this->frame_size += run < room ? run : room;
+      this->read_pos += run;
+      continue;
+    }
+
+    c = data[0];
+    this->read_pos++;
+    if(this->escaped) {
+      if(c == SLIP_ESC_END)
+        c = SLIP_END;
+      else if(c == SLIP_ESC_ESC)
+        c = SLIP_ESC;
+      this->escaped = 0;
+      if(this->frame_size < SERIAL_MTU_SIZE+SERIAL_CRC_SIZE)
+        this->frame[this->frame_size++] = c;
+      else
+        this->overrun = 1;
+    } else if(c == SLIP_ESC) {
+      this->escaped = 1;
+    } else {
+      end_frame();
+      if(this->d_available)
+        return 1;
+    }
+  }
+  return 0;
+}
+
+/*
+ * A SLIP_END closes the frame. Empty frames are the separators the node
+ * sends before every message, anything else must carry a good CRC.
+ */
+void I32CTT_LinuxSerialInterface::end_frame() {
+  uint16_t size = this->frame_size;
+  uint16_t crc;
+
+  this->frame_size = 0;
+  this->escaped = 0;
+  if(this->overrun || (size > 0 && size <= SERIAL_CRC_SIZE)) {
+    this->overrun = 0;
+    this->stats.rx_errors++;
+    return;
+  }
+  if(size == 0)
+    return;
+
+  size -= SERIAL_CRC_SIZE;
+  crc = this->frame[size] | (this->frame[size+1] << 8);
+  if(crc != crc16(0, this->frame, size)) {
+    this->stats.rx_errors++;
+    return;
+  }
+  this->rx_buffer = this->frame;
+  this->rx_size = size;
+  this->stats.rx_frames++;
+  this->d_available = 1;
+}
+
+uint8_t I32CTT_LinuxSerialInterface::available() {
+  return this->fd >= 0 && SERIAL_OUT_SIZE-this->out_len >= SERIAL_FRAME_MAX;
+}
+
+uint8_t I32CTT_LinuxSerialInterface::data_available() {
+  uint8_t result = this->d_available;
+  this->d_available = 0;
+  return result;
+}
+
+/*
+ * Encodes tx_buffer after the pending output and writes as much as the
+ * port takes.
+ */
+void I32CTT_LinuxSerialInterface::send() {
+  uint16_t crc;
+  uint8_t *out;
+  uint8_t c;
+  uint32_t i;
+
+  if(this->tx_size == 0)
+    return;
+  if(this->fd < 0 || this->tx_size > SERIAL_MTU_SIZE) {
+    this->stats.tx_dropped++;
+    this->tx_size = 0;
+    return;
+  }
+
+  if(SERIAL_OUT_SIZE-this->out_len < SERIAL_FRAME_MAX)
+    flush();
+  if(SERIAL_OUT_SIZE-this->out_len < SERIAL_FRAME_MAX) {
+    this->stats.tx_dropped++;
+    this->tx_size = 0;
+    return;
+  }
+  if(SERIAL_OUT_SIZE-this->out_pos-this->out_len < SERIAL_FRAME_MAX) {
+    memmove(this->out_buffer, this->out_buffer+this->out_pos, this->out_len);
+    this->out_pos = 0;
+  }
+
+  crc = crc16(0, this->tx_buffer, this->tx_size);
+  out = this->out_buffer+this->out_pos+this->out_len;
+  *out++ = SLIP_END; // Flushes any noise the node received
+  for(i = 0; i < (uint32_t)this->tx_size+SERIAL_CRC_SIZE; i++) {
+    c = i < this->tx_size ? this->tx_buffer[i] : (i == this->tx_size ? crc & 0xFF : crc >> 8);
+    if(c == SLIP_END) {
+      *out++ = SLIP_ESC;
+      *out++ = SLIP_ESC_END;
+    } else if(c == SLIP_ESC) {
+      *out++ = SLIP_ESC;
+      *out++ = SLIP_ESC_ESC;
+    } else {
+      *out++ = c;
+    }
+  }
+  *out++ = SLIP_END;
+  this->out_len = out-this->out_buffer-this->out_pos;
+  this->tx_size = 0;
+  this->stats.tx_frames++;
+
+  flush();
+}
+
+/*
+ * Writes pending output until the port refuses more, never blocks.
+ */
+void I32CTT_LinuxSerialInterface::flush() {
+  ssize_t count;
+
+  while(this->fd >= 0 && this->out_len > 0) {
+    count = write(this->fd, this->out_buffer+this->out_pos, this->out_len);
+    if(count < 0 && errno == EINTR)
+      continue;
+    if(count <= 0)
+      break;
+    this->out_pos += count;
+    this->out_len -= count;
+    this->stats.tx_writes++;
+    this->stats.tx_bytes += count;
+  }
+  if(this->out_len == 0)
+    this->out_pos = 0;
+}
+
+uint16_t I32CTT_LinuxSerialInterface::get_MTU() {
+  return SERIAL_MTU_SIZE;
+}
+
+int I32CTT_LinuxSerialInterface::get_fd() {
+  return this->fd;
+}
+
+/*
+ * 1 if the driver accepted ASYNC_LOW_LATENCY.
+ */
+uint8_t I32CTT_LinuxSerialInterface::is_low_latency() {
+  return this->low_latency;
+}
+
+I32CTT_SerialStats *I32CTT_LinuxSerialInterface::get_stats() {
+  return &this->stats;
+}
+
+/*
+ * Same CRC-16 as I32CTT_ArduinoStreamInterface::crc16() (ITU-T, 0x1021
+ * reflected), one table lookup per byte instead of eight shifts.
+ */
+uint16_t I32CTT_LinuxSerialInterface::crc16(uint16_t crc, const uint8_t *buffer, uint16_t size) {
+  uint16_t value;
+  uint16_t i;
+  uint8_t j;
+
+  if(crc_table[1] == 0) {
+    for(i = 0; i < 256; i++) {
+      value = i;
+      for(j = 0; j < 8; j++)
+        value = (value & 1) ? (value >> 1) ^ 0x8408 : (value >> 1);
+      crc_table[i] = value;
+    }
+  }
+
+  for(i = 0; i < size; i++)
+    crc = (crc >> 8) ^ crc_table[(crc ^ buffer[i]) & 0xFF];
+  return crc;
+}
@@ -0,0 +1,114 @@
+/*
+ *
+ * This file is part of I32CTT (Integer 32-bit Control & Telemetry Transport).
+ * Copyright (C) 2017 Mario Gomez / Hackerspace San Salvador.
+ *
+ * I32CTT is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * I32CTT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with I32CTT.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef I32CTT_LinuxSerialInterface_H
+#define I32CTT_LinuxSerialInterface_H
+
+#include <stdint.h>
+
+#ifndef SERIAL_MTU_SIZE
+#if I32CTT_SIZE_BITS == 8
+#define SERIAL_MTU_SIZE 100
+#else
+#define SERIAL_MTU_SIZE 1024 // Same as SER_MTU_SIZE on the node
+#endif
+#endif
+#define SERIAL_CRC_SIZE 2
+#define SERIAL_FRAME_MAX (2+2*(SERIAL_MTU_SIZE+SERIAL_CRC_SIZE)) // Every byte escaped
+#ifndef SERIAL_READ_SIZE
+#define SERIAL_READ_SIZE 4096 // Bytes per read() at most
+#endif
+#ifndef SERIAL_OUT_SIZE
+#define SERIAL_OUT_SIZE (8*SERIAL_FRAME_MAX)
+#endif
+
+#ifndef SLIP_END
+#define SLIP_END     0xC0 // RFC 1055 framing, as I32CTT_ArduinoStreamInterface
+#define SLIP_ESC     0xDB
+#define SLIP_ESC_END 0xDC
+#define SLIP_ESC_ESC 0xDD
+#endif
+
+struct I32CTT_SerialStats {
+  uint32_t rx_frames;
+  uint32_t rx_reads;    // read() calls that returned bytes
+  uint32_t rx_bytes;
+  uint32_t rx_errors;   // Bad CRC, too long or too short
+  uint32_t tx_frames;
+  uint32_t tx_writes;   // write() calls that took bytes
+  uint32_t tx_bytes;
+  uint32_t tx_dropped;  // No room in the output buffer
+};
+
+/*
+ * Host side of I32CTT_ArduinoStreamInterface in binary mode: SLIP framed
+ * I32CTT messages followed by their CRC-16 (little endian) over a serial
+ * port, a USB-CDC adapter or a pty.
+ *
+ * The port is opened in raw mode with O_NONBLOCK and VMIN = VTIME = 0, so
+ * read() returns at once with whatever the driver holds. update() reads a
+ * whole chunk and decodes it in runs between SLIP specials, leftover
+ * bytes after a complete message wait for the next update(). Output is
+ * encoded into a buffer and written without blocking, update() writes
+ * what the port did not take. A message that finds the buffer full is
+ * dropped and counted.
+ *
+ * Baud rates are the termios ones up to 4 Mb/s, the real rate of a USB-CDC
+ * port does not depend on them. ASYNC_LOW_LATENCY is requested where the
+ * driver supports it (FTDI and other USB serial adapters flush their
+ * receive buffer every 1 ms instead of 16 ms).
+ */
+class I32CTT_LinuxSerialInterface: public I32CTT_Interface {
+  public:
+    I32CTT_LinuxSerialInterface(const char *device, uint32_t baud = 115200);
+    ~I32CTT_LinuxSerialInterface();
+    void init();
+    void update();
+    uint8_t available();
+    uint8_t data_available();
+    void send();
+    uint16_t get_MTU();
+    void flush();
+    int get_fd();
+    uint8_t is_low_latency();
+    I32CTT_SerialStats *get_stats();
+    static uint16_t crc16(uint16_t crc, const uint8_t *buffer, uint16_t size);
+  private:
+    uint8_t configure();
+    void receive();
+    uint8_t decode();
+    void end_frame();
+    int fd;
+    char *device;
+    uint32_t baud;
+    uint8_t low_latency;
+    uint8_t *read_buffer;
+    uint16_t read_pos;
+    uint16_t read_len;
+    uint8_t *frame;         // Message and CRC being decoded
+    uint16_t frame_size;
+    uint8_t escaped;
+    uint8_t overrun;
+    uint8_t *out_buffer;
+    uint32_t out_pos;       // First byte not written
+    uint32_t out_len;
+    uint8_t d_available;
+    I32CTT_SerialStats stats;
+};
+
+#endif
@@ -0,0 +1,722 @@
+/*
+ *
+ * This file is part of I32CTT (Integer 32-bit Control & Telemetry Transport).
+ * Copyright (C) 2017 Mario Gomez / Hackerspace San Salvador.
+ *
+ * I32CTT is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * I32CTT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with I32CTT.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // pthread_setaffinity_np()
+#endif
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include "I32CTT.h"
+#include "I32CTT_LinuxShardPool.h"
+
+static uint32_t shard_now_ms() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec*1000+ts.tv_nsec/1000000;
+}
+
+// Counters have one writer, readers in other threads see whole values
+static inline void shard_count(uint32_t *counter) {
+  __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED)+1, __ATOMIC_RELAXED);
+}
+
+// Command that answers a request, 0 if none is expected
+static uint8_t shard_answer_cmd(uint8_t cmd) {
+  switch(cmd) {
+    case CMD_R:
+      return CMD_AR;
+    case CMD_W:
+      return CMD_AW;
+    case CMD_LST:
+      return CMD_LSTA;
+    case CMD_FND:
+      return CMD_FNDA;
+    default:
+      return 0;
+  }
+}
+
+I32CTT_ShardQueue::I32CTT_ShardQueue() {
+  uint32_t i;
+
+  this->cells = new I32CTT_ShardCell[SHARD_QUEUE_SIZE];
+  for(i = 0; i < SHARD_QUEUE_SIZE; i++)
+    this->cells[i].sequence = i;
+  this->enqueue_pos = 0;
+  this->dequeue_pos = 0;
+}
+
+I32CTT_ShardQueue::~I32CTT_ShardQueue() {
+  delete[] this->cells;
+}
+
+/*
+ * Returns 0 if the queue is full.
+ */
+uint8_t I32CTT_ShardQueue::push(uint16_t node, const uint8_t *data, uint16_t size) {
+  I32CTT_ShardCell *cell;
+  uint32_t pos = __atomic_load_n(&this->enqueue_pos, __ATOMIC_RELAXED);
+  int32_t diff;
+
+  for(;;) {
+    cell = &this->cells[pos & (SHARD_QUEUE_SIZE-1)];
+    diff = (int32_t)(__atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE)-pos);
+    if(diff == 0) {
+      if(__atomic_compare_exchange_n(&this->enqueue_pos, &pos, pos+1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        break;
+    } else if(diff < 0) {
+      return 0;
+    } else {
+      pos = __atomic_load_n(&this->enqueue_pos, __ATOMIC_RELAXED);
+    }
+  }
+
+  cell->msg.node = node;
+  cell->msg.size = size;
+  if(size > 0)
+    memcpy(cell->msg.data, data, size);
+  __atomic_store_n(&cell->sequence, pos+1, __ATOMIC_RELEASE);
+  return 1;
+}
+
+/*
+ * Returns 0 if the queue is empty.
+ */
+uint8_t I32CTT_ShardQueue::pop(I32CTT_ShardMessage *msg) {
+  I32CTT_ShardCell *cell;
+  uint32_t pos = __atomic_load_n(&this->dequeue_pos, __ATOMIC_RELAXED);
+  int32_t diff;
+
+  for(;;) {
+    cell = &this->cells[pos & (SHARD_QUEUE_SIZE-1)];
+    diff = (int32_t)(__atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE)-(pos+1));
+    if(diff == 0) {
+      if(__atomic_compare_exchange_n(&this->dequeue_pos, &pos, pos+1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        break;
+    } else if(diff < 0) {
+      return 0;
+    } else {
+      pos = __atomic_load_n(&this->dequeue_pos, __ATOMIC_RELAXED);
+    }
+  }
+
+  msg->node = cell->msg.node;
+  msg->size = cell->msg.size;
+  memcpy(msg->data, cell->msg.data, cell->msg.size);
+  __atomic_store_n(&cell->sequence, pos+SHARD_QUEUE_SIZE, __ATOMIC_RELEASE);
+  return 1;
+}
+
+/*
+ * Messages waiting, a snapshot while others push and pop.
+ */
+uint32_t I32CTT_ShardQueue::depth() {
+  uint32_t dequeue = __atomic_load_n(&this->dequeue_pos, __ATOMIC_RELAXED);
+  uint32_t enqueue = __atomic_load_n(&this->enqueue_pos, __ATOMIC_RELAXED);
+
+  return enqueue-dequeue < SHARD_QUEUE_SIZE ? enqueue-dequeue : SHARD_QUEUE_SIZE;
+}
+
+I32CTT_LinuxShard::I32CTT_LinuxShard() {
+  this->pool = NULL;
+  this->controller = NULL;
+  this->lower = NULL;
+  this->index = 0;
+  this->cpu = -1;
+  this->wait_fd = -1;
+  this->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  this->job_ready = 0;
+  memset(this->pending, 0, sizeof(this->pending));
+  this->pending_count = 0;
+  this->tx_state = SHARD_TX_IDLE;
+  this->tx_to_dst = 0;
+  this->dst_node = 0;
+  this->progress = 0;
+  this->d_available = 0;
+  this->sleeping = 0;
+  memset(&this->stats, 0, sizeof(I32CTT_ShardStats));
+
+  this->rx_buffer = NULL;
+  this->rx_size = 0;
+  this->tx_buffer = new uint8_t[SHARD_MTU_SIZE];
+  this->tx_size = 0;
+}
+
+I32CTT_LinuxShard::~I32CTT_LinuxShard() {
+  if(this->wake_fd >= 0)
+    close(this->wake_fd);
+  delete[] this->tx_buffer;
+}
+
+void I32CTT_LinuxShard::init() {
+  this->lower->init();
+}
+
+/*
+ * Sends queued jobs while the window allows, then takes answers from the
+ * lower interface back to the dispatcher. The first message for the
+ * controller stops it.
+ */
+void I32CTT_LinuxShard::update() {
+  uint8_t i;
+
+  this->progress = 0;
+  pump_tx();
+  for(i = 0; i < SHARD_BUDGET; i++) {
+    this->lower->update();
+    if(this->d_available || !this->lower->data_available())
+      break;
+    this->progress = 1;
+    if(this->lower->rx_size > 0 && !route_answer()) {
+      this->rx_buffer = this->lower->rx_buffer;
+      this->rx_size = this->lower->rx_size;
+      this->d_available = 1;
+      shard_count(&this->stats.local);
+    }
+  }
+  if(this->pending_count > 0)
+    expire_pending();
+}
+
+uint8_t I32CTT_LinuxShard::available() {
+  return this->tx_size == 0 && this->lower->available();
+}
+
+uint8_t I32CTT_LinuxShard::data_available() {
+  uint8_t result = this->d_available;
+  this->d_available = 0;
+  return result;
+}
+
+void I32CTT_LinuxShard::send() {
+  this->tx_to_dst = 0;
+  pump_tx();
+}
+
+void I32CTT_LinuxShard::send_to_dst() {
+  this->tx_to_dst = 1;
+  pump_tx();
+}
+
+uint16_t I32CTT_LinuxShard::get_MTU() {
+  uint16_t mtu = this->lower->get_MTU();
+
+  return mtu < SHARD_MTU_SIZE ? mtu : SHARD_MTU_SIZE;
+}
+
+void I32CTT_LinuxShard::set_dst(uint16_t addr) {
+  this->dst_node = addr;
+}
+
+uint16_t I32CTT_LinuxShard::get_src() {
+  return this->lower->get_src();
+}
+
+void *I32CTT_LinuxShard::thread_main(void *arg) {
+  I32CTT_LinuxShard *shard = (I32CTT_LinuxShard*)arg;
+  cpu_set_t set;
+
+  if(shard->cpu >= 0) {
+    CPU_ZERO(&set);
+    CPU_SET(shard->cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  }
+  shard->work();
+  return NULL;
+}
+
+void I32CTT_LinuxShard::work() {
+  uint32_t idle = 0;
+
+  while(__atomic_load_n(&this->pool->running, __ATOMIC_ACQUIRE)) {
+    this->controller->run();
+    if(this->progress) {
+      idle = 0;
+    } else if(++idle >= SHARD_IDLE_SPINS) {
+      wait();
+      idle = 0;
+    }
+  }
+}
+
+/*
+ * Sleeps until the dispatcher queues a job, the lower interface has
+ * input or a pending request may expire. sleeping pairs with the fence
+ * in I32CTT_LinuxShardPool::send_to_dst(), one of both sides sees the
+ * other's store.
+ */
+void I32CTT_LinuxShard::wait() {
+  struct pollfd fds[2];
+  uint64_t value;
+  uint8_t count = 1;
+  int timeout;
+
+  memset(fds, 0, sizeof(fds));
+  fds[0].fd = this->wake_fd;
+  fds[0].events = POLLIN;
+  if(this->wait_fd >= 0) {
+    fds[1].fd = this->wait_fd;
+    fds[1].events = POLLIN;
+    count = 2;
+    timeout = this->pending_count > 0 ? 10 : 100;
+  } else {
+    timeout = SHARD_IDLE_WAIT;
+  }
+
+  __atomic_store_n(&this->sleeping, 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if(this->jobs.depth() == 0) {
+    shard_count(&this->stats.sleeps);
+    poll(fds, count, timeout);
+  }
+  __atomic_store_n(&this->sleeping, 0, __ATOMIC_RELAXED);
+  if(fds[0].revents & POLLIN) {
+    if(read(this->wake_fd, &value, sizeof(value)) < 0)
+      return;
+  }
+}
+
+/*
+ * Gives the message in the lower rx_buffer back to the dispatcher if it
+ * answers a job of this shard: same node, answer command and mode.
+ * Returns 0 if it does not.
+ */
+uint8_t I32CTT_LinuxShard::route_answer() {
+  I32CTT_ShardPending *p;
+  uint8_t cmd = this->lower->rx_buffer[0];
+  uint8_t mode = this->lower->rx_size > 1 ? this->lower->rx_buffer[1] : 0;
+  uint16_t src = this->lower->get_src();
+  uint8_t i;
+
+  if(cmd != CMD_AR && cmd != CMD_AW && cmd != CMD_LSTA && cmd != CMD_FNDA)
+    return 0;
+
+  for(i = 0; i < SHARD_MAX_PENDING; i++) {
+    p = &this->pending[i];
+    if(!p->used || p->answer != cmd)
+      continue;
+    if((cmd == CMD_AR || cmd == CMD_AW) && p->mode != mode)
+      continue; // LSTA and FNDA do not carry the mode
+    if(src != 0 && p->node != src)
+      continue; // Lower interfaces without addresses report 0
+    break;
+  }
+  if(i >= SHARD_MAX_PENDING)
+    return 0;
+
+  p->used = 0;
+  this->pending_count--;
+  if(this->answers.push(p->node, this->lower->rx_buffer, this->lower->rx_size))
+    shard_count(&this->stats.answers);
+  else
+    shard_count(&this->stats.overflows);
+  this->pool->wake_dispatcher();
+  return 1;
+}
+
+void I32CTT_LinuxShard::expire_pending() {
+  uint32_t now = shard_now_ms();
+  I32CTT_ShardPending *p;
+  uint8_t i;
+
+  for(i = 0; i < SHARD_MAX_PENDING; i++) {
+    p = &this->pending[i];
+    if(!p->used || now-p->sent <= SHARD_ANSWER_TIMEOUT)
+      continue;
+    p->used = 0;
+    this->pending_count--;
+    shard_count(&this->stats.timeouts);
+  }
+}
+
+/*
+ * Feeds the lower interface: first a message it did not take yet, then
+ * the controller's own message and then jobs, the shard's own first.
+ */
+void I32CTT_LinuxShard::pump_tx() {
+  I32CTT_ShardPending *p;
+  uint8_t answer;
+  uint8_t sent;
+  uint8_t i;
+
+  if(this->tx_state != SHARD_TX_IDLE) {
+    if(this->lower->tx_size > 0) {
+      if(this->tx_state == SHARD_TX_TO_DST)
+        this->lower->send_to_dst();
+      else
+        this->lower->send();
+    }
+    if(this->lower->tx_size > 0)
+      return;
+    this->tx_state = SHARD_TX_IDLE;
+  }
+
+  if(this->tx_size > 0) {
+    if(this->lower->tx_size > 0 || !this->lower->available())
+      return;
+    memcpy(this->lower->tx_buffer, this->tx_buffer, this->tx_size);
+    this->lower->tx_size = this->tx_size;
+    this->tx_size = 0;
+    if(this->tx_to_dst) {
+      this->lower->set_dst(this->dst_node);
+      this->lower->send_to_dst();
+    } else {
+      this->lower->send();
+    }
+    if(this->lower->tx_size > 0) {
+      this->tx_state = this->tx_to_dst ? SHARD_TX_TO_DST : SHARD_TX_SEND;
+      return;
+    }
+  }
+
+  for(sent = 0; sent < SHARD_BUDGET && this->tx_state == SHARD_TX_IDLE; sent++) {
+    if(this->pending_count >= this->pool->window || this->lower->tx_size > 0 || !this->lower->available())
+      return;
+    if(!this->job_ready && !take_job())
+      return;
+
+    memcpy(this->lower->tx_buffer, this->job.data, this->job.size);
+    this->lower->tx_size = this->job.size;
+    this->lower->set_dst(this->job.node);
+    this->lower->send_to_dst();
+    if(this->lower->tx_size > 0)
+      this->tx_state = SHARD_TX_TO_DST;
+    this->job_ready = 0;
+    this->progress = 1;
+    shard_count(&this->stats.jobs);
+
+    answer = shard_answer_cmd(this->job.data[0]);
+    if(answer != 0) {
+      for(i = 0; i < SHARD_MAX_PENDING && this->pending[i].used; i++);
+      p = &this->pending[i];
+      p->used = 1;
+      p->answer = answer;
+      p->mode = this->job.size > 1 ? this->job.data[1] : 0;
+      p->node = this->job.node;
+      p->sent = shard_now_ms();
+      this->pending_count++;
+    }
+  }
+}
+
+/*
+ * Next job from the shard's queue. A dispatcher waiting for room is
+ * woken.
+ */
+uint8_t I32CTT_LinuxShard::take_job() {
+  this->job_ready = this->jobs.pop(&this->job);
+  if(this->job_ready)
+    this->pool->wake_dispatcher();
+  return this->job_ready;
+}
+
+I32CTT_LinuxShardPool::I32CTT_LinuxShardPool() {
+  this->shard_count = 0;
+  this->next_shard = 0;
+  this->window = SHARD_WINDOW;
+  this->mtu = SHARD_MTU_SIZE;
+  this->running = 0;
+  this->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  this->waiting = 0;
+  this->src_node = 0;
+  this->dst_node = 0;
+  this->d_available = 0;
+
+  this->rx_buffer = this->answer.data;
+  this->rx_size = 0;
+  this->tx_buffer = new uint8_t[SHARD_MTU_SIZE];
+  this->tx_size = 0;
+}
+
+I32CTT_LinuxShardPool::~I32CTT_LinuxShardPool() {
+  uint8_t i;
+
+  stop();
+  for(i = 0; i < this->shard_count; i++)
+    delete this->shards[i];
+  if(this->wake_fd >= 0)
+    close(this->wake_fd);
+  delete[] this->tx_buffer;
+}
+
+/*
+ * A shard for controller on lower, before start(). Its worker runs on
+ * cpu if not -1. wait_fd is a descriptor readable when lower has input
+ * (get_fd() of the UDP or serial interface), the worker sleeps on it;
+ * without one it wakes every SHARD_IDLE_WAIT ms. Returns 0 if the pool
+ * is full or running.
+ */
+uint8_t I32CTT_LinuxShardPool::add_shard(I32CTT_Controller &controller, I32CTT_Interface &lower, int cpu,
+    int wait_fd) {
+  I32CTT_LinuxShard *shard;
+
+  if(this->shard_count >= SHARD_MAX_SHARDS || this->running)
+    return 0;
+
+  shard = new I32CTT_LinuxShard();
+  if(shard->wake_fd < 0) {
+    delete shard;
+    return 0;
+  }
+  shard->pool = this;
+  shard->controller = &controller;
+  shard->lower = &lower;
+  shard->index = this->shard_count;
+  shard->cpu = cpu;
+  shard->wait_fd = wait_fd;
+  this->shards[this->shard_count++] = shard;
+  controller.set_interface(*shard);
+  if(shard->get_MTU() < this->mtu)
+    this->mtu = shard->get_MTU();
+  return 1;
+}
+
+/*
+ * Starts one worker thread per shard. From now on only the workers touch
+ * the shards' controllers and lower interfaces.
+ */
+uint8_t I32CTT_LinuxShardPool::start() {
+  uint8_t i;
+
+  if(this->running || this->shard_count == 0 || this->wake_fd < 0)
+    return 0;
+
+  __atomic_store_n(&this->running, 1, __ATOMIC_RELEASE);
+  for(i = 0; i < this->shard_count; i++) {
+    if(pthread_create(&this->shards[i]->thread, NULL, I32CTT_LinuxShard::thread_main, this->shards[i]) != 0) {
+      this->shard_count = i; // Only the started ones are joined
+      stop();
+      return 0;
+    }
+  }
+  return 1;
+}
+
+void I32CTT_LinuxShardPool::stop() {
+  uint64_t one = 1;
+  uint8_t i;
+
+  if(!this->running)
+    return;
+
+  __atomic_store_n(&this->running, 0, __ATOMIC_RELEASE);
+  for(i = 0; i < this->shard_count; i++) {
+    if(write(this->shards[i]->wake_fd, &one, sizeof(one)) < 0)
+      continue;
+  }
+  for(i = 0; i < this->shard_count; i++)
+    pthread_join(this->shards[i]->thread, NULL);
+}
+
+/*
+ * Requests each shard keeps waiting for an answer at once, up to
+ * SHARD_MAX_PENDING.
+ */
+void I32CTT_LinuxShardPool::set_window(uint8_t window) {
+  if(window == 0)
+    window = 1;
+  this->window = window < SHARD_MAX_PENDING ? window : SHARD_MAX_PENDING;
+}
+
+/*
+ * Sleeps up to timeout_ms until a shard queues an answer or frees room in
+ * its job queue, or fd (the front end's epoll descriptor, -1 for none)
+ * becomes readable. Returns at once if answers are waiting. Returns 1 if
+ * something is ready.
+ */
+uint8_t I32CTT_LinuxShardPool::wait(int fd, int timeout_ms) {
+  struct pollfd fds[2];
+  uint64_t value;
+  uint8_t count = 1;
+  uint8_t i;
+  int ready;
+
+  __atomic_store_n(&this->waiting, 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  for(i = 0; i < this->shard_count; i++) {
+    if(this->shards[i]->answers.depth() > 0) {
+      __atomic_store_n(&this->waiting, 0, __ATOMIC_RELAXED);
+      return 1;
+    }
+  }
+
+  memset(fds, 0, sizeof(fds));
+  fds[0].fd = this->wake_fd;
+  fds[0].events = POLLIN;
+  if(fd >= 0) {
+    fds[1].fd = fd;
+    fds[1].events = POLLIN;
+    count = 2;
+  }
+  ready = poll(fds, count, timeout_ms);
+  __atomic_store_n(&this->waiting, 0, __ATOMIC_RELAXED);
+  if(fds[0].revents & POLLIN) {
+    if(read(this->wake_fd, &value, sizeof(value)) < 0)
+      return ready > 0;
+  }
+  return ready > 0;
+}
+
+uint8_t I32CTT_LinuxShardPool::get_shard_count() {
+  return this->shard_count;
+}
+
+uint8_t I32CTT_LinuxShardPool::shard_of(uint16_t node) {
+  return this->shard_count > 0 ? node%this->shard_count : 0;
+}
+
+/*
+ * Copy of a shard's counters, safe while the workers run.
+ */
+void I32CTT_LinuxShardPool::get_stats(uint8_t shard, I32CTT_ShardStats *stats) {
+  I32CTT_ShardStats *s;
+
+  memset(stats, 0, sizeof(I32CTT_ShardStats));
+  if(shard >= this->shard_count)
+    return;
+  s = &this->shards[shard]->stats;
+  stats->jobs = __atomic_load_n(&s->jobs, __ATOMIC_RELAXED);
+  stats->answers = __atomic_load_n(&s->answers, __ATOMIC_RELAXED);
+  stats->local = __atomic_load_n(&s->local, __ATOMIC_RELAXED);
+  stats->timeouts = __atomic_load_n(&s->timeouts, __ATOMIC_RELAXED);
+  stats->refused = s->refused; // Written by the dispatcher
+  stats->overflows = __atomic_load_n(&s->overflows, __ATOMIC_RELAXED);
+  stats->sleeps = __atomic_load_n(&s->sleeps, __ATOMIC_RELAXED);
+  stats->queue_depth = this->shards[shard]->jobs.depth();
+  stats->queue_max = s->queue_max;
+}
+
+void I32CTT_LinuxShardPool::init() {
+}
+
+/*
+ * Presents the next answer a shard queued, shards take turns.
+ */
+void I32CTT_LinuxShardPool::update() {
+  uint8_t idx;
+  uint8_t i;
+
+  if(this->d_available)
+    return;
+
+  for(i = 0; i < this->shard_count; i++) {
+    idx = (this->next_shard+i)%this->shard_count;
+    if(this->shards[idx]->answers.pop(&this->answer)) {
+      this->next_shard = (idx+1)%this->shard_count;
+      this->rx_buffer = this->answer.data;
+      this->rx_size = this->answer.size;
+      this->src_node = this->answer.node;
+      this->d_available = 1;
+      return;
+    }
+  }
+}
+
+uint8_t I32CTT_LinuxShardPool::available() {
+  return this->tx_size == 0 && this->running;
+}
+
+uint8_t I32CTT_LinuxShardPool::data_available() {
+  uint8_t result = this->d_available;
+  this->d_available = 0;
+  return result;
+}
+
+/*
+ * Answers go to the node the last message came from, through its shard.
+ */
+void I32CTT_LinuxShardPool::send() {
+  this->dst_node = this->src_node;
+  send_to_dst();
+}
+
+/*
+ * Queues tx_buffer as a job of the node's shard. If the queue is full
+ * tx_size stays set and the caller tries again later, as with a busy
+ * lower interface.
+ */
+void I32CTT_LinuxShardPool::send_to_dst() {
+  I32CTT_LinuxShard *shard;
+  uint32_t depth;
+
+  if(this->tx_size == 0)
+    return;
+  if(this->shard_count == 0 || this->tx_size > this->mtu) {
+    this->tx_size = 0;
+    return;
+  }
+
+  shard = this->shards[shard_of(this->dst_node)];
+  if(!shard->jobs.push(this->dst_node, this->tx_buffer, this->tx_size)) {
+    shard->stats.refused++;
+    return;
+  }
+  this->tx_size = 0;
+  depth = shard->jobs.depth();
+  if(depth > shard->stats.queue_max)
+    shard->stats.queue_max = depth;
+
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if(__atomic_load_n(&shard->sleeping, __ATOMIC_RELAXED))
+    wake(shard);
+}
+
+uint16_t I32CTT_LinuxShardPool::get_MTU() {
+  return this->mtu;
+}
+
+void I32CTT_LinuxShardPool::set_dst(uint16_t addr) {
+  this->dst_node = addr;
+}
+
+uint16_t I32CTT_LinuxShardPool::get_src() {
+  return this->src_node;
+}
+
+/*
+ * One eventfd write per sleep, the exchange makes sure of it.
+ */
+void I32CTT_LinuxShardPool::wake(I32CTT_LinuxShard *shard) {
+  uint64_t one = 1;
+
+  if(__atomic_exchange_n(&shard->sleeping, 0, __ATOMIC_SEQ_CST)) {
+    if(write(shard->wake_fd, &one, sizeof(one)) < 0)
+      return;
+  }
+}
+
+/*
+ * Called by workers after queueing an answer or freeing room for a job.
+ */
+void I32CTT_LinuxShardPool::wake_dispatcher() {
+  uint64_t one = 1;
+
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if(__atomic_load_n(&this->waiting, __ATOMIC_RELAXED) &&
+    __atomic_exchange_n(&this->waiting, 0, __ATOMIC_SEQ_CST)) {
+    if(write(this->wake_fd, &one, sizeof(one)) < 0)
+      return;
+  }
+}
@@ -0,0 +1,217 @@
+/*
+ *
+ * This file is part of I32CTT (Integer 32-bit Control & Telemetry Transport).
+ * Copyright (C) 2017 Mario Gomez / Hackerspace San Salvador.
+ *
+ * I32CTT is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * I32CTT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with I32CTT.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef I32CTT_LinuxShardPool_H
+#define I32CTT_LinuxShardPool_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#ifndef SHARD_MTU_SIZE
+#if I32CTT_SIZE_BITS == 8
+#define SHARD_MTU_SIZE 255
+#else
+#define SHARD_MTU_SIZE 1024
+#endif
+#endif
+#ifndef SHARD_MAX_SHARDS
+#define SHARD_MAX_SHARDS 16
+#endif
+#ifndef SHARD_QUEUE_SIZE
+#define SHARD_QUEUE_SIZE 256     // Jobs and answers per shard queue, a power of two
+#endif
+#define SHARD_MAX_PENDING 64     // Requests a shard can have waiting for an answer
+#ifndef SHARD_WINDOW
+#define SHARD_WINDOW 8           // Of them in use unless set_window()
+#endif
+#ifndef SHARD_ANSWER_TIMEOUT
+#define SHARD_ANSWER_TIMEOUT 1000 // ms before a pending request is forgotten
+#endif
+#define SHARD_BUDGET 16          // Jobs sent and answers routed per update()
+#define SHARD_IDLE_SPINS 64      // Idle rounds of a worker before it sleeps
+#define SHARD_IDLE_WAIT 1        // ms a worker sleeps without a descriptor to wait on
+#define SHARD_CACHE_LINE 64
+
+enum SHARD_TX_STATE {
+  SHARD_TX_IDLE = 0,
+  SHARD_TX_SEND,    // Lower interface busy with send()
+  SHARD_TX_TO_DST   // Lower interface busy with send_to_dst()
+};
+
+struct I32CTT_ShardMessage {
+  uint16_t node;
+  uint16_t size;
+  uint8_t data[SHARD_MTU_SIZE];
+};
+
+struct I32CTT_ShardCell {
+  uint32_t sequence;
+  I32CTT_ShardMessage msg;
+};
+
+/*
+ * Bounded lock-free queue of messages, any number of producers and
+ * consumers (D. Vyukov's array queue). Each cell's sequence tells whose
+ * turn it is, the positions are claimed with a compare and swap.
+ */
+class I32CTT_ShardQueue {
+  public:
+    I32CTT_ShardQueue();
+    ~I32CTT_ShardQueue();
+    uint8_t push(uint16_t node, const uint8_t *data, uint16_t size);
+    uint8_t pop(I32CTT_ShardMessage *msg);
+    uint32_t depth();
+  private:
+    I32CTT_ShardCell *cells;
+    uint8_t pad0[SHARD_CACHE_LINE];
+    uint32_t enqueue_pos;
+    uint8_t pad1[SHARD_CACHE_LINE-4];
+    uint32_t dequeue_pos;
+    uint8_t pad2[SHARD_CACHE_LINE-4];
+};
+
+struct I32CTT_ShardStats {
+  uint32_t jobs;        // Requests sent on the shard's lower interface
+  uint32_t answers;     // Passed back to the dispatcher
+  uint32_t local;       // Messages given to the shard's own controller
+  uint32_t timeouts;    // Requests never answered
+  uint32_t refused;     // Jobs not queued, the queue was full
+  uint32_t overflows;   // Answers dropped, the answer queue was full
+  uint32_t sleeps;
+  uint32_t queue_depth; // Jobs waiting now
+  uint32_t queue_max;   // Most jobs seen waiting
+};
+
+struct I32CTT_ShardPending {
+  uint8_t used;
+  uint8_t answer;
+  uint8_t mode;
+  uint16_t node;
+  uint32_t sent;        // ms
+};
+
+class I32CTT_LinuxShardPool;
+
+/*
+ * One worker thread: a controller, its lower interface and the requests
+ * waiting for an answer on it. The shard is the controller's interface,
+ * like I32CTT_LinuxGatewayInterface, so messages from the field that are
+ * not answers to a job are parsed by the shard's own controller.
+ */
+class I32CTT_LinuxShard: public I32CTT_Interface {
+  friend class I32CTT_LinuxShardPool;
+  public:
+    I32CTT_LinuxShard();
+    virtual ~I32CTT_LinuxShard();
+    void init();
+    void update();
+    uint8_t available();
+    uint8_t data_available();
+    void send();
+    void send_to_dst();
+    uint16_t get_MTU();
+    void set_dst(uint16_t addr);
+    uint16_t get_src();
+  private:
+    static void *thread_main(void *arg);
+    void work();
+    void wait();
+    uint8_t route_answer();
+    void expire_pending();
+    void pump_tx();
+    uint8_t take_job();
+    I32CTT_LinuxShardPool *pool;
+    I32CTT_Controller *controller;
+    I32CTT_Interface *lower;
+    uint8_t index;
+    int cpu;               // -1 runs anywhere
+    int wait_fd;           // Readable when the lower interface has input, -1 if unknown
+    int wake_fd;           // eventfd the dispatcher writes to wake the worker
+    pthread_t thread;
+    I32CTT_ShardQueue jobs;
+    I32CTT_ShardQueue answers;
+    I32CTT_ShardMessage job; // Taken, waiting for the lower interface
+    uint8_t job_ready;
+    I32CTT_ShardPending pending[SHARD_MAX_PENDING];
+    uint8_t pending_count;
+    uint8_t tx_state;
+    uint8_t tx_to_dst;
+    uint16_t dst_node;
+    uint8_t progress;      // Something moved in the last update()
+    uint8_t d_available;
+    uint32_t sleeping;     // Set by the worker before it waits on wake_fd
+    I32CTT_ShardStats stats;
+};
+
+/*
+ * Sharded gateway runtime. Node addresses are split among up to
+ * SHARD_MAX_SHARDS worker threads (node modulo the shard count), each
+ * with its own controller, lower interface, pending requests and job
+ * queue, so one slow node or radio only holds its shard.
+ *
+ * The pool is itself an I32CTT_Interface, meant as the lower interface of
+ * an I32CTT_LinuxGatewayInterface (with set_max_in_flight() above one):
+ * set_dst() and send_to_dst() queue a job to the node's shard through a
+ * lock-free queue, update() presents the answers the shards queue back.
+ * The front end keeps doing client I/O and matching in its own thread.
+ *
+ * A node always goes to the same shard, so its answers come back in
+ * order, as the front end matches them. Workers sleep on an eventfd and
+ * their lower interface's descriptor, the dispatcher writes the eventfd
+ * only when the worker said it was going to sleep.
+ */
+class I32CTT_LinuxShardPool: public I32CTT_Interface {
+  friend class I32CTT_LinuxShard;
+  public:
+    I32CTT_LinuxShardPool();
+    ~I32CTT_LinuxShardPool();
+    uint8_t add_shard(I32CTT_Controller &controller, I32CTT_Interface &lower, int cpu = -1, int wait_fd = -1);
+    uint8_t start();
+    void stop();
+    void set_window(uint8_t window);
+    uint8_t wait(int fd, int timeout_ms);
+    uint8_t get_shard_count();
+    uint8_t shard_of(uint16_t node);
+    void get_stats(uint8_t shard, I32CTT_ShardStats *stats);
+    void init();
+    void update();
+    uint8_t available();
+    uint8_t data_available();
+    void send();
+    void send_to_dst();
+    uint16_t get_MTU();
+    void set_dst(uint16_t addr);
+    uint16_t get_src();
+  private:
+    void wake(I32CTT_LinuxShard *shard);
+    void wake_dispatcher();
+    I32CTT_LinuxShard *shards[SHARD_MAX_SHARDS];
+    uint8_t shard_count;
+    uint8_t next_shard;    // Round robin start for answers
+    uint8_t window;
+    uint16_t mtu;          // Smallest of the shards
+    uint32_t running;
+    int wake_fd;           // eventfd the workers write to wake wait()
+    uint32_t waiting;      // Set by wait() before it sleeps
+    I32CTT_ShardMessage answer;
+    uint16_t src_node;
+    uint16_t dst_node;
+    uint8_t d_available;
+};
+
+#endif
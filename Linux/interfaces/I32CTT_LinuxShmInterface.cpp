@@ -0,0 +1,308 @@
+/*
+ *
+ * This file is part of I32CTT (Integer 32-bit Control & Telemetry Transport).
+ * Copyright (C) 2017 Mario Gomez / Hackerspace San Salvador.
+ *
+ * I32CTT is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * I32CTT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with I32CTT.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "I32CTT.h"
+#include "I32CTT_LinuxShmInterface.h"
+
+// Frames the consumer takes before publishing its tail, unless it drains the ring first
+#define SHM_RELEASE_BATCH (SHM_RING_SLOTS/4)
+
+static inline void shm_cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __asm__ __volatile__("pause");
+#elif defined(__aarch64__) || defined(__arm__)
+  __asm__ __volatile__("yield");
+#endif
+}
+
+// Shared futexes, the segment is mapped by two processes
+static void shm_futex_wait(uint32_t *addr, uint32_t value, int timeout_ms) {
+  struct timespec ts;
+
+  ts.tv_sec = timeout_ms/1000;
+  ts.tv_nsec = (timeout_ms%1000)*1000000L;
+  syscall(SYS_futex, addr, FUTEX_WAIT, value, timeout_ms >= 0 ? &ts : NULL, NULL, 0);
+}
+
+static void shm_futex_wake(uint32_t *addr) {
+  syscall(SYS_futex, addr, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+/*
+ * name is a POSIX shared memory name ("/i32ctt_radio"). The SHM_OWNER side
+ * creates the segment and removes it when destroyed, the SHM_PEER side
+ * opens an existing one. spin is the number of empty polls in wait()
+ * before sleeping, 0 sleeps at once (best with a single CPU).
+ */
+I32CTT_LinuxShmInterface::I32CTT_LinuxShmInterface(const char *name, I32CTT_SHM_SIDE side, uint32_t spin) {
+  this->name = strdup(name);
+  this->side = side;
+  this->spin = spin;
+  this->segment = NULL;
+  this->rx_ring = NULL;
+  this->tx_ring = NULL;
+  this->rx_head = 0;
+  this->rx_tail = 0;
+  this->rx_held = 0;
+  this->tx_head = 0;
+  this->tx_tail = 0;
+  this->scratch = new uint8_t[SHM_MTU_SIZE];
+  this->d_available = 0;
+  memset(&this->stats, 0, sizeof(I32CTT_ShmStats));
+
+  this->rx_buffer = NULL;
+  this->rx_size = 0;
+  this->tx_buffer = this->scratch;
+  this->tx_size = 0;
+}
+
+I32CTT_LinuxShmInterface::~I32CTT_LinuxShmInterface() {
+  if(this->segment != NULL) {
+    munmap(this->segment, sizeof(I32CTT_ShmSegment));
+    if(this->side == SHM_OWNER)
+      shm_unlink(this->name);
+  }
+  free(this->name);
+  delete[] this->scratch;
+}
+
+/*
+ * Maps the segment. The owner publishes magic last, a peer that finds it
+ * missing or with another MTU or ring size stays closed (is_open() 0).
+ */
+void I32CTT_LinuxShmInterface::init() {
+  I32CTT_ShmSegment *segment;
+  struct stat st;
+  int fd;
+
+  if(this->segment != NULL)
+    return;
+
+  if(this->side == SHM_OWNER) {
+    // A fresh segment, a peer still mapping an old one keeps it untouched
+    shm_unlink(this->name);
+    fd = shm_open(this->name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if(fd < 0)
+      return;
+    if(ftruncate(fd, sizeof(I32CTT_ShmSegment)) != 0) {
+      close(fd);
+      shm_unlink(this->name);
+      return;
+    }
+  } else {
+    fd = shm_open(this->name, O_RDWR | O_CLOEXEC, 0);
+    if(fd < 0)
+      return;
+    if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(I32CTT_ShmSegment)) {
+      close(fd);
+      return;
+    }
+  }
+
+  segment = (I32CTT_ShmSegment*)mmap(NULL, sizeof(I32CTT_ShmSegment), PROT_READ | PROT_WRITE,
+    MAP_SHARED, fd, 0);
+  close(fd);
+  if(segment == MAP_FAILED)
+    return;
+
+  if(this->side == SHM_OWNER) {
+    segment->mtu = SHM_MTU_SIZE; // ftruncate() zeroed the rest
+    segment->slots = SHM_RING_SLOTS;
+    __atomic_store_n(&segment->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+  } else if(__atomic_load_n(&segment->magic, __ATOMIC_ACQUIRE) != SHM_MAGIC ||
+    segment->mtu != SHM_MTU_SIZE || segment->slots != SHM_RING_SLOTS) {
+    munmap(segment, sizeof(I32CTT_ShmSegment));
+    return;
+  }
+
+  this->segment = segment;
+  this->tx_ring = &segment->ring[this->side == SHM_OWNER ? 0 : 1];
+  this->rx_ring = &segment->ring[this->side == SHM_OWNER ? 1 : 0];
+  this->rx_tail = __atomic_load_n(&this->rx_ring->tail, __ATOMIC_ACQUIRE);
+  this->rx_head = this->rx_tail;
+  this->tx_head = __atomic_load_n(&this->tx_ring->head, __ATOMIC_RELAXED);
+  this->tx_tail = __atomic_load_n(&this->tx_ring->tail, __ATOMIC_ACQUIRE);
+  next_tx_slot();
+}
+
+/*
+ * Releases the slot presented last and presents the next one. The
+ * producer's head is read again only when the frames seen so far are
+ * used up. The length in a slot is the peer's word: slots with a length
+ * of 0 or over SHM_MTU_SIZE are released unread.
+ */
+void I32CTT_LinuxShmInterface::update() {
+  uint8_t *frame;
+  uint32_t size;
+
+  if(this->segment == NULL || this->d_available)
+    return;
+
+  for(;;) {
+    if(this->rx_held) {
+      this->rx_tail++;
+      this->rx_held = 0;
+      if(this->rx_tail == this->rx_head || this->rx_tail%SHM_RELEASE_BATCH == 0)
+        __atomic_store_n(&this->rx_ring->tail, this->rx_tail, __ATOMIC_RELEASE);
+    }
+
+    if(this->rx_head == this->rx_tail)
+      this->rx_head = __atomic_load_n(&this->rx_ring->head, __ATOMIC_ACQUIRE);
+    if(this->rx_head == this->rx_tail)
+      return;
+
+    frame = slot(this->rx_ring, this->rx_tail);
+    size = *(volatile uint32_t*)frame; // Read once, the peer can still write it
+    this->rx_held = 1;
+    if(size > 0 && size <= SHM_MTU_SIZE)
+      break;
+    this->stats.rx_invalid++;
+  }
+
+  this->rx_buffer = frame+SHM_SLOT_HEADER;
+  this->rx_size = size;
+  this->stats.rx_frames++;
+  this->d_available = 1;
+}
+
+uint8_t I32CTT_LinuxShmInterface::available() {
+  if(this->tx_buffer == this->scratch && this->tx_size == 0)
+    next_tx_slot();
+  return this->tx_buffer != this->scratch;
+}
+
+uint8_t I32CTT_LinuxShmInterface::data_available() {
+  uint8_t result = this->d_available;
+  this->d_available = 0;
+  return result;
+}
+
+/*
+ * Publishes the slot behind tx_buffer. A message written while the ring
+ * was full is copied in if a slot was freed meanwhile, otherwise dropped.
+ */
+void I32CTT_LinuxShmInterface::send() {
+  uint8_t *frame;
+
+  if(this->tx_size == 0)
+    return;
+  if(this->tx_buffer == this->scratch && this->segment != NULL && this->tx_size <= SHM_MTU_SIZE) {
+    next_tx_slot();
+    if(this->tx_buffer != this->scratch)
+      memcpy(this->tx_buffer, this->scratch, this->tx_size);
+  }
+  if(this->tx_buffer == this->scratch || this->tx_size > SHM_MTU_SIZE) {
+    this->stats.tx_dropped++;
+    this->tx_size = 0;
+    return;
+  }
+
+  frame = this->tx_buffer-SHM_SLOT_HEADER;
+  *(uint32_t*)frame = this->tx_size;
+  this->tx_head++;
+  __atomic_store_n(&this->tx_ring->head, this->tx_head, __ATOMIC_RELEASE);
+  this->tx_size = 0;
+  this->stats.tx_frames++;
+
+  // Pairs with the fence in wait(), one of both sides sees the other's
+  // store. Clearing sleeping makes it one wake per sleep, not per frame.
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if(__atomic_load_n(&this->tx_ring->sleeping, __ATOMIC_RELAXED) &&
+    __atomic_exchange_n(&this->tx_ring->sleeping, 0, __ATOMIC_SEQ_CST)) {
+    shm_futex_wake(&this->tx_ring->head);
+    this->stats.wakeups++;
+  }
+  next_tx_slot();
+}
+
+uint16_t I32CTT_LinuxShmInterface::get_MTU() {
+  return SHM_MTU_SIZE;
+}
+
+/*
+ * Waits up to timeout_ms (negative waits forever) for a frame after the
+ * one presented last. Polls first, then publishes the tail so the
+ * producer sees all the free slots and sleeps on the futex at head.
+ * Returns 1 if a frame arrived.
+ */
+uint8_t I32CTT_LinuxShmInterface::wait(int timeout_ms) {
+  uint32_t next;
+  uint32_t i;
+
+  if(this->segment == NULL)
+    return 0;
+  if(this->d_available)
+    return 1;
+
+  next = this->rx_tail+this->rx_held;
+  if(this->rx_head != next)
+    return 1;
+  for(i = 0; i < this->spin; i++) {
+    if(__atomic_load_n(&this->rx_ring->head, __ATOMIC_ACQUIRE) != next)
+      return 1;
+    shm_cpu_relax();
+  }
+
+  __atomic_store_n(&this->rx_ring->tail, this->rx_tail, __ATOMIC_RELEASE);
+  __atomic_store_n(&this->rx_ring->sleeping, 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if(__atomic_load_n(&this->rx_ring->head, __ATOMIC_RELAXED) == next) {
+    this->stats.sleeps++;
+    shm_futex_wait(&this->rx_ring->head, next, timeout_ms);
+  }
+  __atomic_store_n(&this->rx_ring->sleeping, 0, __ATOMIC_RELAXED);
+  return __atomic_load_n(&this->rx_ring->head, __ATOMIC_ACQUIRE) != next;
+}
+
+uint8_t I32CTT_LinuxShmInterface::is_open() {
+  return this->segment != NULL;
+}
+
+I32CTT_ShmStats *I32CTT_LinuxShmInterface::get_stats() {
+  return &this->stats;
+}
+
+uint8_t *I32CTT_LinuxShmInterface::slot(I32CTT_ShmRing *ring, uint32_t index) {
+  return ring->slots+(index%SHM_RING_SLOTS)*SHM_SLOT_STRIDE;
+}
+
+/*
+ * Points tx_buffer at the next free slot, or at scratch if the ring is
+ * full. The consumer's tail is read again only when the ring looks full.
+ */
+void I32CTT_LinuxShmInterface::next_tx_slot() {
+  if(this->segment == NULL)
+    return;
+  if(this->tx_head-this->tx_tail >= SHM_RING_SLOTS)
+    this->tx_tail = __atomic_load_n(&this->tx_ring->tail, __ATOMIC_ACQUIRE);
+  if(this->tx_head-this->tx_tail < SHM_RING_SLOTS)
+    this->tx_buffer = slot(this->tx_ring, this->tx_head)+SHM_SLOT_HEADER;
+  else
+    this->tx_buffer = this->scratch;
+}
@@ -0,0 +1,123 @@
+/*
+ *
+ * This file is part of I32CTT (Integer 32-bit Control & Telemetry Transport).
+ * Copyright (C) 2017 Mario Gomez / Hackerspace San Salvador.
+ *
+ * I32CTT is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * I32CTT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with I32CTT.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef I32CTT_LinuxShmInterface_H
+#define I32CTT_LinuxShmInterface_H
+
+#include <stdint.h>
+
+#ifndef SHM_MTU_SIZE
+#if I32CTT_SIZE_BITS == 8
+#define SHM_MTU_SIZE 255
+#else
+#define SHM_MTU_SIZE 1024
+#endif
+#endif
+#ifndef SHM_RING_SLOTS
+#define SHM_RING_SLOTS 1024 // Frames per direction, a power of two
+#endif
+#define SHM_CACHE_LINE 64
+#define SHM_SLOT_HEADER 4   // Frame length, 32-bit
+#define SHM_SLOT_STRIDE ((SHM_SLOT_HEADER+SHM_MTU_SIZE+SHM_CACHE_LINE-1)/SHM_CACHE_LINE*SHM_CACHE_LINE)
+#ifndef SHM_SPIN_POLLS
+#define SHM_SPIN_POLLS 2000 // Empty polls in wait() before sleeping on the futex
+#endif
+#define SHM_MAGIC 0x49333253 // "I32S"
+
+enum I32CTT_SHM_SIDE {
+  SHM_OWNER = 0, // Creates the segment, sends on ring 0
+  SHM_PEER       // Opens it, sends on ring 1
+};
+
+/*
+ * One direction. head and tail are free running counters, each written by
+ * one side only and kept on its own cache line. sleeping is set by the
+ * consumer before it waits on the futex at head.
+ */
+struct I32CTT_ShmRing {
+  uint32_t head;      // Frames published by the producer
+  uint8_t pad0[SHM_CACHE_LINE-4];
+  uint32_t tail;      // Frames released by the consumer
+  uint8_t pad1[SHM_CACHE_LINE-4];
+  uint32_t sleeping;
+  uint8_t pad2[SHM_CACHE_LINE-4];
+  uint8_t slots[SHM_RING_SLOTS*SHM_SLOT_STRIDE];
+};
+
+struct I32CTT_ShmSegment {
+  uint32_t magic;
+  uint32_t mtu;
+  uint32_t slots;
+  uint8_t pad[SHM_CACHE_LINE-12];
+  I32CTT_ShmRing ring[2];
+};
+
+struct I32CTT_ShmStats {
+  uint32_t rx_frames;
+  uint32_t rx_invalid; // Slots with a length of 0 or over SHM_MTU_SIZE, dropped
+  uint32_t tx_frames;
+  uint32_t tx_dropped; // Ring full or message too long
+  uint32_t sleeps;     // wait() calls that slept on the futex
+  uint32_t wakeups;    // futex wakes sent to a sleeping peer
+};
+
+/*
+ * I32CTT messages between two processes on the same host through a POSIX
+ * shared memory segment with one single producer, single consumer ring of
+ * fixed size slots per direction. Messages are never copied: rx_buffer
+ * points into the receive slot until the next update() releases it, and
+ * tx_buffer is the next free transmit slot, send() only publishes it.
+ *
+ * Nothing blocks and no system call is made while frames flow. A process
+ * with nothing to do calls wait(), which polls for SHM_SPIN_POLLS rounds
+ * and then sleeps on a futex; the producer only calls futex wake when the
+ * consumer said it was going to sleep.
+ */
+class I32CTT_LinuxShmInterface: public I32CTT_Interface {
+  public:
+    I32CTT_LinuxShmInterface(const char *name, I32CTT_SHM_SIDE side, uint32_t spin = SHM_SPIN_POLLS);
+    ~I32CTT_LinuxShmInterface();
+    void init();
+    void update();
+    uint8_t available();
+    uint8_t data_available();
+    void send();
+    uint16_t get_MTU();
+    uint8_t wait(int timeout_ms);
+    uint8_t is_open();
+    I32CTT_ShmStats *get_stats();
+  private:
+    uint8_t *slot(I32CTT_ShmRing *ring, uint32_t index);
+    void next_tx_slot();
+    char *name;
+    uint8_t side;
+    uint32_t spin;
+    I32CTT_ShmSegment *segment;
+    I32CTT_ShmRing *rx_ring;
+    I32CTT_ShmRing *tx_ring;
+    uint32_t rx_head;      // Producer's head as last seen, saves reading its line
+    uint32_t rx_tail;
+    uint8_t rx_held;       // A slot is presented and not released yet
+    uint32_t tx_head;
+    uint32_t tx_tail;      // Consumer's tail as last seen
+    uint8_t *scratch;      // tx_buffer while the ring is full
+    uint8_t d_available;
+    I32CTT_ShmStats stats;
+};
+
+#endif
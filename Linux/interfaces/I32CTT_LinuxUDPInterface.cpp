@@ -0,0 +1,380 @@
+/*
+ *
+ * This file is part of I32CTT (Integer 32-bit Control & Telemetry Transport).
+ * Copyright (C) 2017 Mario Gomez / Hackerspace San Salvador.
+ *
+ * I32CTT is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * I32CTT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with I32CTT.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include "I32CTT.h"
+#include "I32CTT_LinuxUDPInterface.h"
+
+/*
+ * Binds to the given port once init() is called, on every local address
+ * if host is NULL. Port 0 picks a free port, see get_port(). batch is
+ * clamped to 1..UDP_BATCH_SIZE.
+ */
+I32CTT_LinuxUDPInterface::I32CTT_LinuxUDPInterface(uint16_t port, const char *host, uint8_t batch) {
+  uint8_t i;
+
+  if(batch == 0)
+    batch = 1;
+  if(batch > UDP_BATCH_SIZE)
+    batch = UDP_BATCH_SIZE;
+
+  this->fd = -1;
+  this->port = port;
+  this->host = host != NULL ? strdup(host) : NULL;
+  this->batch = batch;
+
+  this->rx_frames = new uint8_t[batch*(UDP_MTU_SIZE+1)];
+  this->tx_frames = new uint8_t[batch*UDP_MTU_SIZE];
+  this->rx_msgs = new struct mmsghdr[batch];
+  this->tx_msgs = new struct mmsghdr[batch];
+  this->rx_iov = new struct iovec[batch];
+  this->tx_iov = new struct iovec[batch];
+  this->rx_addrs = new struct sockaddr_storage[batch];
+  this->tx_addrs = new struct sockaddr_storage[batch];
+  memset(this->rx_msgs, 0, sizeof(struct mmsghdr)*batch);
+  memset(this->tx_msgs, 0, sizeof(struct mmsghdr)*batch);
+
+  for(i = 0; i < batch; i++) {
+    this->rx_iov[i].iov_base = this->rx_frames+i*(UDP_MTU_SIZE+1);
+    this->rx_iov[i].iov_len = UDP_MTU_SIZE+1;
+    this->rx_msgs[i].msg_hdr.msg_iov = &this->rx_iov[i];
+    this->rx_msgs[i].msg_hdr.msg_iovlen = 1;
+    this->rx_msgs[i].msg_hdr.msg_name = &this->rx_addrs[i];
+    this->tx_iov[i].iov_base = this->tx_frames+i*UDP_MTU_SIZE;
+    this->tx_msgs[i].msg_hdr.msg_iov = &this->tx_iov[i];
+    this->tx_msgs[i].msg_hdr.msg_iovlen = 1;
+    this->tx_msgs[i].msg_hdr.msg_name = &this->tx_addrs[i];
+  }
+
+  this->rx_buffer = this->rx_frames;
+  this->rx_size = 0;
+  this->tx_buffer = this->tx_frames;
+  this->tx_size = 0;
+  this->rx_count = 0;
+  this->rx_next = 0;
+  this->tx_count = 0;
+  this->last_len = 0;
+  this->dst_len = 0;
+  this->node_len = 0;
+  this->node_port = 0;
+  this->d_available = 0;
+  memset(&this->stats, 0, sizeof(I32CTT_UDPStats));
+}
+
+I32CTT_LinuxUDPInterface::~I32CTT_LinuxUDPInterface() {
+  if(this->fd >= 0) {
+    flush();
+    close(this->fd);
+  }
+  free(this->host);
+  delete[] this->rx_frames;
+  delete[] this->tx_frames;
+  delete[] this->rx_msgs;
+  delete[] this->tx_msgs;
+  delete[] this->rx_iov;
+  delete[] this->tx_iov;
+  delete[] this->rx_addrs;
+  delete[] this->tx_addrs;
+}
+
+/*
+ * Opens and binds the socket. On failure get_fd() stays negative and
+ * available() returns 0.
+ */
+void I32CTT_LinuxUDPInterface::init() {
+  struct addrinfo hints;
+  struct addrinfo *res;
+  struct addrinfo *ai;
+  char service[8];
+  int one = 1;
+
+  if(this->fd >= 0)
+    return;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_DGRAM;
+  hints.ai_flags = AI_PASSIVE;
+  snprintf(service, sizeof(service), "%u", this->port);
+  if(getaddrinfo(this->host, service, &hints, &res) != 0)
+    return;
+
+  for(ai = res; ai != NULL; ai = ai->ai_next) {
+    this->fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+    if(this->fd < 0)
+      continue;
+    setsockopt(this->fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if(bind(this->fd, ai->ai_addr, ai->ai_addrlen) == 0)
+      break;
+    close(this->fd);
+    this->fd = -1;
+  }
+  freeaddrinfo(res);
+}
+
+void I32CTT_LinuxUDPInterface::update() {
+  struct msghdr *hdr;
+
+  if(this->fd < 0 || this->d_available)
+    return;
+
+  if(this->rx_next >= this->rx_count) {
+    flush(); // Answers to the previous batch leave together
+    receive();
+  }
+
+  while(this->rx_next < this->rx_count) {
+    hdr = &this->rx_msgs[this->rx_next].msg_hdr;
+    if(
+      this->rx_msgs[this->rx_next].msg_len == 0 ||
+      this->rx_msgs[this->rx_next].msg_len > UDP_MTU_SIZE ||
+      (hdr->msg_flags & MSG_TRUNC)
+    ) {
+      this->stats.rx_dropped++;
+      this->rx_next++;
+      continue;
+    }
+
+    this->rx_buffer = (uint8_t*)this->rx_iov[this->rx_next].iov_base;
+    this->rx_size = this->rx_msgs[this->rx_next].msg_len;
+    memcpy(&this->last_addr, hdr->msg_name, hdr->msg_namelen);
+    this->last_len = hdr->msg_namelen;
+    this->rx_next++;
+    this->stats.rx_frames++;
+    this->d_available = 1;
+    break;
+  }
+}
+
+/*
+ * Fills the receive slots with one recvmmsg(), the kernel writes the
+ * peer address and length of each datagram.
+ */
+void I32CTT_LinuxUDPInterface::receive() {
+  int count;
+  uint8_t i;
+
+  for(i = 0; i < this->batch; i++) {
+    this->rx_msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+    this->rx_msgs[i].msg_hdr.msg_flags = 0;
+  }
+
+  do {
+    count = recvmmsg(this->fd, this->rx_msgs, this->batch, MSG_DONTWAIT, NULL);
+  } while(count < 0 && errno == EINTR);
+
+  this->rx_next = 0;
+  this->rx_count = count > 0 ? count : 0;
+  if(count > 0)
+    this->stats.rx_batches++;
+}
+
+uint8_t I32CTT_LinuxUDPInterface::available() {
+  return this->fd >= 0; // A full queue is flushed on the spot
+}
+
+uint8_t I32CTT_LinuxUDPInterface::data_available() {
+  uint8_t result = this->d_available;
+  this->d_available = 0;
+  return result;
+}
+
+void I32CTT_LinuxUDPInterface::send() {
+  queue(&this->last_addr, this->last_len);
+}
+
+void I32CTT_LinuxUDPInterface::send_to_dst() {
+  queue(&this->dst_addr, this->dst_len);
+}
+
+/*
+ * The message was written in place in tx_buffer, the next free slot.
+ * Only its length and destination are recorded and tx_buffer moves on.
+ */
+void I32CTT_LinuxUDPInterface::queue(const struct sockaddr_storage *addr, socklen_t len) {
+  if(this->tx_size == 0)
+    return;
+  if(this->fd < 0 || len == 0 || this->tx_size > UDP_MTU_SIZE) {
+    this->stats.tx_dropped++;
+    this->tx_size = 0;
+    return;
+  }
+
+  this->tx_iov[this->tx_count].iov_len = this->tx_size;
+  memcpy(&this->tx_addrs[this->tx_count], addr, len);
+  this->tx_msgs[this->tx_count].msg_hdr.msg_namelen = len;
+  this->tx_count++;
+  this->tx_size = 0;
+
+  if(this->tx_count >= this->batch)
+    flush();
+  this->tx_buffer = this->tx_frames+this->tx_count*UDP_MTU_SIZE;
+}
+
+/*
+ * Sends the queued messages with as few sendmmsg() calls as possible. A
+ * datagram the socket refuses (full buffer, ICMP error pending) is
+ * dropped and the rest still go out.
+ */
+void I32CTT_LinuxUDPInterface::flush() {
+  uint8_t sent = 0;
+  int count;
+
+  while(sent < this->tx_count) {
+    count = sendmmsg(this->fd, this->tx_msgs+sent, this->tx_count-sent, MSG_DONTWAIT);
+    if(count < 0 && errno == EINTR)
+      continue;
+    if(count <= 0) {
+      this->stats.tx_dropped++;
+      sent++;
+      continue;
+    }
+    this->stats.tx_batches++;
+    this->stats.tx_frames += count;
+    sent += count;
+  }
+
+  this->tx_count = 0;
+  this->tx_buffer = this->tx_frames;
+}
+
+uint16_t I32CTT_LinuxUDPInterface::get_MTU() {
+  return UDP_MTU_SIZE;
+}
+
+/*
+ * Destination of send_to_dst(), returns 0 if the host does not resolve.
+ */
+uint8_t I32CTT_LinuxUDPInterface::set_dst_addr(const char *host, uint16_t port) {
+  struct addrinfo hints;
+  struct addrinfo *res;
+  char service[8];
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_DGRAM;
+  snprintf(service, sizeof(service), "%u", port);
+  if(getaddrinfo(host, service, &hints, &res) != 0)
+    return 0;
+
+  set_dst_addr(res->ai_addr, res->ai_addrlen);
+  freeaddrinfo(res);
+  return 1;
+}
+
+void I32CTT_LinuxUDPInterface::set_dst_addr(const struct sockaddr *addr, socklen_t len) {
+  if(len > sizeof(struct sockaddr_storage))
+    len = sizeof(struct sockaddr_storage);
+  memcpy(&this->dst_addr, addr, len);
+  this->dst_len = len;
+}
+
+/*
+ * Gives nodes addresses: node N is port+N on host. Returns 0 if the host
+ * does not resolve.
+ */
+uint8_t I32CTT_LinuxUDPInterface::set_node_base(const char *host, uint16_t port) {
+  struct addrinfo hints;
+  struct addrinfo *res;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_DGRAM;
+  if(getaddrinfo(host, NULL, &hints, &res) != 0)
+    return 0;
+
+  this->node_len = res->ai_addrlen < sizeof(struct sockaddr_storage) ? res->ai_addrlen :
+    sizeof(struct sockaddr_storage);
+  memcpy(&this->node_addr, res->ai_addr, this->node_len);
+  this->node_port = port;
+  freeaddrinfo(res);
+  return 1;
+}
+
+/*
+ * Destination of send_to_dst() by node address, needs set_node_base().
+ */
+void I32CTT_LinuxUDPInterface::set_dst(uint16_t addr) {
+  uint16_t port = this->node_port+addr;
+
+  if(this->node_len == 0)
+    return;
+  memcpy(&this->dst_addr, &this->node_addr, this->node_len);
+  this->dst_len = this->node_len;
+  if(this->dst_addr.ss_family == AF_INET6)
+    ((struct sockaddr_in6*)&this->dst_addr)->sin6_port = htons(port);
+  else
+    ((struct sockaddr_in*)&this->dst_addr)->sin_port = htons(port);
+}
+
+/*
+ * Node that sent the message in rx_buffer, 0 without set_node_base() or
+ * from a port below the base.
+ */
+uint16_t I32CTT_LinuxUDPInterface::get_src() {
+  uint16_t port;
+
+  if(this->node_len == 0 || this->last_len == 0 || this->last_addr.ss_family != this->node_addr.ss_family)
+    return 0;
+  if(this->last_addr.ss_family == AF_INET6)
+    port = ntohs(((struct sockaddr_in6*)&this->last_addr)->sin6_port);
+  else
+    port = ntohs(((struct sockaddr_in*)&this->last_addr)->sin_port);
+  return port >= this->node_port ? port-this->node_port : 0;
+}
+
+/*
+ * Peer of the last message presented to the controller.
+ */
+const struct sockaddr *I32CTT_LinuxUDPInterface::get_last_addr() {
+  return (const struct sockaddr*)&this->last_addr;
+}
+
+socklen_t I32CTT_LinuxUDPInterface::get_last_addr_len() {
+  return this->last_len;
+}
+
+/*
+ * Port actually bound, 0 if the socket is not open.
+ */
+uint16_t I32CTT_LinuxUDPInterface::get_port() {
+  struct sockaddr_storage addr;
+  socklen_t len = sizeof(addr);
+
+  if(this->fd < 0 || getsockname(this->fd, (struct sockaddr*)&addr, &len) != 0)
+    return 0;
+  if(addr.ss_family == AF_INET6)
+    return ntohs(((struct sockaddr_in6*)&addr)->sin6_port);
+  return ntohs(((struct sockaddr_in*)&addr)->sin_port);
+}
+
+int I32CTT_LinuxUDPInterface::get_fd() {
+  return this->fd;
+}
+
+I32CTT_UDPStats *I32CTT_LinuxUDPInterface::get_stats() {
+  return &this->stats;
+}
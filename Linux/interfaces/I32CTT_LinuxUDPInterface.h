@@ -0,0 +1,112 @@
+/*
+ *
+ * This file is part of I32CTT (Integer 32-bit Control & Telemetry Transport).
+ * Copyright (C) 2017 Mario Gomez / Hackerspace San Salvador.
+ *
+ * I32CTT is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * I32CTT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with I32CTT.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef I32CTT_LinuxUDPInterface_H
+#define I32CTT_LinuxUDPInterface_H
+
+#include <stdint.h>
+#include <sys/socket.h>
+
+#ifndef UDP_MTU_SIZE
+#if I32CTT_SIZE_BITS == 8
+#define UDP_MTU_SIZE 255
+#else
+#define UDP_MTU_SIZE 1024
+#endif
+#endif
+#ifndef UDP_BATCH_SIZE
+#define UDP_BATCH_SIZE 32 // Datagrams per recvmmsg()/sendmmsg() at most
+#endif
+
+struct I32CTT_UDPStats {
+  uint32_t rx_frames;
+  uint32_t rx_batches; // recvmmsg() calls that returned datagrams
+  uint32_t rx_dropped; // Empty or bigger than the MTU
+  uint32_t tx_frames;
+  uint32_t tx_batches; // sendmmsg() calls that sent datagrams
+  uint32_t tx_dropped; // Refused by the socket or without destination
+};
+
+/*
+ * Raw I32CTT messages over UDP, one message per datagram. send() answers
+ * the peer of the message being parsed (the last_addr of the radio
+ * interface) and send_to_dst() goes to the address set with
+ * set_dst_addr().
+ *
+ * The controller parses one message per run(), so update() receives up
+ * to a batch of datagrams with a single recvmmsg() and presents them one
+ * per call. Messages sent meanwhile are queued and leave together with a
+ * single sendmmsg() before the next batch is received, or as soon as the
+ * queue is full. The socket never blocks.
+ *
+ * After set_node_base() the interface has node addresses like the radio:
+ * node N is the base port plus N on the base host, set_dst() selects it
+ * for send_to_dst() and get_src() tells it from the sender's port.
+ */
+class I32CTT_LinuxUDPInterface: public I32CTT_Interface {
+  public:
+    I32CTT_LinuxUDPInterface(uint16_t port, const char *host = NULL, uint8_t batch = UDP_BATCH_SIZE);
+    ~I32CTT_LinuxUDPInterface();
+    void init();
+    void update();
+    uint8_t available();
+    uint8_t data_available();
+    void send();
+    void send_to_dst();
+    uint16_t get_MTU();
+    uint8_t set_dst_addr(const char *host, uint16_t port);
+    void set_dst_addr(const struct sockaddr *addr, socklen_t len);
+    uint8_t set_node_base(const char *host, uint16_t port);
+    void set_dst(uint16_t addr);
+    uint16_t get_src();
+    const struct sockaddr *get_last_addr();
+    socklen_t get_last_addr_len();
+    uint16_t get_port();
+    int get_fd();
+    void flush();
+    I32CTT_UDPStats *get_stats();
+  private:
+    void receive();
+    void queue(const struct sockaddr_storage *addr, socklen_t len);
+    int fd;
+    uint16_t port;
+    char *host;
+    uint8_t batch;
+    uint8_t *rx_frames; // batch slots of UDP_MTU_SIZE+1, the extra byte detects oversize
+    uint8_t *tx_frames; // batch slots of UDP_MTU_SIZE, tx_buffer is the next free one
+    struct mmsghdr *rx_msgs;
+    struct mmsghdr *tx_msgs;
+    struct iovec *rx_iov;
+    struct iovec *tx_iov;
+    struct sockaddr_storage *rx_addrs;
+    struct sockaddr_storage *tx_addrs;
+    uint8_t rx_count;
+    uint8_t rx_next;
+    uint8_t tx_count;
+    struct sockaddr_storage last_addr;
+    socklen_t last_len;
+    struct sockaddr_storage dst_addr;
+    socklen_t dst_len;
+    struct sockaddr_storage node_addr; // Node 0, see set_node_base()
+    socklen_t node_len;
+    uint16_t node_port;
+    uint8_t d_available;
+    I32CTT_UDPStats stats;
+};
+
+#endif
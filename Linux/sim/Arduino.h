@@ -0,0 +1,119 @@
+/*
+ *
+ * This file is part of I32CTT (Integer 32-bit Control & Telemetry Transport).
+ * Copyright (C) 2017 Mario Gomez / Hackerspace San Salvador.
+ *
+ * I32CTT is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * I32CTT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with I32CTT.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Minimal Arduino core for running the Arduino sources on a Linux host
+ * against the simulated radio. Time is the virtual time of the
+ * I32CTT_SimMedium and SPI/pin accesses go to the selected I32CTT_SimRadio.
+ */
+#ifndef I32CTT_SIM_ARDUINO_H
+#define I32CTT_SIM_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef unsigned int uint;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define DEC 10
+#define HEX 16
+#define A8 22
+#define SIM_SERIAL_BAUD 115200 // Until Serial.begin()
+
+class Print {
+  public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c)=0;
+    virtual size_t write(const uint8_t *buffer, size_t size);
+    virtual int availableForWrite();
+    size_t write(const char *str);
+    size_t print(const char *str);
+    size_t print(char c);
+    size_t print(unsigned char value, int base=DEC);
+    size_t print(int value, int base=DEC);
+    size_t print(unsigned int value, int base=DEC);
+    size_t print(long value, int base=DEC);
+    size_t print(unsigned long value, int base=DEC);
+    size_t print(unsigned long long value, int base=DEC);
+    size_t print(double value, int digits=2);
+    size_t println();
+    size_t println(const char *str);
+    size_t println(char c);
+    size_t println(unsigned char value, int base=DEC);
+    size_t println(int value, int base=DEC);
+    size_t println(unsigned int value, int base=DEC);
+    size_t println(long value, int base=DEC);
+    size_t println(unsigned long value, int base=DEC);
+    size_t println(unsigned long long value, int base=DEC);
+    size_t println(double value, int digits=2);
+    virtual void flush() {}
+  private:
+    size_t print_number(unsigned long long value, int base);
+};
+
+class Stream: public Print {
+  public:
+    virtual int available()=0;
+    virtual int read()=0;
+    virtual int peek()=0;
+    size_t readBytes(char *buffer, size_t length);
+    size_t readBytes(uint8_t *buffer, size_t length);
+};
+
+/*
+ * Serial output is discarded unless echo is enabled. Every byte still
+ * takes a start, 8 data and a stop bit at the baud rate of begin(),
+ * SIM_SERIAL_BAUD until then, of virtual time, as the UART would.
+ */
+class I32CTT_SimSerial: public Stream {
+  public:
+    I32CTT_SimSerial();
+    void begin(unsigned long baud);
+    void set_echo(uint8_t value);
+    size_t write(uint8_t c);
+    int available();
+    int read();
+    int peek();
+    using Print::write;
+  private:
+    uint8_t echo;
+    unsigned long baud;
+    uint64_t pending;     // Bit times not yet whole microseconds, in us*baud
+};
+
+extern I32CTT_SimSerial Serial;
+
+// 32-bit like unsigned long on the Arduino targets, keeps wraparound math intact
+uint32_t millis();
+uint32_t micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+int analogRead(uint8_t pin);
+long map(long value, long in_min, long in_max, long out_min, long out_max);
+
+#endif
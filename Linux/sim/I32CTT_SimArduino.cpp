@@ -0,0 +1,285 @@
+/*
+ *
+ * This file is part of I32CTT (Integer 32-bit Control & Telemetry Transport).
+ * Copyright (C) 2017 Mario Gomez / Hackerspace San Salvador.
+ *
+ * I32CTT is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * I32CTT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with I32CTT.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <time.h>
+#include "Arduino.h"
+#include "SPI.h"
+#include "I32CTT_SimRadio.h"
+#include "I32CTT_SimMedium.h"
+
+I32CTT_SimSerial Serial;
+SPIClass SPI;
+
+size_t Print::write(const uint8_t *buffer, size_t size) {
+  size_t count = 0;
+
+  while(size--)
+    count += write(*buffer++);
+  return count;
+}
+
+int Print::availableForWrite() {
+  return 0;
+}
+
+size_t Print::write(const char *str) {
+  if(str == 0)
+    return 0;
+  return write((const uint8_t*)str, strlen(str));
+}
+
+size_t Print::print_number(unsigned long long value, int base) {
+  char buf[8*sizeof(unsigned long long)+1];
+  char *str = &buf[sizeof(buf)-1];
+
+  if(base < 2)
+    base = 10;
+  *str = '\0';
+  do {
+    char digit = value%base;
+    value /= base;
+    *--str = digit < 10 ? digit+'0' : digit+'A'-10;
+  } while(value);
+  return write(str);
+}
+
+size_t Print::print(const char *str) {
+  return write(str);
+}
+
+size_t Print::print(char c) {
+  return write((uint8_t)c);
+}
+
+size_t Print::print(unsigned char value, int base) {
+  return print_number(value, base);
+}
+
+size_t Print::print(int value, int base) {
+  return print((long)value, base);
+}
+
+size_t Print::print(unsigned int value, int base) {
+  return print_number(value, base);
+}
+
+size_t Print::print(long value, int base) {
+  if(base == DEC && value < 0)
+    return write((uint8_t)'-')+print_number(-(unsigned long long)value, base);
+  return print_number((unsigned long)value, base);
+}
+
+size_t Print::print(unsigned long value, int base) {
+  return print_number(value, base);
+}
+
+size_t Print::print(unsigned long long value, int base) {
+  return print_number(value, base);
+}
+
+size_t Print::print(double value, int digits) {
+  char buf[64];
+
+  snprintf(buf, sizeof(buf), "%.*f", digits, value);
+  return write(buf);
+}
+
+size_t Print::println() {
+  return write("\r\n");
+}
+
+size_t Print::println(const char *str) {
+  return print(str)+println();
+}
+
+size_t Print::println(char c) {
+  return print(c)+println();
+}
+
+size_t Print::println(unsigned char value, int base) {
+  return print(value, base)+println();
+}
+
+size_t Print::println(int value, int base) {
+  return print(value, base)+println();
+}
+
+size_t Print::println(unsigned int value, int base) {
+  return print(value, base)+println();
+}
+
+size_t Print::println(long value, int base) {
+  return print(value, base)+println();
+}
+
+size_t Print::println(unsigned long value, int base) {
+  return print(value, base)+println();
+}
+
+size_t Print::println(unsigned long long value, int base) {
+  return print(value, base)+println();
+}
+
+size_t Print::println(double value, int digits) {
+  return print(value, digits)+println();
+}
+
+size_t Stream::readBytes(char *buffer, size_t length) {
+  return readBytes((uint8_t*)buffer, length);
+}
+
+size_t Stream::readBytes(uint8_t *buffer, size_t length) {
+  size_t count = 0;
+  int c;
+
+  while(count < length) {
+    c = read();
+    if(c < 0)
+      break;
+    buffer[count++] = c;
+  }
+  return count;
+}
+
+I32CTT_SimSerial::I32CTT_SimSerial() {
+  this->echo = 0;
+  this->baud = SIM_SERIAL_BAUD;
+  this->pending = 0;
+}
+
+void I32CTT_SimSerial::begin(unsigned long baud) {
+  if(baud > 0)
+    this->baud = baud;
+}
+
+void I32CTT_SimSerial::set_echo(uint8_t value) {
+  this->echo = value;
+}
+
+size_t I32CTT_SimSerial::write(uint8_t c) {
+  I32CTT_SimMedium *medium = I32CTT_SimMedium::instance();
+
+  if(this->echo)
+    fputc(c, stderr);
+  if(medium != 0) {
+    this->pending += 10*1000000ULL; // Start, 8 data and stop bits
+    medium->advance(this->pending/this->baud);
+    this->pending %= this->baud;
+  }
+  return 1;
+}
+
+int I32CTT_SimSerial::available() {
+  return 0;
+}
+
+int I32CTT_SimSerial::read() {
+  return -1;
+}
+
+int I32CTT_SimSerial::peek() {
+  return -1;
+}
+
+SPISettings::SPISettings() {
+  this->clock = 1000000;
+}
+
+SPISettings::SPISettings(uint32_t clock, uint8_t, uint8_t) {
+  this->clock = clock;
+}
+
+void SPIClass::begin() {
+}
+
+void SPIClass::end() {
+}
+
+void SPIClass::beginTransaction(SPISettings) {
+}
+
+void SPIClass::endTransaction() {
+}
+
+uint8_t SPIClass::transfer(uint8_t value) {
+  I32CTT_SimRadio *radio = I32CTT_SimRadio::selected();
+
+  if(radio == 0)
+    return 0;
+  return radio->spi_transfer(value);
+}
+
+// Without a medium (host interfaces only) time is the real clock
+static uint64_t monotonic_us() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec*1000000+ts.tv_nsec/1000;
+}
+
+uint32_t millis() {
+  I32CTT_SimMedium *medium = I32CTT_SimMedium::instance();
+
+  if(medium == 0)
+    return monotonic_us()/1000;
+  return medium->now()/1000;
+}
+
+uint32_t micros() {
+  I32CTT_SimMedium *medium = I32CTT_SimMedium::instance();
+
+  if(medium == 0)
+    return monotonic_us();
+  return medium->now();
+}
+
+void delay(unsigned long ms) {
+  I32CTT_SimMedium *medium = I32CTT_SimMedium::instance();
+
+  if(medium != 0)
+    medium->advance((uint64_t)ms*1000);
+}
+
+void delayMicroseconds(unsigned int us) {
+  I32CTT_SimMedium *medium = I32CTT_SimMedium::instance();
+
+  if(medium != 0)
+    medium->advance(us);
+}
+
+void pinMode(uint8_t, uint8_t) {
+}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+  I32CTT_SimRadio *radio = I32CTT_SimRadio::selected();
+
+  if(radio != 0)
+    radio->pin_write(pin, value);
+}
+
+int digitalRead(uint8_t) {
+  return LOW;
+}
+
+int analogRead(uint8_t) {
+  return 0;
+}
+
+long map(long value, long in_min, long in_max, long out_min, long out_max) {
+  return (value-in_min)*(out_max-out_min)/(in_max-in_min)+out_min;
+}
@@ -0,0 +1,257 @@
+/*
+ *
+ * This file is part of I32CTT (Integer 32-bit Control & Telemetry Transport).
+ * Copyright (C) 2017 Mario Gomez / Hackerspace San Salvador.
+ *
+ * I32CTT is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * I32CTT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with I32CTT.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdint.h>
+#include <string.h>
+#include "I32CTT_SimMedium.h"
+
+I32CTT_SimMedium *I32CTT_SimMedium::current = 0;
+
+I32CTT_SimMedium::I32CTT_SimMedium(uint32_t seed) : rng(seed) {
+  this->clock = 0;
+  this->advancing = 0;
+  this->next_tx_id = 0;
+  this->spi_byte_us = SIM_SPI_BYTE_US;
+  this->default_link.connected = 1;
+  this->default_link.loss = 0.0;
+  this->default_link.lqi = 0xFF;
+  this->default_link.rssi = -60;
+  this->default_link.latency_us = 0;
+  memset(&this->stats, 0, sizeof(I32CTT_SimMediumStats));
+  current = this;
+}
+
+I32CTT_SimMedium::~I32CTT_SimMedium() {
+  std::list<I32CTT_SimTx*>::iterator it;
+
+  for(it = this->active.begin(); it != this->active.end(); it++)
+    delete *it;
+  if(current == this)
+    current = 0;
+}
+
+I32CTT_SimMedium *I32CTT_SimMedium::instance() {
+  return current;
+}
+
+uint64_t I32CTT_SimMedium::now() {
+  return this->clock;
+}
+
+void I32CTT_SimMedium::advance(uint64_t us) {
+  run_until(this->clock+us);
+}
+
+void I32CTT_SimMedium::attach(I32CTT_SimRadio *radio) {
+  this->radios.push_back(radio);
+}
+
+void I32CTT_SimMedium::set_default_link(I32CTT_SimLink link) {
+  this->default_link = link;
+}
+
+void I32CTT_SimMedium::set_link(I32CTT_SimRadio *a, I32CTT_SimRadio *b, I32CTT_SimLink link) {
+  this->links[((uint64_t)a->id<<32) | b->id] = link;
+  this->links[((uint64_t)b->id<<32) | a->id] = link;
+}
+
+void I32CTT_SimMedium::set_spi_byte_time(uint32_t us) {
+  this->spi_byte_us = us;
+}
+
+uint32_t I32CTT_SimMedium::get_spi_byte_time() {
+  return this->spi_byte_us;
+}
+
+I32CTT_SimLink *I32CTT_SimMedium::link(I32CTT_SimRadio *src, I32CTT_SimRadio *dst) {
+  std::map<uint64_t, I32CTT_SimLink>::iterator it;
+
+  it = this->links.find(((uint64_t)src->id<<32) | dst->id);
+  if(it == this->links.end())
+    return &this->default_link;
+  return &it->second;
+}
+
+uint32_t I32CTT_SimMedium::random(uint32_t max) {
+  if(max == 0)
+    return 0;
+  return this->rng()%max;
+}
+
+/*
+ * Clear channel assessment: the channel is busy if another transmission
+ * on the same channel can be heard by this radio.
+ */
+uint8_t I32CTT_SimMedium::channel_clear(I32CTT_SimRadio *radio) {
+  std::list<I32CTT_SimTx*>::iterator it;
+  uint8_t channel = radio->channel();
+
+  for(it = this->active.begin(); it != this->active.end(); it++) {
+    if((*it)->src == radio || (*it)->channel != channel)
+      continue;
+    if(link((*it)->src, radio)->connected)
+      return 0;
+  }
+  return 1;
+}
+
+uint64_t I32CTT_SimMedium::transmit(I32CTT_SimRadio *src, uint8_t *psdu, uint8_t len) {
+  I32CTT_SimTx *tx = new I32CTT_SimTx;
+  uint8_t clear;
+  uint32_t i;
+
+  tx->id = ++this->next_tx_id;
+  tx->src = src;
+  tx->channel = src->channel();
+  tx->start = this->clock;
+  tx->end = this->clock+(uint64_t)(SIM_SHR_PHR_SIZE+len)*SIM_BYTE_US;
+  tx->len = len;
+  memcpy(tx->psdu, psdu, len);
+
+  this->stats.transmissions++;
+  if(tx->channel < SIM_CHANNEL_COUNT)
+    this->stats.busy_us[tx->channel] += tx->end-tx->start;
+
+  for(i = 0; i < this->radios.size(); i++) {
+    if(this->radios[i] == src || this->radios[i]->channel() != tx->channel)
+      continue;
+    if(!link(src, this->radios[i])->connected)
+      continue;
+    clear = channel_clear(this->radios[i]);
+    this->radios[i]->rx_start(tx, clear);
+  }
+
+  this->active.push_back(tx);
+  return tx->end;
+}
+
+void I32CTT_SimMedium::end_tx(I32CTT_SimTx *tx) {
+  I32CTT_SimDelivery delivery;
+  I32CTT_SimLink *l;
+  I32CTT_SimRadio *dst;
+  uint32_t i;
+
+  for(i = 0; i < tx->receivers.size(); i++) {
+    dst = tx->receivers[i];
+    l = link(tx->src, dst);
+    delivery.at = this->clock+l->latency_us;
+    delivery.dst = dst;
+    delivery.tx_id = tx->id;
+    delivery.ok = 1;
+    delivery.lqi = l->lqi;
+    delivery.rssi = l->rssi;
+    delivery.len = tx->len;
+    memcpy(delivery.psdu, tx->psdu, tx->len);
+
+    if(dst->rx_tx_id == tx->id && dst->rx_corrupt) {
+      delivery.ok = 0;
+      this->stats.collisions++;
+    } else if(l->loss > 0.0 && std::generate_canonical<double, 32>(this->rng) < l->loss) {
+      delivery.ok = 0;
+      this->stats.losses++;
+    } else {
+      this->stats.deliveries++;
+    }
+    this->deliveries.push_back(delivery);
+  }
+
+  tx->src->tx_end(tx);
+}
+
+/*
+ * Event loop of the virtual clock. Processes transmission ends, frame
+ * deliveries and radio timers in time order up to the given time. Calls
+ * made from inside an event (for example SPI traffic caused by a timer)
+ * only move the target forward.
+ */
+void I32CTT_SimMedium::run_until(uint64_t time) {
+  std::list<I32CTT_SimTx*>::iterator tx_it;
+  std::list<I32CTT_SimTx*>::iterator tx_next;
+  std::list<I32CTT_SimDelivery>::iterator dl_it;
+  std::list<I32CTT_SimDelivery>::iterator dl_next;
+  I32CTT_SimTx *tx;
+  I32CTT_SimDelivery delivery;
+  I32CTT_SimRadio *radio;
+  uint64_t next;
+  uint8_t kind;
+  uint32_t i;
+
+  if(this->advancing) {
+    if(time > this->clock)
+      this->clock = time;
+    return;
+  }
+  this->advancing = 1;
+
+  for(;;) {
+    next = SIM_NO_TIMER;
+    kind = 0;
+    tx_next = this->active.end();
+    dl_next = this->deliveries.end();
+    radio = 0;
+
+    for(tx_it = this->active.begin(); tx_it != this->active.end(); tx_it++) {
+      if((*tx_it)->end < next) {
+        next = (*tx_it)->end;
+        tx_next = tx_it;
+        kind = 1;
+      }
+    }
+    for(dl_it = this->deliveries.begin(); dl_it != this->deliveries.end(); dl_it++) {
+      if(dl_it->at < next) {
+        next = dl_it->at;
+        dl_next = dl_it;
+        kind = 2;
+      }
+    }
+    for(i = 0; i < this->radios.size(); i++) {
+      if(this->radios[i]->next_timer < next) {
+        next = this->radios[i]->next_timer;
+        radio = this->radios[i];
+        kind = 3;
+      }
+    }
+
+    if(kind == 0 || next > time)
+      break;
+    if(next > this->clock)
+      this->clock = next;
+
+    switch(kind) {
+      case 1:
+        tx = *tx_next;
+        this->active.erase(tx_next);
+        end_tx(tx);
+        delete tx;
+        break;
+      case 2:
+        delivery = *dl_next;
+        this->deliveries.erase(dl_next);
+        delivery.dst->rx_end(delivery.tx_id, delivery.psdu, delivery.len,
+          delivery.ok, delivery.lqi, delivery.rssi);
+        break;
+      case 3:
+        radio->timer();
+        break;
+    }
+  }
+
+  if(time > this->clock)
+    this->clock = time;
+  this->advancing = 0;
+}
@@ -0,0 +1,118 @@
+/*
+ *
+ * This file is part of I32CTT (Integer 32-bit Control & Telemetry Transport).
+ * Copyright (C) 2017 Mario Gomez / Hackerspace San Salvador.
+ *
+ * I32CTT is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * I32CTT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with I32CTT.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef I32CTT_SimMedium_H
+#define I32CTT_SimMedium_H
+
+#include <stdint.h>
+#include <list>
+#include <map>
+#include <random>
+#include <vector>
+#include "I32CTT_SimRadio.h"
+
+#define SIM_SYMBOL_US        16
+#define SIM_BYTE_US          32
+#define SIM_SHR_PHR_SIZE     6
+#define SIM_CHANNEL_COUNT    27
+#define SIM_SPI_BYTE_US      8 // 1 MHz SPI clock
+
+struct I32CTT_SimLink {
+  uint8_t connected;
+  double loss;         // Probability of losing a frame on this link
+  uint8_t lqi;
+  int8_t rssi;         // dBm
+  uint32_t latency_us; // Extra delay before the receiver sees the frame end
+};
+
+struct I32CTT_SimTx {
+  uint32_t id;
+  I32CTT_SimRadio *src;
+  uint8_t channel;
+  uint64_t start;
+  uint64_t end;
+  uint8_t len;
+  uint8_t psdu[SIM_PSDU_SIZE];
+  std::vector<I32CTT_SimRadio*> receivers;
+};
+
+struct I32CTT_SimDelivery {
+  uint64_t at;
+  I32CTT_SimRadio *dst;
+  uint32_t tx_id;
+  uint8_t ok;
+  uint8_t lqi;
+  int8_t rssi;
+  uint8_t len;
+  uint8_t psdu[SIM_PSDU_SIZE];
+};
+
+struct I32CTT_SimMediumStats {
+  uint32_t transmissions;
+  uint32_t deliveries;
+  uint32_t collisions;
+  uint32_t losses;
+  uint64_t busy_us[SIM_CHANNEL_COUNT];
+};
+
+/*
+ * Shared radio medium with a virtual clock. Radios transmit on their
+ * current channel, every connected radio listening on that channel locks
+ * on the frame and receives it at the end unless another audible
+ * transmission overlapped (collision) or the link dropped it (loss).
+ * Only one medium exists per process, millis()/micros() read its clock.
+ */
+class I32CTT_SimMedium {
+  public:
+    I32CTT_SimMedium(uint32_t seed);
+    ~I32CTT_SimMedium();
+    static I32CTT_SimMedium *instance();
+
+    uint64_t now();
+    void advance(uint64_t us);
+    void run_until(uint64_t time);
+
+    void attach(I32CTT_SimRadio *radio);
+    void set_default_link(I32CTT_SimLink link);
+    void set_link(I32CTT_SimRadio *a, I32CTT_SimRadio *b, I32CTT_SimLink link);
+    void set_spi_byte_time(uint32_t us);
+    uint32_t get_spi_byte_time();
+    I32CTT_SimLink *link(I32CTT_SimRadio *src, I32CTT_SimRadio *dst);
+
+    uint8_t channel_clear(I32CTT_SimRadio *radio);
+    uint64_t transmit(I32CTT_SimRadio *src, uint8_t *psdu, uint8_t len);
+    uint32_t random(uint32_t max);
+
+    I32CTT_SimMediumStats stats;
+
+  private:
+    static I32CTT_SimMedium *current;
+    uint64_t clock;
+    uint8_t advancing;
+    uint32_t next_tx_id;
+    uint32_t spi_byte_us;
+    std::mt19937 rng;
+    I32CTT_SimLink default_link;
+    std::vector<I32CTT_SimRadio*> radios;
+    std::map<uint64_t, I32CTT_SimLink> links;
+    std::list<I32CTT_SimTx*> active;
+    std::list<I32CTT_SimDelivery> deliveries;
+    void end_tx(I32CTT_SimTx *tx);
+};
+
+#endif
@@ -0,0 +1,647 @@
+/*
+ *
+ * This file is part of I32CTT (Integer 32-bit Control & Telemetry Transport).
+ * Copyright (C) 2017 Mario Gomez / Hackerspace San Salvador.
+ *
+ * I32CTT is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * I32CTT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with I32CTT.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdint.h>
+#include <string.h>
+#include "I32CTT_SimRadio.h"
+#include "I32CTT_SimMedium.h"
+
+#define SIM_IRQ_RX_START     (1<<2)
+#define SIM_IRQ_TRX_END      (1<<3)
+#define SIM_IRQ_AMI          (1<<5)
+#define SIM_RX_SAFE_MODE     (1<<7)
+#define SIM_RX_CRC_VALID     (1<<7)
+#define SIM_AACK_PROM_MODE   (1<<1)
+#define SIM_AACK_UPLD_RES_FT (1<<4)
+#define SIM_AACK_I_AM_COORD  (1<<3)
+#define SIM_AACK_DIS_ACK     (1<<4)
+#define SIM_AACK_SET_PD      (1<<5)
+#define SIM_RSSI_BASE_VAL    -94
+#define SIM_ED_MAX           0x53
+
+#define SIM_BACKOFF_US       (20*SIM_SYMBOL_US)
+#define SIM_CCA_US           (8*SIM_SYMBOL_US)
+#define SIM_TURNAROUND_US    (12*SIM_SYMBOL_US)
+#define SIM_ACK_WAIT_US      (54*SIM_SYMBOL_US)
+#define SIM_ACK_PSDU_SIZE    5
+
+#define SIM_FRAME_ACK        2
+#define SIM_FRAME_MAC_CMD    3
+#define SIM_MAC_DATA_REQUEST 0x04
+
+static I32CTT_SimRadio *selected_radio = 0;
+static uint32_t radio_count = 0;
+
+I32CTT_SimRadio::I32CTT_SimRadio(I32CTT_SimMedium &medium) {
+  this->medium = &medium;
+  this->id = ++radio_count;
+  // Same pins the Arduino interface uses by default
+  this->cs_pin = 14;
+  this->slp_tr_pin = 16;
+  this->rst_pin = 17;
+  this->cs_low = 0;
+  this->slp_tr = 0;
+  this->spi_pending_us = 0;
+  memset(&this->stats, 0, sizeof(I32CTT_SimRadioStats));
+  reset();
+  medium.attach(this);
+}
+
+void I32CTT_SimRadio::select(I32CTT_SimRadio *radio) {
+  selected_radio = radio;
+}
+
+I32CTT_SimRadio *I32CTT_SimRadio::selected() {
+  return selected_radio;
+}
+
+void I32CTT_SimRadio::reset() {
+  memset(this->regs, 0, sizeof(this->regs));
+  this->regs[0x03] = 0x09; // TRX_CTRL_0
+  this->regs[SIM_TRX_CTRL_1] = 0x22;
+  this->regs[SIM_PHY_ED_LEVEL] = 0xFF;
+  this->regs[SIM_PHY_CC_CCA] = 0x2B;
+  this->regs[0x09] = 0xC7; // CCA_THRES
+  this->regs[0x0A] = 0xA7; // RX_CTRL
+  this->regs[0x0B] = 0xA7; // SFD_VALUE
+  this->regs[SIM_PART_NUM] = 0x0B;
+  this->regs[SIM_VERSION_NUM] = 0x02;
+  this->regs[SIM_MAN_ID_0] = 0x1F;
+  this->regs[SIM_SHORT_ADDR_0] = 0xFF;
+  this->regs[SIM_SHORT_ADDR_1] = 0xFF;
+  this->regs[SIM_PAN_ID_0] = 0xFF;
+  this->regs[SIM_PAN_ID_1] = 0xFF;
+  this->regs[SIM_XAH_CTRL_0] = 0x38; // 3 frame retries, 4 CSMA retries
+  this->regs[SIM_CSMA_SEED_0] = 0xEA;
+  this->regs[SIM_CSMA_SEED_1] = 0x42;
+  this->regs[SIM_CSMA_BE] = 0x53;
+  memset(this->fb, 0, sizeof(this->fb));
+  this->fb_lqi = 0;
+  this->fb_ed = 0;
+  this->fb_rx_status = 0;
+  this->fb_protected = 0;
+  this->state = SIM_P_ON;
+  this->trac_status = SIM_TRAC_INVALID;
+  this->irq_status = 0;
+  this->spi_op = SIM_SPI_NONE;
+  this->spi_addr = 0;
+  this->spi_index = 0;
+  this->rx_tx_id = 0;
+  this->rx_corrupt = 0;
+  this->aret_phase = SIM_ARET_IDLE;
+  this->aret_nb = 0;
+  this->aret_be = 0;
+  this->aret_retries = 0;
+  this->aret_seq = 0;
+  this->aret_wants_ack = 0;
+  this->ack_pending = 0;
+  this->ack_seq = 0;
+  this->ack_fp = 0;
+  this->waking = 0;
+  this->sleep_since = 0;
+  this->pll_settle_until = 0;
+  this->next_timer = SIM_NO_TIMER;
+}
+
+uint8_t I32CTT_SimRadio::channel() {
+  return this->regs[SIM_PHY_CC_CCA] & 0x1F;
+}
+
+uint16_t I32CTT_SimRadio::get_short_addr() {
+  return this->regs[SIM_SHORT_ADDR_0] | (this->regs[SIM_SHORT_ADDR_1]<<8);
+}
+
+uint16_t I32CTT_SimRadio::get_pan_id() {
+  return this->regs[SIM_PAN_ID_0] | (this->regs[SIM_PAN_ID_1]<<8);
+}
+
+uint8_t I32CTT_SimRadio::get_state() {
+  return this->state;
+}
+
+/*
+ * SPI slave. The first byte of each transaction (CS low) is the command,
+ * the radio answers it with PHY_STATUS. Time spent on the bus is added to
+ * the virtual clock when CS goes high.
+ */
+uint8_t I32CTT_SimRadio::spi_transfer(uint8_t value) {
+  uint8_t result = 0;
+  uint8_t idx;
+
+  this->stats.spi_bytes++;
+  this->spi_pending_us += this->medium->get_spi_byte_time();
+
+  if(!this->cs_low || this->state == SIM_SLEEP)
+    return 0; // Chip not selected or asleep, MISO stays low
+
+  if(this->spi_index == 0) {
+    result = phy_status();
+    this->spi_addr = value & 0x3F;
+    if((value & 0xC0) == 0x80)
+      this->spi_op = SIM_SPI_REG_READ;
+    else if((value & 0xC0) == 0xC0)
+      this->spi_op = SIM_SPI_REG_WRITE;
+    else if((value & 0xE0) == 0x20)
+      this->spi_op = SIM_SPI_FB_READ;
+    else if((value & 0xE0) == 0x60)
+      this->spi_op = SIM_SPI_FB_WRITE;
+    else
+      this->spi_op = SIM_SPI_NONE; // SRAM access not modeled
+    this->spi_index++;
+    return result;
+  }
+
+  idx = this->spi_index-1;
+  switch(this->spi_op) {
+    case SIM_SPI_REG_READ:
+      if(idx == 0)
+        result = reg_read(this->spi_addr);
+      break;
+    case SIM_SPI_REG_WRITE:
+      if(idx == 0)
+        reg_write(this->spi_addr, value);
+      break;
+    case SIM_SPI_FB_READ:
+      // PHR, PSDU, LQI, ED, RX_STATUS
+      if(idx == 0)
+        result = this->fb[0];
+      else if(idx <= this->fb[0])
+        result = this->fb[idx];
+      else if(idx == this->fb[0]+1)
+        result = this->fb_lqi;
+      else if(idx == this->fb[0]+2)
+        result = this->fb_ed;
+      else if(idx == this->fb[0]+3)
+        result = this->fb_rx_status;
+      break;
+    case SIM_SPI_FB_WRITE:
+      if(idx <= SIM_PSDU_SIZE)
+        this->fb[idx] = value;
+      break;
+  }
+  if(this->spi_index < 0xFF)
+    this->spi_index++;
+
+  return result;
+}
+
+void I32CTT_SimRadio::pin_write(uint8_t pin, uint8_t value) {
+  uint32_t pending;
+
+  if(pin == this->cs_pin) {
+    if(!value) {
+      this->cs_low = 1;
+      this->spi_index = 0;
+      this->spi_op = SIM_SPI_NONE;
+    } else if(this->cs_low) {
+      this->cs_low = 0;
+      if(this->spi_op == SIM_SPI_FB_READ && this->spi_index > 1) {
+        this->fb_protected = 0; // Dynamic frame buffer protection released
+        this->stats.fb_reads++;
+      }
+      pending = this->spi_pending_us;
+      this->spi_pending_us = 0;
+      if(pending)
+        this->medium->advance(pending);
+    }
+  } else if(pin == this->slp_tr_pin) {
+    if(value && !this->slp_tr) {
+      if(this->state == SIM_TRX_OFF) {
+        this->state = SIM_SLEEP;
+        this->sleep_since = this->medium->now();
+        this->stats.sleeps++;
+      } else if(this->state == SIM_TX_ARET_ON || this->state == SIM_PLL_ON) {
+        command(SIM_CMD_TX_START);
+      }
+    } else if(!value && this->slp_tr && this->state == SIM_SLEEP) {
+      // Registers keep their values, the oscillator needs time to settle
+      this->stats.sleep_us += this->medium->now()-this->sleep_since;
+      this->state = SIM_STATE_TRANSITION;
+      this->waking = 1;
+      this->next_timer = this->medium->now()+SIM_WAKEUP_US;
+    }
+    this->slp_tr = value;
+  } else if(pin == this->rst_pin) {
+    if(!value) {
+      abort_rx();
+      reset();
+    }
+  }
+}
+
+uint8_t I32CTT_SimRadio::phy_status() {
+  switch((this->regs[SIM_TRX_CTRL_1]>>2) & 0x03) {
+    case 1:
+      return this->state;
+    case 2:
+      return reg_read(SIM_PHY_RSSI);
+    case 3:
+      return this->irq_status;
+  }
+  return 0;
+}
+
+uint8_t I32CTT_SimRadio::reg_read(uint8_t addr) {
+  uint8_t result;
+
+  switch(addr) {
+    case SIM_TRX_STATUS:
+      return this->state;
+    case SIM_TRX_STATE:
+      return (this->trac_status<<5) | (this->regs[SIM_TRX_STATE] & 0x1F);
+    case SIM_IRQ_STATUS:
+      result = this->irq_status;
+      this->irq_status = 0; // Cleared on read
+      return result;
+    case SIM_PHY_RSSI:
+      return this->fb_rx_status & SIM_RX_CRC_VALID;
+    case SIM_PHY_ED_LEVEL:
+      return this->fb_ed;
+  }
+  return this->regs[addr & 0x3F];
+}
+
+void I32CTT_SimRadio::reg_write(uint8_t addr, uint8_t value) {
+  switch(addr) {
+    case SIM_TRX_STATUS:
+    case SIM_IRQ_STATUS:
+    case SIM_PHY_RSSI:
+    case SIM_PHY_ED_LEVEL:
+    case SIM_XAH_CTRL_2:
+    case SIM_PART_NUM:
+    case SIM_VERSION_NUM:
+      return; // Read only
+    case SIM_TRX_STATE:
+      this->regs[SIM_TRX_STATE] = value & 0x1F;
+      command(value & 0x1F);
+      return;
+    case SIM_PHY_CC_CCA:
+      if((value & 0x1F) != channel()) {
+        abort_rx(); // The PLL relocks, a frame in flight is lost
+        this->pll_settle_until = this->medium->now()+SIM_PLL_CH_US;
+        this->stats.retunes++;
+      }
+      break;
+  }
+  this->regs[addr & 0x3F] = value;
+}
+
+void I32CTT_SimRadio::abort_rx() {
+  this->rx_tx_id = 0;
+  this->rx_corrupt = 0;
+  this->ack_pending = 0;
+  if(this->state == SIM_BUSY_RX_AACK)
+    this->state = SIM_RX_AACK_ON;
+  else if(this->state == SIM_BUSY_RX)
+    this->state = SIM_RX_ON;
+}
+
+/*
+ * TRX_STATE commands. State changes are immediate, busy states only accept
+ * the FORCE commands like the real chip.
+ */
+void I32CTT_SimRadio::command(uint8_t cmd) {
+  uint8_t busy_tx = (this->state == SIM_BUSY_TX || this->state == SIM_BUSY_TX_ARET);
+
+  if(cmd == SIM_CMD_NOP || this->state == SIM_SLEEP)
+    return;
+
+  if(busy_tx && cmd != SIM_CMD_FORCE_TRX_OFF && cmd != SIM_CMD_FORCE_PLL_ON)
+    return; // Transmission completes first
+
+  if(cmd != SIM_CMD_TX_START) {
+    abort_rx();
+    this->aret_phase = SIM_ARET_IDLE;
+    this->next_timer = SIM_NO_TIMER;
+  }
+  if(cmd != SIM_CMD_RX_ON && cmd != SIM_CMD_RX_AACK_ON)
+    this->fb_protected = 0; // Leaving the receive states releases the protection
+
+  switch(cmd) {
+    case SIM_CMD_TX_START:
+      if(this->state == SIM_TX_ARET_ON)
+        start_aret();
+      else if(this->state == SIM_PLL_ON)
+        start_basic_tx();
+      break;
+    case SIM_CMD_FORCE_TRX_OFF:
+    case SIM_CMD_TRX_OFF:
+      this->state = SIM_TRX_OFF;
+      break;
+    case SIM_CMD_FORCE_PLL_ON:
+    case SIM_CMD_PLL_ON:
+      this->state = SIM_PLL_ON;
+      break;
+    case SIM_CMD_RX_ON:
+      this->state = SIM_RX_ON;
+      break;
+    case SIM_CMD_RX_AACK_ON:
+      this->state = SIM_RX_AACK_ON;
+      break;
+    case SIM_CMD_TX_ARET_ON:
+      this->state = SIM_TX_ARET_ON;
+      break;
+    case SIM_CMD_PREP_DEEP_SLEEP:
+      this->state = SIM_PREP_DEEP_SLEEP;
+      break;
+  }
+}
+
+void I32CTT_SimRadio::raise_irq(uint8_t mask) {
+  this->irq_status |= mask;
+}
+
+void I32CTT_SimRadio::start_basic_tx() {
+  this->state = SIM_BUSY_TX;
+  this->stats.frames_tx++;
+  this->medium->transmit(this, this->fb+1, this->fb[0]);
+}
+
+void I32CTT_SimRadio::start_aret() {
+  uint16_t fcf = this->fb[1] | (this->fb[2]<<8);
+
+  this->state = SIM_BUSY_TX_ARET;
+  this->aret_retries = 0;
+  this->aret_nb = 0;
+  this->aret_be = this->regs[SIM_CSMA_BE] & 0x0F;
+  this->aret_seq = this->fb[3];
+  this->aret_wants_ack = (fcf>>5) & 0x01;
+  schedule_backoff();
+}
+
+void I32CTT_SimRadio::schedule_backoff() {
+  uint8_t max_csma = (this->regs[SIM_XAH_CTRL_0]>>1) & 0x07;
+
+  this->aret_phase = SIM_ARET_BACKOFF;
+  if(max_csma == 7) {
+    // CSMA disabled, transmit right away
+    this->next_timer = this->medium->now();
+  } else {
+    this->next_timer = this->medium->now()+
+      (uint64_t)this->medium->random(1<<this->aret_be)*SIM_BACKOFF_US+SIM_CCA_US;
+  }
+}
+
+void I32CTT_SimRadio::finish_aret(uint8_t trac) {
+  this->trac_status = trac;
+  this->regs[SIM_XAH_CTRL_2] = (this->aret_retries<<4) | ((this->aret_nb & 0x07)<<1);
+  this->state = SIM_TX_ARET_ON;
+  this->aret_phase = SIM_ARET_IDLE;
+  this->next_timer = SIM_NO_TIMER;
+  this->stats.aret_retries += this->aret_retries;
+  switch(trac) {
+    case SIM_TRAC_SUCCESS:
+    case SIM_TRAC_SUCCESS_DATA_PENDING:
+      this->stats.aret_success++;
+      break;
+    case SIM_TRAC_NO_ACK:
+      this->stats.aret_no_ack++;
+      break;
+    case SIM_TRAC_CHANNEL_ACCESS_FAILURE:
+      this->stats.aret_channel_access_failure++;
+      break;
+  }
+  raise_irq(SIM_IRQ_TRX_END);
+}
+
+void I32CTT_SimRadio::timer() {
+  uint8_t ack[SIM_ACK_PSDU_SIZE];
+  uint8_t max_csma = (this->regs[SIM_XAH_CTRL_0]>>1) & 0x07;
+  uint8_t max_frame_retries = this->regs[SIM_XAH_CTRL_0]>>4;
+  uint8_t max_be = this->regs[SIM_CSMA_BE]>>4;
+
+  this->next_timer = SIM_NO_TIMER;
+
+  if(this->waking) {
+    this->waking = 0;
+    this->state = SIM_TRX_OFF;
+    return;
+  }
+
+  if(this->ack_pending) {
+    // RX_AACK acknowledgment after the turnaround time
+    ack[0] = SIM_FRAME_ACK | (this->ack_fp ? 0x10 : 0x00);
+    ack[1] = 0x00;
+    ack[2] = this->ack_seq;
+    ack[3] = 0x00;
+    ack[4] = 0x00;
+    this->ack_pending = 0;
+    this->stats.acks_tx++;
+    this->medium->transmit(this, ack, SIM_ACK_PSDU_SIZE);
+    return;
+  }
+
+  switch(this->aret_phase) {
+    case SIM_ARET_BACKOFF:
+      if(max_csma == 7 || this->medium->channel_clear(this)) {
+        this->aret_phase = SIM_ARET_TX;
+        this->stats.frames_tx++;
+        this->medium->transmit(this, this->fb+1, this->fb[0]);
+      } else {
+        this->aret_nb++;
+        if(this->aret_be < max_be)
+          this->aret_be++;
+        if(this->aret_nb > max_csma)
+          finish_aret(SIM_TRAC_CHANNEL_ACCESS_FAILURE);
+        else
+          schedule_backoff();
+      }
+      break;
+    case SIM_ARET_WAIT_ACK:
+      this->rx_tx_id = 0;
+      if(this->aret_retries >= max_frame_retries) {
+        finish_aret(SIM_TRAC_NO_ACK);
+      } else {
+        this->aret_retries++;
+        this->aret_nb = 0;
+        this->aret_be = this->regs[SIM_CSMA_BE] & 0x0F;
+        schedule_backoff();
+      }
+      break;
+  }
+}
+
+uint8_t I32CTT_SimRadio::is_listening() {
+  if(this->rx_tx_id != 0 || this->medium->now() < this->pll_settle_until)
+    return 0;
+  if(this->state == SIM_RX_ON || this->state == SIM_RX_AACK_ON)
+    return 1;
+  return this->state == SIM_BUSY_TX_ARET && this->aret_phase == SIM_ARET_WAIT_ACK;
+}
+
+void I32CTT_SimRadio::rx_start(I32CTT_SimTx *tx, uint8_t clear_channel) {
+  if(this->rx_tx_id != 0) {
+    this->rx_corrupt = 1; // Overlaps the frame being received
+    return;
+  }
+  if(!is_listening())
+    return;
+
+  this->rx_tx_id = tx->id;
+  this->rx_corrupt = !clear_channel;
+  tx->receivers.push_back(this);
+
+  if(this->state == SIM_RX_ON)
+    this->state = SIM_BUSY_RX;
+  else if(this->state == SIM_RX_AACK_ON)
+    this->state = SIM_BUSY_RX_AACK;
+  raise_irq(SIM_IRQ_RX_START);
+}
+
+/*
+ * Frame filter of the extended operating mode. Returns 0 if the frame is
+ * rejected, 1 if only promiscuous mode accepts it and 2 on address match.
+ */
+uint8_t I32CTT_SimRadio::filter(uint8_t *psdu, uint8_t len, uint8_t *send_ack) {
+  uint16_t fcf;
+  uint8_t type;
+  uint8_t dst_mode;
+  uint8_t version;
+  uint16_t dst_pan;
+  uint16_t dst;
+  uint8_t match = 0;
+  uint8_t broadcast = 0;
+  uint8_t promiscuous = this->regs[SIM_XAH_CTRL_1] & SIM_AACK_PROM_MODE;
+  uint8_t csma_seed_1 = this->regs[SIM_CSMA_SEED_1];
+
+  *send_ack = 0;
+  if(len < SIM_ACK_PSDU_SIZE)
+    return 0;
+
+  fcf = psdu[0] | (psdu[1]<<8);
+  type = fcf & 0x07;
+  dst_mode = (fcf>>10) & 0x03;
+  version = (fcf>>12) & 0x03;
+
+  if(version > (csma_seed_1>>6))
+    return promiscuous ? 1 : 0;
+
+  if(type == SIM_FRAME_ACK)
+    return promiscuous ? 1 : 0;
+  if(type > SIM_FRAME_MAC_CMD && !(this->regs[SIM_XAH_CTRL_1] & SIM_AACK_UPLD_RES_FT))
+    return promiscuous ? 1 : 0;
+
+  if(dst_mode == 2 && len >= 7) {
+    dst_pan = psdu[3] | (psdu[4]<<8);
+    dst = psdu[5] | (psdu[6]<<8);
+    broadcast = (dst == 0xFFFF);
+    match = (dst_pan == get_pan_id() || dst_pan == 0xFFFF) &&
+      (dst == get_short_addr() || broadcast);
+  } else if(dst_mode == 0) {
+    // Beacons and frames to the PAN coordinator
+    match = (type == 0) || (csma_seed_1 & SIM_AACK_I_AM_COORD);
+  }
+
+  if(!match)
+    return promiscuous ? 1 : 0;
+
+  *send_ack = ((fcf>>5) & 0x01) && !broadcast && dst_mode != 0 &&
+    !(csma_seed_1 & SIM_AACK_DIS_ACK);
+  return 2;
+}
+
+void I32CTT_SimRadio::rx_end(uint32_t tx_id, uint8_t *psdu, uint8_t len, uint8_t ok, uint8_t lqi, int8_t rssi) {
+  uint8_t accepted;
+  uint8_t send_ack = 0;
+  int16_t ed;
+
+  if(this->rx_tx_id != tx_id)
+    return; // Reception was aborted
+  this->rx_tx_id = 0;
+
+  if(this->state == SIM_BUSY_TX_ARET) {
+    // Waiting for our acknowledgment
+    if(
+      ok && len == SIM_ACK_PSDU_SIZE &&
+      (psdu[0] & 0x07) == SIM_FRAME_ACK &&
+      psdu[2] == this->aret_seq
+    ) {
+      finish_aret((psdu[0] & 0x10) ? SIM_TRAC_SUCCESS_DATA_PENDING : SIM_TRAC_SUCCESS);
+    }
+    return;
+  }
+
+  if(this->state == SIM_BUSY_RX)
+    this->state = SIM_RX_ON;
+  else if(this->state == SIM_BUSY_RX_AACK)
+    this->state = SIM_RX_AACK_ON;
+
+  if(!ok)
+    return;
+
+  if(this->state == SIM_RX_AACK_ON) {
+    accepted = filter(psdu, len, &send_ack);
+    if(!accepted) {
+      this->stats.frames_filtered++;
+      return;
+    }
+  } else {
+    accepted = 1; // Basic RX mode has no filter
+  }
+
+  if(this->fb_protected && (this->regs[SIM_TRX_CTRL_2] & SIM_RX_SAFE_MODE)) {
+    this->stats.frames_overrun++;
+    return;
+  }
+
+  ed = rssi-SIM_RSSI_BASE_VAL;
+  if(ed < 0)
+    ed = 0;
+  if(ed > SIM_ED_MAX)
+    ed = SIM_ED_MAX;
+
+  this->fb[0] = len;
+  memcpy(this->fb+1, psdu, len);
+  this->fb_lqi = lqi;
+  this->fb_ed = ed;
+  this->fb_rx_status = SIM_RX_CRC_VALID;
+  this->fb_protected = 1;
+  this->stats.frames_rx++;
+  raise_irq(SIM_IRQ_TRX_END | (accepted == 2 ? SIM_IRQ_AMI : 0));
+
+  if(send_ack) {
+    this->state = SIM_BUSY_RX_AACK;
+    this->ack_pending = 1;
+    this->ack_seq = psdu[2];
+    this->ack_fp = (this->regs[SIM_CSMA_SEED_1] & SIM_AACK_SET_PD) &&
+      (psdu[0] & 0x07) == SIM_FRAME_MAC_CMD &&
+      len > 9 && psdu[len-3] == SIM_MAC_DATA_REQUEST;
+    this->next_timer = this->medium->now()+SIM_TURNAROUND_US;
+  }
+}
+
+void I32CTT_SimRadio::tx_end(I32CTT_SimTx *) {
+  switch(this->state) {
+    case SIM_BUSY_RX_AACK:
+      this->state = SIM_RX_AACK_ON; // Acknowledgment sent
+      break;
+    case SIM_BUSY_TX:
+      this->state = SIM_PLL_ON;
+      this->trac_status = SIM_TRAC_SUCCESS;
+      raise_irq(SIM_IRQ_TRX_END);
+      break;
+    case SIM_BUSY_TX_ARET:
+      if(this->aret_wants_ack) {
+        this->aret_phase = SIM_ARET_WAIT_ACK;
+        this->next_timer = this->medium->now()+SIM_ACK_WAIT_US;
+      } else {
+        finish_aret(SIM_TRAC_SUCCESS);
+      }
+      break;
+  }
+}
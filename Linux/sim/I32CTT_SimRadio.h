@@ -0,0 +1,210 @@
+/*
+ *
+ * This file is part of I32CTT (Integer 32-bit Control & Telemetry Transport).
+ * Copyright (C) 2017 Mario Gomez / Hackerspace San Salvador.
+ *
+ * I32CTT is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * I32CTT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with I32CTT.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef I32CTT_SimRadio_H
+#define I32CTT_SimRadio_H
+
+#include <stdint.h>
+
+#define SIM_PSDU_SIZE 127
+#define SIM_REG_COUNT 64
+#define SIM_NO_TIMER  UINT64_MAX
+#define SIM_WAKEUP_US 240 // SLEEP to TRX_OFF
+#define SIM_PLL_CH_US 11  // PLL settling after a channel change
+
+// Register addresses (AT86RF233 datasheet)
+enum SIM_REG {
+  SIM_TRX_STATUS   = 0x01,
+  SIM_TRX_STATE    = 0x02,
+  SIM_TRX_CTRL_1   = 0x04,
+  SIM_PHY_RSSI     = 0x06,
+  SIM_PHY_ED_LEVEL = 0x07,
+  SIM_PHY_CC_CCA   = 0x08,
+  SIM_TRX_CTRL_2   = 0x0C,
+  SIM_IRQ_MASK     = 0x0E,
+  SIM_IRQ_STATUS   = 0x0F,
+  SIM_XAH_CTRL_1   = 0x17,
+  SIM_XAH_CTRL_2   = 0x19,
+  SIM_PART_NUM     = 0x1C,
+  SIM_VERSION_NUM  = 0x1D,
+  SIM_MAN_ID_0     = 0x1E,
+  SIM_SHORT_ADDR_0 = 0x20,
+  SIM_SHORT_ADDR_1 = 0x21,
+  SIM_PAN_ID_0     = 0x22,
+  SIM_PAN_ID_1     = 0x23,
+  SIM_XAH_CTRL_0   = 0x2C,
+  SIM_CSMA_SEED_0  = 0x2D,
+  SIM_CSMA_SEED_1  = 0x2E,
+  SIM_CSMA_BE      = 0x2F
+};
+
+// TRX_STATUS values
+enum SIM_STATE {
+  SIM_P_ON         = 0x00,
+  SIM_BUSY_RX      = 0x01,
+  SIM_BUSY_TX      = 0x02,
+  SIM_RX_ON        = 0x06,
+  SIM_TRX_OFF      = 0x08,
+  SIM_PLL_ON       = 0x09,
+  SIM_SLEEP        = 0x0F,
+  SIM_PREP_DEEP_SLEEP = 0x10,
+  SIM_BUSY_RX_AACK = 0x11,
+  SIM_BUSY_TX_ARET = 0x12,
+  SIM_RX_AACK_ON   = 0x16,
+  SIM_TX_ARET_ON   = 0x19,
+  SIM_STATE_TRANSITION = 0x1F
+};
+
+// TRX_STATE commands
+enum SIM_CMD {
+  SIM_CMD_NOP           = 0x00,
+  SIM_CMD_TX_START      = 0x02,
+  SIM_CMD_FORCE_TRX_OFF = 0x03,
+  SIM_CMD_FORCE_PLL_ON  = 0x04,
+  SIM_CMD_RX_ON         = 0x06,
+  SIM_CMD_TRX_OFF       = 0x08,
+  SIM_CMD_PLL_ON        = 0x09,
+  SIM_CMD_PREP_DEEP_SLEEP = 0x10,
+  SIM_CMD_RX_AACK_ON    = 0x16,
+  SIM_CMD_TX_ARET_ON    = 0x19
+};
+
+enum SIM_TRAC {
+  SIM_TRAC_SUCCESS = 0,
+  SIM_TRAC_SUCCESS_DATA_PENDING = 1,
+  SIM_TRAC_CHANNEL_ACCESS_FAILURE = 3,
+  SIM_TRAC_NO_ACK = 5,
+  SIM_TRAC_INVALID = 7
+};
+
+enum SIM_ARET_PHASE {
+  SIM_ARET_IDLE = 0,
+  SIM_ARET_BACKOFF,
+  SIM_ARET_TX,
+  SIM_ARET_WAIT_ACK
+};
+
+enum SIM_SPI_OP {
+  SIM_SPI_NONE = 0,
+  SIM_SPI_REG_READ,
+  SIM_SPI_REG_WRITE,
+  SIM_SPI_FB_READ,
+  SIM_SPI_FB_WRITE
+};
+
+class I32CTT_SimMedium;
+struct I32CTT_SimTx;
+
+struct I32CTT_SimRadioStats {
+  uint32_t spi_bytes;
+  uint32_t fb_reads;
+  uint32_t frames_tx;
+  uint32_t frames_rx;
+  uint32_t frames_filtered; // Dropped by the AACK frame filter
+  uint32_t frames_overrun;  // Dropped because the frame buffer was protected
+  uint32_t acks_tx;
+  uint32_t aret_success;
+  uint32_t aret_no_ack;
+  uint32_t aret_channel_access_failure;
+  uint32_t aret_retries;
+  uint32_t sleeps;
+  uint64_t sleep_us; // Time spent in SLEEP
+  uint32_t retunes;
+};
+
+/*
+ * Register level model of an AT86RF233: SPI command decoding, frame
+ * buffer, TRX state machine, IRQ_STATUS and the RX_AACK/TX_ARET extended
+ * operating modes. Timing follows the 2.4 GHz O-QPSK PHY (16 us symbols).
+ */
+class I32CTT_SimRadio {
+  public:
+    I32CTT_SimRadio(I32CTT_SimMedium &medium);
+    static void select(I32CTT_SimRadio *radio);
+    static I32CTT_SimRadio *selected();
+
+    // Arduino side
+    uint8_t spi_transfer(uint8_t value);
+    void pin_write(uint8_t pin, uint8_t value);
+
+    // Medium side
+    uint8_t channel();
+    uint8_t is_listening();
+    void rx_start(I32CTT_SimTx *tx, uint8_t clear_channel);
+    void rx_end(uint32_t tx_id, uint8_t *psdu, uint8_t len, uint8_t ok, uint8_t lqi, int8_t rssi);
+    void tx_end(I32CTT_SimTx *tx);
+    void timer();
+    uint64_t next_timer;
+
+    uint16_t get_short_addr();
+    uint16_t get_pan_id();
+    uint8_t get_state();
+    I32CTT_SimRadioStats stats;
+    uint8_t cs_pin;
+    uint8_t slp_tr_pin;
+    uint8_t rst_pin;
+    uint32_t id;
+
+  private:
+    I32CTT_SimMedium *medium;
+    uint8_t regs[SIM_REG_COUNT];
+    uint8_t fb[SIM_PSDU_SIZE+1];
+    uint8_t fb_lqi;
+    uint8_t fb_ed;
+    uint8_t fb_rx_status;
+    uint8_t fb_protected;
+    uint8_t state;
+    uint8_t trac_status;
+    uint8_t irq_status;
+    uint8_t cs_low;
+    uint8_t slp_tr;
+    uint8_t spi_op;
+    uint8_t spi_addr;
+    uint8_t spi_index;
+    uint32_t spi_pending_us;
+    uint32_t rx_tx_id;
+    uint8_t rx_corrupt;
+    uint8_t aret_phase;
+    uint8_t aret_nb;
+    uint8_t aret_be;
+    uint8_t aret_retries;
+    uint8_t aret_seq;
+    uint8_t aret_wants_ack;
+    uint8_t ack_pending;
+    uint8_t ack_seq;
+    uint8_t ack_fp;
+    uint8_t waking;
+    uint64_t sleep_since;
+    uint64_t pll_settle_until;
+    uint8_t phy_status();
+    uint8_t reg_read(uint8_t addr);
+    void reg_write(uint8_t addr, uint8_t value);
+    void command(uint8_t cmd);
+    void reset();
+    void raise_irq(uint8_t mask);
+    void start_aret();
+    void schedule_backoff();
+    void finish_aret(uint8_t trac);
+    void start_basic_tx();
+    uint8_t filter(uint8_t *psdu, uint8_t len, uint8_t *send_ack);
+    void abort_rx();
+
+  friend class I32CTT_SimMedium;
+};
+
+#endif
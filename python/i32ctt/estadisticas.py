@@ -0,0 +1,52 @@
+#Lector de la tabla de estadisticas de enlace que exponen los nodos 802.15.4
+#(I32CTT_LinkStatsEndpoint en la implementacion de Arduino)
+
+class estadisticas_enlace:
+  base_pares = 0x0100
+  campos = ['direccion', 'lqi', 'rssi', 'tramas_rx', 'tx_exitosas', 'tx_sin_ack',
+            'tx_fallo_acceso_canal', 'tx_reintentos', 'tiempo_aire_tx', 'tiempo_aire_rx', 'edad',
+            'flujo_tx', 'flujo_rx', 'flujo_perdidas']
+
+  def __init__(self, i32ctt, dir_nodo, num_endpoint):
+    self.__i32ctt = i32ctt
+    self.__dir_nodo = dir_nodo
+    self.__num_endpoint = num_endpoint
+
+  def leer_tabla(self):
+    #El registro 1 contiene el numero de entradas de la tabla de pares
+    pares = self.__i32ctt.leer_registros(self.__dir_nodo, self.__num_endpoint, [1])
+    if not pares:
+      return []
+
+    tabla = []
+    for n in range(pares[0][1]):
+      entrada = self.leer_par(n)
+      if entrada and entrada['direccion'] != 0:
+        tabla.append(entrada)
+
+    #Se ordena de mejor a peor enlace para poder consultar primero los nodos sanos
+    tabla.sort(key=lambda x: x['lqi'], reverse=True)
+    return tabla
+
+  def leer_par(self, n):
+    base = self.base_pares + (n << 4)
+    registros = [base + i for i in range(len(self.campos))]
+    pares = self.__i32ctt.leer_registros(self.__dir_nodo, self.__num_endpoint, registros)
+    if len(pares) != len(self.campos):
+      return None
+
+    entrada = {}
+    for i in range(len(self.campos)):
+      entrada[self.campos[i]] = pares[i][1]
+
+    #El RSSI viaja como entero de 32 bits con signo
+    if entrada['rssi'] & 0x80000000:
+      entrada['rssi'] -= 0x100000000
+
+    #Tasa de entrega de las tramas sin ACK segun los saltos de secuencia
+    total = entrada['flujo_rx'] + entrada['flujo_perdidas']
+    entrada['flujo_entrega'] = entrada['flujo_rx'] / float(total) if total else 1.0
+    return entrada
+
+  def limpiar(self):
+    return self.__i32ctt.escr_registros(self.__dir_nodo, self.__num_endpoint, [(2, 0)])